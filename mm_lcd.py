@@ -85,39 +85,19 @@ def generate_lcd(table, i, npanxx_dict, my_npa):
         for index in range(0, 16):
             a.append(0)
 
-    stflag = 0
-
-    for index in range(200, 1000): #, row in allnpa.iterrows():
-        cur_npanxx = str(i) + "-" + str(index)
-
-        if cur_npanxx in npanxx_dict:
-            flag = npanxx_dict.get(cur_npanxx)
-        else:
-            flag = 3    # No entry in NPA table, means invalid.
-
-        if (table < 92):
-            # Uncompressed table, each entry is one byte.
-            a.append(flag)
-        elif (table < 115):
-            # Compressed table, two entries packed into a byte.
-            # Pack into Compressed LCD byte
-            stflag = stflag << 4
-            stflag = stflag | flag
-
-            # Every 2nd entry, add compressed LCD byte to table.
-            if index % 2 == 1:
-                a.append(stflag)
-                stflag = 0
-        else:
-            # Double-compressed, four entries in one byte.
-                # Pack into double-compressed LCD byte
-                stflag = stflag << 2
-                stflag = stflag | flag
-
-                # Every 4th entry, add compressed LCD byte to table.
-                if index % 4 == 3:
-                    a.append(stflag)
-                    stflag = 0
+    # Flags of NXX 200-999, no entry in NPA table means invalid.
+    flags = [npanxx_dict.get(str(i) + "-" + str(index), 3) for index in range(200, 1000)]
+
+    if (table < 92):
+        # Uncompressed table, each entry is one byte.
+        a.extend(flags)
+    elif (table < 115):
+        # Compressed table, two entries packed into a byte.
+        a.extend((f0 << 4) | f1 for f0, f1 in zip(flags[0::2], flags[1::2]))
+    else:
+        # Double-compressed, four entries in one byte.
+        a.extend((f0 << 6) | (f1 << 4) | (f2 << 2) | f3
+                 for f0, f1, f2, f3 in zip(flags[0::4], flags[1::4], flags[2::4], flags[3::4]))
 
     # Write LCD table array to file.
     f=open(fname, "wb")
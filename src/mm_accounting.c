@@ -567,7 +567,21 @@ int mm_acct_save_TPERFST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
     return 0;
 }
 
-int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_term_status_t* dlog_mt_term_status) {
+/* Most recent status word of a terminal, 0 if none. */
+uint64_t mm_acct_load_TSTATUS(void *db, char* terminal_id) {
+    char sql[256] = { 0 };
+
+    snprintf(sql, sizeof(sql), "SELECT STATUS_WORD from TSTATUS where(TERMINAL_ID = %s) ORDER BY ID DESC LIMIT 1",
+        terminal_id);
+
+    return mm_sql_read_uint64(db, sql);
+}
+
+/*
+ * Save the terminal's status if it changed.  known_status_word, if not
+ * NULL, is the terminal's last status word, and is updated.
+ */
+int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_term_status_t* dlog_mt_term_status, uint64_t *known_status_word) {
     char sql[1536] = { 0 };
     uint8_t  serial_number[11] = { 0 };
     uint64_t term_status_word;
@@ -590,11 +604,13 @@ int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
     printf("\t\tTerminal serial number %s, Terminal Status Word: 0x%010" PRIx64 "\n",
         serial_number, term_status_word);
 
-    /* Retrieve the most recent terminal status, and update only if changed. */
-    snprintf(sql, sizeof(sql), "SELECT STATUS_WORD from TSTATUS where(TERMINAL_ID = %s) ORDER BY ID DESC LIMIT 1",
-        terminal_id);
-
-    last_status_word = mm_sql_read_uint64(db, sql);
+    /* Retrieve the most recent terminal status, unless already known, and update only if changed. */
+    if (known_status_word != NULL) {
+        last_status_word = *known_status_word;
+        *known_status_word = term_status_word;
+    } else {
+        last_status_word = mm_acct_load_TSTATUS(db, terminal_id);
+    }
 
     if (term_status_word != last_status_word) {
         char received_time_str[16] = { 0 };
@@ -716,6 +732,18 @@ int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt
     return 0;
 }
 
+/* Terminal type from the terminal's most recent software version, 0 if unknown. */
+uint8_t mm_acct_load_terminal_type(void *db, char* terminal_id) {
+    char sql[256] = { 0 };
+
+    snprintf(sql, sizeof(sql), "SELECT TERMTYP.TERMINAL_TYPE from TSWVERS "
+        "JOIN TERMTYP ON (TERMTYP.CONTROL_ROM_EDITION = TSWVERS.CONTROL_ROM_EDITION) "
+        "where(TSWVERS.TERMINAL_ID = \"%s\") ORDER BY TSWVERS.ID DESC LIMIT 1",
+        terminal_id);
+
+    return mm_sql_read_uint8(db, sql);
+}
+
 int mm_acct_save_TSWVERS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_sw_version_t* dlog_mt_sw_version, uint8_t *terminal_type) {
     char sql[512] = { 0 };
     char received_time_str[16] = { 0 };
@@ -0,0 +1,287 @@
+/*
+ * Bounded cache for mm_manager.
+ *
+ * Maps a key of bytes to a value of bytes, copied in and out, so that a
+ * value a line is using is never freed under it.  Each cache has its own
+ * lock and holds at most the number of bytes of keys and values it was
+ * created with: the least recently used entries are evicted to make room.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else  /* ifdef _WIN32 */
+#include <pthread.h>
+#endif /* _WIN32 */
+
+#include "mm_manager.h"
+
+#define CACHE_HASH_SIZE (256)
+
+typedef struct mm_cache_entry {
+    struct mm_cache_entry *next;        /* In the hash bucket */
+    struct mm_cache_entry *lru_prev;    /* More recently used */
+    struct mm_cache_entry *lru_next;    /* Less recently used */
+    uint64_t hash;
+    size_t   key_len;
+    size_t   len;
+    uint8_t  data[];                    /* Key, then value */
+} mm_cache_entry_t;
+
+struct mm_cache {
+#ifdef _WIN32
+    SRWLOCK lock;
+#else  /* ifdef _WIN32 */
+    pthread_mutex_t lock;
+#endif /* _WIN32 */
+    size_t   max_bytes;
+    size_t   bytes;
+    mm_cache_entry_t *lru_head;         /* Most recently used */
+    mm_cache_entry_t *lru_tail;         /* Least recently used */
+    mm_cache_entry_t *hash[CACHE_HASH_SIZE];
+};
+
+static void mm_cache_lock(mm_cache_t *cache) {
+#ifdef _WIN32
+    AcquireSRWLockExclusive(&cache->lock);
+#else  /* ifdef _WIN32 */
+    pthread_mutex_lock(&cache->lock);
+#endif /* _WIN32 */
+}
+
+static void mm_cache_unlock(mm_cache_t *cache) {
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(&cache->lock);
+#else  /* ifdef _WIN32 */
+    pthread_mutex_unlock(&cache->lock);
+#endif /* _WIN32 */
+}
+
+/* Create a cache of at most max_bytes of keys and values. */
+mm_cache_t *mm_cache_create(size_t max_bytes) {
+    mm_cache_t *cache = (mm_cache_t *)calloc(1, sizeof(mm_cache_t));
+
+    if (cache == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_cache_t));
+        return NULL;
+    }
+
+#ifdef _WIN32
+    InitializeSRWLock(&cache->lock);
+#else  /* ifdef _WIN32 */
+    pthread_mutex_init(&cache->lock, NULL);
+#endif /* _WIN32 */
+    cache->max_bytes = max_bytes;
+
+    return cache;
+}
+
+static size_t mm_cache_entry_bytes(const mm_cache_entry_t *entry) {
+    return sizeof(mm_cache_entry_t) + entry->key_len + entry->len;
+}
+
+static void mm_cache_lru_unlink(mm_cache_t *cache, mm_cache_entry_t *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void mm_cache_lru_push(mm_cache_t *cache, mm_cache_entry_t *entry) {
+    entry->lru_next = cache->lru_head;
+
+    if (cache->lru_head != NULL) {
+        cache->lru_head->lru_prev = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+
+    cache->lru_head = entry;
+}
+
+/* Called with the cache locked.  Returns the entry, most recently used. */
+static mm_cache_entry_t *mm_cache_find(mm_cache_t *cache, const void *key, size_t key_len, uint64_t hash) {
+    mm_cache_entry_t *entry;
+
+    for (entry = cache->hash[hash % CACHE_HASH_SIZE]; entry != NULL; entry = entry->next) {
+        if ((entry->hash == hash) && (entry->key_len == key_len) && (memcmp(entry->data, key, key_len) == 0)) {
+            mm_cache_lru_unlink(cache, entry);
+            mm_cache_lru_push(cache, entry);
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Called with the cache locked. */
+static void mm_cache_delete(mm_cache_t *cache, mm_cache_entry_t *entry) {
+    mm_cache_entry_t **prev = &cache->hash[entry->hash % CACHE_HASH_SIZE];
+
+    while (*prev != entry) {
+        prev = &(*prev)->next;
+    }
+
+    *prev = entry->next;
+    mm_cache_lru_unlink(cache, entry);
+    cache->bytes -= mm_cache_entry_bytes(entry);
+    free(entry);
+}
+
+/*
+ * Copy the value of key into a buffer the caller frees.  Returns 0, or
+ * -ENOENT if key is not cached.
+ */
+int mm_cache_get(mm_cache_t *cache, const void *key, size_t key_len, uint8_t **value, size_t *len) {
+    mm_cache_entry_t *entry;
+    uint64_t hash = mm_fnv1a((const uint8_t *)key, key_len);
+    size_t   value_len = 0;
+    int      status = 0;
+
+    *value = NULL;
+
+    mm_cache_lock(cache);
+    entry = mm_cache_find(cache, key, key_len, hash);
+    if (entry == NULL) {
+        status = -ENOENT;
+    } else {
+        value_len = entry->len;
+        *value = (uint8_t *)malloc(value_len ? value_len : 1);
+        if (*value == NULL) {
+            status = -ENOMEM;
+        } else {
+            memcpy(*value, &entry->data[key_len], value_len);
+            *len = value_len;
+        }
+    }
+    mm_cache_unlock(cache);
+
+    if (status == -ENOMEM) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, value_len);
+    }
+
+    return status;
+}
+
+/*
+ * Copy the value of key, of len bytes, into value.  Returns 0, or -ENOENT
+ * if key is not cached with a value of that length.
+ */
+int mm_cache_read(mm_cache_t *cache, const void *key, size_t key_len, void *value, size_t len) {
+    mm_cache_entry_t *entry;
+    uint64_t hash = mm_fnv1a((const uint8_t *)key, key_len);
+
+    mm_cache_lock(cache);
+    entry = mm_cache_find(cache, key, key_len, hash);
+    if ((entry == NULL) || (entry->len != len)) {
+        mm_cache_unlock(cache);
+        return -ENOENT;
+    }
+    memcpy(value, &entry->data[key_len], len);
+    mm_cache_unlock(cache);
+
+    return 0;
+}
+
+/*
+ * Cache a copy of value as the value of key, replacing any it had, or if
+ * replace is 0, keeping it.  Least recently used entries are evicted to
+ * stay within the cache's size.  Returns 0, -EEXIST if key was kept,
+ * -E2BIG if the entry would not fit in the cache, or -ENOMEM.
+ */
+int mm_cache_put(mm_cache_t *cache, const void *key, size_t key_len, const void *value, size_t len, int replace) {
+    mm_cache_entry_t *entry;
+    mm_cache_entry_t *old;
+    uint64_t hash = mm_fnv1a((const uint8_t *)key, key_len);
+    size_t   bytes = sizeof(mm_cache_entry_t) + key_len + len;
+
+    if (bytes > cache->max_bytes) return -E2BIG;
+
+    entry = (mm_cache_entry_t *)malloc(bytes);
+    if (entry == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, bytes);
+        return -ENOMEM;
+    }
+
+    entry->hash = hash;
+    entry->key_len = key_len;
+    entry->len = len;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+    memcpy(entry->data, key, key_len);
+    memcpy(&entry->data[key_len], value, len);
+
+    mm_cache_lock(cache);
+    old = mm_cache_find(cache, key, key_len, hash);
+    if (old != NULL) {
+        if (!replace) {
+            mm_cache_unlock(cache);
+            free(entry);
+            return -EEXIST;
+        }
+        mm_cache_delete(cache, old);
+    }
+
+    while (cache->bytes + bytes > cache->max_bytes) {
+        mm_cache_delete(cache, cache->lru_tail);
+    }
+
+    entry->next = cache->hash[hash % CACHE_HASH_SIZE];
+    cache->hash[hash % CACHE_HASH_SIZE] = entry;
+    mm_cache_lru_push(cache, entry);
+    cache->bytes += bytes;
+    mm_cache_unlock(cache);
+
+    return 0;
+}
+
+/* Remove key from the cache.  Returns 0, or -ENOENT if it was not cached. */
+int mm_cache_remove(mm_cache_t *cache, const void *key, size_t key_len) {
+    mm_cache_entry_t *entry;
+    uint64_t hash = mm_fnv1a((const uint8_t *)key, key_len);
+
+    mm_cache_lock(cache);
+    entry = mm_cache_find(cache, key, key_len, hash);
+    if (entry != NULL) {
+        mm_cache_delete(cache, entry);
+    }
+    mm_cache_unlock(cache);
+
+    return (entry != NULL) ? 0 : -ENOENT;
+}
+
+/* Remove every entry from the cache. */
+void mm_cache_clear(mm_cache_t *cache) {
+    mm_cache_lock(cache);
+    while (cache->lru_tail != NULL) {
+        mm_cache_delete(cache, cache->lru_tail);
+    }
+    mm_cache_unlock(cache);
+}
+
+void mm_cache_free(mm_cache_t *cache) {
+    if (cache == NULL) return;
+
+    mm_cache_clear(cache);
+#ifndef _WIN32
+    pthread_mutex_destroy(&cache->lock);
+#endif /* _WIN32 */
+    free(cache);
+}
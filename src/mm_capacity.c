@@ -0,0 +1,672 @@
+/*
+ * Modem bank capacity model for mm_manager.
+ *
+ * Runs a discrete-event simulation of a fleet of terminals calling in to
+ * a modem bank, to find out how many lines the fleet needs.  The fleet
+ * is taken from the mm_manager database: each terminal's call-in time and
+ * average session length (TERMSTATE), and its rate of CDRs and alarms
+ * (TCDR, TALARM.)  Table downloads are timed from the size of the tables
+ * in the table directory, at the terminal's line rate, with the manager's
+ * inter-packet gap and retransmissions.
+ *
+ * For each number of lines, the simulation reports the probability of a
+ * call finding all lines busy, and how long calls were delayed by it.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#ifndef _WIN32
+# include <getopt.h>
+# include <unistd.h>
+# include <libgen.h>
+#else  /* ifndef _WIN32 */
+# include "third-party/getopt.h"
+#endif /* ifndef _WIN32 */
+
+#include <sqlite3.h>
+
+#include "mm_manager.h"
+
+#define SECS_PER_DAY            (24 * 60 * 60)
+#define CALL_CONNECT_SECS       (10.0)  /* Dialing, answer and modem training. */
+#define CALL_BASE_BYTES         (400)   /* Time sync, status and acknowledgements of a session. */
+#define CALL_CDR_THRESHOLD      (30)    /* CDRs stored before the terminal calls in. */
+#define CALL_RETRY_JITTER_SECS  (60.0)  /* Variation in when terminals call back. */
+
+typedef enum {
+    POLICY_NONE = 0,
+    POLICY_MINIMAL,
+    POLICY_FULL
+} download_policy_t;
+
+typedef enum {
+    SCHEDULE_DB = 0,    /* Call-in times from TERMSTATE. */
+    SCHEDULE_SPREAD,    /* Evenly spread over the call-in interval. */
+    SCHEDULE_BURST      /* All at the same time. */
+} call_in_schedule_t;
+
+typedef struct sim_terminal {
+    char     terminal_id[11];
+    int      call_in_offset;    /* Minutes into the call-in interval, -1 if not known. */
+    double   session_secs;      /* Average session length, 0 if not known. */
+    double   cdrs_per_day;
+    double   alarms_per_day;
+    /* Simulation state */
+    double   last_call;
+    uint8_t  in_call;
+    uint8_t  waiting;           /* Found the lines busy, will call back. */
+} sim_terminal_t;
+
+typedef struct sim_params {
+    const char* database;
+    const char* table_dir;
+    int      lines_min;
+    int      lines_max;
+    int      terminals;         /* Fleet size, 0 for the terminals in the database. */
+    double   days;
+    download_policy_t policy;
+    double   downloads_per_day; /* Per terminal */
+    call_in_schedule_t schedule;
+    int      baud;
+    int      gap_ms;
+    double   error_pct;
+    int      retry_mins;
+    uint64_t seed;
+} sim_params_t;
+
+typedef struct sim_results {
+    uint32_t attempts;
+    uint32_t blocked;
+    uint32_t calls;
+    double   delay_total;
+    double   delay_max;
+    double*  delays;            /* Delay of each call, for percentiles. */
+    double   busy_secs;         /* Line-seconds in use. */
+    int      peak;
+} sim_results_t;
+
+typedef enum {
+    EVENT_CALL_IN = 0,  /* Scheduled call-in. */
+    EVENT_CALL,         /* Unscheduled call: CDR threshold or alarm. */
+    EVENT_RETRY,        /* Call back after finding the lines busy. */
+    EVENT_HANGUP
+} sim_event_type_t;
+
+typedef struct sim_event {
+    double   time;
+    double   first_attempt;
+    int      terminal;
+    sim_event_type_t type;
+} sim_event_t;
+
+typedef struct sim_queue {
+    sim_event_t* events;
+    size_t   count;
+    size_t   size;
+} sim_queue_t;
+
+static uint64_t rng_state;
+
+static double rng_uniform(void) {
+    /* xorshift64* */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+/* Time to the next event of a Poisson process. */
+static double rng_exponential(double rate) {
+    return -log(1.0 - rng_uniform()) / rate;
+}
+
+static int queue_push(sim_queue_t* queue, sim_event_t* event) {
+    size_t i;
+
+    if (queue->count == queue->size) {
+        size_t size = queue->size ? queue->size * 2 : 1024;
+        sim_event_t* events = (sim_event_t*)realloc(queue->events, size * sizeof(sim_event_t));
+
+        if (events == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, size * sizeof(sim_event_t));
+            return -ENOMEM;
+        }
+        queue->events = events;
+        queue->size = size;
+    }
+
+    for (i = queue->count++; i > 0; i = (i - 1) / 2) {
+        if (queue->events[(i - 1) / 2].time <= event->time) break;
+        queue->events[i] = queue->events[(i - 1) / 2];
+    }
+    queue->events[i] = *event;
+
+    return 0;
+}
+
+static void queue_pop(sim_queue_t* queue, sim_event_t* event) {
+    sim_event_t last = queue->events[--queue->count];
+    size_t i = 0;
+
+    *event = queue->events[0];
+
+    for (;;) {
+        size_t child = i * 2 + 1;
+
+        if (child >= queue->count) break;
+        if ((child + 1 < queue->count) && (queue->events[child + 1].time < queue->events[child].time)) child++;
+        if (last.time <= queue->events[child].time) break;
+
+        queue->events[i] = queue->events[child];
+        i = child;
+    }
+    queue->events[i] = last;
+}
+
+/*
+ * Seconds to send len bytes of a table: packets of up to
+ * PKT_TABLE_DATA_LEN_MAX bytes, each preceded by the inter-packet gap and
+ * acknowledged by the terminal, then the terminal's acknowledgement of the
+ * table.  Errored packets are sent again.
+ */
+static double wire_secs(const sim_params_t* params, size_t len) {
+    double byte_secs = 10.0 / params->baud;
+    double gap_secs = params->gap_ms / 1000.0;
+    double tries = 100.0 / (100.0 - params->error_pct);
+    double secs = 0.0;
+
+    while (len > 0) {
+        size_t chunk = (len > PKT_TABLE_DATA_LEN_MAX) ? PKT_TABLE_DATA_LEN_MAX : len;
+
+        secs += tries * (gap_secs + (chunk + PKT_OVERHEAD_BYTES) * byte_secs + gap_secs + PKT_ACK_BYTES * byte_secs);
+        len -= chunk;
+    }
+
+    /* Table acknowledgement and its ACK. */
+    secs += gap_secs + (2 + PKT_OVERHEAD_BYTES) * byte_secs + gap_secs + PKT_ACK_BYTES * byte_secs;
+
+    return secs;
+}
+
+/* Seconds to download the tables of the download policy. */
+static double download_secs(const sim_params_t* params, int* ntables, size_t* nbytes) {
+    char     fname[TABLE_PATH_MAX_LEN];
+    FILE*    stream;
+    double   secs = 0.0;
+
+    *ntables = 0;
+    *nbytes = 0;
+
+    if (params->policy == POLICY_NONE) return 0.0;
+
+    for (int table_id = 1; table_id < 256; table_id++) {
+        long size;
+
+        if ((params->policy == POLICY_MINIMAL) && !mm_table_is_mandatory((uint8_t)table_id)) continue;
+
+        snprintf(fname, sizeof(fname), "%s/mm_table_%02x.bin", params->table_dir, table_id);
+        if ((stream = fopen(fname, "rb")) == NULL) continue;
+
+        fseek(stream, 0, SEEK_END);
+        size = ftell(stream);
+        fclose(stream);
+
+        if (size <= 0) continue;
+
+        /* The table ID precedes the table. */
+        secs += wire_secs(params, (size_t)size + 1);
+        *nbytes += (size_t)size + 1;
+        (*ntables)++;
+    }
+
+    /* Tables generated by mm_manager. */
+    secs += wire_secs(params, sizeof(dlog_mt_install_params_t));
+    secs += wire_secs(params, sizeof(dlog_mt_ncc_term_params_t));
+    if (params->policy == POLICY_FULL) {
+        secs += wire_secs(params, sizeof(dlog_mt_call_in_params_t));
+        secs += wire_secs(params, sizeof(dlog_mt_call_stat_params_t));
+        secs += wire_secs(params, sizeof(dlog_mt_comm_stat_params_t));
+    }
+
+    return secs;
+}
+
+static sim_terminal_t* find_terminal(sim_terminal_t* fleet, int count, const char* terminal_id) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(fleet[i].terminal_id, terminal_id) == 0) return &fleet[i];
+    }
+
+    return NULL;
+}
+
+/* Daily rate of the records of each terminal in an accounting table, over the days it has records for. */
+static void load_daily_rate(sqlite3* db, const char* table, sim_terminal_t* fleet, int count, size_t rate_offset) {
+    char sql[512];
+    sqlite3_stmt* res;
+
+    snprintf(sql, sizeof(sql), "SELECT TERMINAL_ID, COUNT(*), "
+        "julianday(MAX(D)) - julianday(MIN(D)) + 1 FROM "
+        "(SELECT TERMINAL_ID, substr(START_DATE, 1, 4) || '-' || substr(START_DATE, 5, 2) || '-' || substr(START_DATE, 7, 2) AS D "
+        "from %s) GROUP BY TERMINAL_ID", table);
+
+    if (sqlite3_prepare_v2(db, sql, -1, &res, 0) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: \nSQL: '%s'\nError: %s\n", __func__, sql, sqlite3_errmsg(db));
+        sqlite3_finalize(res);
+        return;
+    }
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        const char* terminal_id = (const char*)sqlite3_column_text(res, 0);
+        sim_terminal_t* terminal;
+        double days = sqlite3_column_double(res, 2);
+
+        if ((terminal_id == NULL) || ((terminal = find_terminal(fleet, count, terminal_id)) == NULL)) continue;
+
+        *(double*)((uint8_t*)terminal + rate_offset) = sqlite3_column_int(res, 1) / ((days >= 1.0) ? days : 1.0);
+    }
+
+    sqlite3_finalize(res);
+}
+
+/* Load the fleet from the database.  Returns the number of terminals, or a negative errno. */
+static int load_fleet(const char* database, sim_terminal_t** pfleet) {
+    sqlite3* db;
+    sqlite3_stmt* res;
+    sim_terminal_t* fleet = NULL;
+    int count = 0;
+
+    if (sqlite3_open_v2(database, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Cannot open database %s: %s\n", database, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return -ENOENT;
+    }
+
+    if (sqlite3_prepare_v2(db, "SELECT TERMINAL_ID, CALL_IN_OFFSET, SESSION_SECS from TERMSTATE", -1, &res, 0) != SQLITE_OK) {
+        fprintf(stderr, "Cannot read terminals from %s: %s\n", database, sqlite3_errmsg(db));
+        sqlite3_finalize(res);
+        sqlite3_close(db);
+        return -EIO;
+    }
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        const char* terminal_id = (const char*)sqlite3_column_text(res, 0);
+        sim_terminal_t* grown = (sim_terminal_t*)realloc(fleet, (count + 1) * sizeof(sim_terminal_t));
+
+        if (grown == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, (count + 1) * sizeof(sim_terminal_t));
+            free(fleet);
+            sqlite3_finalize(res);
+            sqlite3_close(db);
+            return -ENOMEM;
+        }
+        fleet = grown;
+
+        memset(&fleet[count], 0, sizeof(sim_terminal_t));
+        snprintf(fleet[count].terminal_id, sizeof(fleet[count].terminal_id), "%s", terminal_id ? terminal_id : "");
+        fleet[count].call_in_offset = sqlite3_column_int(res, 1);
+        fleet[count].session_secs = sqlite3_column_int(res, 2);
+        count++;
+    }
+
+    sqlite3_finalize(res);
+
+    load_daily_rate(db, "TCDR", fleet, count, offsetof(sim_terminal_t, cdrs_per_day));
+    load_daily_rate(db, "TALARM", fleet, count, offsetof(sim_terminal_t, alarms_per_day));
+
+    sqlite3_close(db);
+
+    *pfleet = fleet;
+    return count;
+}
+
+/* Seconds a call from terminal keeps a line busy. */
+static double session_secs(const sim_params_t* params, sim_terminal_t* terminal, double now, double download) {
+    double secs;
+    double cdrs;
+
+    /* The measured average already includes the terminal's CDR uploads and downloads. */
+    if (terminal->session_secs > 0) {
+        return terminal->session_secs;
+    }
+
+    cdrs = terminal->cdrs_per_day * (now - terminal->last_call) / SECS_PER_DAY;
+    if (cdrs > CALL_CDR_THRESHOLD) cdrs = CALL_CDR_THRESHOLD;
+
+    secs = CALL_CONNECT_SECS + wire_secs(params, CALL_BASE_BYTES);
+    secs += cdrs * wire_secs(params, sizeof(dlog_mt_call_details_t));
+
+    /* Spread the terminal's downloads over its calls, two call-ins a day and the unscheduled calls. */
+    if (rng_uniform() < params->downloads_per_day /
+        (2.0 + terminal->cdrs_per_day / CALL_CDR_THRESHOLD + terminal->alarms_per_day)) {
+        secs += download;
+    }
+
+    return secs;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Simulate the fleet calling in to a modem bank of the given number of lines. */
+static int simulate(const sim_params_t* params, sim_terminal_t* fleet, int count, int lines, double download, sim_results_t* results) {
+    sim_queue_t queue = { NULL, 0, 0 };
+    sim_event_t event;
+    double end = params->days * SECS_PER_DAY;
+    double interval = CALL_IN_INTERVAL_MINS * 60.0;
+    size_t delays_size = 0;
+    int busy = 0;
+    int status = 0;
+
+    memset(results, 0, sizeof(sim_results_t));
+    rng_state = params->seed ? params->seed : 1;
+
+    for (int i = 0; i < count && status == 0; i++) {
+        sim_terminal_t* terminal = &fleet[i];
+        double rate = (terminal->cdrs_per_day / CALL_CDR_THRESHOLD + terminal->alarms_per_day) / SECS_PER_DAY;
+
+        terminal->last_call = 0;
+        terminal->in_call = 0;
+        terminal->waiting = 0;
+
+        event.terminal = i;
+        event.type = EVENT_CALL_IN;
+        switch (params->schedule) {
+            case SCHEDULE_SPREAD:
+                event.time = interval * i / count;
+                break;
+            case SCHEDULE_BURST:
+                event.time = 0;
+                break;
+            default:
+                event.time = (terminal->call_in_offset >= 0) ?
+                    terminal->call_in_offset * 60.0 : rng_uniform() * interval;
+                break;
+        }
+        event.first_attempt = event.time;
+        status = queue_push(&queue, &event);
+
+        if ((rate > 0) && (status == 0)) {
+            event.type = EVENT_CALL;
+            event.time = rng_exponential(rate);
+            event.first_attempt = event.time;
+            status = queue_push(&queue, &event);
+        }
+    }
+
+    while ((status == 0) && (queue.count > 0)) {
+        sim_terminal_t* terminal;
+
+        queue_pop(&queue, &event);
+        if (event.time >= end) break;
+
+        terminal = &fleet[event.terminal];
+
+        if (event.type == EVENT_HANGUP) {
+            busy--;
+            terminal->in_call = 0;
+            continue;
+        }
+
+        /* Schedule the terminal's next call. */
+        if (event.type == EVENT_CALL_IN) {
+            sim_event_t next = { event.time + interval, event.time + interval, event.terminal, EVENT_CALL_IN };
+
+            status = queue_push(&queue, &next);
+        } else if (event.type == EVENT_CALL) {
+            double rate = (terminal->cdrs_per_day / CALL_CDR_THRESHOLD + terminal->alarms_per_day) / SECS_PER_DAY;
+            sim_event_t next = { 0, 0, event.terminal, EVENT_CALL };
+
+            next.time = event.time + rng_exponential(rate);
+            next.first_attempt = next.time;
+            status = queue_push(&queue, &next);
+        }
+
+        /* A terminal already in a call, or about to call back, has nothing more to say. */
+        if (event.type == EVENT_RETRY) {
+            terminal->waiting = 0;
+        } else if (terminal->in_call || terminal->waiting) {
+            continue;
+        }
+
+        results->attempts++;
+
+        if (busy >= lines) {
+            sim_event_t retry = { event.time + params->retry_mins * 60.0 + rng_uniform() * CALL_RETRY_JITTER_SECS,
+                                  event.first_attempt, event.terminal, EVENT_RETRY };
+
+            results->blocked++;
+            terminal->waiting = 1;
+            status = queue_push(&queue, &retry);
+            continue;
+        }
+
+        {
+            double delay = event.time - event.first_attempt;
+            double secs = session_secs(params, terminal, event.time, download);
+            sim_event_t hangup = { event.time + secs, 0, event.terminal, EVENT_HANGUP };
+
+            if (results->calls == delays_size) {
+                size_t size = delays_size ? delays_size * 2 : 1024;
+                double* delays = (double*)realloc(results->delays, size * sizeof(double));
+
+                if (delays == NULL) {
+                    fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, size * sizeof(double));
+                    status = -ENOMEM;
+                    break;
+                }
+                results->delays = delays;
+                delays_size = size;
+            }
+
+            results->delays[results->calls++] = delay;
+            results->delay_total += delay;
+            if (delay > results->delay_max) results->delay_max = delay;
+            results->busy_secs += ((event.time + secs) < end) ? secs : (end - event.time);
+
+            terminal->in_call = 1;
+            terminal->last_call = event.time;
+            if (++busy > results->peak) results->peak = busy;
+
+            status = queue_push(&queue, &hangup);
+        }
+    }
+
+    free(queue.events);
+
+    if (results->calls > 0) {
+        qsort(results->delays, results->calls, sizeof(double), compare_double);
+    }
+
+    return status;
+}
+
+static void mm_capacity_help(const char* name, FILE* stream) {
+    fprintf(stream,
+        "usage: %s [-h] [-d <database>] [-T <table_dir>] [-l <lines>[-<lines>]] [-t <terminals>] [-D <days>] "
+        "[-p full|minimal|none] [-u <downloads>] [-c db|spread|burst] [-b <bps>] [-g <gap_ms>] [-e <error_pct>] "
+        "[-R <minutes>] [-S <seed>]\n", name);
+    fprintf(stream,
+        "\t-d <database> - mm_manager database with the fleet's history (default: mm_manager.db)\n" \
+        "\t-T <table_dir> - table directory, for the size of downloads (default: tables/default)\n" \
+        "\t-l <lines>[-<lines>] - number of lines, or range of numbers of lines to simulate (default: 1-8)\n" \
+        "\t-t <terminals> - fleet size, the terminals in the database are repeated as needed (default: database)\n" \
+        "\t-D <days> - days to simulate (default: 7)\n" \
+        "\t-p full|minimal|none - download policy: all tables, only the minimal set (-s), or none (default: full)\n" \
+        "\t-u <downloads> - downloads per terminal per day (default: 0.14, weekly)\n" \
+        "\t-c db|spread|burst - call-in times: from the database, evenly spread, or all at once (default: db)\n" \
+        "\t-b <bps> - line rate (default: %d)\n" \
+        "\t-g <gap_ms> - inter-packet gap, in ms (default: 100)\n" \
+        "\t-e <error_pct> - percentage of packets sent again (default: 2)\n" \
+        "\t-R <minutes> - time before a terminal calls back after finding the lines busy (default: 15)\n" \
+        "\t-S <seed> - random number seed (default: 1)\n" \
+        "\t-h this help.\n", PKT_LINE_RATE);
+}
+
+int main(int argc, char* argv[]) {
+    sim_params_t params = {
+        "mm_manager.db", "tables/default", 1, 8, 0, 7.0, POLICY_FULL, 1.0 / 7.0, SCHEDULE_DB,
+        PKT_LINE_RATE, 100, 2.0, 15, 1
+    };
+    sim_terminal_t* db_fleet = NULL;
+    sim_terminal_t* fleet;
+    sim_results_t results;
+    double download;
+    size_t download_bytes;
+    int download_tables;
+    int db_count = 0;
+    int count;
+    int c;
+    int status = 0;
+
+    while ((c = getopt(argc, argv, "b:c:d:D:e:g:hl:p:R:S:t:T:u:")) != -1) {
+        switch (c) {
+            case 'b':
+                params.baud = atoi(optarg);
+                break;
+            case 'c':
+                if (strcmp(optarg, "db") == 0) {
+                    params.schedule = SCHEDULE_DB;
+                } else if (strcmp(optarg, "spread") == 0) {
+                    params.schedule = SCHEDULE_SPREAD;
+                } else if (strcmp(optarg, "burst") == 0) {
+                    params.schedule = SCHEDULE_BURST;
+                } else {
+                    fprintf(stderr, "Unknown call-in schedule '%s'.\n", optarg);
+                    return -EINVAL;
+                }
+                break;
+            case 'd':
+                params.database = optarg;
+                break;
+            case 'D':
+                params.days = atof(optarg);
+                break;
+            case 'e':
+                params.error_pct = atof(optarg);
+                break;
+            case 'g':
+                params.gap_ms = atoi(optarg);
+                break;
+            case 'h':
+                mm_capacity_help(basename(argv[0]), stdout);
+                return 0;
+            case 'l':
+                if (sscanf(optarg, "%d-%d", &params.lines_min, &params.lines_max) == 1) {
+                    params.lines_max = params.lines_min;
+                }
+                break;
+            case 'p':
+                if (strcmp(optarg, "full") == 0) {
+                    params.policy = POLICY_FULL;
+                } else if (strcmp(optarg, "minimal") == 0) {
+                    params.policy = POLICY_MINIMAL;
+                } else if (strcmp(optarg, "none") == 0) {
+                    params.policy = POLICY_NONE;
+                } else {
+                    fprintf(stderr, "Unknown download policy '%s'.\n", optarg);
+                    return -EINVAL;
+                }
+                break;
+            case 'R':
+                params.retry_mins = atoi(optarg);
+                break;
+            case 'S':
+                params.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                params.terminals = atoi(optarg);
+                break;
+            case 'T':
+                params.table_dir = optarg;
+                break;
+            case 'u':
+                params.downloads_per_day = atof(optarg);
+                break;
+            default:
+                mm_capacity_help(basename(argv[0]), stderr);
+                return -EINVAL;
+        }
+    }
+
+    if ((params.lines_min < 1) || (params.lines_max < params.lines_min) || (params.days <= 0) ||
+        (params.baud <= 0) || (params.gap_ms < 0) || (params.error_pct < 0) || (params.error_pct >= 100) ||
+        (params.retry_mins <= 0) || (params.terminals < 0)) {
+        mm_capacity_help(basename(argv[0]), stderr);
+        return -EINVAL;
+    }
+
+    db_count = load_fleet(params.database, &db_fleet);
+    if (db_count < 0) {
+        db_count = 0;
+    }
+
+    count = params.terminals ? params.terminals : db_count;
+    if (count == 0) {
+        fprintf(stderr, "No terminals in %s, give the fleet size with -t.\n", params.database);
+        free(db_fleet);
+        return -EINVAL;
+    }
+
+    fleet = (sim_terminal_t*)calloc(count, sizeof(sim_terminal_t));
+    if (fleet == NULL) {
+        fprintf(stderr, "Error: failed to allocate %zu bytes.\n", count * sizeof(sim_terminal_t));
+        free(db_fleet);
+        return -ENOMEM;
+    }
+
+    /* Terminals beyond those in the database repeat their history. */
+    for (int i = 0; i < count; i++) {
+        if (db_count > 0) {
+            fleet[i] = db_fleet[i % db_count];
+            if (i >= db_count) fleet[i].call_in_offset = -1;
+        } else {
+            fleet[i].call_in_offset = -1;
+        }
+    }
+    free(db_fleet);
+
+    download = download_secs(&params, &download_tables, &download_bytes);
+
+    printf("Fleet: %d terminals (%d from %s), %.1f days, call-ins %s.\n", count, db_count, params.database, params.days,
+        (params.schedule == SCHEDULE_SPREAD) ? "evenly spread" : (params.schedule == SCHEDULE_BURST) ? "all at once" : "from database");
+    printf("Downloads: %.2f per terminal per day, %d tables, %zu bytes, %.0f seconds at %d bps, %dms gap, %.1f%% of packets sent again.\n\n",
+        (params.policy == POLICY_NONE) ? 0.0 : params.downloads_per_day, download_tables, download_bytes, download,
+        params.baud, params.gap_ms, params.error_pct);
+
+    printf("Lines  Calls  Blocked  Delay (avg/95%%/max, min)  Utilization  Peak\n");
+
+    for (int lines = params.lines_min; lines <= params.lines_max && status == 0; lines++) {
+        status = simulate(&params, fleet, count, lines, download, &results);
+
+        if ((status == 0) && (results.calls > 0)) {
+            printf("%5d  %5u  %6.2f%%  %7.1f %7.1f %7.1f      %6.1f%%  %4d\n",
+                lines,
+                results.calls,
+                results.attempts ? (results.blocked * 100.0) / results.attempts : 0.0,
+                results.delay_total / results.calls / 60.0,
+                results.delays[(size_t)((results.calls - 1) * 0.95)] / 60.0,
+                results.delay_max / 60.0,
+                (results.busy_secs * 100.0) / (lines * params.days * SECS_PER_DAY),
+                results.peak);
+        }
+
+        free(results.delays);
+    }
+
+    free(fleet);
+
+    return status;
+}
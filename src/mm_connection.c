@@ -14,7 +14,15 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <errno.h> /* Error number definitions */
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>  /* time_t, struct tm, time, gmtime */
+#ifdef _WIN32
+# include <windows.h>
+# include <process.h>
+#else  /* ifdef _WIN32 */
+# include <pthread.h>
+#endif /* _WIN32 */
 
 #include "mm_manager.h"
 #include "mm_serial.h"
@@ -24,9 +32,24 @@ extern int manager_running;
 extern const char* modem_responses[];
 extern time_t mm_time(int test_mode, time_t* rawtime);
 
-int mm_connection_open(mm_connection_t* connection, const char *modem_dev, int baudrate, int test_mode) {
-    int   status;
+static int mm_connection_start(mm_connection_t* connection);
+
+/* All lines, from mm_connection_init_wait(). */
+static mm_connection_t** line_connections = NULL;
+static int line_count = 0;
 
+#define HOURLY_CALLS_DECAY  (0.9)     /* Part of the calls counted in each hour kept per day. */
+#define SECS_PER_DAY        (24 * 60 * 60)
+
+/*
+ * Calls answered in each hour of the day, including call-backs scheduled.
+ * Decayed every day, so the last few weeks count, and kept in LINECALLS
+ * across restarts.
+ */
+static double line_hourly_calls[24];
+static time_t line_hourly_decayed;      /* When the calls were last decayed, 0 if never. */
+
+int mm_connection_open(mm_connection_t* connection, const char *modem_dev, int baudrate, int test_mode) {
     connection->test_mode = test_mode;
     if (test_mode) {
         if (modem_dev == NULL) {
@@ -50,28 +73,371 @@ int mm_connection_open(mm_connection_t* connection, const char *modem_dev, int b
         }
     }
 
-    connection->proto.serial_context = open_serial(modem_dev, connection->logstream, connection->bytestream);
+    connection->modem_dev = modem_dev;
+    connection->baudrate = baudrate;
 
-    if (connection->proto.serial_context == NULL) {
+    if (mm_connection_start(connection) != 0) {
         fprintf(stderr, "Unable to open modem: %s.", modem_dev);
         mm_connection_close(connection);
         return(-ENODEV);
     }
 
-    init_serial(connection->proto.serial_context, baudrate);
-    status = init_modem(connection->proto.serial_context, connection->modem_reset_string, connection->modem_init_string);
+    return (0);
+}
 
-    if (status == 0) {
-        printf("Modem initialized.\n");
-    }
-    else {
-        fprintf(stderr, "Error initializing modem.\n");
-        mm_connection_close(connection);
-        return(-EIO);
+/* Open the line's modem and start initializing it. */
+static int mm_connection_start(mm_connection_t* connection) {
+    connection->proto.serial_context = open_serial(connection->modem_dev, connection->logstream, connection->bytestream);
+
+    if (connection->proto.serial_context == NULL) {
+        return(-ENODEV);
     }
+
+    init_serial(connection->proto.serial_context, connection->baudrate);
+
+    /* Initialization completes in mm_connection_init_wait() or mm_connection_wait(). */
+    modem_attach(&connection->modem, connection->proto.serial_context);
+    connection->proto.modem = &connection->modem;
+    modem_start_init(&connection->modem, connection->modem_reset_string, connection->modem_init_string);
+
     return (0);
 }
 
+static void mm_connection_print_time(mm_connection_t* connection) {
+    time_t rawtime;
+    struct tm ptm = { 0 };
+
+    mm_time(connection->test_mode, &rawtime);
+    localtime_r(&rawtime, &ptm);
+
+    printf("%04d-%02d-%02d %2d:%02d:%02d: Line %d: ",
+        ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
+        connection->line);
+}
+
+static void mm_connection_set_state(mm_connection_t* connection, uint8_t line_state) {
+    mm_lines_lock();
+    connection->line_state = line_state;
+    if (line_state != LINE_STATE_IN_SERVICE) connection->in_call = 0;
+    mm_lines_unlock();
+}
+
+/*
+ * Take a line out of service, closing its modem.  It is re-initialized
+ * after a delay that doubles with each consecutive failure.
+ */
+static void mm_connection_out_of_service(mm_connection_t* connection, const char* reason) {
+    if (connection->line_state == LINE_STATE_IN_SERVICE) {
+        connection->reinit_backoff = LINE_REINIT_BACKOFF_MIN_MS;
+    } else if (connection->reinit_backoff < LINE_REINIT_BACKOFF_MAX_MS / 2) {
+        connection->reinit_backoff *= 2;
+    } else {
+        connection->reinit_backoff = LINE_REINIT_BACKOFF_MAX_MS;
+    }
+
+    close_serial(connection->proto.serial_context);
+    connection->proto.serial_context = NULL;
+    connection->proto.connected = 0;
+
+    mm_connection_set_state(connection, LINE_STATE_OUT_OF_SERVICE);
+    connection->reinit_time = mm_monotonic_ms() + connection->reinit_backoff;
+    connection->failures++;
+
+    mm_connection_print_time(connection);
+    printf("Out of service: %s, re-initializing in %u seconds.\n\n", reason, connection->reinit_backoff / 1000);
+}
+
+/* Re-initialize an out-of-service line once its delay has passed. */
+static void mm_connection_reinit(mm_connection_t* connection) {
+    if (connection->line_state == LINE_STATE_OUT_OF_SERVICE) {
+        uint64_t now = mm_monotonic_ms();
+
+        if (now < connection->reinit_time) {
+            mm_sleep_ms((connection->reinit_time - now) < 1000 ? (uint32_t)(connection->reinit_time - now) : 1000);
+            return;
+        }
+
+        if (mm_connection_start(connection) != 0) {
+            mm_connection_out_of_service(connection, "unable to open modem");
+            return;
+        }
+
+        mm_connection_set_state(connection, LINE_STATE_REINIT);
+    }
+
+    if (modem_poll(&connection->modem, 1000) == MODEM_RSP_READ_ERROR) {
+        mm_connection_out_of_service(connection, "error communicating with modem");
+    } else if (connection->modem.state == MODEM_STATE_FAILED) {
+        mm_connection_out_of_service(connection, "modem not responding");
+    } else if (connection->modem.state == MODEM_STATE_IDLE) {
+        mm_connection_set_state(connection, LINE_STATE_IN_SERVICE);
+
+        mm_connection_print_time(connection);
+        printf("Back in service.\n\n");
+    }
+}
+
+/*
+ * Wait for the modems of all lines to finish initializing, in parallel.
+ *
+ * Returns the number of lines with a working modem.
+ */
+int mm_connection_init_wait(mm_connection_t* connections[], int count) {
+    int pending;
+    int ready = 0;
+    int i;
+
+    line_connections = connections;
+    line_count = count;
+
+    do {
+        pending = 0;
+
+        for (i = 0; i < count; i++) {
+            mm_modem_t* modem = &connections[i]->modem;
+
+            if ((modem->state == MODEM_STATE_IDLE) || (modem->state == MODEM_STATE_FAILED)) continue;
+
+            if (modem_poll(modem, 10) == MODEM_RSP_READ_ERROR) {
+                modem->state = MODEM_STATE_FAILED;
+            }
+            pending++;
+        }
+    } while (pending && manager_running);
+
+    for (i = 0; i < count; i++) {
+        if (count > 1) {
+            printf("Line %d: ", connections[i]->line);
+        }
+
+        if (connections[i]->modem.state == MODEM_STATE_IDLE) {
+            printf("Modem initialized.\n");
+            ready++;
+        }
+        else {
+            fprintf(stderr, "Error initializing modem.\n");
+            mm_connection_out_of_service(connections[i], "modem not responding");
+        }
+    }
+
+    return (ready);
+}
+
+/* Percentage of packets with errors or retries over the line's recent calls. */
+static uint32_t mm_connection_error_pct(mm_connection_t* connection, uint32_t* packets) {
+    uint32_t errors = 0;
+
+    *packets = 0;
+    for (int i = 0; i < LINE_HEALTH_CALLS; i++) {
+        *packets += connection->health_packets[i];
+        errors += connection->health_errors[i];
+    }
+
+    return (*packets == 0) ? 0 : (errors * 100) / *packets;
+}
+
+/*
+ * Account for the link-layer errors of the call just ended, and busy out
+ * the line if its recent calls had too many.  The last line in service
+ * is never busied out.
+ */
+void mm_connection_call_ended(mm_connection_t* connection) {
+    mm_proto_stats_t* stats = &connection->proto.stats;
+    mm_proto_stats_t* start = &connection->call_start;
+    uint32_t packets;
+    uint32_t error_pct;
+    int unhealthy;
+    int in_service = 0;
+    int busied_out = 0;
+
+    connection->health_packets[connection->health_index] =
+        (stats->rx_packets - start->rx_packets) + (stats->tx_packets - start->tx_packets);
+    connection->health_errors[connection->health_index] =
+        (stats->rx_errors - start->rx_errors) + (stats->rx_timeouts - start->rx_timeouts) +
+        (stats->tx_retries - start->tx_retries);
+    connection->health_index = (connection->health_index + 1) % LINE_HEALTH_CALLS;
+
+    error_pct = mm_connection_error_pct(connection, &packets);
+    unhealthy = (packets >= LINE_HEALTH_MIN_PACKETS) && (error_pct > LINE_HEALTH_MAX_ERROR_PCT);
+
+    /* Count the lines in service and busy this one out in one go, so the last line is never busied out. */
+    mm_lines_lock();
+    connection->in_call = 0;
+    if (unhealthy && (connection->line_state == LINE_STATE_IN_SERVICE)) {
+        for (int i = 0; i < line_count; i++) {
+            if (line_connections[i]->line_state == LINE_STATE_IN_SERVICE) in_service++;
+        }
+
+        if (in_service > 1) {
+            /* The modem is taken off-hook by mm_connection_probation() once it has hung up. */
+            connection->line_state = LINE_STATE_BUSY_OUT;
+            connection->probation_time = 0;
+            connection->busy_outs++;
+            busied_out = 1;
+        }
+    }
+    mm_lines_unlock();
+
+    if (!unhealthy) return;
+
+    mm_connection_print_time(connection);
+    if (busied_out) {
+        printf("Busied out: %u%% errors over %u packets, on probation for %u minutes.\n\n",
+            error_pct, packets, LINE_PROBATION_MS / 60000);
+    } else if (connection->line_state == LINE_STATE_IN_SERVICE) {
+        printf("%u%% errors over %u packets, but it is the last line in service.\n\n", error_pct, packets);
+    }
+}
+
+/* Number of lines in the modem bank. */
+int mm_connection_line_count(void) {
+    return (line_count > 0) ? line_count : 1;
+}
+
+/*
+ * Percentage of the lines in service that are in a call, or -1 if there
+ * is only one line in service, as the load of the pool can't be told.
+ */
+int mm_connection_load_pct(void) {
+    int in_service = 0;
+    int busy = 0;
+
+    mm_lines_lock();
+    for (int i = 0; i < line_count; i++) {
+        if (line_connections[i]->line_state != LINE_STATE_IN_SERVICE) continue;
+
+        in_service++;
+        if (line_connections[i]->in_call) busy++;
+    }
+    mm_lines_unlock();
+
+    return (in_service > 1) ? (busy * 100) / in_service : -1;
+}
+
+/* Called with the lines locked. */
+static void mm_connection_hourly_decay(time_t now) {
+    if ((line_hourly_decayed == 0) || (now - line_hourly_decayed > 365 * SECS_PER_DAY)) {
+        if (line_hourly_decayed != 0) memset(line_hourly_calls, 0, sizeof(line_hourly_calls));
+        line_hourly_decayed = now;
+        return;
+    }
+
+    while (now - line_hourly_decayed >= SECS_PER_DAY) {
+        for (int i = 0; i < 24; i++) {
+            line_hourly_calls[i] *= HOURLY_CALLS_DECAY;
+        }
+        line_hourly_decayed += SECS_PER_DAY;
+    }
+}
+
+int mm_connection_create_tables(void* db) {
+    int rc;
+
+    rc = mm_sql_exec(db, "CREATE TABLE IF NOT EXISTS LINECALLS ( "
+        "HOUR TINYINT NOT NULL PRIMARY KEY,"
+        "CALLS REAL DEFAULT 0,"
+        "DECAYED_TIME BIGINT DEFAULT 0);");
+
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to create table LINECALLS.\n", __func__);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Load the calls answered in each hour of the day, as last saved. */
+int mm_connection_load_calls(void* db) {
+    double calls[24] = { 0 };
+    time_t decayed_time = 0;
+    int rc;
+
+    if ((rc = mm_sql_load_LINECALLS(db, calls, &decayed_time)) != 0) return rc;
+
+    mm_lines_lock();
+    memcpy(line_hourly_calls, calls, sizeof(line_hourly_calls));
+    line_hourly_decayed = decayed_time;
+    mm_lines_unlock();
+
+    return 0;
+}
+
+/* Save the calls answered in each hour of the day. */
+int mm_connection_save_calls(void* db) {
+    double calls[24];
+    time_t decayed_time;
+
+    mm_lines_lock();
+    memcpy(calls, line_hourly_calls, sizeof(calls));
+    decayed_time = line_hourly_decayed;
+    mm_lines_unlock();
+
+    return mm_sql_save_LINECALLS(db, calls, decayed_time);
+}
+
+/*
+ * Time for a terminal to call back while the lines are busy: the hour,
+ * of the next 23, that had the fewest calls answered, the soonest of those.
+ * Terminals are spread over the hour by their terminal ID, and each
+ * call-back counts as a call in its hour so they don't all pile into it.
+ */
+time_t mm_connection_call_back_time(const char* terminal_id, time_t now) {
+    struct tm ptm = { 0 };
+    double quietest = 0;
+    int hours = 1;
+
+    localtime_r(&now, &ptm);
+
+    mm_lines_lock();
+    mm_connection_hourly_decay(now);
+    for (int i = 1; i < 24; i++) {
+        if ((i == 1) || (line_hourly_calls[(ptm.tm_hour + i) % 24] < quietest)) {
+            quietest = line_hourly_calls[(ptm.tm_hour + i) % 24];
+            hours = i;
+        }
+    }
+    line_hourly_calls[(ptm.tm_hour + hours) % 24] += 1;
+    mm_lines_unlock();
+
+    ptm.tm_hour += hours;
+    ptm.tm_min = 0;
+    ptm.tm_sec = (int)(strtoull(terminal_id, NULL, 10) % 3600);
+    ptm.tm_isdst = -1;
+
+    return mktime(&ptm);
+}
+
+/* Keep a busied out line off-hook until its probation ends. */
+static void mm_connection_probation(mm_connection_t* connection) {
+    mm_modem_t* modem = &connection->modem;
+
+    if (modem_poll(modem, 1000) == MODEM_RSP_READ_ERROR) {
+        mm_connection_out_of_service(connection, "error communicating with modem");
+        return;
+    }
+
+    if (modem->state == MODEM_STATE_FAILED) {
+        mm_connection_out_of_service(connection, "modem not responding");
+        return;
+    }
+
+    if (modem->state != MODEM_STATE_IDLE) return;
+
+    if (connection->probation_time == 0) {
+        /* Off-hook, so the hunt group skips this line. */
+        modem_start_command(modem, "ATH1");
+        connection->probation_time = mm_monotonic_ms() + LINE_PROBATION_MS;
+    } else if (mm_monotonic_ms() >= connection->probation_time) {
+        modem_start_command(modem, "ATH0");
+        memset(connection->health_packets, 0, sizeof(connection->health_packets));
+        memset(connection->health_errors, 0, sizeof(connection->health_errors));
+        mm_connection_set_state(connection, LINE_STATE_IN_SERVICE);
+
+        mm_connection_print_time(connection);
+        printf("Probation ended, back in service.\n\n");
+    }
+}
+
 int mm_connection_wait(mm_connection_t* connection)
 {
     int   modem_response = 0;
@@ -80,7 +446,23 @@ int mm_connection_wait(mm_connection_t* connection)
     struct tm ptm = { 0 };
 
     while (manager_running) {
-        modem_response = wait_for_modem_response(connection->proto.serial_context, 1);
+        if (connection->line_state == LINE_STATE_BUSY_OUT) {
+            mm_connection_probation(connection);
+            break;
+        }
+
+        if (connection->line_state != LINE_STATE_IN_SERVICE) {
+            mm_connection_reinit(connection);
+            break;
+        }
+
+        /* While idle, only wake up every second if the modem's carrier and shutdown can't wake the read. */
+        modem_response = modem_poll(&connection->modem, serial_read_wakes(connection->proto.serial_context) ? -1 : 1000);
+
+        if (connection->modem.state == MODEM_STATE_FAILED) {
+            mm_connection_out_of_service(connection, "modem not responding");
+            break;
+        }
 
         mm_time(connection->test_mode, &rawtime);
         localtime_r(&rawtime, &ptm);
@@ -96,6 +478,13 @@ int mm_connection_wait(mm_connection_t* connection)
             printf("%04d-%02d-%02d %2d:%02d:%02d: Connected!\n\n",
                 ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
 
+            connection->calls++;
+            connection->call_start = connection->proto.stats;
+            mm_lines_lock();
+            connection->in_call = 1;
+            mm_connection_hourly_decay(rawtime);
+            line_hourly_calls[ptm.tm_hour] += 1;
+            mm_lines_unlock();
             proto_connect(&connection->proto);
             break;
         case MODEM_RSP_NO_CARRIER:
@@ -103,14 +492,23 @@ int mm_connection_wait(mm_connection_t* connection)
             printf("%04d-%02d-%02d %2d:%02d:%02d: Carrier lost.\n\n",
                 ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
 
+            continue;
+        case MODEM_RSP_CALLER_ID:
+            printf("%04d-%02d-%02d %2d:%02d:%02d: Caller ID: %s\n\n",
+                ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
+                connection->modem.caller_id);
+
+            /* Use the time until the call is answered. */
+            if (connection->caller_id_fn != NULL) {
+                connection->caller_id_fn(connection->caller_id_arg, connection->modem.caller_id);
+            }
             continue;
         case MODEM_RSP_NULL:
             break;
         case MODEM_RSP_READ_ERROR:
-            manager_running = 0;
-            printf("%04d-%02d-%02d %2d:%02d:%02d: Error communicating with modem, shutting down.\n\n",
-                ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec);
-                break;
+            /* Only this line is affected, the others keep answering calls. */
+            mm_connection_out_of_service(connection, "error communicating with modem");
+            break;
         default:
             printf("%04d-%02d-%02d %2d:%02d:%02d: Unhandled modem response = %d (%s)\n\n",
                 ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
@@ -123,10 +521,51 @@ int mm_connection_wait(mm_connection_t* connection)
     return (connection->proto.connected);
 }
 
+/* Print the state of each line. */
+void mm_connection_status(mm_connection_t* connections[], int count, FILE* stream) {
+    static const char* line_state_str[] = { "In service", "Out of service", "Re-initializing", "Busied out" };
+    int in_service = 0;
+
+    fprintf(stream, "Line  State            Calls  Failures  Busy-outs  Errors  Device\n");
+
+    for (int i = 0; i < count; i++) {
+        mm_connection_t* connection = connections[i];
+        uint8_t line_state;
+        uint8_t in_call;
+        const char* state;
+        uint32_t packets;
+        uint32_t error_pct = mm_connection_error_pct(connection, &packets);
+
+        mm_lines_lock();
+        line_state = connection->line_state;
+        in_call = connection->in_call;
+        mm_lines_unlock();
+
+        state = line_state_str[line_state];
+        if (line_state == LINE_STATE_IN_SERVICE) {
+            in_service++;
+
+            if (in_call) {
+                state = "Connected";
+            }
+        }
+
+        fprintf(stream, "%4d  %-15s  %5u  %8u  %9u  %5u%%  %s\n", connection->line, state,
+            connection->calls, connection->failures, connection->busy_outs, error_pct, connection->modem_dev);
+    }
+
+    fprintf(stream, "%d of %d lines in service.\n", in_service, count);
+}
+
+/* The log, capture and UDP streams are shared by all lines, and owned by line 0. */
 int mm_connection_close(mm_connection_t* connection) {
     close_serial(connection->proto.serial_context);
     connection->proto.serial_context = NULL;
 
+    if (connection->line != 0) {
+        return (0);
+    }
+
     if (connection->bytestream) {
         fclose(connection->bytestream);
     }
@@ -145,3 +584,132 @@ int mm_connection_close(mm_connection_t* connection) {
 
     return (0);
 }
+
+/* Each line runs its sessions in a thread of its own. */
+typedef struct mm_line_thread {
+#ifdef _WIN32
+    HANDLE handle;
+#else  /* ifdef _WIN32 */
+    pthread_t handle;
+#endif /* _WIN32 */
+    int (*fn)(void* arg);
+    void* arg;
+} mm_line_thread_t;
+
+#ifdef _WIN32
+static unsigned __stdcall mm_line_thread_main(void* arg) {
+    mm_line_thread_t* thread = (mm_line_thread_t*)arg;
+
+    return (unsigned)thread->fn(thread->arg);
+}
+#else  /* ifdef _WIN32 */
+static void* mm_line_thread_main(void* arg) {
+    mm_line_thread_t* thread = (mm_line_thread_t*)arg;
+
+    thread->fn(thread->arg);
+    return NULL;
+}
+#endif /* _WIN32 */
+
+void* mm_line_thread_start(int (*fn)(void* arg), void* arg) {
+    mm_line_thread_t* thread = (mm_line_thread_t*)calloc(1, sizeof(mm_line_thread_t));
+
+    if (thread == NULL) {
+        return NULL;
+    }
+
+    thread->fn = fn;
+    thread->arg = arg;
+
+#ifdef _WIN32
+    thread->handle = (HANDLE)_beginthreadex(NULL, 0, mm_line_thread_main, thread, 0, NULL);
+    if (thread->handle == 0) {
+#else  /* ifdef _WIN32 */
+    if (pthread_create(&thread->handle, NULL, mm_line_thread_main, thread) != 0) {
+#endif /* _WIN32 */
+        fprintf(stderr, "%s: Error creating thread.\n", __func__);
+        free(thread);
+        return NULL;
+    }
+
+    return thread;
+}
+
+void mm_line_thread_join(void* line_thread) {
+    mm_line_thread_t* thread = (mm_line_thread_t*)line_thread;
+
+    if (thread == NULL) return;
+
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else  /* ifdef _WIN32 */
+    pthread_join(thread->handle, NULL);
+#endif /* _WIN32 */
+    free(thread);
+}
+
+/*
+ * Serializes access to resources shared between lines, such as the caches
+ * and the terminal state.  Never held across I/O.  The card authorization
+ * service client has its own lock, as its calls block on the network, and
+ * so does the terminal state, as it is held while the state is written to
+ * the database so that the writes of a terminal's state stay in order.
+ */
+#ifdef _WIN32
+static SRWLOCK mm_line_lock = SRWLOCK_INIT;
+static SRWLOCK mm_auth_lock_ = SRWLOCK_INIT;
+static SRWLOCK mm_termstate_lock_ = SRWLOCK_INIT;
+
+void mm_lines_lock(void) {
+    AcquireSRWLockExclusive(&mm_line_lock);
+}
+
+void mm_lines_unlock(void) {
+    ReleaseSRWLockExclusive(&mm_line_lock);
+}
+
+void mm_auth_lock(void) {
+    AcquireSRWLockExclusive(&mm_auth_lock_);
+}
+
+void mm_auth_unlock(void) {
+    ReleaseSRWLockExclusive(&mm_auth_lock_);
+}
+
+void mm_termstate_lock(void) {
+    AcquireSRWLockExclusive(&mm_termstate_lock_);
+}
+
+void mm_termstate_unlock(void) {
+    ReleaseSRWLockExclusive(&mm_termstate_lock_);
+}
+#else  /* ifdef _WIN32 */
+static pthread_mutex_t mm_line_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t mm_auth_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t mm_termstate_lock_ = PTHREAD_MUTEX_INITIALIZER;
+
+void mm_lines_lock(void) {
+    pthread_mutex_lock(&mm_line_lock);
+}
+
+void mm_lines_unlock(void) {
+    pthread_mutex_unlock(&mm_line_lock);
+}
+
+void mm_auth_lock(void) {
+    pthread_mutex_lock(&mm_auth_lock_);
+}
+
+void mm_auth_unlock(void) {
+    pthread_mutex_unlock(&mm_auth_lock_);
+}
+
+void mm_termstate_lock(void) {
+    pthread_mutex_lock(&mm_termstate_lock_);
+}
+
+void mm_termstate_unlock(void) {
+    pthread_mutex_unlock(&mm_termstate_lock_);
+}
+#endif /* _WIN32 */
@@ -0,0 +1,177 @@
+/*
+ * Download ordering tests for mm_manager.
+ *
+ * Checks the order tables are downloaded in, mandatory tables first and
+ * DLOG_MT_END_DATA last, and which tables are sent when a download is
+ * resumed or its download budget (-B) is used.  Returns the number of
+ * failed tests.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mm_manager.h"
+
+/* Tables of a terminal, with DLOG_MT_END_DATA not last, as in the table lists. */
+static const uint8_t test_table_list[] = {
+    DLOG_MT_NCC_TERM_PARAMS,
+    DLOG_MT_ADVERT_PROMPTS,
+    DLOG_MT_CARD_TABLE_EXP,
+    DLOG_MT_END_DATA,
+    DLOG_MT_USER_IF_PARMS,
+    DLOG_MT_COIN_VAL_TABLE,
+    DLOG_MT_REP_DIAL_LIST,
+    DLOG_MT_RATE_TABLE,
+    0
+};
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/* A terminal type of the model, 0 if there is none. */
+static uint8_t test_terminal_type(uint8_t model) {
+    for (int terminal_type = 1; terminal_type <= 60; terminal_type++) {
+        if (term_type_to_model((uint8_t)terminal_type) == model) return (uint8_t)terminal_type;
+    }
+
+    return 0;
+}
+
+/* Position of table_id in order, -1 if it is not there. */
+static int test_position(const uint8_t *order, uint8_t table_id) {
+    for (int i = 0; order[i] != 0; i++) {
+        if (order[i] == table_id) return i;
+    }
+
+    return -1;
+}
+
+/* Mandatory tables come first, in list order, then the optional ones, then DLOG_MT_END_DATA. */
+static void test_order(void) {
+    uint8_t order[256];
+    uint8_t terminal_type = test_terminal_type(TERM_MULTIPAY);
+    int     count;
+    int     optional = 0;
+
+    CHECK(terminal_type != 0);
+
+    count = mm_table_download_order(test_table_list, terminal_type, 0, order);
+    CHECK(count == (int)sizeof(test_table_list) - 1);
+    CHECK(order[count] == 0);
+    CHECK(order[count - 1] == DLOG_MT_END_DATA);
+
+    for (int i = 0; i < count - 1; i++) {
+        if (!mm_table_is_mandatory(order[i])) {
+            optional = 1;
+        } else {
+            CHECK(!optional);
+        }
+    }
+    CHECK(optional);
+    CHECK(test_position(order, DLOG_MT_NCC_TERM_PARAMS) < test_position(order, DLOG_MT_CARD_TABLE_EXP));
+    CHECK(test_position(order, DLOG_MT_ADVERT_PROMPTS) < test_position(order, DLOG_MT_USER_IF_PARMS));
+}
+
+/* With -s, only the mandatory tables and DLOG_MT_END_DATA are sent. */
+static void test_order_minimal(void) {
+    uint8_t order[256];
+    int     count = mm_table_download_order(test_table_list, test_terminal_type(TERM_MULTIPAY), 1, order);
+
+    CHECK(count == 5);
+    CHECK(order[count - 1] == DLOG_MT_END_DATA);
+    for (int i = 0; i < count; i++) {
+        CHECK(mm_table_is_mandatory(order[i]));
+    }
+}
+
+/* Tables that don't apply to the model are left out. */
+static void test_order_model(void) {
+    uint8_t order[256];
+    uint8_t coin = test_terminal_type(TERM_COIN_BASIC);
+    uint8_t card = test_terminal_type(TERM_CARD);
+
+    CHECK((coin != 0) && (card != 0));
+
+    mm_table_download_order(test_table_list, coin, 0, order);
+    CHECK(test_position(order, DLOG_MT_CARD_TABLE_EXP) < 0);
+    CHECK(test_position(order, DLOG_MT_COIN_VAL_TABLE) >= 0);
+
+    mm_table_download_order(test_table_list, card, 0, order);
+    CHECK(test_position(order, DLOG_MT_CARD_TABLE_EXP) >= 0);
+    CHECK(test_position(order, DLOG_MT_COIN_VAL_TABLE) < 0);
+}
+
+/* Once the budget is used, only mandatory tables and DLOG_MT_END_DATA are sent. */
+static void test_budget(void) {
+    uint8_t order[256];
+    uint8_t acked[32] = { 0 };
+    int     count = mm_table_download_order(test_table_list, test_terminal_type(TERM_MULTIPAY), 0, order);
+    int     sent = 0;
+    int     deferred = 0;
+
+    for (int i = 0; i < count; i++) {
+        int action = mm_table_download_action(order[i], 0, acked, 1, 1);
+
+        if (mm_table_is_mandatory(order[i])) {
+            CHECK(action == DL_TABLE_SEND);
+        } else {
+            CHECK(action == DL_TABLE_DEFERRED);
+        }
+
+        if (action == DL_TABLE_SEND) sent++;
+        if (action == DL_TABLE_DEFERRED) deferred++;
+    }
+
+    CHECK(sent == 5);
+    CHECK(deferred == count - 5);
+    CHECK(mm_table_download_action(DLOG_MT_END_DATA, 0, acked, 1, 1) == DL_TABLE_SEND);
+
+    /* Before the budget is used, every table is sent. */
+    for (int i = 0; i < count; i++) {
+        CHECK(mm_table_download_action(order[i], 0, acked, 1, 0) == DL_TABLE_SEND);
+    }
+}
+
+/* A resumed download skips the tables ACKed and not changed since, and sends the rest. */
+static void test_resume(void) {
+    uint8_t acked[32] = { 0 };
+
+    acked[DLOG_MT_NCC_TERM_PARAMS / 8] |= (1 << (DLOG_MT_NCC_TERM_PARAMS % 8));
+    acked[DLOG_MT_ADVERT_PROMPTS / 8] |= (1 << (DLOG_MT_ADVERT_PROMPTS % 8));
+
+    CHECK(mm_table_download_action(DLOG_MT_NCC_TERM_PARAMS, 1, acked, 0, 0) == DL_TABLE_ACKED);
+    CHECK(mm_table_download_action(DLOG_MT_ADVERT_PROMPTS, 1, acked, 0, 1) == DL_TABLE_ACKED);
+    CHECK(mm_table_download_action(DLOG_MT_CARD_TABLE_EXP, 1, acked, 0, 0) == DL_TABLE_SEND);
+    CHECK(mm_table_download_action(DLOG_MT_REP_DIAL_LIST, 1, acked, 0, 1) == DL_TABLE_DEFERRED);
+
+    /* Changed since it was ACKed, or not resuming: sent again. */
+    CHECK(mm_table_download_action(DLOG_MT_NCC_TERM_PARAMS, 1, acked, 1, 0) == DL_TABLE_SEND);
+    CHECK(mm_table_download_action(DLOG_MT_NCC_TERM_PARAMS, 0, acked, 0, 0) == DL_TABLE_SEND);
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+
+    test_order();
+    test_order_minimal();
+    test_order_model();
+    test_budget();
+    test_resume();
+
+    printf("mm_download_test: %d failures.\n", failures);
+
+    return failures;
+}
@@ -64,7 +64,7 @@ int main(int argc, char *argv[]) {
     FILE *instream;
     dlog_mt_lcd_table_t *lcd_table;
     uint8_t* load_buffer;
-    uint8_t c = 0;
+    uint8_t nxx_flags[MAX_NPA];
     int     nxx;
     uint8_t npa_char[2] = { 0 };
     uint8_t check_digit;
@@ -149,11 +149,22 @@ int main(int argc, char *argv[]) {
     npa +=  (npa_char[0] & 0x0f) * 10;
     npa += ((npa_char[1] & 0xf0) >> 4);
 
+    /* Unpack the flags of all NXX at once. */
+    switch (size + 1) {
+    case LCD_TABLE_LEN:
+        mm_lcd_unpack(((dlog_mt_lcd_table_t *)lcd_table)->lcd, 8, nxx_flags);
+        break;
+    case COMPRESSED_LCD_TABLE_LEN:
+        mm_lcd_unpack(((dlog_mt_compressed_lcd_table_t *)lcd_table)->lcd, 4, nxx_flags);
+        break;
+    case DOUBLE_COMPRESSED_LCD_TABLE_LEN:
+    default:
+        mm_lcd_unpack(((dlog_mt_npa_nxx_table_t *)lcd_table)->lcd, 2, nxx_flags);
+        break;
+    }
+
     for (nxx = 200; nxx <= 999; nxx++) {
-        uint8_t flag_mask = 0;
-        uint8_t flag_shift;
         uint8_t flags;
-        uint8_t twobit_group;
 
         if (nxx % 200 == 0) {
             printf("\n+---------------------------------------------------------------------+\n" \
@@ -165,41 +176,7 @@ int main(int argc, char *argv[]) {
             printf("\n| %03d-%02dx |", npa, nxx / 10);
         }
 
-        switch(size + 1) {
-        case LCD_TABLE_LEN:
-            c = ((dlog_mt_lcd_table_t *)lcd_table)->lcd[nxx - 200];
-            flag_shift = 0;
-            flag_mask = 0xFF;
-            break;
-        case COMPRESSED_LCD_TABLE_LEN:
-            if (nxx % 2 == 0) {
-                c = ((dlog_mt_compressed_lcd_table_t *)lcd_table)->lcd[(nxx - 200) / 2];
-                flag_mask  = 0xF0;
-                flag_shift = 4;
-            } else {
-                flag_mask = 0x0F;
-                flag_shift = 0;
-            }
-            break;
-        case DOUBLE_COMPRESSED_LCD_TABLE_LEN:
-            twobit_group = nxx % 4;
-
-            if (twobit_group == 0) {
-                c = ((dlog_mt_npa_nxx_table_t *)lcd_table)->lcd[(nxx - 200) / 4];
-            }
-
-            flag_mask  = 0xc0 >> (twobit_group * 2);
-            flag_shift = 6 - (twobit_group * 2);
-            break;
-        default:
-            printf("Invalid LCD table!\n");
-            if (lcd_table != NULL) {
-                free(lcd_table);
-            }
-            return -1;
-        }
-
-        flags = (c & flag_mask) >> flag_shift;
+        flags = nxx_flags[nxx - 200];
 
         if (argc < 3) {
             if (size + 1 == DOUBLE_COMPRESSED_LCD_TABLE_LEN) {
@@ -0,0 +1,174 @@
+/*
+ * LCD table packing for mm_manager.
+ *
+ * LCD tables hold a flag for each NXX 200-999 of an NPA, packed 8 bits
+ * (uncompressed), 4 bits (compressed) or 2 bits (double-compressed) per
+ * NXX, the first NXX in the most significant bits.  These convert a whole
+ * table between its packed form and a flag per byte, with SSE2 where it is
+ * available and a byte at a time otherwise.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+# define LCD_SSE2
+# include <emmintrin.h>
+#endif
+
+#include "mm_manager.h"
+
+/* Unpack the scalar tail of a table, from NXX first. */
+static void lcd_unpack_scalar(const uint8_t *packed, int bits, uint8_t *flags, int first) {
+    int     per_byte = 8 / bits;
+    uint8_t mask = (uint8_t)((1 << bits) - 1);
+
+    for (int nxx = first; nxx < MAX_NPA; nxx++) {
+        int shift = (per_byte - 1 - (nxx % per_byte)) * bits;
+
+        flags[nxx] = (packed[nxx / per_byte] >> shift) & mask;
+    }
+}
+
+static void lcd_pack_scalar(const uint8_t *flags, int bits, uint8_t *packed, int first) {
+    int     per_byte = 8 / bits;
+    uint8_t mask = (uint8_t)((1 << bits) - 1);
+
+    for (int nxx = first; nxx < MAX_NPA; nxx++) {
+        int shift = (per_byte - 1 - (nxx % per_byte)) * bits;
+
+        if (nxx % per_byte == 0) packed[nxx / per_byte] = 0;
+        packed[nxx / per_byte] |= (uint8_t)((flags[nxx] & mask) << shift);
+    }
+}
+
+#ifdef LCD_SSE2
+/* 16 packed bytes to 32 flags. */
+static int lcd_unpack4_sse2(const uint8_t *packed, uint8_t *flags) {
+    const __m128i low_nibbles = _mm_set1_epi8(0x0f);
+    int nxx;
+
+    for (nxx = 0; nxx + 32 <= MAX_NPA; nxx += 32) {
+        __m128i b  = _mm_loadu_si128((const __m128i *)&packed[nxx / 2]);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(b, 4), low_nibbles);
+        __m128i lo = _mm_and_si128(b, low_nibbles);
+
+        _mm_storeu_si128((__m128i *)&flags[nxx], _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)&flags[nxx + 16], _mm_unpackhi_epi8(hi, lo));
+    }
+
+    return nxx;
+}
+
+/* 16 packed bytes to 64 flags. */
+static int lcd_unpack2_sse2(const uint8_t *packed, uint8_t *flags) {
+    const __m128i two_bits = _mm_set1_epi8(0x03);
+    int nxx;
+
+    for (nxx = 0; nxx + 64 <= MAX_NPA; nxx += 64) {
+        __m128i b   = _mm_loadu_si128((const __m128i *)&packed[nxx / 4]);
+        __m128i e0  = _mm_and_si128(_mm_srli_epi16(b, 6), two_bits);
+        __m128i e1  = _mm_and_si128(_mm_srli_epi16(b, 4), two_bits);
+        __m128i e2  = _mm_and_si128(_mm_srli_epi16(b, 2), two_bits);
+        __m128i e3  = _mm_and_si128(b, two_bits);
+        __m128i e01 = _mm_unpacklo_epi8(e0, e1);
+        __m128i e23 = _mm_unpacklo_epi8(e2, e3);
+
+        _mm_storeu_si128((__m128i *)&flags[nxx], _mm_unpacklo_epi16(e01, e23));
+        _mm_storeu_si128((__m128i *)&flags[nxx + 16], _mm_unpackhi_epi16(e01, e23));
+
+        e01 = _mm_unpackhi_epi8(e0, e1);
+        e23 = _mm_unpackhi_epi8(e2, e3);
+
+        _mm_storeu_si128((__m128i *)&flags[nxx + 32], _mm_unpacklo_epi16(e01, e23));
+        _mm_storeu_si128((__m128i *)&flags[nxx + 48], _mm_unpackhi_epi16(e01, e23));
+    }
+
+    return nxx;
+}
+
+/* 32 flags to 16 packed bytes: each 16-bit lane holds two flags. */
+static int lcd_pack4_sse2(const uint8_t *flags, uint8_t *packed) {
+    const __m128i nibble = _mm_set1_epi16(0x000f);
+    int nxx;
+
+    for (nxx = 0; nxx + 32 <= MAX_NPA; nxx += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&flags[nxx]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&flags[nxx + 16]);
+
+        a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, nibble), 4), _mm_and_si128(_mm_srli_epi16(a, 8), nibble));
+        b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, nibble), 4), _mm_and_si128(_mm_srli_epi16(b, 8), nibble));
+
+        _mm_storeu_si128((__m128i *)&packed[nxx / 2], _mm_packus_epi16(a, b));
+    }
+
+    return nxx;
+}
+
+/* Four flags of a 32-bit lane to one byte, in the low byte of the lane. */
+static __m128i lcd_pack2_lane(__m128i w) {
+    const __m128i two_bits = _mm_set1_epi32(0x03);
+
+    return _mm_or_si128(
+        _mm_or_si128(_mm_slli_epi32(_mm_and_si128(w, two_bits), 6),
+                     _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(w, 8), two_bits), 4)),
+        _mm_or_si128(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(w, 16), two_bits), 2),
+                     _mm_and_si128(_mm_srli_epi32(w, 24), two_bits)));
+}
+
+/* 64 flags to 16 packed bytes. */
+static int lcd_pack2_sse2(const uint8_t *flags, uint8_t *packed) {
+    int nxx;
+
+    for (nxx = 0; nxx + 64 <= MAX_NPA; nxx += 64) {
+        __m128i a = lcd_pack2_lane(_mm_loadu_si128((const __m128i *)&flags[nxx]));
+        __m128i b = lcd_pack2_lane(_mm_loadu_si128((const __m128i *)&flags[nxx + 16]));
+        __m128i c = lcd_pack2_lane(_mm_loadu_si128((const __m128i *)&flags[nxx + 32]));
+        __m128i d = lcd_pack2_lane(_mm_loadu_si128((const __m128i *)&flags[nxx + 48]));
+
+        _mm_storeu_si128((__m128i *)&packed[nxx / 4],
+                         _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+
+    return nxx;
+}
+#endif /* LCD_SSE2 */
+
+/*
+ * Unpack the MAX_NPA flags of an LCD table packed bits (2, 4 or 8) per
+ * NXX into a flag per byte.
+ */
+void mm_lcd_unpack(const uint8_t *packed, int bits, uint8_t *flags) {
+    int nxx = 0;
+
+    if (bits == 8) {
+        memcpy(flags, packed, MAX_NPA);
+        return;
+    }
+
+#ifdef LCD_SSE2
+    nxx = (bits == 4) ? lcd_unpack4_sse2(packed, flags) : lcd_unpack2_sse2(packed, flags);
+#endif /* LCD_SSE2 */
+
+    lcd_unpack_scalar(packed, bits, flags, nxx);
+}
+
+/* Pack the MAX_NPA flags, one per byte, into an LCD table of bits (2, 4 or 8) per NXX. */
+void mm_lcd_pack(const uint8_t *flags, int bits, uint8_t *packed) {
+    int nxx = 0;
+
+    if (bits == 8) {
+        memcpy(packed, flags, MAX_NPA);
+        return;
+    }
+
+#ifdef LCD_SSE2
+    nxx = (bits == 4) ? lcd_pack4_sse2(flags, packed) : lcd_pack2_sse2(flags, packed);
+#endif /* LCD_SSE2 */
+
+    lcd_pack_scalar(flags, bits, packed, nxx);
+}
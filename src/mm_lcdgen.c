@@ -0,0 +1,617 @@
+/*
+ * LCD table compiler for the Nortel Millennium Payphone
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ *
+ * Generates the LCD (Local Call Determination) tables of a whole fleet of
+ * terminals from the NANPA and CNAC NPA-NXX assignment files, in the same
+ * way as generate_lcd.py does for one terminal:
+ *
+ * USA: https://nationalnanpa.com/nanp1/allutlzd.zip (allutlzd.txt)
+ * Canada: http://www.cnac.ca/data/COCodeStatus_ALL.zip (COCodeStatus_ALL.csv)
+ *
+ * The assignment files are read once, line by line, into an index of the
+ * rate center of every assigned NPA-NXX.  For each terminal, listed with
+ * its NPA, state and local rate centers in a terminal file, an NXX is local
+ * if it is in one of the terminal's rate centers, toll if it is assigned to
+ * another, and invalid if it is not assigned.  Each NPA with an NXX in the
+ * terminal's rate centers gets an LCD table, starting with the terminal's
+ * own NPA, in all three formats:
+ *
+ * MTR 1.7: Uncompressed LCD tables 0x4a-0x51, 0x5a, 0x5b (10 NPAs.)
+ * MTR 1.9: Compressed LCD tables 0x65-0x6b (7 NPAs.)
+ * MTR 1.20 / 2.x: Double-compressed LCD tables 0x88-0x95, 0xa0, 0xa1 (16 NPAs.)
+ *
+ * The tables are written to the terminal-specific directory of each
+ * terminal, and terminals are compiled by a thread per core.
+ *
+ * The terminal file has a line per terminal, the state may be empty to
+ * match rate centers in any state or province:
+ *
+ * # terminal_id,npa,state,rate center[,rate center...]
+ * 4085551212,408,CA,SNJS NORTH,SNJS WEST,SNJS SOUTH,CAMPBELL,SARATOGA,SUNNYVALE,LOS GATOS
+ * 6135551212,613,,Ottawa-Hull
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+# include <getopt.h>
+# include <unistd.h>
+# include <libgen.h>
+#else  /* ifndef _WIN32 */
+# include <windows.h>
+# include "third-party/getopt.h"
+#endif /* ifndef _WIN32 */
+
+#include "mm_manager.h"
+
+#define NPA_FIRST           (200)
+#define NPA_COUNT           (800)       /* NPA and NXX 200-999 */
+#define LINE_LEN            (1024)
+#define MAX_FIELDS          (32)
+#define MAX_RATE_CENTERS    (32)        /* Per terminal */
+#define RATE_CENTER_LEN     (64)
+#define STATE_LEN           (8)
+#define RATE_CENTER_HASH    (4096)
+
+#define LCD_LOCAL           (0)
+#define LCD_TOLL            (2)         /* Intra-LATA toll */
+#define LCD_INVALID         (3)
+
+#define NO_RATE_CENTER      (-1)
+
+typedef struct rate_center {
+    char state[STATE_LEN];
+    char name[RATE_CENTER_LEN];
+    int next;                           /* Next rate center in the hash bucket. */
+} rate_center_t;
+
+/* Rate center of every assigned NPA-NXX. */
+typedef struct lcd_index {
+    int32_t *npa_nxx;                   /* [NPA_COUNT][NPA_COUNT], NO_RATE_CENTER if not assigned. */
+    rate_center_t *rate_centers;
+    int count;
+    int allocated;
+    int hash[RATE_CENTER_HASH];
+} lcd_index_t;
+
+typedef struct lcd_terminal {
+    char terminal_id[16];
+    int npa;
+    char state[STATE_LEN];
+    char rate_centers[MAX_RATE_CENTERS][RATE_CENTER_LEN];
+    int rate_center_count;
+    int npas[NPA_COUNT];                /* NPAs with tables, the terminal's own first. */
+    int npa_count;
+    int status;
+} lcd_terminal_t;
+
+/* LCD table formats, by MTR. */
+typedef struct lcd_format {
+    const char *name;
+    const uint8_t *table_ids;
+    int count;
+    size_t len;                         /* Of the table file, without the table ID. */
+    int bits;                           /* Bits per NXX. */
+} lcd_format_t;
+
+static const uint8_t lcd_table_ids[] = {
+    DLOG_MT_LCD_TABLE_1, DLOG_MT_LCD_TABLE_2, DLOG_MT_LCD_TABLE_3, DLOG_MT_LCD_TABLE_4, DLOG_MT_LCD_TABLE_5,
+    DLOG_MT_LCD_TABLE_6, DLOG_MT_LCD_TABLE_7, DLOG_MT_LCD_TABLE_8, DLOG_MT_LCD_TABLE_9, DLOG_MT_LCD_TABLE_10
+};
+
+static const uint8_t comp_lcd_table_ids[] = {
+    DLOG_MT_COMP_LCD_TABLE_1, DLOG_MT_COMP_LCD_TABLE_2, DLOG_MT_COMP_LCD_TABLE_3, DLOG_MT_COMP_LCD_TABLE_4,
+    DLOG_MT_COMP_LCD_TABLE_5, DLOG_MT_COMP_LCD_TABLE_6, DLOG_MT_COMP_LCD_TABLE_7
+};
+
+static const uint8_t npa_nxx_table_ids[] = {
+    DLOG_MT_NPA_NXX_TABLE_1, DLOG_MT_NPA_NXX_TABLE_2, DLOG_MT_NPA_NXX_TABLE_3, DLOG_MT_NPA_NXX_TABLE_4,
+    DLOG_MT_NPA_NXX_TABLE_5, DLOG_MT_NPA_NXX_TABLE_6, DLOG_MT_NPA_NXX_TABLE_7, DLOG_MT_NPA_NXX_TABLE_8,
+    DLOG_MT_NPA_NXX_TABLE_9, DLOG_MT_NPA_NXX_TABLE_10, DLOG_MT_NPA_NXX_TABLE_11, DLOG_MT_NPA_NXX_TABLE_12,
+    DLOG_MT_NPA_NXX_TABLE_13, DLOG_MT_NPA_NXX_TABLE_14, DLOG_MT_NPA_NXX_TABLE_15, DLOG_MT_NPA_NXX_TABLE_16
+};
+
+static const lcd_format_t lcd_formats[] = {
+    { "MTR 1.20/2.x (Double-Compressed)", npa_nxx_table_ids,  sizeof(npa_nxx_table_ids),  sizeof(dlog_mt_npa_nxx_table_t) - 1,        2 },
+    { "MTR 1.9 (Compressed)",             comp_lcd_table_ids, sizeof(comp_lcd_table_ids), sizeof(dlog_mt_compressed_lcd_table_t) - 1, 4 },
+    { "MTR 1.7 (Uncompressed)",           lcd_table_ids,      sizeof(lcd_table_ids),      sizeof(dlog_mt_lcd_table_t) - 1,            8 },
+};
+
+/* Index of the rate center, added if it is not in the index.  Returns -ENOMEM if it can't be added. */
+static int rate_center_id(lcd_index_t *index, const char *state, const char *name) {
+    char key[STATE_LEN + RATE_CENTER_LEN];
+    int  bucket;
+    int  id;
+
+    snprintf(key, sizeof(key), "%s\t%s", state, name);
+    bucket = (int)(mm_fnv1a((const uint8_t *)key, strlen(key)) % RATE_CENTER_HASH);
+
+    for (id = index->hash[bucket]; id != NO_RATE_CENTER; id = index->rate_centers[id].next) {
+        if ((strcmp(index->rate_centers[id].state, state) == 0) && (strcmp(index->rate_centers[id].name, name) == 0)) {
+            return id;
+        }
+    }
+
+    if (index->count == index->allocated) {
+        int allocated = index->allocated ? index->allocated * 2 : 1024;
+        rate_center_t *grown = (rate_center_t *)realloc(index->rate_centers, allocated * sizeof(rate_center_t));
+
+        if (grown == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, allocated * sizeof(rate_center_t));
+            return -ENOMEM;
+        }
+        index->rate_centers = grown;
+        index->allocated = allocated;
+    }
+
+    id = index->count++;
+    snprintf(index->rate_centers[id].state, sizeof(index->rate_centers[id].state), "%s", state);
+    snprintf(index->rate_centers[id].name, sizeof(index->rate_centers[id].name), "%s", name);
+    index->rate_centers[id].next = index->hash[bucket];
+    index->hash[bucket] = id;
+
+    return id;
+}
+
+/* Split a line into fields at the separator, trimming spaces and quotes.  Returns the number of fields. */
+static int split_fields(char *line, char separator, char *fields[MAX_FIELDS]) {
+    int count = 0;
+    char *p = line;
+
+    while (count < MAX_FIELDS) {
+        char *end;
+        char *next;
+        int quoted = 0;
+
+        while (*p == ' ') p++;
+        if (*p == '"') {
+            quoted = 1;
+            p++;
+        }
+
+        fields[count++] = p;
+
+        for (end = p; *end != '\0'; end++) {
+            if (quoted && (*end == '"')) {
+                quoted = 0;
+                *end = ' ';
+            } else if (!quoted && ((*end == separator) || (*end == '\r') || (*end == '\n'))) {
+                break;
+            }
+        }
+
+        separator = (*end == separator) ? separator : '\0';
+        next = end + 1;
+        *end = '\0';
+
+        while ((end > p) && (end[-1] == ' ')) *--end = '\0';
+
+        if (separator == '\0') break;
+        p = next;
+    }
+
+    return count;
+}
+
+static int find_field(char *fields[], int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(fields[i], name) == 0) return i;
+    }
+
+    return -1;
+}
+
+static int parse_npa(const char *str) {
+    int npa = atoi(str);
+
+    return ((npa >= NPA_FIRST) && (npa < NPA_FIRST + NPA_COUNT)) ? npa : -1;
+}
+
+/*
+ * Add the assigned NPA-NXX of a NANPA (allutlzd.txt, tab-separated) or CNAC
+ * (COCodeStatus_ALL.csv) assignment file to the index, told apart by its
+ * header.
+ */
+static int load_assignments(lcd_index_t *index, const char *filename) {
+    FILE *instream;
+    char  line[LINE_LEN];
+    char *fields[MAX_FIELDS];
+    char  separator;
+    int   npa_nxx_col, npa_col, nxx_col, status_col, rate_center_col, state_col;
+    int   count;
+    int   assigned = 0;
+
+    if ((instream = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "Error: Cannot read NPA-NXX data file %s.\n", filename);
+        return -ENOENT;
+    }
+
+    if (fgets(line, sizeof(line), instream) == NULL) {
+        fprintf(stderr, "Error: %s is empty.\n", filename);
+        fclose(instream);
+        return -EIO;
+    }
+
+    separator = (strchr(line, '\t') != NULL) ? '\t' : ',';
+    count = split_fields(line, separator, fields);
+
+    npa_nxx_col = find_field(fields, count, "NPA-NXX");
+    npa_col = find_field(fields, count, "NPA");
+    nxx_col = find_field(fields, count, "CO Code (NXX)");
+    status_col = find_field(fields, count, (npa_nxx_col >= 0) ? "Use" : "Status");
+    rate_center_col = find_field(fields, count, (npa_nxx_col >= 0) ? "RateCenter" : "Exchange Area");
+    state_col = find_field(fields, count, (npa_nxx_col >= 0) ? "State" : "Province");
+
+    if (((npa_nxx_col < 0) && ((npa_col < 0) || (nxx_col < 0))) || (status_col < 0) || (rate_center_col < 0)) {
+        fprintf(stderr, "Error: %s is not a NANPA or CNAC NPA-NXX data file.\n", filename);
+        fclose(instream);
+        return -EINVAL;
+    }
+
+    while (fgets(line, sizeof(line), instream) != NULL) {
+        int npa, nxx, id;
+        const char *status;
+
+        count = split_fields(line, separator, fields);
+        if ((count <= status_col) || (count <= rate_center_col)) continue;
+
+        if (npa_nxx_col >= 0) {
+            if (count <= npa_nxx_col) continue;
+            npa = parse_npa(fields[npa_nxx_col]);
+            nxx = (strlen(fields[npa_nxx_col]) == 7) ? parse_npa(&fields[npa_nxx_col][4]) : -1;
+        } else {
+            if ((count <= npa_col) || (count <= nxx_col)) continue;
+            npa = parse_npa(fields[npa_col]);
+            nxx = parse_npa(fields[nxx_col]);
+        }
+
+        if ((npa < 0) || (nxx < 0)) continue;
+
+        status = fields[status_col];
+        if ((strcmp(status, "AS") != 0) && (strcmp(status, "In Service") != 0)) {
+            index->npa_nxx[(npa - NPA_FIRST) * NPA_COUNT + (nxx - NPA_FIRST)] = NO_RATE_CENTER;
+            continue;
+        }
+
+        id = rate_center_id(index, ((state_col >= 0) && (count > state_col)) ? fields[state_col] : "",
+                            fields[rate_center_col]);
+        if (id < 0) {
+            fclose(instream);
+            return id;
+        }
+
+        index->npa_nxx[(npa - NPA_FIRST) * NPA_COUNT + (nxx - NPA_FIRST)] = id;
+        assigned++;
+    }
+
+    fclose(instream);
+
+    printf("%s: %d assigned NPA-NXX.\n", filename, assigned);
+
+    return 0;
+}
+
+typedef struct lcd_fleet {
+    lcd_terminal_t *terminals;
+    int count;
+    int allocated;
+} lcd_fleet_t;
+
+static int load_terminals(lcd_fleet_t *fleet, const char *filename) {
+    FILE *instream;
+    char  line[LINE_LEN];
+    char *fields[MAX_FIELDS];
+    int   line_num = 0;
+
+    if ((instream = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "Error: Cannot read terminal file %s.\n", filename);
+        return -ENOENT;
+    }
+
+    while (fgets(line, sizeof(line), instream) != NULL) {
+        lcd_terminal_t *terminal;
+        int count;
+
+        line_num++;
+        if ((line[0] == '#') || (line[0] == '\r') || (line[0] == '\n')) continue;
+
+        count = split_fields(line, ',', fields);
+        if ((count < 4) || (strlen(fields[0]) != 10) || (parse_npa(fields[1]) < 0)) {
+            fprintf(stderr, "%s:%d: expected terminal_id,npa,state,rate center[,rate center...]\n", filename, line_num);
+            fclose(instream);
+            return -EINVAL;
+        }
+
+        if (fleet->count == fleet->allocated) {
+            int allocated = fleet->allocated ? fleet->allocated * 2 : 64;
+            lcd_terminal_t *grown = (lcd_terminal_t *)realloc(fleet->terminals, allocated * sizeof(lcd_terminal_t));
+
+            if (grown == NULL) {
+                fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, allocated * sizeof(lcd_terminal_t));
+                fclose(instream);
+                return -ENOMEM;
+            }
+            fleet->terminals = grown;
+            fleet->allocated = allocated;
+        }
+
+        terminal = &fleet->terminals[fleet->count++];
+        memset(terminal, 0, sizeof(lcd_terminal_t));
+        snprintf(terminal->terminal_id, sizeof(terminal->terminal_id), "%s", fields[0]);
+        terminal->npa = parse_npa(fields[1]);
+        snprintf(terminal->state, sizeof(terminal->state), "%s", fields[2]);
+
+        for (int i = 3; (i < count) && (terminal->rate_center_count < MAX_RATE_CENTERS); i++) {
+            snprintf(terminal->rate_centers[terminal->rate_center_count++], RATE_CENTER_LEN, "%s", fields[i]);
+        }
+    }
+
+    fclose(instream);
+
+    return 0;
+}
+
+/* Encode the flags of the NXX 200-999 of an NPA as an LCD table of the format, with its table ID. */
+static void encode_lcd_table(const lcd_format_t *format, uint8_t table_id, int npa, const uint8_t *flags, uint8_t *table) {
+    memset(table, 0, format->len + 1);
+    table[0] = table_id;
+
+    /* The NPA as BCD digits, followed by 0xe. */
+    table[1] = (uint8_t)(((npa / 100) << 4) | ((npa / 10) % 10));
+    table[2] = (uint8_t)(((npa % 10) << 4) | 0x0e);
+
+    if (format->bits == 8) {
+        mm_lcd_pack(flags, format->bits, ((dlog_mt_lcd_table_t *)table)->lcd);
+    } else {
+        mm_lcd_pack(flags, format->bits, &table[3]);
+    }
+}
+
+static int write_table(const char *dirname, const uint8_t *table, size_t len) {
+    char  fname[TABLE_PATH_MAX_LEN];
+    FILE *ostream;
+
+    if (snprintf(fname, sizeof(fname), "%s/mm_table_%02x.bin", dirname, table[0]) >= (int)sizeof(fname)) {
+        fprintf(stderr, "Path %s is too long.\n", dirname);
+        return -ENAMETOOLONG;
+    }
+
+    if ((ostream = fopen(fname, "wb")) == NULL) {
+        fprintf(stderr, "Error opening %s for write.\n", fname);
+        return -ENOENT;
+    }
+
+    if (fwrite(&table[1], len, 1, ostream) != 1) {
+        fprintf(stderr, "Error writing %s.\n", fname);
+        fclose(ostream);
+        return -EIO;
+    }
+
+    fclose(ostream);
+
+    return 0;
+}
+
+typedef struct lcd_job {
+    const lcd_index_t *index;
+    lcd_fleet_t *fleet;
+    const char *table_dir;
+} lcd_job_t;
+
+/*
+ * Generate the LCD tables of a terminal.  Returns 0, or -E2BIG if the
+ * terminal has more NPAs than fit in one of the formats; the tables that
+ * fit are still written.
+ */
+static int compile_terminal(const lcd_job_t *job, lcd_terminal_t *terminal) {
+    const lcd_index_t *index = job->index;
+    char     dirname[TABLE_PATH_MAX_LEN];
+    uint8_t *local;
+    uint8_t  flags[NPA_COUNT];
+    uint8_t  table[sizeof(dlog_mt_lcd_table_t)];
+    int      status = 0;
+    int      write_status;
+
+    local = (uint8_t *)calloc(1, index->count + 1);
+    if (local == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %d bytes.\n", __func__, index->count + 1);
+        return -ENOMEM;
+    }
+
+    /* Mark the terminal's local rate centers, in any state if it has none. */
+    for (int id = 0; id < index->count; id++) {
+        if ((terminal->state[0] != '\0') && (strcmp(index->rate_centers[id].state, terminal->state) != 0)) continue;
+
+        for (int i = 0; i < terminal->rate_center_count; i++) {
+            if (strcmp(index->rate_centers[id].name, terminal->rate_centers[i]) == 0) {
+                local[id] = 1;
+                break;
+            }
+        }
+    }
+
+    /* NPAs with an NXX in a local rate center, the terminal's own first. */
+    terminal->npa_count = 0;
+    terminal->npas[terminal->npa_count++] = terminal->npa;
+
+    for (int npa = 0; npa < NPA_COUNT; npa++) {
+        if (npa + NPA_FIRST == terminal->npa) continue;
+
+        for (int nxx = 0; nxx < NPA_COUNT; nxx++) {
+            int32_t id = index->npa_nxx[npa * NPA_COUNT + nxx];
+
+            if ((id != NO_RATE_CENTER) && local[id]) {
+                terminal->npas[terminal->npa_count++] = npa + NPA_FIRST;
+                break;
+            }
+        }
+    }
+
+    snprintf(dirname, sizeof(dirname), "%s/%s", job->table_dir, terminal->terminal_id);
+    if ((write_status = mm_make_directory(dirname)) != 0) {
+        free(local);
+        return write_status;
+    }
+
+    for (int i = 0; i < terminal->npa_count; i++) {
+        const int32_t *nxx_index = &index->npa_nxx[(terminal->npas[i] - NPA_FIRST) * NPA_COUNT];
+
+        for (int nxx = 0; nxx < NPA_COUNT; nxx++) {
+            if (nxx_index[nxx] == NO_RATE_CENTER) {
+                flags[nxx] = LCD_INVALID;
+            } else {
+                flags[nxx] = local[nxx_index[nxx]] ? LCD_LOCAL : LCD_TOLL;
+            }
+        }
+
+        for (size_t f = 0; f < sizeof(lcd_formats) / sizeof(lcd_formats[0]); f++) {
+            const lcd_format_t *format = &lcd_formats[f];
+
+            if (i >= format->count) {
+                status = -E2BIG;
+                continue;
+            }
+
+            encode_lcd_table(format, format->table_ids[i], terminal->npas[i], flags, table);
+            if ((write_status = write_table(dirname, table, format->len)) != 0) {
+                free(local);
+                return write_status;
+            }
+        }
+    }
+
+    free(local);
+
+    return status;
+}
+
+static void compile_one_terminal(void *arg, int index) {
+    const lcd_job_t *job = (const lcd_job_t *)arg;
+    lcd_terminal_t *terminal = &job->fleet->terminals[index];
+
+    terminal->status = compile_terminal(job, terminal);
+}
+
+static void mm_lcdgen_help(const char *name, FILE *stream) {
+    fprintf(stream, "usage: %s [-h] [-j <threads>] [-T <table_dir>] -t <terminals.csv> <allutlzd.txt|COCodeStatus_ALL.csv>...\n", name);
+    fprintf(stream,
+        "\t-t <terminals.csv> - terminals, one per line: terminal_id,npa,state,rate center[,rate center...]\n" \
+        "\t-T <table_dir> - write each terminal's tables to <table_dir>/<terminal_id> (default: tables)\n" \
+        "\t-j <threads> - number of threads compiling tables (default: one per core)\n" \
+        "\t-h this help.\n");
+}
+
+int main(int argc, char *argv[]) {
+    lcd_index_t index;
+    lcd_fleet_t fleet = { 0 };
+    lcd_job_t   job;
+    const char *terminal_file = NULL;
+    const char *table_dir = "tables";
+    int threads = mm_default_threads();
+    int failed = 0;
+    int status = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "hj:t:T:")) != -1) {
+        switch (c) {
+            case 'h':
+                mm_lcdgen_help(basename(argv[0]), stdout);
+                return 0;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 't':
+                terminal_file = optarg;
+                break;
+            case 'T':
+                table_dir = optarg;
+                break;
+            default:
+                mm_lcdgen_help(basename(argv[0]), stderr);
+                return -EINVAL;
+        }
+    }
+
+    if ((terminal_file == NULL) || (optind == argc)) {
+        mm_lcdgen_help(basename(argv[0]), stderr);
+        return -EINVAL;
+    }
+
+    printf("LCD Table Compiler for the Nortel Millennium Payphone\n\n");
+
+    memset(&index, 0, sizeof(index));
+    memset(index.hash, 0xff, sizeof(index.hash));  /* NO_RATE_CENTER */
+    index.npa_nxx = (int32_t *)malloc(NPA_COUNT * NPA_COUNT * sizeof(int32_t));
+
+    if (index.npa_nxx == NULL) {
+        fprintf(stderr, "Error: failed to allocate %zu bytes.\n", NPA_COUNT * NPA_COUNT * sizeof(int32_t));
+        return -ENOMEM;
+    }
+
+    for (int i = 0; i < NPA_COUNT * NPA_COUNT; i++) {
+        index.npa_nxx[i] = NO_RATE_CENTER;
+    }
+
+    for (int i = optind; (i < argc) && (status == 0); i++) {
+        status = load_assignments(&index, argv[i]);
+    }
+
+    if (status == 0) {
+        status = load_terminals(&fleet, terminal_file);
+    }
+
+    if (status == 0) {
+        status = mm_make_directory(table_dir);
+    }
+
+    if (status == 0) {
+        job.index = &index;
+        job.fleet = &fleet;
+        job.table_dir = table_dir;
+
+        if (threads < 1) threads = 1;
+        if (threads > MM_THREADS_MAX) threads = MM_THREADS_MAX;
+
+        mm_parallel_for(fleet.count, threads, compile_one_terminal, &job);
+
+        for (int i = 0; i < fleet.count; i++) {
+            lcd_terminal_t *terminal = &fleet.terminals[i];
+
+            printf("%s: NPA %d, %d NPAs:", terminal->terminal_id, terminal->npa, terminal->npa_count);
+            for (int j = 0; j < terminal->npa_count; j++) {
+                printf(" %d", terminal->npas[j]);
+            }
+            printf("\n");
+
+            if (terminal->status == -E2BIG) {
+                printf("* * * WARNING: %s has more NPAs than fit in the LCD tables of:", terminal->terminal_id);
+                for (size_t f = 0; f < sizeof(lcd_formats) / sizeof(lcd_formats[0]); f++) {
+                    if (terminal->npa_count > lcd_formats[f].count) printf(" %s", lcd_formats[f].name);
+                }
+                printf("\n");
+            }
+
+            if (terminal->status != 0) failed++;
+        }
+
+        printf("%d terminals, %d rate centers, %d with LCD table limits exceeded or errors.\n",
+               fleet.count, index.count, failed);
+    }
+
+    free(fleet.terminals);
+    free(index.rate_centers);
+    free(index.npa_nxx);
+
+    if (status != 0) return status;
+
+    return failed ? -E2BIG : 0;
+}
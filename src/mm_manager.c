@@ -10,6 +10,7 @@
  * Copyright (c) 2020-2023, Howard M. Harte
  */
 
+#include <stddef.h>
 #include <stdio.h>   /* Standard input/output definitions */
 #include <stdlib.h>
 #include <stdint.h>
@@ -41,24 +42,142 @@
 
 #define JAN12020 1577865600
 
+#define IMPACT_HASH_SIZE    (256)
+#define IMPACT_KEY_LEN      (1024)
+
+/* A terminal that receives a table from a source, in the reverse index. */
+typedef struct mm_impact_ref {
+    struct mm_impact_ref *next;
+    char    terminal_id[11];
+    uint8_t terminal_type;
+    uint8_t table_id;
+    char   *overlay;            /* Overlay composed on the source, NULL if the table is the source. */
+    int     kept;               /* The table the overlay was made on is in the table store. */
+} mm_impact_ref_t;
+
+/* A file or table store table that tables are loaded from, and the terminals that receive it. */
+typedef struct mm_impact_source {
+    struct mm_impact_source *next;
+    char key[IMPACT_KEY_LEN];
+    int  count;
+    mm_impact_ref_t *refs;
+} mm_impact_source_t;
+
+/* Length of a source as sent to a terminal type as a table ID. */
+typedef struct mm_impact_sent {
+    uint8_t terminal_type;
+    uint8_t table_id;
+    size_t  len;
+} mm_impact_sent_t;
+
+/* Reverse index of the fleet's tables: from the source each is resolved to, to the terminals receiving it. */
+typedef struct mm_impact_index {
+    mm_context_t *context;
+    int terminals;
+    mm_impact_source_t *hash[IMPACT_HASH_SIZE];
+} mm_impact_index_t;
+
+#define PLAN_CACHE_BYTES        (16 * 1024 * 1024)
+#define PLAN_IMAGE_CACHE_BYTES  (4 * 1024 * 1024)
+#define PLAN_QUEUE_LEN          (MM_MAX_LINES)
+#define TABLE_WATCH_MS          (5000)
+#define LINE_CALLS_SAVE_MS      (10 * 60 * 1000)
+
+/* Key of a plan in the plan cache. */
+typedef struct mm_plan_key {
+    char    terminal_id[11];
+    uint8_t terminal_type;
+} mm_plan_key_t;
+
+/*
+ * A table of a plan in the plan cache, followed by the name of its
+ * source.  The value of a plan is the table generation it was built in,
+ * followed by its tables.
+ */
+typedef struct mm_plan_cached_entry {
+    uint8_t  table_id;
+    uint8_t  source_id;
+    uint8_t  generated;
+    uint8_t  loaded;
+    uint16_t packets;
+    uint16_t source_len;        /* With the NUL. */
+    uint32_t wire_ms;
+    uint32_t len;
+} mm_plan_cached_entry_t;
+
+/* Key of a loaded table in the plan image cache. */
+typedef struct mm_plan_image_key {
+    uint32_t generation;
+    uint8_t  terminal_type;
+    uint8_t  table_id;
+    uint8_t  source_id;
+    uint8_t  pad;
+    char     source[TABLE_PATH_MAX_LEN];
+} mm_plan_image_key_t;
+
+/*
+ * Download plans shared by all lines, and the tables loaded for them,
+ * valid while the table generation is unchanged.  The generation changes
+ * when a table file or table assignment does, see mm_table_watch().
+ */
+static mm_cache_t *plan_cache;
+static mm_cache_t *plan_image_cache;
+static uint32_t table_generation;
+static uint64_t table_fingerprint;
+
+/* Terminals whose Caller ID was received, for the main thread to plan. */
+static char plan_queue[PLAN_QUEUE_LEN][11];
+static int  plan_queue_count;
+
 /* Function Prototypes */
 time_t mm_time(int test_mode, time_t* rawtime);
 
 static int mm_shutdown(mm_context_t* context);
+static int mm_line_run(void* arg);
 static int mm_download_tables(mm_context_t* context, char* terminal_id);
-static int load_mm_table(mm_context_t* context, char* terminal_id, uint8_t table_id, uint8_t** buffer, size_t* len);
+static int mm_table_resolve(mm_context_t* context, char* terminal_id, uint8_t terminal_type, uint8_t table_id, char* fname, size_t size, struct stat* attr);
+static int load_mm_table(mm_context_t* context, char* terminal_id, uint8_t terminal_type, uint8_t table_id, uint8_t** buffer, size_t* len, char* source);
+static uint8_t *mm_table_list(uint8_t terminal_type);
+static int mm_download_order(mm_context_t *context, uint8_t terminal_type, uint8_t *order);
+static void mm_prefetch_terminal(void *arg, const char *caller_id);
+static void mm_prefetch_plans(mm_context_t *context);
+static void mm_table_watch(mm_context_t *context);
+static mm_termstate_t *mm_session_termstate(mm_context_t *context, const char *terminal_id);
+static size_t mm_generated_table_len(uint8_t terminal_type, uint8_t table_id);
+static void mm_plan_clear(mm_plan_t *plan);
+static void mm_plan_release(mm_context_t *context);
+static int mm_plan_load_entry(mm_context_t *context, char *terminal_id, uint8_t terminal_type, mm_plan_entry_t *entry);
+static void mm_plan_build(mm_context_t *context, char *terminal_id, uint8_t terminal_type, mm_plan_t *plan);
+static int mm_plan_init(void);
+static void mm_plan_free(void);
+static uint32_t mm_plan_generation(void);
+static void mm_plan_save(const mm_plan_t *plan);
+static int mm_plan_restore(mm_context_t *context, char *terminal_id, uint8_t terminal_type, uint32_t generation, mm_plan_t *plan);
+static mm_plan_t *mm_plan_get(mm_context_t *context, char *terminal_id, uint8_t terminal_type);
+static int mm_plan_load_table(mm_plan_entry_t *entry, uint8_t **buffer, size_t *len);
+static void mm_plan_print(mm_context_t *context, const mm_plan_t *plan, FILE *stream);
+static int mm_plan_print_terminal(mm_context_t *context, char *terminal_id);
+static void mm_table_source_key(const char *source, char *key, size_t size);
+static void mm_impact_build(mm_context_t *context, mm_impact_index_t *index);
+static void mm_impact_free(mm_impact_index_t *index);
+static int mm_impact_print(mm_context_t *context, const char *changed, FILE *stream);
 static void generate_install_parameters(mm_context_t* context, uint8_t** buffer, size_t* len);
 static void generate_term_access_parameters(mm_context_t* context, char* terminal_id, uint8_t** buffer, size_t* len);
 static void generate_term_access_parameters_mtr1(mm_context_t* context, char* terminal_id, uint8_t** buffer, size_t* len);
-static void generate_call_in_parameters(mm_context_t* context, uint8_t** buffer, size_t* len);
+static void generate_call_in_parameters(mm_context_t* context, char* terminal_id, uint8_t** buffer, size_t* len);
 static void generate_call_stat_parameters(mm_context_t* context, uint8_t** buffer, size_t* len);
 static void generate_comm_stat_parameters(mm_context_t* context, uint8_t** buffer, size_t* len);
 static void generate_user_if_parameters(mm_context_t* context, uint8_t** buffer, size_t* len);
 static void generate_dlog_mt_end_data(mm_context_t* context, uint8_t** buffer, size_t* len);
+static void generate_call_back_req(time_t call_back_time, uint8_t** pack_payload);
+static int mm_defer_table_update(mm_context_t* context, char* terminal_id, uint8_t** pack_payload);
 static int process_mm_table(mm_context_t* context, mm_table_t* table);
 static int create_terminal_specific_directory(char* table_dir, char* terminal_id);
 static int update_terminal_download_time(mm_context_t* context, char* terminal_id);
 static int check_mm_table_is_newer(mm_context_t* context, char* terminal_id, uint8_t table_id);
+static time_t mm_table_mtime(mm_context_t* context, char* terminal_id, uint8_t terminal_type, uint8_t table_id);
+static int mm_download_resume(mm_context_t* context, mm_termstate_t* termstate);
+static int mm_download_pending(mm_context_t* context, mm_termstate_t* termstate);
 static void mm_display_help(const char* name, FILE* stream);
 #ifndef _WIN32
 void signal_handler(int sig);
@@ -251,7 +370,7 @@ uint8_t table_list_mtr17_intl[] = {
     0                         /* End of table list */
 };
 
-const char cmdline_options[] = "a:b:cd:e:f:hi:k:l:mn:p:qrst:uvwx:y:z:";
+const char cmdline_options[] = "a:b:B:cd:e:f:hi:I:k:l:L:mn:p:P:qrst:T:uvwx:y:z:";
 
 /* Default communication parameters, may be overridden during compile. */
 #ifndef DEFAULT_BAUD_RATE
@@ -270,6 +389,7 @@ volatile int inject_comm_error = 0;
 
 #ifdef _WIN32
 int manager_running = 1;
+int status_requested = 0;
 
 BOOL WINAPI signal_handler(DWORD dwCtrlType) {
     switch (dwCtrlType)
@@ -277,6 +397,7 @@ BOOL WINAPI signal_handler(DWORD dwCtrlType) {
     case CTRL_C_EVENT:
         printf("\nReceived ^C, wait for shutdown.\n");
         manager_running = 0;
+        serial_wake_all();
         return TRUE;
     case CTRL_BREAK_EVENT:
         printf("\nReceived ^BREAK, inject communication error.\n");
@@ -289,12 +410,17 @@ BOOL WINAPI signal_handler(DWORD dwCtrlType) {
 }
 #else
 volatile sig_atomic_t manager_running = 1;
+volatile sig_atomic_t status_requested = 0;
 
 void signal_handler(int sig) {
     switch (sig) {
     case SIGINT:
         printf("\nReceived ^C, wait for shutdown.\n");
         manager_running = 0;
+        serial_wake_all();
+        break;
+    case SIGUSR1:   /* Print line status. */
+        status_requested = 1;
         break;
     default:
         printf("Received signal %d\n", sig);
@@ -306,8 +432,12 @@ void *sb_client = NULL;
 
 int main(int argc, char *argv[]) {
     mm_context_t *mm_context;
-    mm_table_t    mm_table;
-    char *modem_dev = NULL;
+    mm_context_t *line_context[MM_MAX_LINES] = { NULL };
+    mm_connection_t *line_connection[MM_MAX_LINES];
+    void *line_thread[MM_MAX_LINES] = { NULL };
+    char *modem_dev[MM_MAX_LINES] = { NULL };
+    int   lines = 0;
+    int   line;
     int   ncc_index = 0;
     int   c;
     int   baudrate      = DEFAULT_BAUD_RATE;
@@ -315,17 +445,18 @@ int main(int argc, char *argv[]) {
     char  key_card_number_str[11];
     int   quiet = 0;
     int   status;
-    int   retries;
     int   betest = 1;
     char *shadybank_username = NULL, *shadybank_pw = NULL, *shadybank_url = NULL;
-
-    time_t rawtime;
-    struct tm ptm = { 0 };
+    char *plan_terminal_id = NULL;
+    char *impact_table = NULL;
+    uint64_t watch_ms;
+    uint64_t save_ms;
 
 #ifdef _WIN32
     SetConsoleCtrlHandler(signal_handler, TRUE);
 #else
     signal(SIGINT, signal_handler);
+    signal(SIGUSR1, signal_handler);
 #endif /* _WIN32 */
 
     opterr = 0;
@@ -349,6 +480,11 @@ int main(int argc, char *argv[]) {
     snprintf(mm_context->connection.modem_init_string,  sizeof(mm_context->connection.modem_init_string), "%s",  DEFAULT_MODEM_INIT_STRING);
 
     mm_context->connection.proto.rx_packet_gap = 10;
+    mm_context->connection.proto.timeout_packet     = PKT_TIMEOUT_PACKET_MS;
+    mm_context->connection.proto.timeout_inter_byte = PKT_TIMEOUT_INTER_BYTE_MS;
+    mm_context->connection.proto.timeout_ack        = PKT_TIMEOUT_ACK_MS;
+    mm_context->connection.proto.timeout_table_ack  = PKT_TIMEOUT_TABLE_ACK_MS;
+    mm_context->connection.proto.timeout_session    = PKT_TIMEOUT_SESSION_MS;
 
     mm_context->access_code[0] = 0x27;
     mm_context->access_code[1] = 0x27;
@@ -362,6 +498,7 @@ int main(int argc, char *argv[]) {
     mm_context->key_card_number[4] = 0x88;
 
     mm_context->complete_download = FALSE;
+    mm_context->call_back_load_pct = CALL_BACK_LOAD_PCT_DEFAULT;
     mm_context->connection.proto.monitor_carrier = TRUE;
 
     mm_context->test_mode = TRUE;
@@ -410,6 +547,18 @@ int main(int argc, char *argv[]) {
             case 'b':
                 baudrate = atoi(optarg);
                 break;
+            case 'B':
+            {
+                int budget_secs = atoi(optarg);
+
+                if ((budget_secs < 0) || (budget_secs > UINT16_MAX)) {
+                    fprintf(stderr, "Option -B takes a number of seconds, 0 to %d.\n", UINT16_MAX);
+                    mm_shutdown(mm_context);
+                    return(-EINVAL);
+                }
+                mm_context->download_budget_secs = (uint16_t)budget_secs;
+                break;
+            }
             case 'c':
                 fprintf(stdout, "NOTE: Complete set of tables will be downloaded for every download request.\n");
                 mm_context->complete_download = TRUE;
@@ -432,7 +581,12 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             case 'f':
-                modem_dev = optarg;
+                if (lines >= MM_MAX_LINES) {
+                    fprintf(stderr, "-f may only be specified %d times.\n", MM_MAX_LINES);
+                    mm_shutdown(mm_context);
+                    return(-EINVAL);
+                }
+                modem_dev[lines++] = optarg;
                 break;
             case 'h':
                 mm_display_help(basename(argv[0]), stdout);
@@ -442,6 +596,9 @@ int main(int argc, char *argv[]) {
             case 'i':
                 snprintf(mm_context->connection.modem_init_string, sizeof(mm_context->connection.modem_init_string), "%s", optarg);
                 break;
+            case 'I':
+                impact_table = optarg;
+                break;
             case 'k':
             {
                 if (strnlen(optarg, 10) != 10) {
@@ -468,6 +625,18 @@ int main(int argc, char *argv[]) {
                     return(-ENOENT);
                 }
                 break;
+            case 'L':
+            {
+                int load_pct = atoi(optarg);
+
+                if ((load_pct < 0) || (load_pct > 100)) {
+                    fprintf(stderr, "Option -L takes a percentage, 0 to 100.\n");
+                    mm_shutdown(mm_context);
+                    return(-EINVAL);
+                }
+                mm_context->call_back_load_pct = (uint8_t)load_pct;
+                break;
+            }
             case 'm':
                 mm_context->connection.proto.use_modem = TRUE;
                 mm_context->test_mode = FALSE;
@@ -496,6 +665,9 @@ int main(int argc, char *argv[]) {
                     return(-EINVAL);
                 }
                 break;
+            case 'P':
+                plan_terminal_id = optarg;
+                break;
             case 'q':
                 break;
             case 'r':
@@ -509,6 +681,12 @@ int main(int argc, char *argv[]) {
             case 't':
                 snprintf(mm_context->term_table_dir,    sizeof(mm_context->term_table_dir),    "%s", optarg);
                 break;
+            case 'T':
+                if (proto_set_timeout(&mm_context->connection.proto, optarg) != 0) {
+                    mm_shutdown(mm_context);
+                    return(-EINVAL);
+                }
+                break;
             case 'u':
                 printf("Sending UDP packets to 127.0.0.1:%d\n", MM_UDP_PORT);
                 if (mm_create_udp("127.0.0.1", MM_UDP_PORT) != 0) {
@@ -536,7 +714,7 @@ int main(int argc, char *argv[]) {
                 break;
             case '?':
             default:
-                if ((optopt == 'f') || (optopt == 'l') || (optopt == 'a') || (optopt == 'n') || (optopt == 'b') || (optopt == 'x') || (optopt == 'y') || (optopt == 'z')) {
+                if ((optopt == 'f') || (optopt == 'l') || (optopt == 'a') || (optopt == 'n') || (optopt == 'b') || (optopt == 'B') || (optopt == 'P') || (optopt == 'T') || (optopt == 'x') || (optopt == 'y') || (optopt == 'z')) {
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 } else {
                     fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -615,54 +793,197 @@ int main(int argc, char *argv[]) {
         return(-EINVAL);
     }
 
-    status = mm_connection_open(&mm_context->connection, modem_dev, baudrate, mm_context->test_mode);
-    if (status != 0) {
+    if ((mm_termstate_init(mm_context->database) != 0) || (mm_transcode_init() != 0) ||
+        (mm_table_store_init() != 0) || (mm_table_overlay_init() != 0) || (mm_plan_init() != 0)) {
+        mm_shutdown(mm_context);
+        return(-ENOMEM);
+    }
+
+    if (plan_terminal_id != NULL) {
+        status = mm_plan_print_terminal(mm_context, plan_terminal_id);
+        mm_shutdown(mm_context);
+        return(status);
+    }
+
+    if (impact_table != NULL) {
+        status = mm_impact_print(mm_context, impact_table, stdout);
         mm_shutdown(mm_context);
         return(status);
     }
 
-    mm_context->cdr_ack_buffer_len = 0;
+    if ((lines > 1) && (mm_context->test_mode)) {
+        fprintf(stderr, "Error: only one -f <filename> may be specified without -m.\n");
+        mm_shutdown(mm_context);
+        return(-EINVAL);
+    }
+
+    /* Call-backs go to the quietest hours, as known before the restart. */
+    mm_connection_load_calls(mm_context->database);
+
+    /*
+     * Each line gets its own copy of the context, sharing the database and
+     * the log, capture and UDP streams with line 0.
+     */
+    line_context[0] = mm_context;
+    mm_context->connection.caller_id_fn = mm_prefetch_terminal;
+    mm_context->connection.caller_id_arg = mm_context;
+    for (line = 1; line < lines; line++) {
+        if ((line_context[line] = (mm_context_t *)malloc(sizeof(mm_context_t))) == NULL) {
+            printf("Error: failed to allocate %d bytes.\n", (int)sizeof(mm_context_t));
+            mm_shutdown(mm_context);
+            return(-ENOMEM);
+        }
+        memcpy(line_context[line], mm_context, sizeof(mm_context_t));
+        memset(line_context[line]->lines, 0, sizeof(line_context[line]->lines));
+        line_context[line]->connection.line = line;
+        line_context[line]->connection.caller_id_arg = line_context[line];
+        mm_context->lines[line] = line_context[line];
+    }
+
+    if (lines == 0) {
+        (void)fprintf(stderr, "mm_manager: -f <filename> must be specified.\n");
+        mm_shutdown(mm_context);
+        return(-EINVAL);
+    }
+
+    for (line = 0; line < lines; line++) {
+        status = mm_connection_open(&line_context[line]->connection, modem_dev[line], baudrate, mm_context->test_mode);
+        if (status != 0) {
+            mm_shutdown(mm_context);
+            return(status);
+        }
+        line_connection[line] = &line_context[line]->connection;
+    }
+
+    /* Initialize the whole modem bank at once. */
+    if (mm_connection_init_wait(line_connection, lines) == 0) {
+        mm_shutdown(mm_context);
+        return(-EIO);
+    }
+
     printf("Waiting for call from terminal...\n");
 
+    /*
+     * Each line answers calls in its own thread, lines whose modem failed
+     * to initialize keep retrying.
+     */
+    for (line = 0; line < lines; line++) {
+        line_thread[line] = mm_line_thread_start(mm_line_run, line_context[line]);
+    }
+
+    /*
+     * Meanwhile, the main thread prints the line status on request, plans
+     * the downloads of terminals whose call is ringing, watches the tables
+     * for changes, and saves the calls answered in each hour.
+     */
+    mm_table_watch(mm_context);
+    watch_ms = mm_monotonic_ms();
+    save_ms = watch_ms;
+    while (manager_running) {
+        if (status_requested) {
+            status_requested = 0;
+            mm_connection_status(line_connection, lines, stdout);
+        }
+        mm_prefetch_plans(mm_context);
+        if (mm_monotonic_ms() - watch_ms >= TABLE_WATCH_MS) {
+            mm_table_watch(mm_context);
+            watch_ms = mm_monotonic_ms();
+        }
+        if (mm_monotonic_ms() - save_ms >= LINE_CALLS_SAVE_MS) {
+            mm_connection_save_calls(mm_context->database);
+            save_ms = mm_monotonic_ms();
+        }
+        mm_sleep_ms(250);
+    }
+
+    /* Lines waiting for a call without a timeout. */
+    serial_wake_all();
+
+    for (line = 0; line < lines; line++) {
+        mm_line_thread_join(line_thread[line]);
+    }
+
+    mm_connection_save_calls(mm_context->database);
+
+    mm_connection_status(line_connection, lines, stdout);
+
+    printf("mm_manager: Shutting down.\n");
+
+    if (shadybank_logout(sb_client) < 0) {
+        printf("Failed to logout!\n");
+    } else {
+        printf("Logout success!\n");
+    }
+    mm_shutdown(mm_context);
+    return 0;
+}
+
+/* Answer calls on one line, until the manager shuts down. */
+static int mm_line_run(void* arg) {
+    mm_context_t *context = (mm_context_t *)arg;
+    mm_table_t    mm_table;
+    int   status;
+    int   retries;
+    uint64_t session_start;
+
+    time_t rawtime;
+    struct tm ptm = { 0 };
+
+    context->cdr_ack_buffer_len = 0;
+
     while (manager_running) {
 
         retries = 0;
-        if (mm_connection_wait(&mm_context->connection)) {
-            while (proto_connected(&mm_context->connection.proto) && (manager_running) && (retries < 3)) {
+        if (mm_connection_wait(&context->connection)) {
+            session_start = mm_monotonic_ms();
+            while (proto_connected(&context->connection.proto) && (manager_running) && (retries < 3)) {
                 retries++;
-                status = process_mm_table(mm_context, &mm_table);
+                status = process_mm_table(context, &mm_table);
                 if (status == PKT_SUCCESS) {
                     retries = 0;
                 }
             }
 
-            if (proto_connected(&mm_context->connection.proto)) {
-                proto_disconnect(&mm_context->connection.proto);
+            if (proto_connected(&context->connection.proto)) {
+                proto_disconnect(&context->connection.proto);
+            }
+            mm_connection_call_ended(&context->connection);
+
+            /* Session lengths are used to schedule the terminal's call-ins. */
+            if (context->termstate.terminal_id[0] != '\0') {
+                mm_termstate_session_ended(&context->termstate, (uint32_t)((mm_monotonic_ms() - session_start) / 1000));
+                mm_termstate_put(context->database, &context->termstate);
             }
+            memset(&context->termstate, 0, sizeof(mm_termstate_t));
 
-            mm_time(mm_context->test_mode, &rawtime);
+            mm_time(context->test_mode, &rawtime);
             localtime_r(&rawtime, &ptm);
 
             printf("\n\n%04d-%02d-%02d %2d:%02d:%02d: Terminal %s: Disconnected.\n\n",
                 ptm.tm_year + 1900, ptm.tm_mon + 1, ptm.tm_mday, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
-                mm_context->connection.proto.terminal_id);
+                context->connection.proto.terminal_id);
         }
     }
 
-    printf("mm_manager: Shutting down.\n");
-
-    if (shadybank_logout(sb_client) < 0) {
-        printf("Failed to logout!\n");
-    } else {
-        printf("Logout success!\n");
-    }
-    mm_shutdown(mm_context);
+    mm_plan_release(context);
     return 0;
 }
 
 static int mm_shutdown(mm_context_t* context) {
     mm_close_database(context->database);
+
+    for (int line = 1; line < MM_MAX_LINES; line++) {
+        if (context->lines[line] != NULL) {
+            mm_connection_close(&context->lines[line]->connection);
+            free(context->lines[line]);
+        }
+    }
     mm_connection_close(&context->connection);
+    mm_termstate_free();
+    mm_transcode_free();
+    mm_table_store_free();
+    mm_table_overlay_free();
+    mm_plan_free();
 
     free(context);
     return (0);
@@ -691,6 +1012,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
     int      reply_length = 0;
     uint8_t  table_download_pending = 0;
     uint8_t  status;
+    mm_termstate_t *termstate;
 
     status = receive_mm_table(&context->connection.proto, table);
 
@@ -699,6 +1021,8 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
     phone_num_to_string(terminal_id, sizeof(terminal_id), pkt->payload, PKT_TABLE_ID_OFFSET);
     ppayload = pkt->payload + PKT_TABLE_ID_OFFSET;
 
+    termstate = mm_session_termstate(context, terminal_id);
+
     while (ppayload < pkt->payload + pkt->payload_len) {
         table->table_id = *ppayload;
 
@@ -755,6 +1079,10 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                        context->terminal_upd_reason & TTBLREQ_PWR_LOST_ON_DL ? "Power Lost on Download, " : "",
                        context->terminal_upd_reason & TTBLREQ_CASHBOX_STATUS ? "Cashbox Status Request" : "");
 
+                if (mm_defer_table_update(context, terminal_id, &pack_payload)) {
+                    break;
+                }
+
                 /* Send DLOG_MT_TABLE_UPD */
                 *pack_payload++ = DLOG_MT_TABLE_UPD;
 
@@ -765,7 +1093,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                     cashbox_status_univ_t* cashbox_status = (cashbox_status_univ_t*)pack_payload;
                     printf("\tSend DLOG_MT_CASH_BOX_STATUS table as requested by terminal.\n\t");
 
-                    mm_acct_load_TCASHST(context->database, terminal_id, cashbox_status);
+                    memcpy(cashbox_status, &termstate->cashbox_status, sizeof(cashbox_status_univ_t));
 
                     /* Perform endian conversion */
                     cashbox_status->currency_value = LE16(cashbox_status->currency_value);
@@ -824,7 +1152,9 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                     printf("Attempting capture...\n");
                     char auth_code[16];
                     snprintf(auth_code, sizeof(auth_code), "%06" PRIu64, cdr->auth_code);
+                    mm_auth_lock();
                     int32_t capture_res = shadybank_capture(sb_client, ((double)cdr->call_cost[1] / 100), auth_code);
+                    mm_auth_unlock();
                     if (capture_res < 0) {
                         printf("Captured failed!\n");
                     } else {
@@ -878,7 +1208,9 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 
                 ppayload += sizeof(dlog_mt_term_status_t);
 
-                mm_acct_save_TSTATUS(context->database, &context->telco, terminal_id, dlog_mt_term_status);
+                mm_acct_save_TSTATUS(context->database, &context->telco, terminal_id, dlog_mt_term_status,
+                                     &termstate->status_word);
+                mm_termstate_put(context->database, termstate);
                 break;
             }
             case DLOG_MT_TERM_ERR_REP: {
@@ -893,6 +1225,12 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 ppayload += sizeof(dlog_mt_sw_version_t);
 
                 mm_acct_save_TSWVERS(context->database, &context->telco, terminal_id, dlog_mt_sw_version, &context->terminal_type);
+
+                termstate->terminal_type = context->terminal_type;
+                memset(termstate->control_rom_edition, 0, sizeof(termstate->control_rom_edition));
+                memcpy(termstate->control_rom_edition, dlog_mt_sw_version->control_rom_edition,
+                       sizeof(dlog_mt_sw_version->control_rom_edition));
+                mm_termstate_put(context->database, termstate);
                 break;
             }
             case DLOG_MT_CASH_BOX_STATUS: {
@@ -907,6 +1245,9 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 
                 mm_acct_save_TCASHST(context->database, &context->telco, terminal_id, cashbox_status);
 
+                memcpy(&termstate->cashbox_status, cashbox_status, sizeof(cashbox_status_univ_t));
+                mm_termstate_put(context->database, termstate);
+
                 ppayload += sizeof(cashbox_status_univ_t);
                 break;
             }
@@ -931,6 +1272,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 //                context->terminal_upd_reason |= TTBLREQ_CRAFT_FORCE_DL;
 //                table_download_pending = 1;
                 context->trans_data_in_progress = 1;
+                table_download_pending = mm_download_pending(context, termstate);
                 break;
             }
             case DLOG_MT_CALL_BACK: {
@@ -938,6 +1280,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                 ppayload += sizeof(dlog_mt_call_back_t);
                 *pack_payload++                 = DLOG_MT_TRANS_DATA;
                 context->trans_data_in_progress = 1;
+                table_download_pending = mm_download_pending(context, termstate);
                 break;
             }
             case DLOG_MT_CARRIER_CALL_STATS:
@@ -1094,32 +1437,9 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 #ifdef REQUEST_CALL_BACK_DURING_RATE_REQ
                 {
                     time_t rawtime = { 0 };
-                    struct tm ptm = { 0 };
-                    dlog_mt_call_back_req_t   call_back_req = { DLOG_MT_CALL_BACK_REQ, 0, 0, 0, 0, 0, 0 };
-
-                    call_back_req.id = DLOG_MT_CALL_BACK_REQ;
 
                     mm_time(context->test_mode, &rawtime);
-                    localtime_r(&rawtime, &ptm);
-
-                    call_back_req.year = (ptm.tm_year & 0xff);    /* Fill current years since 1900 */
-                    call_back_req.month = (ptm.tm_mon + 1 & 0xff); /* Fill current month (1-12) */
-                    call_back_req.day = (ptm.tm_mday & 0xff);    /* Fill current day (1-31) */
-                    call_back_req.hour = (ptm.tm_hour & 0xff);    /* Fill current hour (0-23) */
-                    call_back_req.min = ((ptm.tm_min + 2) & 0xff);     /* Fill current minute (0-59) */
-                    call_back_req.sec = (ptm.tm_sec & 0xff);     /* Fill current second (0-59) */
-
-                    memcpy(pack_payload, &call_back_req, sizeof(call_back_req));
-                    pack_payload += sizeof(dlog_mt_call_back_req_t);
-
-                    printf("\t\tRequest callback at day/time: %04d-%02d-%02d / %2d:%02d:%02d\n",
-                        call_back_req.year + 1900,
-                        call_back_req.month,
-                        call_back_req.day,
-                        call_back_req.hour,
-                        call_back_req.min,
-                        call_back_req.sec);
-
+                    generate_call_back_req(rawtime + 2 * 60, &pack_payload);
                 }
 #endif /* REQUEST_CALL_BACK_DURING_RATE_REQ */
 
@@ -1149,7 +1469,9 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
                     sizeof(auth_request->card_number));
 
                 printf("Attempting pre-auth...\n");
+                mm_auth_lock();
                 char *auth_code = shadybank_authorize_pan_shotp(sb_client, card_number_string, pin_str, 10.0);
+                mm_auth_unlock();
 
                 mm_acct_save_TAUTH(context->database, &context->telco, terminal_id, auth_code, auth_request);
 
@@ -1175,26 +1497,7 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
 
 //#define REQUEST_CALL_BACK_DURING_CARD_AUTH
 #ifdef REQUEST_CALL_BACK_DURING_CARD_AUTH
-                {
-                    time_t rawtime = { 0 };
-                    struct tm ptm = { 0 };
-                    dlog_mt_call_back_req_t   call_back_req = { DLOG_MT_CALL_BACK_REQ, 0, 0, 0, 0, 0, 0 };
-
-                    call_back_req.id = DLOG_MT_CALL_BACK_REQ;
-
-                    mm_time(context->test_mode, &rawtime);
-                    localtime_r(&rawtime, &ptm);
-
-                    call_back_req.year = (ptm.tm_year & 0xff);    /* Fill current years since 1900 */
-                    call_back_req.month = (ptm.tm_mon + 1 & 0xff); /* Fill current month (1-12) */
-                    call_back_req.day = (ptm.tm_mday & 0xff);    /* Fill current day (1-31) */
-                    call_back_req.hour = (ptm.tm_hour & 0xff);    /* Fill current hour (0-23) */
-                    call_back_req.min = ((ptm.tm_min + 1) & 0xff);     /* Fill current minute (0-59) */
-                    call_back_req.sec = (ptm.tm_sec & 0xff);     /* Fill current second (0-59) */
-
-                    memcpy(pack_payload, &call_back_req, sizeof(call_back_req));
-                    pack_payload += sizeof(dlog_mt_call_back_req_t);
-                }
+                generate_call_back_req(rawtime + 60, &pack_payload);
 #endif /* REQUEST_CALL_BACK_DURING_CARD_AUTH */
                 break;
             }
@@ -1239,16 +1542,11 @@ static int process_mm_table(mm_context_t* context, mm_table_t* table) {
     return 0;
 }
 
-static int mm_download_tables(mm_context_t *context, char *terminal_id) {
-    int      table_index;
-    int      status = 0;
-    size_t   table_len;
-    uint8_t *table_buffer;
-    uint8_t *table_list = table_list_mtr_2x;
-    uint8_t  table_id;
-    uint8_t  term_model = term_type_to_model(context->terminal_type);
+/* List of tables to download to the terminal, by terminal type. */
+static uint8_t *mm_table_list(uint8_t terminal_type) {
+    uint8_t *table_list;
 
-    switch (term_type_to_mtr(context->terminal_type)) {
+    switch (term_type_to_mtr(terminal_type)) {
     case MTR_2_X:
         table_list = table_list_mtr_2x;
         break;
@@ -1269,56 +1567,127 @@ static int mm_download_tables(mm_context_t *context, char *terminal_id) {
         table_list = table_list_mtr17;
         break;
     default:
-        fprintf(stderr, "%s: Error: Unknown terminal type %d, defaulting to MTR 1.7\n", __func__, context->terminal_type);
+        fprintf(stderr, "%s: Error: Unknown terminal type %d, defaulting to MTR 1.7\n", __func__, terminal_type);
         table_list = table_list_mtr17;
         break;
     }
 
-    for (table_index = 0; (table_id = table_list[table_index]) > 0; table_index++) {
+    return table_list;
+}
+
+/*
+ * Determine whether to resume the terminal's previous download, which was
+ * interrupted, rather than start a new one.  A download is resumed unless
+ * the terminal lost its memory, or a download or install was requested
+ * from its craft interface.
+ */
+static int mm_download_resume(mm_context_t *context, mm_termstate_t *termstate) {
+    char date[100];
+    struct tm ptm = { 0 };
+
+    if ((termstate->dl_started != 0) &&
+        !(context->terminal_upd_reason & (TTBLREQ_CRAFT_FORCE_DL | TTBLREQ_CRAFT_INSTALL | TTBLREQ_LOST_MEMORY))) {
+        localtime_r(&termstate->dl_started, &ptm);
+        strftime(date, 99, "%Y-%m-%d %H:%M:%S", &ptm);
+        printf("Terminal %s: Resuming download started %s.\n", termstate->terminal_id, date);
+        return 1;
+    }
+
+    memset(termstate->dl_acked, 0, sizeof(termstate->dl_acked));
+    /* Wall clock time, as it is compared with the tables' modification times. */
+    time(&termstate->dl_started);
+    mm_termstate_put(context->database, termstate);
+
+    return 0;
+}
+
+/* Order of a download to a terminal of terminal_type, see mm_table_download_order(). */
+static int mm_download_order(mm_context_t *context, uint8_t terminal_type, uint8_t *order) {
+    return mm_table_download_order(mm_table_list(terminal_type), terminal_type, context->minimal_table_set == 1, order);
+}
+
+/*
+ * Determine whether to continue the terminal's download on a call-in: the
+ * optional tables left when the download budget ran out, or the tables
+ * left by an interrupted download.  Not while the modem bank is busy.
+ */
+static int mm_download_pending(mm_context_t *context, mm_termstate_t *termstate) {
+    if (termstate->dl_started == 0) return 0;
+
+    if ((context->call_back_load_pct != 0) && (mm_connection_load_pct() >= context->call_back_load_pct)) {
+        return 0;
+    }
+
+    printf("\tContinuing download to terminal %s.\n", termstate->terminal_id);
+    context->terminal_upd_reason = 0;
+
+    return 1;
+}
+
+static int mm_download_tables(mm_context_t *context, char *terminal_id) {
+    int      table_index;
+    int      status = 0;
+    int      resume;
+    int      changed;
+    int      missed = 0;
+    int      deferred = 0;
+    size_t   table_len;
+    uint8_t *table_buffer;
+    uint8_t  table_id = 0;
+    uint64_t budget_deadline = 0;
+    mm_termstate_t *termstate = mm_session_termstate(context, terminal_id);
+    mm_plan_t *plan = mm_plan_get(context, terminal_id, context->terminal_type);
+    mm_plan_entry_t *entry;
+
+    if (plan == NULL) {
+        return PKT_ERROR_FAILURE;
+    }
+
+    if (context->debuglevel > 0) {
+        mm_plan_print(context, plan, stdout);
+    } else {
+        printf("Download plan: %d tables, %zu bytes, %u packets, %.1f seconds.\n",
+               plan->count, plan->len, plan->packets, plan->wire_ms / 1000.0);
+    }
+
+    resume = mm_download_resume(context, termstate);
+
+    if (context->download_budget_secs != 0) {
+        budget_deadline = mm_monotonic_ms() + (uint64_t)context->download_budget_secs * 1000;
+    }
+
+    for (table_index = 0; table_index < plan->count; table_index++) {
+        entry = &plan->entry[table_index];
+        table_id = entry->table_id;
+
+        /* Tables that can't be loaded are skipped. */
+        if (!entry->generated && (entry->image == NULL)) continue;
+
         /* Abort table download if manager is shutting down. */
         if (!manager_running) break;
         if (!proto_connected(&context->connection.proto)) break;
 
-        /* Skip DLOG_MT_CARD_TABLE, DLOG_MT_CARD_TABLE_EXP if the terminal is coin-only. */
-        if (term_model == TERM_COIN_BASIC) {
-            switch (table_id) {
-            case DLOG_MT_CARD_TABLE:
-            case DLOG_MT_CARD_TABLE_EXP:
+        /*
+         * When resuming, skip tables already ACKed, unless they changed since.
+         * Generated tables have no file to tell whether they changed, such
+         * as after -n or -a, so they are always sent.  Once the budget is
+         * used, leave the optional tables to the next call.
+         */
+        changed = !resume || entry->generated ||
+                  (mm_table_mtime(context, terminal_id, context->terminal_type, entry->source_id) >= termstate->dl_started);
+
+        switch (mm_table_download_action(table_id, resume, termstate->dl_acked, changed,
+                                         (budget_deadline != 0) && (mm_monotonic_ms() >= budget_deadline))) {
+            case DL_TABLE_ACKED:
+                if (context->debuglevel > 0) {
+                    printf("\tSkipping table %d (0x%02x), already downloaded.\n", table_id, table_id);
+                }
+                continue;
+            case DL_TABLE_DEFERRED:
+                deferred++;
                 continue;
             default:
                 break;
-            }
-        }
-        else if (((term_model == TERM_CARD) || (term_model == TERM_DESK)) && (table_id == DLOG_MT_COIN_VAL_TABLE)) {
-            /* Skip DLOG_MT_COIN_VAL_TABLE for card-only terminals */
-            continue;
-        }
-
-        /* If -s was specified, only download mandatory tables */
-        if (context->minimal_table_set == 1) {
-            switch (table_id) {
-            case DLOG_MT_NCC_TERM_PARAMS:
-            case DLOG_MT_CARD_TABLE:
-            case DLOG_MT_CARRIER_TABLE:
-            case DLOG_MT_CALLSCRN_UNIVERSAL:
-            case DLOG_MT_FCONFIG_OPTS:
-            case DLOG_MT_INSTALL_PARAMS:
-            case DLOG_MT_COIN_VAL_TABLE:
-            case DLOG_MT_NUM_PLAN_TABLE:
-            case DLOG_MT_SPARE_TABLE:
-            case DLOG_MT_RATE_TABLE:
-            case DLOG_MT_CALL_SCREEN_LIST:
-            case DLOG_MT_SCARD_PARM_TABLE:
-            case DLOG_MT_CARD_TABLE_EXP:
-            case DLOG_MT_CARRIER_TABLE_EXP:
-            case DLOG_MT_NPA_NXX_TABLE_1:
-            case DLOG_MT_COMP_LCD_TABLE_1:
-            case DLOG_MT_LCD_TABLE_1:
-            case DLOG_MT_END_DATA:
-                break;
-            default: /* Skip tables that are not mandatory */
-                continue;
-            }
         }
 
         switch (table_id) {
@@ -1326,7 +1695,7 @@ static int mm_download_tables(mm_context_t *context, char *terminal_id) {
                 generate_install_parameters(context, &table_buffer, &table_len);
                 break;
             case DLOG_MT_CALL_IN_PARMS:
-                generate_call_in_parameters(context, &table_buffer, &table_len);
+                generate_call_in_parameters(context, terminal_id, &table_buffer, &table_len);
                 break;
             case DLOG_MT_NCC_TERM_PARAMS:
                 if (term_type_to_mtr(context->terminal_type) <= MTR_1_13) {
@@ -1354,7 +1723,8 @@ static int mm_download_tables(mm_context_t *context, char *terminal_id) {
                     fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(cashbox_status_univ_t));
                     return -ENOMEM;
                 }
-                mm_acct_load_TCASHST(context->database, terminal_id, (cashbox_status_univ_t *)table_buffer);
+                memcpy(table_buffer, &mm_session_termstate(context, terminal_id)->cashbox_status,
+                       sizeof(cashbox_status_univ_t));
 
                 /* Perform endian conversion */
                 pcashbox_status->currency_value = LE16(pcashbox_status->currency_value);
@@ -1375,49 +1745,58 @@ static int mm_download_tables(mm_context_t *context, char *terminal_id) {
                     (context->terminal_upd_reason & TTBLREQ_CRAFT_FORCE_DL) &&
                     !(context->terminal_upd_reason & TTBLREQ_LOST_MEMORY) &&
                     !(context->terminal_upd_reason & TTBLREQ_PWR_LOST_ON_DL)) {
-                    if (check_mm_table_is_newer(context, terminal_id, table_id) != 0) {
+                    if (check_mm_table_is_newer(context, terminal_id, entry->source_id) != 0) {
                         table_buffer = NULL;
                         continue;
                     }
                 }
 
-                status = load_mm_table(context, terminal_id, table_id, &table_buffer, &table_len);
-
-                if (status != 0) {
-                    if (table_id == DLOG_MT_USER_IF_PARMS) { /* Can't load DLOG_MT_USER_IF_PARMS, generate it. */
-                        generate_user_if_parameters(context, &table_buffer, &table_len);
-                    }
-                    else { /* If table can't be loaded, continue to the next. */
-                        if (table_buffer != NULL) free(table_buffer);
-                        table_buffer = NULL;
-                        continue;
-                    }
+                if (entry->generated) { /* Can't load DLOG_MT_USER_IF_PARMS, generate it. */
+                    generate_user_if_parameters(context, &table_buffer, &table_len);
+                } else if (mm_plan_load_table(entry, &table_buffer, &table_len) != 0) {
+                    return -ENOMEM;
                 }
                 break;
         }
 
-        /* Update DLOG_MT_FCONFIG_OPTS based on terminal type. */
-        if (table_id == DLOG_MT_FCONFIG_OPTS) {
-            ((dlog_mt_fconfig_opts_t*)table_buffer)->term_type = term_model & 0x0F;
-        }
-
         status = send_mm_table(&context->connection.proto, table_buffer, table_len);
 
         if (status == PKT_SUCCESS) {
             /* For all tables except END_OF_DATA, expect a table ACK. */
-            if (table_list[table_index] != DLOG_MT_END_DATA) {
+            if (table_id != DLOG_MT_END_DATA) {
                 status = wait_for_table_ack(&context->connection.proto, table_buffer[0]);
+
+                if (status == 0) {
+                    termstate->dl_acked[table_id / 8] |= (1 << (table_id % 8));
+                    mm_termstate_put(context->database, termstate);
+                }
             }
         }
 
+        if (status != PKT_SUCCESS) missed = 1;
+
         free(table_buffer);
         table_buffer = NULL;
 
     }
 
     if (proto_connected(&context->connection.proto)) {
-        /* Update table download time. */
-        update_terminal_download_time(context, terminal_id);
+        /* Update table download time, unless tables are left, so they are still due on the next call-in. */
+        if (!missed && !deferred) {
+            update_terminal_download_time(context, terminal_id);
+        }
+
+        if (deferred != 0) {
+            printf("%s: Download budget of %d seconds used, %d optional tables left for the next call-in.\n",
+                   __func__, context->download_budget_secs, deferred);
+        }
+
+        /* Download is complete when every table was ACKed. */
+        if ((table_index == plan->count) && !missed && !deferred) {
+            termstate->dl_started = 0;
+            memset(termstate->dl_acked, 0, sizeof(termstate->dl_acked));
+            mm_termstate_put(context->database, termstate);
+        }
     } else {
         printf("%s: Download failed.\n", __func__);
     }
@@ -1456,8 +1835,20 @@ static int update_terminal_download_time(mm_context_t *context, char *terminal_i
     return 0;
 }
 
-static int check_mm_table_is_newer(mm_context_t *context, char *terminal_id, uint8_t table_id) {
+/* Modification time of the file a table is loaded from, 0 if none. */
+static time_t mm_table_mtime(mm_context_t *context, char *terminal_id, uint8_t terminal_type, uint8_t table_id) {
     char  fname[TABLE_PATH_MAX_LEN];
+    struct stat table_mtime_attr;
+
+    if ((terminal_id[0] == '\0') ||
+        (mm_table_resolve(context, terminal_id, terminal_type, table_id, fname, sizeof(fname), &table_mtime_attr) != 0)) {
+        return 0;
+    }
+
+    return table_mtime_attr.st_mtime;
+}
+
+static int check_mm_table_is_newer(mm_context_t *context, char *terminal_id, uint8_t table_id) {
     char  download_time_fname[TABLE_PATH_MAX_LEN + 1];
     struct stat table_mtime_attr;
     struct stat last_download_time_attr;
@@ -1468,14 +1859,8 @@ static int check_mm_table_is_newer(mm_context_t *context, char *terminal_id, uin
     struct tm ptm = { 0 };
 
     if (terminal_id[0] != '\0') {
-        snprintf(fname, sizeof(fname), "%s/%s/mm_table_%02x.bin", context->term_table_dir, terminal_id, table_id);
         snprintf(download_time_fname, sizeof(download_time_fname), "%s/%s/table_update.log", context->term_table_dir, terminal_id);
-        if (stat(fname, &table_mtime_attr) == -1) {
-            snprintf(fname, sizeof(fname), "%s/mm_table_%02x.bin", context->default_table_dir, table_id);
-            if (stat(fname, &table_mtime_attr) == -1) {
-                table_mtime_attr.st_mtime = 0;
-            }
-        }
+        table_mtime_attr.st_mtime = mm_table_mtime(context, terminal_id, context->terminal_type, table_id);
 
         if (stat(download_time_fname, &last_download_time_attr) == -1) {
             last_download_time_attr.st_mtime = 0;
@@ -1501,82 +1886,161 @@ static int check_mm_table_is_newer(mm_context_t *context, char *terminal_id, uin
     return 0;
 }
 
-static int load_mm_table(mm_context_t *context, char *terminal_id, uint8_t table_id, uint8_t **buffer, size_t *len) {
-    FILE *stream;
-    char  fname[TABLE_PATH_MAX_LEN];
-    uint32_t size;
-    uint8_t *bufp;
-    uint8_t  term_model = term_type_to_model(context->terminal_type);
+/*
+ * Find the model-specific or default table file, the table a terminal is
+ * sent when it has none of its own.  Returns 0 with the file name in fname
+ * and its attributes in attr, or -ENOENT.
+ */
+static int mm_table_resolve_base(mm_context_t *context, uint8_t terminal_type, uint8_t table_id, char *fname, size_t size, struct stat *attr) {
+    const char *model_dir;
 
-    if (terminal_id[0] != '\0') {
-        snprintf(fname, sizeof(fname), "%s/%s/mm_table_%02x.bin", context->term_table_dir, terminal_id, table_id);
-    } else {
-        snprintf(fname, sizeof(fname), "%s/mm_table_%02x.bin", context->default_table_dir, table_id);
+    switch (term_type_to_model(terminal_type)) {
+    case TERM_CARD:
+        model_dir = "card_only";
+        break;
+    case TERM_DESK:
+        model_dir = "desk";
+        break;
+    case TERM_COIN_BASIC:
+        model_dir = "coin";
+        break;
+    case TERM_INMATE:
+        model_dir = "inmate";
+        break;
+    case TERM_MULTIPAY:
+    default:
+        model_dir = "multipay";
+        break;
     }
 
-    /* Try to load terminal-specific table first. */
-    if (!(stream = fopen(fname, "rb"))) {
+    snprintf(fname, size, "%s/%s/mm_table_%02x.bin", context->term_table_dir, model_dir, table_id);
+    if (stat(fname, attr) == 0) return 0;
 
-        /* No terminal-specific table, try based on model. */
-        switch (term_model) {
-        case TERM_CARD:
-            snprintf(fname, sizeof(fname), "%s/card_only/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        case TERM_DESK:
-            snprintf(fname, sizeof(fname), "%s/desk/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        case TERM_COIN_BASIC:
-            snprintf(fname, sizeof(fname), "%s/coin/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        case TERM_INMATE:
-            snprintf(fname, sizeof(fname), "%s/inmate/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        case TERM_MULTIPAY:
-        default:
-            snprintf(fname, sizeof(fname), "%s/multipay/mm_table_%02x.bin", context->term_table_dir, table_id);
-            break;
-        }
+    /* No model-specific table, fall back to default table directory. */
+    snprintf(fname, size, "%s/mm_table_%02x.bin", context->default_table_dir, table_id);
+    if (stat(fname, attr) == 0) return 0;
 
-        if (!(stream = fopen(fname, "rb"))) {
-            /* No model-specific table, fall back to default table directory. */
-            snprintf(fname, sizeof(fname), "%s/mm_table_%02x.bin", context->default_table_dir, table_id);
+    return -ENOENT;
+}
 
-            if (!(stream = fopen(fname, "rb"))) {
-                printf("Could not load table %d from %s.\n", table_id, fname);
-                *buffer = NULL;
-                return -1;
-            }
-        }
-    }
+/*
+ * Find the file a table is loaded from: terminal-specific first, then a
+ * terminal-specific overlay, then the table assigned to the terminal in
+ * the table store, then model-specific, then from the default table
+ * directory.  Returns 0 with the file name in fname and its attributes in
+ * attr, or -ENOENT.  A table in the store is named "store:<hash>", with
+ * the time it was assigned as its mtime.  An overlay is named by its file,
+ * with its own mtime: it stays on the table it was made from when the
+ * model or default table changes (see mm_table_overlay_load().)
+ */
+static int mm_table_resolve(mm_context_t *context, char *terminal_id, uint8_t terminal_type, uint8_t table_id, char *fname, size_t size, struct stat *attr) {
+    char   base_fname[TABLE_PATH_MAX_LEN];
+    char   hash[TABLE_HASH_LEN];
+    time_t assigned_time;
+    struct stat base_attr;
 
-    fseek(stream, 0, SEEK_END);
-    size = ftell(stream);
-    fseek(stream, 0, SEEK_SET);
+    if (terminal_id[0] != '\0') {
+        snprintf(fname, size, "%s/%s/mm_table_%02x.bin", context->term_table_dir, terminal_id, table_id);
+    } else {
+        snprintf(fname, size, "%s/mm_table_%02x.bin", context->default_table_dir, table_id);
+    }
 
-    size++;  // Make room for table ID.
+    /* Try terminal-specific table first. */
+    if (stat(fname, attr) == 0) return 0;
 
-    if ((table_id == DLOG_MT_CALL_SCREEN_LIST) &&
-        ((term_type_to_mtr(context->terminal_type) >= MTR_1_9) && (term_type_to_mtr(context->terminal_type) < MTR_1_20))) {
-        if (size == 3061) {
-            size += 340;    /* Pad 180-entry Call Screen List to 200-entries. */
+    if (terminal_id[0] != '\0') {
+        if ((snprintf(fname, size, "%s/%s/mm_table_%02x" TABLE_OVERLAY_EXT,
+                      context->term_table_dir, terminal_id, table_id) < (int)size) &&
+            (stat(fname, attr) == 0) &&
+            (mm_table_resolve_base(context, terminal_type, table_id, base_fname, sizeof(base_fname), &base_attr) == 0)) {
+            return 0;
         }
     }
 
-    *buffer = (uint8_t *)calloc(size, sizeof(uint8_t));
-    fflush(stdout);
-
-    if (*buffer == NULL) {
-        fprintf(stderr, "%s: Error: failed to allocate %u bytes for table %d\n", __func__, size, table_id);
-        fclose(stream);
-        return -ENOMEM;
+    if ((terminal_id[0] != '\0') &&
+        (mm_table_store_assigned(context->database, terminal_id, table_id, hash, &assigned_time) == 0)) {
+        snprintf(fname, size, TABLE_STORE_PREFIX "%s", hash);
+        memset(attr, 0, sizeof(struct stat));
+        attr->st_mtime = assigned_time;
+        return 0;
     }
 
-    bufp    = *buffer;
-    *bufp++ = table_id;
+    /* No terminal-specific table, try based on model. */
+    return mm_table_resolve_base(context, terminal_type, table_id, fname, size, attr);
+}
 
-    *len = 1;
+/* A table file name is of an overlay. */
+static int mm_table_is_overlay(const char *fname) {
+    size_t len = strlen(fname);
 
-    while (1) {
+    return (len > strlen(TABLE_OVERLAY_EXT)) &&
+           (strcmp(&fname[len - strlen(TABLE_OVERLAY_EXT)], TABLE_OVERLAY_EXT) == 0);
+}
+
+/* Load a table, and the name of the file it was loaded from into source. */
+static int load_mm_table(mm_context_t *context, char *terminal_id, uint8_t terminal_type, uint8_t table_id, uint8_t **buffer, size_t *len, char *source) {
+    FILE *stream;
+    char  fname[TABLE_PATH_MAX_LEN];
+    uint32_t size;
+    uint8_t *bufp;
+    struct stat attr;
+
+    if (mm_table_resolve(context, terminal_id, terminal_type, table_id, fname, sizeof(fname), &attr) != 0) {
+        printf("Could not load table %d from %s.\n", table_id, fname);
+        *buffer = NULL;
+        return -1;
+    }
+
+    if (strncmp(fname, TABLE_STORE_PREFIX, strlen(TABLE_STORE_PREFIX)) == 0) {
+        if (mm_table_store_load(context->database, &fname[strlen(TABLE_STORE_PREFIX)], table_id, buffer, len) != 0) {
+            return -1;
+        }
+        snprintf(source, TABLE_PATH_MAX_LEN, "%s", fname);
+        printf("Loaded table ID %d (0x%02x) from %s (%zu bytes).\n", table_id, table_id, fname, *len - 1);
+        return 0;
+    }
+
+    if (mm_table_is_overlay(fname)) {
+        char base_fname[TABLE_PATH_MAX_LEN];
+
+        if ((mm_table_resolve_base(context, terminal_type, table_id, base_fname, sizeof(base_fname), &attr) != 0) ||
+            (mm_table_overlay_load(context->database, fname, base_fname, table_id, buffer, len) != 0)) {
+            printf("Could not load table %d from %s.\n", table_id, fname);
+            return -1;
+        }
+        snprintf(source, TABLE_PATH_MAX_LEN, "%s", fname);
+        printf("Loaded table ID %d (0x%02x) from %s on %s (%zu bytes).\n", table_id, table_id, fname, base_fname, *len - 1);
+        return 0;
+    }
+
+    if (!(stream = fopen(fname, "rb"))) {
+        printf("Could not load table %d from %s.\n", table_id, fname);
+        *buffer = NULL;
+        return -1;
+    }
+    snprintf(source, TABLE_PATH_MAX_LEN, "%s", fname);
+
+    fseek(stream, 0, SEEK_END);
+    size = ftell(stream);
+    fseek(stream, 0, SEEK_SET);
+
+    size++;  // Make room for table ID.
+
+    *buffer = (uint8_t *)calloc(size, sizeof(uint8_t));
+    fflush(stdout);
+
+    if (*buffer == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %u bytes for table %d\n", __func__, size, table_id);
+        fclose(stream);
+        return -ENOMEM;
+    }
+
+    bufp    = *buffer;
+    *bufp++ = table_id;
+
+    *len = 1;
+
+    while (1) {
         uint8_t c = (uint8_t)fgetc(stream);
 
         if (feof(stream)) {
@@ -1602,6 +2066,887 @@ static int load_mm_table(mm_context_t *context, char *terminal_id, uint8_t table
 }
 
 
+/*
+ * Prefetch the state of the terminal calling from caller_id while the
+ * call is ringing, so the session starts with it at hand: the terminal's
+ * cached state, and its download plan.  Called from the line's modem
+ * loop, so the terminal is only queued, for mm_prefetch_plans() to plan
+ * on the main thread.
+ */
+static void mm_prefetch_terminal(void *arg, const char *caller_id) {
+    char     terminal_id[11];
+    size_t   len = strlen(caller_id);
+    int      queued = 0;
+
+    (void)arg;
+
+    /* The terminal ID is the terminal's 10-digit phone number. */
+    if (len < 10) return;
+    snprintf(terminal_id, sizeof(terminal_id), "%s", &caller_id[len - 10]);
+
+    mm_lines_lock();
+    for (int i = 0; i < plan_queue_count; i++) {
+        if (strcmp(plan_queue[i], terminal_id) == 0) queued = 1;
+    }
+    if (!queued && (plan_queue_count < PLAN_QUEUE_LEN)) {
+        snprintf(plan_queue[plan_queue_count++], sizeof(plan_queue[0]), "%s", terminal_id);
+        queued = 1;
+    }
+    mm_lines_unlock();
+
+    if (queued) printf("Prefetching terminal %s.\n", terminal_id);
+}
+
+/*
+ * Load the state and plan the downloads of the terminals queued by
+ * mm_prefetch_terminal(), into the terminal state and plan caches.
+ */
+static void mm_prefetch_plans(mm_context_t *context) {
+    mm_termstate_t termstate;
+    mm_plan_t *plan;
+    char     terminal_id[11];
+    uint32_t generation;
+
+    for (;;) {
+        mm_lines_lock();
+        if (plan_queue_count == 0) {
+            mm_lines_unlock();
+            return;
+        }
+        snprintf(terminal_id, sizeof(terminal_id), "%s", plan_queue[0]);
+        memmove(plan_queue[0], plan_queue[1], (size_t)(--plan_queue_count) * sizeof(plan_queue[0]));
+        mm_lines_unlock();
+
+        /* Tables depend on the terminal type, skip them if it is not known yet. */
+        if ((mm_termstate_get(context->database, terminal_id, &termstate) != 0) ||
+            (termstate.terminal_type == 0)) {
+            continue;
+        }
+
+        plan = (mm_plan_t *)calloc(1, sizeof(mm_plan_t));
+        if (plan == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_plan_t));
+            return;
+        }
+
+        generation = mm_plan_generation();
+        if (mm_plan_restore(context, terminal_id, termstate.terminal_type, generation, plan) != 0) {
+            mm_plan_build(context, terminal_id, termstate.terminal_type, plan);
+            mm_plan_save(plan);
+        }
+        mm_plan_clear(plan);
+        free(plan);
+    }
+}
+
+/*
+ * State of the terminal in session, taken from the terminal state cache
+ * on its first packet.
+ */
+static mm_termstate_t *mm_session_termstate(mm_context_t *context, const char *terminal_id) {
+    mm_termstate_t *termstate = &context->termstate;
+
+    if (strcmp(termstate->terminal_id, terminal_id) != 0) {
+        if (mm_termstate_get(context->database, terminal_id, termstate) != 0) {
+            memset(termstate, 0, sizeof(mm_termstate_t));
+            snprintf(termstate->terminal_id, sizeof(termstate->terminal_id), "%s", terminal_id);
+            termstate->call_in_offset = -1;
+        }
+
+        /* Until the terminal reports its software version, go by its last known terminal type. */
+        if (termstate->terminal_type != 0) {
+            context->terminal_type = termstate->terminal_type;
+        }
+    }
+
+    return termstate;
+}
+
+/* Length of a table generated by mm_manager, 0 if the table is loaded from a file. */
+static size_t mm_generated_table_len(uint8_t terminal_type, uint8_t table_id) {
+    switch (table_id) {
+    case DLOG_MT_INSTALL_PARAMS:
+        return sizeof(dlog_mt_install_params_t);
+    case DLOG_MT_CALL_IN_PARMS:
+        return sizeof(dlog_mt_call_in_params_t);
+    case DLOG_MT_NCC_TERM_PARAMS:
+        if (term_type_to_mtr(terminal_type) <= MTR_1_13) {
+            return sizeof(dlog_mt_ncc_term_params_mtr1_t);
+        }
+        return sizeof(dlog_mt_ncc_term_params_t);
+    case DLOG_MT_CALL_STAT_PARMS:
+        return sizeof(dlog_mt_call_stat_params_t);
+    case DLOG_MT_COMM_STAT_PARMS:
+        return sizeof(dlog_mt_comm_stat_params_t);
+    case DLOG_MT_END_DATA:
+        return 1;
+    case DLOG_MT_CASH_BOX_STATUS:
+        return sizeof(cashbox_status_univ_t);
+    default:
+        return 0;
+    }
+}
+
+static int mm_plan_init(void) {
+    plan_cache = mm_cache_create(PLAN_CACHE_BYTES);
+    plan_image_cache = mm_cache_create(PLAN_IMAGE_CACHE_BYTES);
+
+    return ((plan_cache != NULL) && (plan_image_cache != NULL)) ? 0 : -ENOMEM;
+}
+
+static void mm_plan_free(void) {
+    mm_cache_free(plan_cache);
+    mm_cache_free(plan_image_cache);
+    plan_cache = NULL;
+    plan_image_cache = NULL;
+}
+
+/* Current table generation. */
+static uint32_t mm_plan_generation(void) {
+    uint32_t generation;
+
+    mm_lines_lock();
+    generation = table_generation;
+    mm_lines_unlock();
+
+    return generation;
+}
+
+/* Fold the name, modification time and size of a table file into the fingerprint. */
+static int mm_table_watch_file(void *arg, const char *dir, const char *name) {
+    uint64_t *fingerprint = (uint64_t *)arg;
+    char     fname[TABLE_PATH_MAX_LEN + 32];
+    struct stat attr;
+    int64_t  stamp[2];
+
+    if ((snprintf(fname, sizeof(fname), "%s/%s", dir, name) >= (int)sizeof(fname)) || (stat(fname, &attr) != 0)) {
+        return 0;
+    }
+
+    stamp[0] = (int64_t)attr.st_mtime;
+    stamp[1] = (int64_t)attr.st_size;
+    /* Summed, as the order of the files in a directory is not defined. */
+    *fingerprint += mm_fnv1a((const uint8_t *)fname, strlen(fname)) ^ mm_fnv1a((const uint8_t *)stamp, sizeof(stamp));
+
+    return 0;
+}
+
+/* The terminal-specific and model-specific directories, one level down. */
+static int mm_table_watch_dir(void *arg, const char *dir, const char *name) {
+    char     dirname[TABLE_PATH_MAX_LEN + 32];
+    struct stat attr;
+
+    if ((snprintf(dirname, sizeof(dirname), "%s/%s", dir, name) < (int)sizeof(dirname)) &&
+        (stat(dirname, &attr) == 0) && S_ISDIR(attr.st_mode)) {
+        mm_list_dir(dirname, mm_table_watch_file, arg);
+    }
+
+    return 0;
+}
+
+/*
+ * Move to the next table generation, so that every cached plan is built
+ * again, if a table file or a table assignment changed since the last
+ * call.  Called every TABLE_WATCH_MS from the main thread, so the lines
+ * only compare the generation instead of checking every table.
+ */
+static void mm_table_watch(mm_context_t *context) {
+    uint64_t fingerprint = 0;
+
+    mm_list_dir(context->default_table_dir, mm_table_watch_file, &fingerprint);
+    mm_list_dir(context->term_table_dir, mm_table_watch_dir, &fingerprint);
+
+    /* Assignments are replaced, not updated, so a change moves the last row ID. */
+    fingerprint += mm_sql_read_uint64(context->database, "SELECT COUNT(*) from TABLEASSIGN;");
+    fingerprint ^= mm_sql_read_uint64(context->database, "SELECT IFNULL(MAX(rowid), 0) from TABLEASSIGN;") << 32;
+
+    if (fingerprint != table_fingerprint) {
+        table_fingerprint = fingerprint;
+        mm_lines_lock();
+        table_generation++;
+        mm_lines_unlock();
+    }
+}
+
+static void mm_plan_clear(mm_plan_t *plan) {
+    for (int i = 0; i < plan->count; i++) {
+        free(plan->entry[i].image);
+        free(plan->entry[i].source);
+    }
+
+    memset(plan, 0, sizeof(mm_plan_t));
+}
+
+/* Free the plan of the terminal in session. */
+static void mm_plan_release(mm_context_t *context) {
+    if (context->plan == NULL) return;
+
+    mm_plan_clear(context->plan);
+    free(context->plan);
+    context->plan = NULL;
+}
+
+/* Set the source of a table of a plan, NULL or "" for none.  Returns 0 or -ENOMEM. */
+static int mm_plan_set_source(mm_plan_entry_t *entry, const char *source) {
+    free(entry->source);
+    entry->source = NULL;
+
+    if ((source == NULL) || (source[0] == '\0')) return 0;
+
+    if ((entry->source = strdup(source)) == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, strlen(source) + 1);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/* Source of a table of a plan, "" if none. */
+static const char *mm_plan_source(const mm_plan_entry_t *entry) {
+    return (entry->source != NULL) ? entry->source : "";
+}
+
+/*
+ * Load a table of the plan for the terminal.  A table that is not found in
+ * the terminal's format is transcoded from its canonical MTR 2.x table.
+ */
+static int mm_plan_load_entry(mm_context_t *context, char *terminal_id, uint8_t terminal_type, mm_plan_entry_t *entry) {
+    char fname[TABLE_PATH_MAX_LEN];
+    char source[TABLE_PATH_MAX_LEN];
+    struct stat attr;
+
+    if (mm_table_resolve(context, terminal_id, terminal_type, entry->table_id, fname, sizeof(fname), &attr) != 0) {
+        entry->source_id = mm_transcode_source(entry->table_id, terminal_type);
+    }
+
+    if ((load_mm_table(context, terminal_id, terminal_type, entry->source_id, &entry->image, &entry->len, source) != 0) ||
+        (mm_transcode_table(entry->table_id, terminal_type, &entry->image, &entry->len) != 0) ||
+        (mm_plan_set_source(entry, source) != 0)) {
+        free(entry->image);
+        entry->image = NULL;
+        entry->len = 0;
+        mm_plan_set_source(entry, NULL);
+        return -1;
+    }
+
+    return 0;
+}
+
+static size_t mm_plan_image_key(const mm_plan_t *plan, const mm_plan_entry_t *entry, mm_plan_image_key_t *key) {
+    memset(key, 0, sizeof(mm_plan_image_key_t));
+    key->generation = plan->generation;
+    key->terminal_type = plan->terminal_type;
+    key->table_id = entry->table_id;
+    key->source_id = entry->source_id;
+    snprintf(key->source, sizeof(key->source), "%s", mm_plan_source(entry));
+
+    return offsetof(mm_plan_image_key_t, source) + strlen(key->source) + 1;
+}
+
+/*
+ * Load a table of the plan, like mm_plan_load_entry(), from the plan image
+ * cache if it was loaded for another terminal of the same type from the
+ * same source in this table generation.  A restored plan knows the
+ * source, a plan being built resolves it.
+ */
+static int mm_plan_load_image(mm_context_t *context, mm_plan_t *plan, mm_plan_entry_t *entry) {
+    mm_plan_image_key_t key;
+    size_t   key_len;
+    char     source[TABLE_PATH_MAX_LEN];
+    struct stat attr;
+
+    if (entry->source == NULL) {
+        if (mm_table_resolve(context, plan->terminal_id, plan->terminal_type, entry->table_id,
+                             source, sizeof(source), &attr) != 0) {
+            entry->source_id = mm_transcode_source(entry->table_id, plan->terminal_type);
+            if ((entry->source_id == entry->table_id) ||
+                (mm_table_resolve(context, plan->terminal_id, plan->terminal_type, entry->source_id,
+                                  source, sizeof(source), &attr) != 0)) {
+                source[0] = '\0';
+            }
+        }
+        mm_plan_set_source(entry, source);
+    }
+
+    if (entry->source != NULL) {
+        key_len = mm_plan_image_key(plan, entry, &key);
+        if (mm_cache_get(plan_image_cache, &key, key_len, &entry->image, &entry->len) == 0) return 0;
+    }
+
+    if (mm_plan_load_entry(context, plan->terminal_id, plan->terminal_type, entry) != 0) return -1;
+
+    key_len = mm_plan_image_key(plan, entry, &key);
+    mm_cache_put(plan_image_cache, &key, key_len, entry->image, entry->len, 0);
+
+    return 0;
+}
+
+/*
+ * Build the download plan of terminal_id, a terminal of terminal_type:
+ * load the tables in the order they are downloaded, and estimate the time
+ * to send each at the line rate and inter-packet gap.
+ */
+static void mm_plan_build(mm_context_t *context, char *terminal_id, uint8_t terminal_type, mm_plan_t *plan) {
+    uint8_t order[256];
+
+    mm_plan_clear(plan);
+    snprintf(plan->terminal_id, sizeof(plan->terminal_id), "%s", terminal_id);
+    plan->terminal_type = terminal_type;
+    /* Before the tables are resolved, so a change meanwhile makes the plan stale. */
+    plan->generation = mm_plan_generation();
+
+    mm_download_order(context, terminal_type, order);
+
+    for (int i = 0; order[i] > 0; i++) {
+        mm_plan_entry_t *entry = &plan->entry[plan->count++];
+
+        entry->table_id = order[i];
+        entry->source_id = order[i];
+        entry->len = mm_generated_table_len(terminal_type, entry->table_id);
+
+        if (entry->len != 0) {
+            entry->generated = 1;
+        } else if (mm_plan_load_image(context, plan, entry) != 0) {
+            /* Can't load DLOG_MT_USER_IF_PARMS, generate it. */
+            if (entry->table_id != DLOG_MT_USER_IF_PARMS) continue;
+
+            entry->generated = 1;
+            entry->len = sizeof(dlog_mt_user_if_params_t);
+        }
+
+        entry->wire_ms = proto_table_wire_ms(&context->connection.proto, entry->len, &entry->packets);
+        plan->len += entry->len;
+        plan->packets += entry->packets;
+        plan->wire_ms += entry->wire_ms;
+    }
+}
+
+/* Keep the plan in the plan cache, without its tables, which are in the plan image cache. */
+static void mm_plan_save(const mm_plan_t *plan) {
+    mm_plan_key_t key;
+    mm_plan_cached_entry_t cached;
+    uint8_t *value;
+    size_t   len = sizeof(uint32_t);
+    size_t   offset = sizeof(uint32_t);
+
+    for (int i = 0; i < plan->count; i++) {
+        len += sizeof(mm_plan_cached_entry_t) + strlen(mm_plan_source(&plan->entry[i])) + 1;
+    }
+
+    if ((value = (uint8_t *)malloc(len)) == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, len);
+        return;
+    }
+
+    memcpy(value, &plan->generation, sizeof(uint32_t));
+    for (int i = 0; i < plan->count; i++) {
+        const mm_plan_entry_t *entry = &plan->entry[i];
+
+        memset(&cached, 0, sizeof(cached));
+        cached.table_id = entry->table_id;
+        cached.source_id = entry->source_id;
+        cached.generated = entry->generated;
+        cached.loaded = (entry->image != NULL);
+        cached.packets = entry->packets;
+        cached.source_len = (uint16_t)(strlen(mm_plan_source(entry)) + 1);
+        cached.wire_ms = entry->wire_ms;
+        cached.len = (uint32_t)entry->len;
+        memcpy(&value[offset], &cached, sizeof(cached));
+        memcpy(&value[offset + sizeof(cached)], mm_plan_source(entry), cached.source_len);
+        offset += sizeof(cached) + cached.source_len;
+    }
+
+    memset(&key, 0, sizeof(key));
+    snprintf(key.terminal_id, sizeof(key.terminal_id), "%s", plan->terminal_id);
+    key.terminal_type = plan->terminal_type;
+    mm_cache_put(plan_cache, &key, sizeof(key), value, len, 1);
+    free(value);
+}
+
+/*
+ * Restore the plan of terminal_id from the plan cache, with its tables.
+ * Returns 0, or -ENOENT if there is no plan of this table generation, or
+ * its tables can't all be loaded.
+ */
+static int mm_plan_restore(mm_context_t *context, char *terminal_id, uint8_t terminal_type, uint32_t generation, mm_plan_t *plan) {
+    mm_plan_key_t key;
+    mm_plan_cached_entry_t cached;
+    uint8_t *value;
+    size_t   len;
+    size_t   offset = sizeof(uint32_t);
+    int      status = 0;
+
+    memset(&key, 0, sizeof(key));
+    snprintf(key.terminal_id, sizeof(key.terminal_id), "%s", terminal_id);
+    key.terminal_type = terminal_type;
+
+    if (mm_cache_get(plan_cache, &key, sizeof(key), &value, &len) != 0) return -ENOENT;
+
+    mm_plan_clear(plan);
+    snprintf(plan->terminal_id, sizeof(plan->terminal_id), "%s", terminal_id);
+    plan->terminal_type = terminal_type;
+    if ((len < sizeof(uint32_t)) || (memcmp(value, &generation, sizeof(uint32_t)) != 0)) status = -ENOENT;
+    plan->generation = generation;
+
+    while ((status == 0) && (offset + sizeof(cached) <= len)) {
+        mm_plan_entry_t *entry = &plan->entry[plan->count];
+
+        memcpy(&cached, &value[offset], sizeof(cached));
+        offset += sizeof(cached);
+        if ((plan->count >= (int)(sizeof(plan->entry) / sizeof(plan->entry[0]))) ||
+            (cached.source_len == 0) || (cached.source_len > TABLE_PATH_MAX_LEN) ||
+            (offset + cached.source_len > len) || (value[offset + cached.source_len - 1] != '\0')) {
+            status = -ENOENT;
+            break;
+        }
+
+        entry->table_id = cached.table_id;
+        entry->source_id = cached.source_id;
+        entry->generated = cached.generated;
+        entry->packets = cached.packets;
+        entry->wire_ms = cached.wire_ms;
+        entry->len = cached.len;
+        plan->count++;
+        if (mm_plan_set_source(entry, (const char *)&value[offset]) != 0) {
+            status = -ENOMEM;
+            break;
+        }
+        offset += cached.source_len;
+
+        /* A table that was loaded, and now can't be, is not as planned. */
+        if (cached.loaded && ((mm_plan_load_image(context, plan, entry) != 0) || (entry->len != cached.len))) {
+            status = -ENOENT;
+        }
+
+        plan->len += entry->len;
+        plan->packets += entry->packets;
+        plan->wire_ms += entry->wire_ms;
+    }
+
+    free(value);
+    if (status != 0) mm_plan_clear(plan);
+
+    return status;
+}
+
+/*
+ * Download plan of terminal_id, from the plan cache if it was planned in
+ * this table generation, otherwise built and kept in the plan cache.
+ */
+static mm_plan_t *mm_plan_get(mm_context_t *context, char *terminal_id, uint8_t terminal_type) {
+    mm_plan_t *plan = context->plan;
+    uint32_t generation = mm_plan_generation();
+
+    if (plan == NULL) {
+        if ((plan = (mm_plan_t *)calloc(1, sizeof(mm_plan_t))) == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_plan_t));
+            return NULL;
+        }
+        context->plan = plan;
+    }
+
+    if ((strcmp(plan->terminal_id, terminal_id) == 0) &&
+        (plan->terminal_type == terminal_type) &&
+        (plan->generation == generation)) {
+        return plan;
+    }
+
+    if (mm_plan_restore(context, terminal_id, terminal_type, generation, plan) != 0) {
+        mm_plan_build(context, terminal_id, terminal_type, plan);
+        mm_plan_save(plan);
+    }
+
+    return plan;
+}
+
+/* A copy of a loaded table of the plan, which the download frees once sent. */
+static int mm_plan_load_table(mm_plan_entry_t *entry, uint8_t **buffer, size_t *len) {
+    *buffer = (uint8_t *)malloc(entry->len);
+
+    if (*buffer == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes for table %d\n", __func__, entry->len, entry->table_id);
+        return -ENOMEM;
+    }
+
+    memcpy(*buffer, entry->image, entry->len);
+    *len = entry->len;
+
+    return 0;
+}
+
+/* Print the tables of a download plan, their sizes and the estimated time to send them. */
+static void mm_plan_print(mm_context_t *context, const mm_plan_t *plan, FILE *stream) {
+    fprintf(stream, "Download plan for terminal %s, terminal type %d:\n", plan->terminal_id, plan->terminal_type);
+    fprintf(stream, "Table                                    Bytes  Packets  Seconds  Source\n");
+
+    for (int i = 0; i < plan->count; i++) {
+        const mm_plan_entry_t *entry = &plan->entry[i];
+
+        fprintf(stream, "%3d (0x%02x) %-28s %6zu %8u %8.1f  %s\n",
+                entry->table_id, entry->table_id, table_to_string(entry->table_id),
+                entry->len, entry->packets, entry->wire_ms / 1000.0,
+                entry->generated ? "(generated)" : (entry->image != NULL) ? mm_plan_source(entry) : "(not found)");
+    }
+
+    fprintf(stream, "%d tables, %zu bytes, %u packets, %.1f seconds at %d bps with a %dms gap.\n",
+            plan->count, plan->len, plan->packets, plan->wire_ms / 1000.0,
+            PKT_LINE_RATE, context->connection.proto.rx_packet_gap * 10);
+}
+
+/* Print the download plan of terminal_id, as its last known terminal type. */
+static int mm_plan_print_terminal(mm_context_t *context, char *terminal_id) {
+    mm_termstate_t termstate;
+    mm_plan_t *plan;
+
+    if (mm_termstate_get(context->database, terminal_id, &termstate) != 0) {
+        return -ENOENT;
+    }
+
+    if ((plan = mm_plan_get(context, terminal_id, termstate.terminal_type)) == NULL) {
+        return -ENOMEM;
+    }
+
+    mm_plan_print(context, plan, stdout);
+    mm_plan_release(context);
+
+    return 0;
+}
+
+/*
+ * Name a table source the same however its path is given: files by their
+ * absolute path, tables in the table store by their hash.
+ */
+static void mm_table_source_key(const char *source, char *key, size_t size) {
+    if (strncmp(source, TABLE_STORE_PREFIX, strlen(TABLE_STORE_PREFIX)) != 0) {
+#ifdef _WIN32
+        if (_fullpath(key, source, size) != NULL) return;
+#else  /* ifdef _WIN32 */
+        char *path = realpath(source, NULL);
+
+        if (path != NULL) {
+            snprintf(key, size, "%s", path);
+            free(path);
+            return;
+        }
+#endif /* ifdef _WIN32 */
+    }
+
+    snprintf(key, size, "%s", source);
+}
+
+static unsigned int mm_impact_hash(const char *key) {
+    return (unsigned int)(mm_fnv1a((const uint8_t *)key, strlen(key)) % IMPACT_HASH_SIZE);
+}
+
+static mm_impact_source_t *mm_impact_find(mm_impact_index_t *index, const char *key) {
+    mm_impact_source_t *source;
+
+    for (source = index->hash[mm_impact_hash(key)]; source != NULL; source = source->next) {
+        if (strcmp(source->key, key) == 0) return source;
+    }
+
+    return NULL;
+}
+
+/*
+ * Index the table of a terminal as sent from the file or table store table
+ * fname, or as composed on it from overlay.
+ */
+static int mm_impact_add_ref(mm_impact_index_t *index, const char *fname, const char *overlay, int kept,
+                             const char *terminal_id, uint8_t terminal_type, uint8_t table_id) {
+    char key[IMPACT_KEY_LEN];
+    mm_impact_source_t *source;
+    mm_impact_ref_t *ref;
+
+    mm_table_source_key(fname, key, sizeof(key));
+    source = mm_impact_find(index, key);
+
+    if (source == NULL) {
+        source = (mm_impact_source_t *)calloc(1, sizeof(mm_impact_source_t));
+        if (source == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_impact_source_t));
+            return -ENOMEM;
+        }
+        snprintf(source->key, sizeof(source->key), "%s", key);
+        source->next = index->hash[mm_impact_hash(key)];
+        index->hash[mm_impact_hash(key)] = source;
+    }
+
+    ref = (mm_impact_ref_t *)calloc(1, sizeof(mm_impact_ref_t));
+    if (ref == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_impact_ref_t));
+        return -ENOMEM;
+    }
+    snprintf(ref->terminal_id, sizeof(ref->terminal_id), "%s", terminal_id);
+    ref->terminal_type = terminal_type;
+    ref->table_id = table_id;
+    if (overlay != NULL) {
+        ref->overlay = strdup(overlay);
+        if (ref->overlay == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, strlen(overlay) + 1);
+            free(ref);
+            return -ENOMEM;
+        }
+        ref->kept = kept;
+    }
+    ref->next = source->refs;
+    source->refs = ref;
+    source->count++;
+
+    return 0;
+}
+
+/*
+ * Index the sources of the tables a terminal is sent, as its last known
+ * terminal type.  A table sent from an overlay is also indexed under the
+ * table the overlay is on, as composed on it.  Composing the overlay keeps
+ * the table it was made on in the table store, ahead of a change to it.
+ */
+static void mm_impact_add_terminal(void *arg, const mm_termstate_t *state) {
+    mm_impact_index_t *index = (mm_impact_index_t *)arg;
+    mm_context_t *context = index->context;
+    char     terminal_id[11];
+    char     fname[TABLE_PATH_MAX_LEN];
+    char     base_fname[TABLE_PATH_MAX_LEN];
+    uint8_t  order[256];
+    uint8_t  source_id;
+    struct stat attr;
+
+    snprintf(terminal_id, sizeof(terminal_id), "%s", state->terminal_id);
+    mm_download_order(context, state->terminal_type, order);
+    index->terminals++;
+
+    for (int i = 0; order[i] > 0; i++) {
+        if (mm_generated_table_len(state->terminal_type, order[i]) != 0) continue;
+
+        /* As mm_plan_load_entry() resolves it. */
+        source_id = order[i];
+        if (mm_table_resolve(context, terminal_id, state->terminal_type, order[i], fname, sizeof(fname), &attr) != 0) {
+            source_id = mm_transcode_source(order[i], state->terminal_type);
+
+            if ((source_id == order[i]) ||
+                (mm_table_resolve(context, terminal_id, state->terminal_type, source_id, fname, sizeof(fname), &attr) != 0)) {
+                continue;
+            }
+        }
+
+        if (mm_impact_add_ref(index, fname, NULL, 0, terminal_id, state->terminal_type, order[i]) != 0) return;
+
+        if (mm_table_is_overlay(fname) &&
+            (mm_table_resolve_base(context, state->terminal_type, source_id, base_fname, sizeof(base_fname), &attr) == 0)) {
+            uint8_t *image;
+            size_t   len;
+            int      kept = (mm_table_overlay_load(context->database, fname, base_fname, source_id, &image, &len) == 0);
+
+            if (kept) free(image);
+            if (mm_impact_add_ref(index, base_fname, fname, kept, terminal_id, state->terminal_type, order[i]) != 0) return;
+        }
+    }
+}
+
+/*
+ * Build the reverse index of the tables of every terminal in TERMSTATE,
+ * resolved with the same fallback as their downloads: from each file or
+ * table store table, to the terminals that are sent it.
+ */
+static void mm_impact_build(mm_context_t *context, mm_impact_index_t *index) {
+    memset(index, 0, sizeof(mm_impact_index_t));
+    index->context = context;
+    mm_sql_foreach_TERMSTATE(context->database, mm_impact_add_terminal, index);
+}
+
+static void mm_impact_free(mm_impact_index_t *index) {
+    for (int i = 0; i < IMPACT_HASH_SIZE; i++) {
+        while (index->hash[i] != NULL) {
+            mm_impact_source_t *source = index->hash[i];
+
+            index->hash[i] = source->next;
+            while (source->refs != NULL) {
+                mm_impact_ref_t *ref = source->refs;
+
+                source->refs = ref->next;
+                free(ref->overlay);
+                free(ref);
+            }
+            free(source);
+        }
+    }
+}
+
+static int mm_impact_ref_compare(const void *a, const void *b) {
+    return strcmp((*(const mm_impact_ref_t * const *)a)->terminal_id, (*(const mm_impact_ref_t * const *)b)->terminal_id);
+}
+
+/* Length of the table of ref as sent, NULL if it is not loaded yet. */
+static mm_impact_sent_t *mm_impact_sent_find(mm_impact_sent_t *sent, int count, const mm_impact_ref_t *ref) {
+    for (int i = 0; i < count; i++) {
+        if ((sent[i].terminal_type == ref->terminal_type) && (sent[i].table_id == ref->table_id)) return &sent[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Print the terminals that receive the table file changed, or table store
+ * table "store:<hash>": the bytes each is sent, and the time to send them
+ * at the line rate and inter-packet gap.  Terminals shadowed from the
+ * file by a terminal-specific or model-specific table are not affected.
+ */
+static int mm_impact_print(mm_context_t *context, const char *changed, FILE *stream) {
+    mm_impact_index_t  *index;
+    mm_impact_source_t *source;
+    mm_impact_ref_t   **refs;
+    mm_impact_ref_t   **overlays;
+    mm_impact_ref_t    *ref;
+    char     key[IMPACT_KEY_LEN];
+    mm_impact_sent_t *sent;
+    int      sent_count = 0;
+    uint8_t  table_ids[32] = { 0 };
+    size_t   total_len = 0;
+    uint64_t total_ms = 0;
+    int      others = 0;
+    int      count = 0;
+    int      overlay_count = 0;
+    int      broken = 0;
+
+    index = (mm_impact_index_t *)calloc(1, sizeof(mm_impact_index_t));
+    if (index == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_impact_index_t));
+        return -ENOMEM;
+    }
+
+    mm_impact_build(context, index);
+    mm_table_source_key(changed, key, sizeof(key));
+    source = mm_impact_find(index, key);
+
+    if (source == NULL) {
+        fprintf(stream, "None of the %d terminals receive %s.\n", index->terminals, key);
+        mm_impact_free(index);
+        free(index);
+        return 0;
+    }
+
+    refs = (mm_impact_ref_t **)calloc(source->count, sizeof(mm_impact_ref_t *));
+    overlays = (mm_impact_ref_t **)calloc(source->count, sizeof(mm_impact_ref_t *));
+    sent = (mm_impact_sent_t *)calloc(source->count, sizeof(mm_impact_sent_t));
+    if ((refs == NULL) || (overlays == NULL) || (sent == NULL)) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__,
+                source->count * (2 * sizeof(mm_impact_ref_t *) + sizeof(mm_impact_sent_t)));
+        free(refs);
+        free(overlays);
+        free(sent);
+        mm_impact_free(index);
+        free(index);
+        return -ENOMEM;
+    }
+
+    /* Overlays on the source keep the table they were made on, and do not receive the change. */
+    for (ref = source->refs; ref != NULL; ref = ref->next) {
+        if (ref->overlay != NULL) {
+            overlays[overlay_count++] = ref;
+        } else {
+            refs[count++] = ref;
+        }
+    }
+    qsort(refs, count, sizeof(mm_impact_ref_t *), mm_impact_ref_compare);
+    qsort(overlays, overlay_count, sizeof(mm_impact_ref_t *), mm_impact_ref_compare);
+
+    /*
+     * The table as sent only depends on the terminal type and the table
+     * ID it is sent as, load it once for each.  One source can be sent as
+     * two tables, such as the Call Screening List to MTR 1.x.
+     */
+    for (int i = 0; i < count; i++) {
+        mm_plan_entry_t entry = { 0 };
+        mm_impact_sent_t *table = &sent[sent_count];
+
+        if (mm_impact_sent_find(sent, sent_count, refs[i]) != NULL) continue;
+
+        table->terminal_type = refs[i]->terminal_type;
+        table->table_id = refs[i]->table_id;
+        sent_count++;
+
+        entry.table_id = refs[i]->table_id;
+        entry.source_id = refs[i]->table_id;
+        if (mm_plan_load_entry(context, refs[i]->terminal_id, refs[i]->terminal_type, &entry) == 0) {
+            table->len = entry.len;
+            free(entry.image);
+            free(entry.source);
+        }
+    }
+
+    fprintf(stream, "Terminals receiving %s:\n", key);
+    fprintf(stream, "Terminal    Type  Table                                    Bytes  Seconds\n");
+
+    for (int i = 0; i < count; i++) {
+        size_t   len = mm_impact_sent_find(sent, sent_count, refs[i])->len;
+        uint16_t packets;
+        uint32_t wire_ms = proto_table_wire_ms(&context->connection.proto, len, &packets);
+
+        fprintf(stream, "%-10s  %4d  %3d (0x%02x) %-28s %6zu %8.1f\n",
+                refs[i]->terminal_id, refs[i]->terminal_type, refs[i]->table_id, refs[i]->table_id,
+                table_to_string(refs[i]->table_id), len, wire_ms / 1000.0);
+        total_len += len;
+        total_ms += wire_ms;
+    }
+
+    /* Terminals sent the same tables from elsewhere, which the change does not reach. */
+    for (int i = 0; i < count; i++) {
+        table_ids[refs[i]->table_id / 8] |= (1 << (refs[i]->table_id % 8));
+    }
+
+    for (int i = 0; i < IMPACT_HASH_SIZE; i++) {
+        mm_impact_source_t *other;
+
+        for (other = index->hash[i]; other != NULL; other = other->next) {
+            /* Overlays on the source are listed with it. */
+            if ((other == source) || mm_table_is_overlay(other->key)) continue;
+
+            for (ref = other->refs; ref != NULL; ref = ref->next) {
+                /* An overlay's terminals are indexed under it and the table it is on. */
+                if ((ref->overlay == NULL) &&
+                    (table_ids[ref->table_id / 8] & (1 << (ref->table_id % 8))) &&
+                    (bsearch(&ref, refs, count, sizeof(mm_impact_ref_t *), mm_impact_ref_compare) == NULL)) {
+                    others++;
+                }
+            }
+        }
+    }
+
+    fprintf(stream, "%d of %d terminals, %zu bytes, %.1f seconds (%.2f line-hours) at %d bps with a %dms gap.\n",
+            count, index->terminals, total_len, total_ms / 1000.0, total_ms / 3600000.0,
+            PKT_LINE_RATE, context->connection.proto.rx_packet_gap * 10);
+    if (others != 0) {
+        fprintf(stream, "Not affected: %d terminals that are sent the table from another source.\n", others);
+    }
+
+    if (overlay_count != 0) {
+        fprintf(stream, "Overlays on %s, composed on the table they were made on, without the change:\n", key);
+        fprintf(stream, "Terminal    Type  Table                                    Overlay\n");
+
+        for (int i = 0; i < overlay_count; i++) {
+            fprintf(stream, "%-10s  %4d  %3d (0x%02x) %-28s %s%s\n",
+                    overlays[i]->terminal_id, overlays[i]->terminal_type, overlays[i]->table_id, overlays[i]->table_id,
+                    table_to_string(overlays[i]->table_id), overlays[i]->overlay,
+                    overlays[i]->kept ? "" : " (BROKEN)");
+            if (!overlays[i]->kept) broken++;
+        }
+
+        if (broken != 0) {
+            fprintf(stream, "BROKEN: %d overlays were made on a table that is not in the table store.  "
+                    "Their terminals are not sent the table until the overlays are made again on %s.\n", broken, key);
+        }
+    }
+
+    free(sent);
+    free(overlays);
+    free(refs);
+    mm_impact_free(index);
+    free(index);
+
+    return 0;
+}
+
 static void generate_install_parameters(mm_context_t* context, uint8_t** buffer, size_t* len) {
     dlog_mt_install_params_t* pinstall_params;
     uint8_t* pbuffer;
@@ -1711,12 +3056,13 @@ static void generate_term_access_parameters_mtr1(mm_context_t *context, char *te
     *buffer = pbuffer;
 }
 
-static void generate_call_in_parameters(mm_context_t *context, uint8_t **buffer, size_t *len) {
+static void generate_call_in_parameters(mm_context_t *context, char *terminal_id, uint8_t **buffer, size_t *len) {
     dlog_mt_call_in_params_t *pcall_in_params;
+    mm_termstate_t *termstate;
     uint8_t  *pbuffer;
     time_t    rawtime;
     struct tm ptm = { 0 };
-    uint8_t   call_in_hour;
+    int       call_in_offset;
 
     *len    = sizeof(dlog_mt_call_in_params_t);
     pbuffer = (uint8_t*)calloc(1, *len);
@@ -1741,19 +3087,19 @@ static void generate_call_in_parameters(mm_context_t *context, uint8_t **buffer,
      * not call in until the call-in time the following day.  Since we want to call in twice
      * a day, set the call-in hour to a time in the AM, so the subsequent call 12 hours later
      * will be in the PM of the same day.
+     *
+     * Each terminal is given its own call-in time within the 12 hours, so that the fleet
+     * does not call in all at once.
      */
-    call_in_hour = (ptm.tm_hour & 0xff);
-
-    if (call_in_hour >= 12) { /* If after noon, set back to the AM. */
-        call_in_hour -= 12;
-    }
+    termstate = mm_session_termstate(context, terminal_id);
+    call_in_offset = mm_termstate_call_in_offset(context->database, termstate, mm_connection_line_count());
 
     pcall_in_params->call_in_start_date[0]      = (ptm.tm_year & 0xff);       /* Call-in start YY */
     pcall_in_params->call_in_start_date[1]      = ((ptm.tm_mon + 1) & 0xff);  /* Call in start MM */
     pcall_in_params->call_in_start_date[2]      = (ptm.tm_mday & 0xff);       /* Call in start DD */
-    pcall_in_params->call_in_start_time[0]      = call_in_hour;               /* Call-in start HH */
-    pcall_in_params->call_in_start_time[1]      = (ptm.tm_min & 0xff);        /* Call-in start MM */
-    pcall_in_params->call_in_start_time[2]      = (ptm.tm_sec & 0xff);        /* Call-in start SS */
+    pcall_in_params->call_in_start_time[0]      = (call_in_offset / 60) & 0xff; /* Call-in start HH */
+    pcall_in_params->call_in_start_time[1]      = (call_in_offset % 60) & 0xff; /* Call-in start MM */
+    pcall_in_params->call_in_start_time[2]      = 0;                          /* Call-in start SS */
     pcall_in_params->call_in_interval[0]        = 0;                          /* Call-in inteval DD */
     pcall_in_params->call_in_interval[1]        = 12;                         /* Call-in inteval HH */
     pcall_in_params->call_in_interval[2]        = 0;                          /* Call-in inteval MM */
@@ -1925,6 +3271,61 @@ static void generate_dlog_mt_end_data(mm_context_t *context, uint8_t **buffer, s
     *buffer[0] = DLOG_MT_END_DATA;
 }
 
+/* Append a DLOG_MT_CALL_BACK_REQ, asking the terminal to call back at call_back_time. */
+static void generate_call_back_req(time_t call_back_time, uint8_t **pack_payload) {
+    struct tm ptm = { 0 };
+    dlog_mt_call_back_req_t call_back_req = { DLOG_MT_CALL_BACK_REQ, 0, 0, 0, 0, 0, 0 };
+
+    localtime_r(&call_back_time, &ptm);
+
+    call_back_req.year  = (ptm.tm_year & 0xff);      /* Years since 1900 */
+    call_back_req.month = ((ptm.tm_mon + 1) & 0xff); /* Month (1-12) */
+    call_back_req.day   = (ptm.tm_mday & 0xff);      /* Day (1-31) */
+    call_back_req.hour  = (ptm.tm_hour & 0xff);      /* Hour (0-23) */
+    call_back_req.min   = (ptm.tm_min & 0xff);       /* Minute (0-59) */
+    call_back_req.sec   = (ptm.tm_sec & 0xff);       /* Second (0-59) */
+
+    memcpy(*pack_payload, &call_back_req, sizeof(call_back_req));
+    *pack_payload += sizeof(dlog_mt_call_back_req_t);
+
+    printf("\t\tRequest callback at day/time: %04d-%02d-%02d / %2d:%02d:%02d\n",
+        call_back_req.year + 1900,
+        call_back_req.month,
+        call_back_req.day,
+        call_back_req.hour,
+        call_back_req.min,
+        call_back_req.sec);
+}
+
+/*
+ * When the modem bank is busy, answer a table update request that is not
+ * urgent with a call-back at a quiet hour, leaving the lines to calls that
+ * can't wait, such as card authorizations and CDR uploads.
+ *
+ * Returns 1 if the update was deferred.
+ */
+static int mm_defer_table_update(mm_context_t *context, char *terminal_id, uint8_t **pack_payload) {
+    time_t rawtime;
+    int    load_pct;
+
+    if ((context->call_back_load_pct == 0) || (context->terminal_upd_reason & TTBLREQ_URGENT)) {
+        return 0;
+    }
+
+    load_pct = mm_connection_load_pct();
+    if (load_pct < context->call_back_load_pct) {
+        return 0;
+    }
+
+    printf("\t\t%d%% of lines busy, deferring table update.\n", load_pct);
+
+    mm_time(context->test_mode, &rawtime);
+    generate_call_back_req(mm_connection_call_back_time(terminal_id, rawtime), pack_payload);
+    *(*pack_payload)++ = DLOG_MT_END_DATA;
+
+    return 1;
+}
+
 static int create_terminal_specific_directory(char *table_dir, char *terminal_id) {
     char dirname[268];
     int  status = 0;
@@ -1960,28 +3361,35 @@ time_t mm_time(int test_mode, time_t *rawtime) {
 }
 
 static void mm_display_help(const char *name, FILE *stream) {
-    /* "a:b:cd:e:f:hi:k:l:mn:p:qrst:uvwx:y:z:" */
+    /* "a:b:B:cd:e:f:hi:I:k:l:L:mn:p:P:qrst:T:uvwx:y:z:" */
     fprintf(stream,
-        "usage: %s [-vhmq] [-f <filename>] [-i \"modem init string\"] [-l <logfile>] [-p <pcapfile>] [-a <access_code>] [-k <key_code>] [-n <ncc_number>] [-d <default_table_dir] [-t <term_table_dir>] [-u <port>] [-x <shadybank_username>] [-y <shadybank_password>] [-z <shadybank_url>]\n",
+        "usage: %s [-vhmq] [-f <filename>] [-i \"modem init string\"] [-l <logfile>] [-L <percent>] [-B <seconds>] [-p <pcapfile>] [-P <terminal_id>] [-I <table_file>] [-a <access_code>] [-k <key_code>] [-n <ncc_number>] [-d <default_table_dir] [-t <term_table_dir>] [-T <phase>=<seconds>] [-u <port>] [-x <shadybank_username>] [-y <shadybank_password>] [-z <shadybank_url>]\n",
         name);
     fprintf(stream,
             "\t-a <access_code> - Craft 7-digit access code (default: CRASERV)\n" \
             "\t-b <baudrate> - Modem baud rate, in bps.  Defaults to 19200.\n" \
+            "\t-B <seconds> - Download budget per call, optional tables left are sent at the next call-in (default 0, no limit.)\n" \
             "\t-c - Always download complete table set.\n" \
             "\t-d <default_table_dir> - default table directory.\n" \
             "\t-e <error_inject_type> - Inject error on SIGBRK.\n" \
-            "\t-f <filename> modem device or file\n" \
+            "\t-f <filename> modem device or file, or pty:, tcp:<host>:<port>, rfc2217:<host>:<port>\n" \
+            "\t             (with -m, repeat for each line of a modem bank, up to 16)\n" \
+            "\t             (<host> is empty to listen, or an IPv6 address in brackets, as tcp:[::1]:2000)\n" \
             "\t-h this help.\n" \
             "\t-i \"modem init string\" - Modem initialization string.\n" \
             "\t-k <key_code> - Desk Terminal 10-digit key card code (default: 4012888888)\n" \
             "\t-l <logfile> - log bytes transmitted to and received from the terminal.  Useful for debugging.\n" \
+            "\t-L <percent> - With a modem bank, defer table updates to a quiet hour when <percent> of lines are busy (default 75, 0 = never.)\n" \
             "\t-m use serial modem (specify device with -f)\n" \
             "\t-n <Primary NCC Number> [-n <Secondary NCC Number>] - specify primary and optionally secondary NCC number.\n" \
             "\t-p <pcapfile> - Save packets in a .pcap file.\n" \
+            "\t-P <terminal_id> - Print the download plan of a terminal, and exit.\n" \
+            "\t-I <table_file> - Print the terminals that receive a table file, or store:<hash>, and exit.\n" \
             "\t-q - Don't display sign-on banner.\n" \
             "\t-r - Rating test mode: Amount charged determined by last 4 digits of dialed number.\n" \
             "\t-s - Download only minimum required tables to terminal.\n" \
             "\t-t <term_table_dir> - terminal-specific table directory.\n" \
+            "\t-T <phase>=<seconds> - Protocol timeout, phase is one of: packet (10), byte (2), ack (10), table (30), session (0 = none.)\n" \
             "\t-u <port> - Send packets as UDP to <port>.\n" \
             "\t-v verbose (multiple v's increase verbosity.\n" \
             "\t-w - don't monitor the modem for carrier loss.\n" \
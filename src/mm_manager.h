@@ -14,6 +14,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
 
 #ifdef _WIN32
 #define PACKED
@@ -43,6 +44,7 @@
 #define MODEM_RSP_CONNECT           (3)
 #define MODEM_RSP_NO_CARRIER        (4)
 #define MODEM_RSP_NULL              (5)
+#define MODEM_RSP_CALLER_ID         (6)     /* Caller ID (NMBR) received, see mm_modem_t. */
 
 /* Packet Error Flags */
 #define PKT_SUCCESS                 (0)
@@ -56,11 +58,18 @@
 #define PKT_ERROR_NO_CARRIER        (1 << 8)
 #define PKT_ERROR_FAILURE           (1 << 9)
 
-#define PKT_TIMEOUT_MAX             (10)    // Maximum time to wait for modem character
+#define PKT_TIMEOUT_PACKET_MS       (10000) // Maximum time to wait for the start of a packet
+#define PKT_TIMEOUT_INTER_BYTE_MS   (2000)  // Maximum time between bytes of a packet
+#define PKT_TIMEOUT_ACK_MS          (10000) // Maximum time to wait for an ACK
+#define PKT_TIMEOUT_TABLE_ACK_MS    (30000) // Maximum time to wait for a table to be acknowledged
+#define PKT_TIMEOUT_SESSION_MS      (0)     // Maximum session length, 0 for no limit
 #define PKT_MAX_RETRIES             (5)     // Maximum number of time to retry an errored packet
+#define PKT_LINE_RATE               (1200)  // Terminal modem line rate, in bps
 
 #define PKT_TABLE_ID_OFFSET         (0x05)
 #define PKT_TABLE_DATA_OFFSET       (PKT_TABLE_ID_OFFSET + 1)
+#define PKT_OVERHEAD_BYTES          (6 + PKT_TABLE_ID_OFFSET)   // Framing, CRC and terminal ID
+#define PKT_ACK_BYTES               (6)
 
 #define PKT_TABLE_DATA_LEN_MAX      (245)   // Maximum table data length
 
@@ -223,6 +232,9 @@
 #define TTBLREQ_LOST_MEMORY         0x04    // Lost Memory
 #define TTBLREQ_PWR_LOST_ON_DL      0x08    // Power Lost on Download
 #define TTBLREQ_CASHBOX_STATUS      0x80    // Cash Box Status Requested
+/* Requests answered even when the lines are busy; the cash box status is only sent with the tables. */
+#define TTBLREQ_URGENT              (TTBLREQ_CRAFT_FORCE_DL | TTBLREQ_CRAFT_INSTALL | TTBLREQ_LOST_MEMORY | TTBLREQ_PWR_LOST_ON_DL | \
+                                     TTBLREQ_CASHBOX_STATUS)
 
 /* TCOLLCT (Terminal Cash Box Collections) pp. 2-464 */
 #define CASHBOX_STATUS_NORMAL           0x00    // Normal State
@@ -1277,6 +1289,49 @@ typedef struct dlog_mt_npa_nxx_table {
 
 #define TABLE_PATH_MAX_LEN   283
 
+/*
+ * Content-addressed table store, shared by mm_manager and mm_tablestore:
+ * each table file is stored once, by the hash of its contents, and a
+ * terminal's tables are assigned to it by hash.
+ */
+#define TABLE_HASH_LEN       17     /* 16 hex digits of the 64-bit FNV-1a hash, and NUL. */
+#define TABLE_STORE_PREFIX   "store:"
+
+/*
+ * Table overlay: a terminal's table kept as a patch (see mm_table_patch)
+ * on the model or default table it would otherwise be sent.  The base an
+ * overlay was made from is kept in the table store by its hash, so the
+ * overlay still applies after the base is changed.
+ */
+#define TABLE_OVERLAY_EXT    ".patch"
+
+#define TABLESTORE_SCHEMA    "CREATE TABLE IF NOT EXISTS TABLESTORE ( " \
+    "HASH VARCHAR(16) NOT NULL PRIMARY KEY," \
+    "TABLE_ID INTEGER NOT NULL," \
+    "DATA_LENGTH INTEGER NOT NULL," \
+    "TABLE_DATA BLOB);"
+
+#define TABLEASSIGN_SCHEMA   "CREATE TABLE IF NOT EXISTS TABLEASSIGN ( " \
+    "TERMINAL_ID VARCHAR(10) NOT NULL," \
+    "TABLE_ID INTEGER NOT NULL," \
+    "HASH VARCHAR(16) NOT NULL," \
+    "ASSIGNED_TIME BIGINT DEFAULT 0," \
+    "PRIMARY KEY(TERMINAL_ID, TABLE_ID));" \
+    "CREATE INDEX IF NOT EXISTS TABLEASSIGN_HASH ON TABLEASSIGN (HASH);"
+
+/* Tables in the store that overlays were made on, kept while unassigned. */
+#define TABLEBASE_SCHEMA     "CREATE TABLE IF NOT EXISTS TABLEBASE ( " \
+    "HASH VARCHAR(16) NOT NULL PRIMARY KEY);"
+
+/* Link-layer statistics, counted from the start of the line. */
+typedef struct mm_proto_stats {
+    uint32_t rx_packets;
+    uint32_t rx_errors;         /* CRC and framing errors. */
+    uint32_t rx_timeouts;
+    uint32_t tx_packets;
+    uint32_t tx_retries;        /* Packets sent again, after a NACK or missing ACK. */
+} mm_proto_stats_t;
+
 typedef struct mm_proto_ctx {
     struct mm_serial_context* serial_context;
     FILE* pcapstream;
@@ -1291,6 +1346,18 @@ typedef struct mm_proto_ctx {
     uint8_t error_inject_type;
     uint8_t debuglevel;
     uint8_t send_udp;
+    /* Protocol phase timeouts in milliseconds, see PKT_TIMEOUT_*. */
+    uint32_t timeout_packet;
+    uint32_t timeout_inter_byte;
+    uint32_t timeout_ack;
+    uint32_t timeout_table_ack;
+    uint32_t timeout_session;
+    uint64_t session_deadline;  /* mm_monotonic_ms() deadlines, 0 for none. */
+    uint64_t phase_deadline;
+    uint64_t tx_complete;       /* When the last transmitted byte leaves the modem. */
+    uint64_t rx_complete;       /* When the last packet was received. */
+    struct mm_modem* modem;     /* Modem control for this line, NULL if none. */
+    mm_proto_stats_t stats;
 } mm_proto_t;
 
 typedef struct mm_telco {
@@ -1298,16 +1365,138 @@ typedef struct mm_telco {
     uint8_t region_code[3];
 } mm_telco_t;
 
+#define MM_MAX_LINES                (16)    /* Maximum number of modem lines */
+
+/* Modem control states */
+#define MODEM_STATE_IDLE            (0)     /* Ready, waiting for result codes. */
+#define MODEM_STATE_STARTING        (1)
+#define MODEM_STATE_RESET           (2)     /* Waiting for OK to the reset string. */
+#define MODEM_STATE_INIT            (3)     /* Waiting for OK to the init string. */
+#define MODEM_STATE_HANGUP          (4)     /* DTR is dropped. */
+#define MODEM_STATE_FAILED          (5)     /* Modem did not respond to initialization. */
+#define MODEM_STATE_COMMAND         (6)     /* Waiting for OK to a single command. */
+
+typedef struct mm_modem {
+    struct mm_serial_context* serial_context;
+    const char* reset_string;
+    const char* init_string;
+    const char* command;        /* Command awaiting OK. */
+    uint8_t state;
+    uint8_t tries;
+    uint64_t timer;             /* mm_monotonic_ms() when the current state times out. */
+    char rsp[80];               /* Result code being assembled. */
+    size_t rsp_len;
+    char caller_id[21];         /* Caller ID of the current call, "" if none. */
+} mm_modem_t;
+
+typedef void (*mm_caller_id_fn)(void* arg, const char* caller_id);
+
+/* Line states */
+#define LINE_STATE_IN_SERVICE       (0)
+#define LINE_STATE_OUT_OF_SERVICE   (1)     /* Waiting to re-initialize the modem. */
+#define LINE_STATE_REINIT           (2)     /* Re-initializing the modem. */
+#define LINE_STATE_BUSY_OUT         (3)     /* Off-hook due to a high error rate, on probation. */
+
+#define LINE_REINIT_BACKOFF_MIN_MS  (5000)  /* First re-initialization delay, doubled on each failure */
+#define LINE_REINIT_BACKOFF_MAX_MS  (300000)
+
+/*
+ * A line is busied out when errors and retries exceed LINE_HEALTH_MAX_ERROR_PCT
+ * of the packets over its last LINE_HEALTH_CALLS calls, once at least
+ * LINE_HEALTH_MIN_PACKETS packets were exchanged.
+ */
+#define LINE_HEALTH_CALLS           (8)
+#define LINE_HEALTH_MIN_PACKETS     (100)
+#define LINE_HEALTH_MAX_ERROR_PCT   (10)
+#define LINE_PROBATION_MS           (15 * 60 * 1000)    /* Time a line stays busied out */
+
+/* Call-back scheduling */
+#define CALL_BACK_LOAD_PCT_DEFAULT  (75)    /* % of lines in a call at which table updates are deferred */
+
 typedef struct mm_connection {
     FILE* logstream;
     FILE* bytestream;
     char modem_reset_string[256];
     char modem_init_string[256];
     int test_mode;
+    int line;                   /* Line number, from 0. */
+    const char* modem_dev;
+    int baudrate;
+    mm_modem_t modem;
+    mm_caller_id_fn caller_id_fn;   /* Called when the modem reports Caller ID. */
+    void* caller_id_arg;
+    /* Line health, line_state and in_call are changed with the lines locked. */
+    uint8_t line_state;         /* LINE_STATE_* */
+    uint8_t in_call;            /* A terminal is connected. */
+    uint32_t reinit_backoff;    /* Delay before the next re-initialization, in ms. */
+    uint64_t reinit_time;       /* mm_monotonic_ms() of the next re-initialization. */
+    uint32_t calls;
+    uint32_t failures;
+    uint32_t busy_outs;
+    uint64_t probation_time;    /* mm_monotonic_ms() when a busied out line returns to service. */
+    mm_proto_stats_t call_start;    /* proto.stats at the start of the call. */
+    uint32_t health_packets[LINE_HEALTH_CALLS];    /* Packets and errors of recent calls */
+    uint32_t health_errors[LINE_HEALTH_CALLS];
+    uint8_t health_index;
     /* Terminal Communication */
     mm_proto_t proto;
 } mm_connection_t;
 
+/*
+ * Last known state of a terminal, kept by the terminal state cache and
+ * persisted in the TERMSTATE table.
+ */
+typedef struct mm_termstate {
+    char terminal_id[11];
+    uint8_t terminal_type;      /* 0 if not known. */
+    char control_rom_edition[8];
+    uint64_t status_word;
+    cashbox_status_univ_t cashbox_status;
+    int16_t call_in_offset;     /* Minutes into the call-in interval, -1 if not assigned. */
+    uint16_t session_secs;      /* Average length of the terminal's sessions. */
+    time_t dl_started;          /* Start of the download in progress, 0 if none. */
+    uint8_t dl_acked[32];       /* Tables of that download ACKed, one bit per table ID. */
+} mm_termstate_t;
+
+/* mm_table_download_action() */
+#define DL_TABLE_SEND               (0)
+#define DL_TABLE_ACKED              (1)     /* ACKed by the download resumed, and not changed since */
+#define DL_TABLE_DEFERRED           (2)     /* Optional, and the download budget is used */
+
+/* Call-in scheduling */
+#define CALL_IN_INTERVAL_MINS       (12 * 60)   /* Terminals call in twice a day */
+#define CALL_IN_SESSION_SECS        (120)       /* Assumed session length of a new terminal */
+
+/* A table of a download plan. */
+typedef struct mm_plan_entry {
+    uint8_t table_id;
+    uint8_t source_id;          /* Table it was loaded from, transcoded to table_id. */
+    uint8_t generated;          /* Generated by mm_manager when sent. */
+    uint16_t packets;
+    uint32_t wire_ms;           /* Estimated time to send it. */
+    size_t len;
+    uint8_t* image;             /* Loaded table, NULL if generated or not found. */
+    char* source;               /* File it was loaded from, NULL if none. */
+} mm_plan_entry_t;
+
+/*
+ * Download plan of a terminal: the tables it is sent, in order, resolved
+ * to the files they are loaded from.  Built while the terminal's call is
+ * ringing if Caller ID identifies it, otherwise when the download starts.
+ * Plans are shared by all lines, by terminal and terminal type, until a
+ * table file or assignment changes.
+ */
+typedef struct mm_plan {
+    char terminal_id[11];       /* "" if there is no plan. */
+    uint8_t terminal_type;      /* Type the plan was built for. */
+    uint32_t generation;        /* Table generation it was built in. */
+    int count;
+    size_t len;
+    uint32_t packets;
+    uint32_t wire_ms;
+    mm_plan_entry_t entry[256];
+} mm_plan_t;
+
 typedef struct mm_context {
     void* database;
     mm_connection_t connection;
@@ -1331,14 +1520,36 @@ typedef struct mm_context {
     cashbox_status_univ_t cashbox_status;
     uint8_t rating_test_mode;
     uint8_t test_mode;
+    uint8_t call_back_load_pct;     /* Defer table updates when this % of lines are busy, 0 = never. */
+    uint16_t download_budget_secs;  /* Defer optional tables after this long downloading, 0 = no limit. */
+    struct mm_context* lines[MM_MAX_LINES]; /* Line 0 only: contexts of the other lines. */
+    mm_termstate_t termstate;   /* State of the terminal in session. */
+    mm_plan_t* plan;            /* Download plan of that terminal, allocated when first needed. */
 } mm_context_t;
 
 typedef uint32_t pkt_status_t;  /* Packet status flags. */
 
 /* MM Connection */
 int mm_connection_open(mm_connection_t* connection, const char* modem_dev, int baudrate, int test_mode);
+int mm_connection_init_wait(mm_connection_t* connections[], int count);
 int mm_connection_wait(mm_connection_t* connection);
+void mm_connection_status(mm_connection_t* connections[], int count, FILE* stream);
+void mm_connection_call_ended(mm_connection_t* connection);
+int mm_connection_load_pct(void);
+int mm_connection_line_count(void);
+time_t mm_connection_call_back_time(const char* terminal_id, time_t now);
+int mm_connection_create_tables(void* db);
+int mm_connection_load_calls(void* db);
+int mm_connection_save_calls(void* db);
 int mm_connection_close(mm_connection_t* connection);
+void* mm_line_thread_start(int (*fn)(void* arg), void* arg);
+void mm_line_thread_join(void* line_thread);
+void mm_lines_lock(void);
+void mm_lines_unlock(void);
+void mm_auth_lock(void);
+void mm_auth_unlock(void);
+void mm_termstate_lock(void);
+void mm_termstate_unlock(void);
 
 /* MM Protocol */
 extern int proto_connect(mm_proto_t* proto);
@@ -1347,11 +1558,18 @@ extern int proto_connected(mm_proto_t* proto);
 extern int receive_mm_table(mm_proto_t* proto, mm_table_t* table);
 extern int send_mm_table(mm_proto_t* proto, uint8_t* payload, size_t len);
 extern int wait_for_table_ack(mm_proto_t* proto, uint8_t table_id);
+extern int proto_set_timeout(mm_proto_t* proto, const char* spec);
+extern uint32_t proto_table_wire_ms(const mm_proto_t* proto, size_t len, uint16_t* packets);
 
 /* modem functions */
 extern int init_modem(struct mm_serial_context *pserial_context, const char *modem_reset_string, const char *modem_init_string);
 extern int wait_for_modem_response(struct mm_serial_context *pserial_context, int max_tries);
 extern int hangup_modem(struct mm_serial_context *pserial_context);
+extern void modem_attach(mm_modem_t *modem, struct mm_serial_context *pserial_context);
+extern void modem_start_init(mm_modem_t *modem, const char *modem_reset_string, const char *modem_init_string);
+extern void modem_start_command(mm_modem_t *modem, const char *command);
+extern void modem_start_hangup(mm_modem_t *modem);
+extern int modem_poll(mm_modem_t *modem, int timeout_ms);
 
 /* accounting functions */
 extern int mm_acct_create_tables(void *db);
@@ -1364,18 +1582,53 @@ extern int mm_acct_save_TCASHST(void *db, mm_telco_t *telco, char* terminal_id,
 extern int mm_acct_save_TCOLLST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_cash_box_collection_t* cash_box_collection);
 extern int mm_acct_save_TOPCODE(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_maint_req_t *maint);
 extern int mm_acct_save_TPERFST(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_perf_stats_record_t* perf_stats);
-extern int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_term_status_t* dlog_mt_term_status);
+extern uint64_t mm_acct_load_TSTATUS(void *db, char* terminal_id);
+extern int mm_acct_save_TSTATUS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_term_status_t* dlog_mt_term_status, uint64_t *known_status_word);
+extern uint8_t mm_acct_load_terminal_type(void *db, char* terminal_id);
 extern int mm_acct_save_TSWVERS(void *db, mm_telco_t *telco, char* terminal_id, dlog_mt_sw_version_t* dlog_mt_sw_version, uint8_t* terminal_type);
 
 /* Table functions */
 int    mm_table_create_tables(void* db);
 size_t mm_table_load(mm_context_t* context, uint8_t table_id, uint64_t version_timestamp, uint8_t* buffer, size_t buflen);
 int    mm_table_save(mm_context_t* context, uint8_t table_id, uint64_t version_timestamp, uint8_t* buffer, size_t buflen);
+int    mm_table_store_assigned(void* db, const char* terminal_id, uint8_t table_id, char* hash, time_t* assigned_time);
+int    mm_table_store_init(void);
+int    mm_table_store_load(void* db, const char* hash, uint8_t table_id, uint8_t** buffer, size_t* len);
+void   mm_table_store_free(void);
+int    mm_table_overlay_init(void);
+int    mm_table_overlay_load(void* db, const char* fname, const char* base_fname, uint8_t table_id, uint8_t** buffer, size_t* len);
+void   mm_table_overlay_free(void);
 
 /* Manager Configuration Database */
 int mm_config_create_tables(void* db);
 uint8_t mm_config_get_term_type_from_control_rom_edition(void* db, const char* control_rom_edition);
 
+/* Terminal state cache */
+int mm_termstate_create_tables(void* db);
+int mm_termstate_init(void* db);
+int mm_termstate_get(void* db, const char* terminal_id, mm_termstate_t* state);
+int mm_termstate_put(void* db, const mm_termstate_t* state);
+void mm_termstate_free(void);
+void mm_termstate_session_ended(mm_termstate_t* state, uint32_t session_secs);
+int mm_termstate_call_in_offset(void* db, mm_termstate_t* state, int lines);
+
+/* Table transcoding */
+int mm_transcode_init(void);
+uint8_t mm_transcode_source(uint8_t table_id, uint8_t terminal_type);
+int mm_transcode_table(uint8_t table_id, uint8_t terminal_type, uint8_t** image, size_t* len);
+void mm_transcode_free(void);
+
+/* Bounded cache */
+typedef struct mm_cache mm_cache_t;
+
+mm_cache_t* mm_cache_create(size_t max_bytes);
+int mm_cache_get(mm_cache_t* cache, const void* key, size_t key_len, uint8_t** value, size_t* len);
+int mm_cache_read(mm_cache_t* cache, const void* key, size_t key_len, void* value, size_t len);
+int mm_cache_put(mm_cache_t* cache, const void* key, size_t key_len, const void* value, size_t len, int replace);
+int mm_cache_remove(mm_cache_t* cache, const void* key, size_t key_len);
+void mm_cache_clear(mm_cache_t* cache);
+void mm_cache_free(mm_cache_t* cache);
+
 /* database functions */
 extern void *mm_open_database(const char *db_filename);
 extern int mm_close_database(void *db);
@@ -1385,9 +1638,22 @@ extern uint64_t mm_sql_read_uint64(void* db, const char* sql);
 extern int mm_sql_read_blob(void* db, const char* sql, uint8_t* buffer, size_t buflen);
 extern int mm_sql_write_blob(void* db, const char* sql, uint8_t* buffer, size_t buflen);
 extern int mm_sql_load_TCASHST(void* db, const char* terminal_id, cashbox_status_univ_t* cashbox_status);
+extern int mm_sql_load_TERMSTATE(void* db, const char* terminal_id, mm_termstate_t* state);
+extern int mm_sql_save_TERMSTATE(void* db, const mm_termstate_t* state);
+extern int mm_sql_foreach_TERMSTATE(void* db, void (*fn)(void* arg, const mm_termstate_t* state), void* arg);
+extern int mm_sql_load_TABLEASSIGN(void* db, const char* terminal_id, uint8_t table_id, char* hash, time_t* assigned_time);
+extern int mm_sql_load_TABLESTORE(void* db, const char* hash, uint8_t** image, size_t* len);
+extern int mm_sql_save_TABLEBASE(void* db, const char* hash, uint8_t table_id, const uint8_t* image, size_t len);
+extern int mm_sql_load_LINECALLS(void* db, double* calls, time_t* decayed_time);
+extern int mm_sql_save_LINECALLS(void* db, const double* calls, time_t decayed_time);
 
 /* mm_util */
 extern uint16_t crc16(uint16_t crc, uint8_t *buf, size_t len);
+extern uint64_t mm_fnv1a(const uint8_t *buf, size_t len);
+extern uint64_t mm_monotonic_ms(void);
+extern void mm_sleep_ms(uint32_t ms);
+extern int mm_list_dir(const char *dir, int (*fn)(void *arg, const char *dir, const char *name), void *arg);
+extern int mm_make_directory(const char *dirname);
 extern void dump_hex(const uint8_t *data, size_t len);
 extern char *phone_num_to_string(char *string_buf, size_t string_len, uint8_t* num_buf, size_t num_buf_len);
 extern uint8_t string_to_bcd_a(char* number_string, uint8_t* buffer, uint8_t buff_len);
@@ -1401,6 +1667,9 @@ extern int print_mm_packet(int direction, mm_packet_t *pkt);
 extern const char* error_inject_type_to_str(uint8_t type);
 extern uint16_t term_type_to_mtr(uint8_t term_type);
 extern uint8_t term_type_to_model(uint8_t term_type);
+extern int mm_table_is_mandatory(uint8_t table_id);
+extern int mm_table_download_order(const uint8_t *table_list, uint8_t terminal_type, int minimal_table_set, uint8_t *order);
+extern int mm_table_download_action(uint8_t table_id, int resume, const uint8_t *dl_acked, int changed, int budget_used);
 extern void print_bits(uint8_t bits, char* str_array[]);
 extern const char* table_to_string(uint8_t table);
 extern const char* alarm_id_to_string(uint8_t alarm_id);
@@ -1418,6 +1687,21 @@ extern void print_comm_stat_table(dlog_mt_comm_stat_params_t* comm_stat_table);
 extern void print_fconfig_table(dlog_mt_fconfig_opts_t* fconfig_table);
 extern int mm_validate_table_fsize(uint8_t table_id, FILE *stream, unsigned long expected_size);
 
+/* mm_thread */
+#define MM_THREADS_MAX  (64)
+extern int mm_default_threads(void);
+extern void mm_parallel_for(int count, int threads, void (*fn)(void *arg, int index), void *arg);
+
+/* mm_lcd_codec */
+extern void mm_lcd_unpack(const uint8_t *packed, int bits, uint8_t *flags);
+extern void mm_lcd_pack(const uint8_t *flags, int bits, uint8_t *packed);
+
+/* mm_table_patch */
+#define TABLE_PATCH_HEADER_LEN  (16)
+extern int mm_table_patch_create(const uint8_t *base, size_t base_len, const uint8_t *image, size_t len, uint8_t **patch, size_t *patch_len);
+extern int mm_table_patch_base_hash(const uint8_t *patch, size_t patch_len, uint64_t *hash);
+extern int mm_table_patch_apply(const uint8_t *base, size_t base_len, const uint8_t *patch, size_t patch_len, uint8_t **image, size_t *len);
+
 /* mm_pcap */
 int mm_create_pcap(const char* capfilename, FILE** pcapstream);
 int mm_add_pcap_rec(FILE* pcapstream, int direction, mm_packet_t* pkt, uint32_t ts_sec, uint32_t ts_usec);
@@ -1426,6 +1710,10 @@ int mm_close_pcap(FILE* pcapstream);
 #ifdef _WIN32
 char* basename(char* path);
 errno_t localtime_r(time_t const* const sourceTime, struct tm* tmDest);
+#ifndef S_ISDIR
+#define S_ISDIR(m)  (((m) & S_IFMT) == S_IFDIR)
+#define S_ISREG(m)  (((m) & S_IFMT) == S_IFREG)
+#endif /* S_ISDIR */
 #endif /* _WIN32 */
 
 #ifdef __BYTE_ORDER
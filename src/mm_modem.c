@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h> /* String function definitions */
+#include <ctype.h>
 #include <time.h>
 #include <fcntl.h>  /* File control definitions */
 #include <errno.h>  /* Error number definitions */
@@ -36,135 +37,281 @@ const char* modem_responses[] = {
     "NULL"
 };
 
-/* Static function declarations */
-static int send_at_command(mm_serial_context_t *pserial_context, const char *command);
+#define MODEM_CMD_TIMEOUT_MS    (5000)  /* Time to wait for a result code */
+#define MODEM_CMD_TRIES         (3)
+#define MODEM_HANGUP_MS         (1000)  /* Time DTR is held low to hang up */
 
-/* Initialize modem with a series of AT commands */
-int init_modem(mm_serial_context_t *pserial_context, const char *modem_reset_string, const char *modem_init_string) {
-    int status;
+/*
+ * Numeric (ATV0) result codes.  Codes 5 and 10 and up are CONNECT at
+ * various rates.
+ */
+static const int modem_numeric_responses[] = {
+    MODEM_RSP_OK,           /* 0 */
+    MODEM_RSP_CONNECT,      /* 1 */
+    MODEM_RSP_RING,         /* 2 */
+    MODEM_RSP_NO_CARRIER,   /* 3 */
+    MODEM_RSP_ERROR,        /* 4 */
+    MODEM_RSP_CONNECT,      /* 5 CONNECT 1200 */
+    MODEM_RSP_ERROR,        /* 6 NO DIALTONE */
+    MODEM_RSP_ERROR,        /* 7 BUSY */
+    MODEM_RSP_ERROR,        /* 8 NO ANSWER */
+};
 
-    // Only do a separate reset if the modem_reset_string is present
-    if (modem_reset_string != NULL && *modem_reset_string != '\0') {
-        printf("Resetting modem: '%s'\n", modem_reset_string);
-        status = send_at_command(pserial_context, modem_reset_string);
-        if (status != MODEM_RSP_OK) {
-            return -1;
+/*
+ * Decode a result code line, in either verbose or numeric (ATV0) form.
+ * Anything else, such as the echo of a command, is MODEM_RSP_NULL.
+ */
+static int modem_parse_response(const char *line) {
+    size_t len = strlen(line);
+    size_t i;
+
+    for (i = 0; (i < len) && isdigit((unsigned char)line[i]); i++) { }
+
+    if ((len > 0) && (i == len)) {
+        int code = atoi(line);
+
+        if (code < (int)(sizeof(modem_numeric_responses) / sizeof(modem_numeric_responses[0]))) {
+            return modem_numeric_responses[code];
         }
+        return (code >= 10) ? MODEM_RSP_CONNECT : MODEM_RSP_NULL;
     }
 
-    printf("Intializing modem: '%s'\n", modem_init_string);
-    status = send_at_command(pserial_context, modem_init_string);
+    for (i = MODEM_RSP_OK; i < MODEM_RSP_NULL; i++) {
+        size_t rsp_len = strlen(modem_responses[i]);
 
-    if (status != MODEM_RSP_OK) {
-        return -1;
+        /* CONNECT may be followed by the connection rate. */
+        if ((strncmp(line, modem_responses[i], rsp_len) == 0) &&
+            ((line[rsp_len] == '\0') || ((i == MODEM_RSP_CONNECT) && (line[rsp_len] == ' ')))) {
+            return (int)i;
+        }
     }
-    return status;
+
+    return MODEM_RSP_NULL;
 }
 
-/* Wait for modem to connect */
-int wait_for_modem_response(mm_serial_context_t *pserial_context, int max_tries) {
-    char buffer[255] = { 0 }; /* Input buffer */
-    uint8_t bufindex = 0;
-    uint8_t i;
-    int     tries = 0;     /* Number of tries so far */
+/* Send an AT command, it is retried by modem_poll() if not answered. */
+static void modem_send_command(mm_modem_t *modem, const char *command) {
+    char buffer[260];
+
+    modem->command = command;
+    flush_serial(modem->serial_context);
+    snprintf(buffer, sizeof(buffer), "%s\r", command);
 
-    drain_serial(pserial_context);
+    if (write_serial(modem->serial_context, buffer, strnlen(buffer, sizeof(buffer))) <= 0) {
+        fprintf(stderr, "%s: Error writing to modem.\n", __func__);
+    }
+
+    modem->timer = mm_monotonic_ms() + MODEM_CMD_TIMEOUT_MS;
+}
 
-    do {
-        ssize_t nbytes; /* Number of bytes read */
-        bufindex  = 0;
-        buffer[0] = '\0';
+/* Advance the initialization sequence: reset, then init. */
+static void modem_next_command(mm_modem_t *modem) {
+    if ((modem->state == MODEM_STATE_INIT) || (modem->init_string == NULL)) {
+        modem->state = MODEM_STATE_IDLE;
+        return;
+    }
 
-        /* read characters into our string buffer until we get a CR or NL */
-        while ((nbytes = read_serial(pserial_context, &buffer[bufindex], 1, 0)) > 0) {
-            bufindex        += (uint8_t)nbytes;
-            buffer[bufindex] = '\0';
+    if ((modem->state == MODEM_STATE_STARTING) && (modem->reset_string != NULL) && (*modem->reset_string != '\0')) {
+        modem->state = MODEM_STATE_RESET;
+        modem_send_command(modem, modem->reset_string);
+    } else {
+        modem->state = MODEM_STATE_INIT;
+        modem_send_command(modem, modem->init_string);
+    }
+}
 
-            if ((buffer[bufindex - 1] == '\n') || (buffer[bufindex - 1] == '\r') || (bufindex >= (sizeof(buffer) - 1))) break;
+void modem_attach(mm_modem_t *modem, struct mm_serial_context *pserial_context) {
+    memset(modem, 0, sizeof(mm_modem_t));
+    modem->serial_context = pserial_context;
+    modem->state = MODEM_STATE_IDLE;
+}
+
+/*
+ * Start initializing the modem with a series of AT commands.  Progress is
+ * made by modem_poll(), the modem is ready when its state is
+ * MODEM_STATE_IDLE, or MODEM_STATE_FAILED if it did not respond.
+ */
+void modem_start_init(mm_modem_t *modem, const char *modem_reset_string, const char *modem_init_string) {
+    modem->reset_string = modem_reset_string;
+    modem->init_string  = modem_init_string;
+    modem->tries = 0;
+    modem->rsp_len = 0;
+    modem->state = MODEM_STATE_STARTING;
+
+    if ((modem_reset_string != NULL) && (*modem_reset_string != '\0')) {
+        printf("Resetting modem: '%s'\n", modem_reset_string);
+    }
+    printf("Intializing modem: '%s'\n", modem_init_string);
+
+    modem_next_command(modem);
+}
+
+/* Send a single AT command, such as ATH1 to take the line off-hook. */
+void modem_start_command(mm_modem_t *modem, const char *command) {
+    modem->tries = 0;
+    modem->state = MODEM_STATE_COMMAND;
+    modem_send_command(modem, command);
+}
+
+/* Hang up by dropping DTR; it is raised again by modem_poll() once the modem has hung up. */
+void modem_start_hangup(mm_modem_t *modem) {
+    modem->caller_id[0] = '\0';
+    serial_set_dtr(modem->serial_context, 0);
+    modem->timer = mm_monotonic_ms() + MODEM_HANGUP_MS;
+    modem->state = MODEM_STATE_HANGUP;
+}
+
+/*
+ * Run the modem state machine, waiting up to timeout_ms for input, or
+ * as long as the state allows if negative (see serial_read_wakes().)
+ *
+ * Returns the result code received (MODEM_RSP_*), MODEM_RSP_NULL if
+ * there was none, or MODEM_RSP_READ_ERROR.  Result codes that are part of
+ * initialization are consumed.
+ */
+int modem_poll(mm_modem_t *modem, int timeout_ms) {
+    uint64_t now = mm_monotonic_ms();
+    int response;
+
+    if (modem->state == MODEM_STATE_FAILED) {
+        return MODEM_RSP_NULL;
+    }
+
+    if ((modem->state != MODEM_STATE_IDLE) && (now >= modem->timer)) {
+        if (modem->state == MODEM_STATE_HANGUP) {
+            serial_set_dtr(modem->serial_context, 1);
+            modem->state = MODEM_STATE_IDLE;
+        } else if (++modem->tries >= MODEM_CMD_TRIES) {
+            fprintf(stderr, "%s: No response from modem.\n", __func__);
+            modem->state = MODEM_STATE_FAILED;
+            return MODEM_RSP_NULL;
+        } else {
+            modem_send_command(modem, modem->command);
         }
+        now = mm_monotonic_ms();
+    }
+
+    /* Don't sleep past the current state's timer. */
+    if ((modem->state != MODEM_STATE_IDLE) && (modem->timer - now < (uint64_t)timeout_ms)) {
+        timeout_ms = (int)(modem->timer - now);
+    }
+
+    for (;;) {
+        char    c = '\0';
+        ssize_t nbytes = read_serial_timeout(modem->serial_context, &c, 1, timeout_ms, 0);
 
         if (nbytes < 0) {
             return MODEM_RSP_READ_ERROR;
         }
 
-        /* See if we got the expected response */
-        for (i = 0; i < (sizeof(modem_responses) / sizeof(char*)); i++) {
-            if (strstr(buffer, modem_responses[i]) != 0) {
-                return i;
+        if (nbytes == 0) {
+            return MODEM_RSP_NULL;
+        }
+
+        /* Further characters of the line are expected right away. */
+        timeout_ms = 100;
+
+        if (c == '\0') continue;
+
+        if ((c != '\r') && (c != '\n')) {
+            if (modem->rsp_len < sizeof(modem->rsp) - 1) {
+                modem->rsp[modem->rsp_len++] = c;
             }
+            continue;
         }
-        tries++;
-    } while (tries < max_tries);
 
-    return MODEM_RSP_NULL;
-}
+        if (modem->rsp_len == 0) continue;
 
-#define USE_MODEM_DTR
-int hangup_modem(mm_serial_context_t *pserial_context) {
-#ifdef USE_MODEM_DTR
-    serial_set_dtr(pserial_context, 0);
-#ifdef _WIN32
-    Sleep(1000);
-#else
-    sleep(1);
-#endif /* _WIN32 */
-    serial_set_dtr(pserial_context, 1);
-    return 0;
-#else
-    int tries; /* Number of tries so far */
+        modem->rsp[modem->rsp_len] = '\0';
+        modem->rsp_len = 0;
 
-    for (tries = 0; tries < 3; tries++) {
-        flush_serial(pserial_context);
+        /* Caller ID, reported between rings as "NMBR = <number>". */
+        if (strncmp(modem->rsp, "NMBR", 4) == 0) {
+            const char *number = strchr(modem->rsp, '=');
+            size_t      i = 0;
 
-        for (int i = 0; i < 3; i++) {
-            write_serial(pserial_context, "+", 1);
-#ifdef _WIN32
-            Sleep(100);
-#else  /* ifdef _WIN32 */
-            nanosleep((const struct timespec[]) { { 0, 100 * 1000000L } }, NULL);
-#endif /* ifdef _WIN32 */
-        }
+            if (number == NULL) continue;
 
-        /* Sleep only if using a real modem. */
-        if (pserial_context->fd != -1) {
-#ifdef _WIN32
-            Sleep(1000);
-#else  /* ifdef _WIN32 */
-            sleep(1); /* Some modems need time to process the AT command. */
-#endif /* ifdef _WIN32 */
-        }
+            for (number++; (*number != '\0') && (i < sizeof(modem->caller_id) - 1); number++) {
+                if (isdigit((unsigned char)*number)) modem->caller_id[i++] = *number;
+            }
+            modem->caller_id[i] = '\0';
+
+            if (i == 0) continue;
 
-        if (wait_for_modem_response(pserial_context, 1) == MODEM_RSP_OK) {
-            return send_at_command(pserial_context, "ATH0");
+            response = MODEM_RSP_CALLER_ID;
+            break;
         }
+
+        if ((response = modem_parse_response(modem->rsp)) == MODEM_RSP_NULL) continue;
+
+        break;
+    }
+
+    switch (modem->state) {
+        case MODEM_STATE_RESET:
+        case MODEM_STATE_INIT:
+        case MODEM_STATE_COMMAND:
+            if (response == MODEM_RSP_OK) {
+                modem->tries = 0;
+                if (modem->state == MODEM_STATE_COMMAND) {
+                    modem->state = MODEM_STATE_IDLE;
+                } else {
+                    modem_next_command(modem);
+                }
+            } else if (response == MODEM_RSP_ERROR) {
+                modem->timer = 0;   /* Retry right away. */
+            }
+            return MODEM_RSP_NULL;
+        case MODEM_STATE_HANGUP:
+            /* Results of the call being dropped. */
+            return MODEM_RSP_NULL;
+        default:
+            return response;
     }
-    return -1;
-#endif /* USE_MODEM_DTR */
 }
 
-/* Send AT Command to Modem */
-static int send_at_command(mm_serial_context_t *pserial_context, const char *command) {
-    char buffer[80]; /* Input buffer */
-    int  tries;      /* Number of tries so far */
-    int  modem_response = MODEM_RSP_ERROR;
+/* Initialize modem with a series of AT commands */
+int init_modem(mm_serial_context_t *pserial_context, const char *modem_reset_string, const char *modem_init_string) {
+    mm_modem_t modem;
 
-    for (tries = 0; tries < 3; tries++) {
-        flush_serial(pserial_context);
-        snprintf(buffer, sizeof(buffer), "%s\r", command);
+    modem_attach(&modem, pserial_context);
+    modem_start_init(&modem, modem_reset_string, modem_init_string);
 
-        /* send an AT command followed by a CR */
-        if (write_serial(pserial_context, buffer, strnlen(buffer, sizeof(buffer))) == 0) {
-            continue;
+    while ((modem.state != MODEM_STATE_IDLE) && (modem.state != MODEM_STATE_FAILED)) {
+        if (modem_poll(&modem, MODEM_CMD_TIMEOUT_MS) == MODEM_RSP_READ_ERROR) {
+            return -1;
         }
+    }
 
-        /* Some modems need time to process the AT command. */
-#ifdef _WIN32
-        Sleep(100);
-#else  /* ifdef _WIN32 */
-        nanosleep((const struct timespec[]) { { 0, 100 * 1000000L } }, NULL);
-#endif /* _WIN32 */
+    return (modem.state == MODEM_STATE_IDLE) ? 0 : -1;
+}
 
-        if ((modem_response = wait_for_modem_response(pserial_context, 5)) == MODEM_RSP_OK) break;
+/* Wait for a result code from the modem, for up to max_tries seconds. */
+int wait_for_modem_response(mm_serial_context_t *pserial_context, int max_tries) {
+    mm_modem_t modem;
+    uint64_t   deadline = mm_monotonic_ms() + (uint64_t)max_tries * 1000;
+    int        response = MODEM_RSP_NULL;
+
+    modem_attach(&modem, pserial_context);
+
+    while ((response == MODEM_RSP_NULL) && (mm_monotonic_ms() < deadline)) {
+        response = modem_poll(&modem, (int)(deadline - mm_monotonic_ms()));
     }
-    return modem_response;
+
+    return response;
+}
+
+/* Hang up, waiting for the modem to go on-hook. */
+int hangup_modem(mm_serial_context_t *pserial_context) {
+    mm_modem_t modem;
+
+    modem_attach(&modem, pserial_context);
+    modem_start_hangup(&modem);
+
+    while (modem.state == MODEM_STATE_HANGUP) {
+        modem_poll(&modem, MODEM_HANGUP_MS);
+    }
+
+    return 0;
 }
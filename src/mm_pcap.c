@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 
 #include "mm_manager.h"
@@ -41,6 +42,7 @@ int mm_create_pcap(const char* capfilename, FILE **pcapstream) {
 
 int mm_add_pcap_rec(FILE* pcapstream, int direction, mm_packet_t *pkt, uint32_t ts_sec, uint32_t ts_usec) {
     mm_pcaprec_hdr_t pcap_rec = { 0 };
+    uint8_t rec[sizeof(mm_pcaprec_hdr_t) + 256];
     struct timespec ts;
 
     if (pcapstream == NULL) {
@@ -63,21 +65,19 @@ int mm_add_pcap_rec(FILE* pcapstream, int direction, mm_packet_t *pkt, uint32_t
     pcap_rec.incl_len = pkt->hdr.pktlen + 1;
     pcap_rec.orig_len = pkt->hdr.pktlen + 1;
 
-    /* Write PCAP record header */
-    if (fwrite(&pcap_rec, sizeof(mm_pcaprec_hdr_t), 1, pcapstream) != 1) {
-        fprintf(stderr, "%s: Error writing.\n", __func__);
-        return -1;
-    }
-    pkt->hdr.start |= (direction == TX) ? 0x80 : 0;
+    /*
+     * Write the record header and payload with a single fwrite(), so
+     * records from lines sharing the capture file are not interleaved.
+     */
+    memcpy(rec, &pcap_rec, sizeof(mm_pcaprec_hdr_t));
+    memcpy(&rec[sizeof(mm_pcaprec_hdr_t)], &pkt->hdr.start, (size_t)pkt->hdr.pktlen + 1);
+    rec[sizeof(mm_pcaprec_hdr_t)] |= (direction == TX) ? 0x80 : 0;
 
-    /* Write Payload */
-    if (fwrite(&pkt->hdr.start, (size_t)pkt->hdr.pktlen + 1, 1, pcapstream) != 1) {
+    if (fwrite(rec, sizeof(mm_pcaprec_hdr_t) + (size_t)pkt->hdr.pktlen + 1, 1, pcapstream) != 1) {
         fprintf(stderr, "%s: Error writing.\n", __func__);
-        pkt->hdr.start &= 0x7F;
         return -1;
     }
 
-    pkt->hdr.start &= 0x7F;
     return 0;
 }
 
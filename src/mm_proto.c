@@ -10,6 +10,7 @@
  * Copyright (c) 2020-2023, Howard M. Harte
  */
 
+#include <errno.h>
 #include <stdio.h>  /* Standard input/output definitions */
 #include <stdlib.h>
 #include <stdint.h>
@@ -44,15 +45,56 @@ extern volatile int inject_comm_error;
 #define L2_STATE_SEARCH_FOR_STOP    7
 
 
+/* Sleep until the mm_monotonic_ms() time t. */
+static void proto_sleep_until(uint64_t t) {
+    uint64_t now = mm_monotonic_ms();
+
+    if (now >= t) return;
+
+    mm_sleep_ms((uint32_t)(t - now));
+}
+
+/*
+ * Account for len bytes queued for transmission: estimate when they will
+ * have reached the terminal, at 10 bits per byte on the terminal's line.
+ *
+ * The send itself stays synchronous: each line has its own thread, which
+ * goes on to wait for the ACK while the frame is on the wire, so a frame
+ * only holds up its own line.  The thread sleeps only for the turnaround
+ * gap before its next frame and for the last frame before a hangup.
+ */
+static void proto_tx_queued(mm_proto_t* proto, size_t len) {
+    uint64_t now = mm_monotonic_ms();
+
+    if (proto->tx_complete < now) {
+        proto->tx_complete = now;
+    }
+
+    proto->tx_complete += ((uint64_t)len * 10 * 1000) / PKT_LINE_RATE;
+}
+
 int proto_connect(mm_proto_t* proto) {
     proto->tx_seq = 0;
     proto->connected = 1;
+    proto->phase_deadline = 0;
+    proto->session_deadline = proto->timeout_session ? mm_monotonic_ms() + proto->timeout_session : 0;
 
     return (0);
 }
 
 int proto_disconnect(mm_proto_t *proto) {
-    hangup_modem(proto->serial_context);
+    /* Let the last packet reach the terminal before hanging up. */
+    if (proto->use_modem) {
+        drain_serial(proto->serial_context);
+        proto_sleep_until(proto->tx_complete);
+    }
+
+    /* With modem control, DTR is raised again once the modem has hung up. */
+    if (proto->modem != NULL) {
+        modem_start_hangup(proto->modem);
+    } else {
+        hangup_modem(proto->serial_context);
+    }
     proto->tx_seq = 0;
     proto->connected = 0;
 
@@ -63,9 +105,77 @@ int proto_connected(mm_proto_t* proto) {
     return (proto->connected);
 }
 
+/*
+ * Set a protocol phase timeout from a "<phase>=<seconds>" specification,
+ * where phase is one of:
+ *   packet  - wait for the start of a packet.
+ *   byte    - maximum gap between bytes within a packet.
+ *   ack     - wait for an ACK.
+ *   table   - wait for the terminal to acknowledge a table.
+ *   session - total length of a session, 0 for no limit.
+ */
+int proto_set_timeout(mm_proto_t* proto, const char* spec) {
+    const struct {
+        const char* name;
+        uint32_t* timeout;
+    } phases[] = {
+        { "packet",  &proto->timeout_packet },
+        { "byte",    &proto->timeout_inter_byte },
+        { "ack",     &proto->timeout_ack },
+        { "table",   &proto->timeout_table_ack },
+        { "session", &proto->timeout_session },
+    };
+    const char* value = strchr(spec, '=');
+    char* end;
+    double seconds;
+
+    if (value != NULL) {
+        seconds = strtod(value + 1, &end);
+
+        for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) {
+            if ((strlen(phases[i].name) == (size_t)(value - spec)) &&
+                (strncmp(spec, phases[i].name, value - spec) == 0) &&
+                (end != value + 1) && (*end == '\0') && (seconds >= 0) && (seconds <= 86400) &&
+                ((seconds > 0) || (strcmp(phases[i].name, "session") == 0))) {
+                *phases[i].timeout = (uint32_t)(seconds * 1000);
+                return 0;
+            }
+        }
+    }
+
+    fprintf(stderr, "Invalid timeout '%s', expected <phase>=<seconds> where phase is packet, byte, ack, table or session.\n", spec);
+    return -EINVAL;
+}
+
+/*
+ * Estimate the time to send a table of len bytes: packets of up to
+ * PKT_TABLE_DATA_LEN_MAX bytes, each preceded by the inter-packet gap and
+ * ACKed by the terminal, then the terminal's acknowledgement of the table
+ * and its ACK.  Returns milliseconds, and the number of packets.
+ */
+uint32_t proto_table_wire_ms(const mm_proto_t* proto, size_t len, uint16_t* packets) {
+    uint64_t bytes = 0;
+    uint32_t count = 0;
+
+    while (len > 0) {
+        size_t chunk = (len > PKT_TABLE_DATA_LEN_MAX) ? PKT_TABLE_DATA_LEN_MAX : len;
+
+        bytes += chunk + PKT_OVERHEAD_BYTES + PKT_ACK_BYTES;
+        len -= chunk;
+        count++;
+    }
+
+    /* DLOG_MT_TABLE_UPD_ACK and its ACK. */
+    bytes += 2 + PKT_OVERHEAD_BYTES + PKT_ACK_BYTES;
+
+    if (packets != NULL) *packets = (uint16_t)count;
+
+    return (uint32_t)((bytes * 10 * 1000) / PKT_LINE_RATE + (uint64_t)(count + 1) * 2 * proto->rx_packet_gap * 10);
+}
+
 int receive_mm_table(mm_proto_t* proto, mm_table_t* table) {
     mm_packet_t* pkt = &table->pkt;
-    uint8_t  status;
+    pkt_status_t status;
 
     status = receive_mm_packet(proto, pkt);
 
@@ -139,14 +249,16 @@ int send_mm_table(mm_proto_t* proto, uint8_t* payload, size_t len) {
 int wait_for_table_ack(mm_proto_t* proto, uint8_t table_id) {
     mm_packet_t  packet = { { 0 }, { 0 }, { 0 }, 0, 0 };
     mm_packet_t* pkt = &packet;
-    int status;
-    int retries = 2;
+    int status = PKT_ERROR_TIMEOUT;
+    uint64_t deadline = mm_monotonic_ms() + proto->timeout_table_ack;
 
     if (proto->debuglevel > 1) printf("Waiting for ACK for table %d (0x%02x)\n", table_id, table_id);
 
-    while (retries > 0) {
+    while (mm_monotonic_ms() < deadline) {
         memset(pkt, 0, sizeof(mm_packet_t));
+        proto->phase_deadline = deadline;
         status = receive_mm_packet(proto, pkt);
+        proto->phase_deadline = 0;
 
         if ((status == PKT_SUCCESS) || (status == PKT_ERROR_RETRY)) {
             proto->rx_seq = pkt->hdr.flags & FLAG_SEQUENCE;
@@ -198,6 +310,11 @@ int wait_for_table_ack(mm_proto_t* proto, uint8_t table_id) {
             }
         }
     }
+
+    if (proto->connected && (mm_monotonic_ms() >= deadline)) {
+        printf("%s: Timeout waiting for ACK for table ID %d (0x%02x)\n", __func__, table_id, table_id);
+        status = PKT_ERROR_TIMEOUT;
+    }
     return status;
 }
 
@@ -215,7 +332,19 @@ static pkt_status_t receive_mm_packet(mm_proto_t *proto, mm_packet_t *pkt) {
     uint8_t databyte     = 0;
     uint8_t l2_state     = L2_STATE_SEARCH_FOR_START;
     pkt_status_t status  = PKT_SUCCESS;
-    uint8_t timeout      = 0;
+    uint64_t deadline;
+
+    /* Wait for the start of the packet; the current phase may allow longer, e.g. for a table ACK. */
+    if (proto->phase_deadline != 0) {
+        deadline = proto->phase_deadline;
+    } else if (proto->waiting_for_ack) {
+        /* The ACK can't arrive until the packet has been sent. */
+        deadline = mm_monotonic_ms();
+        if (proto->tx_complete > deadline) deadline = proto->tx_complete;
+        deadline += proto->timeout_ack;
+    } else {
+        deadline = mm_monotonic_ms() + proto->timeout_packet;
+    }
 
     pkt->payload_len = 0;
     memset(pkt, 0, sizeof(mm_packet_t));
@@ -246,11 +375,34 @@ static pkt_status_t receive_mm_packet(mm_proto_t *proto, mm_packet_t *pkt) {
             printf("Inject error type %d: Injecting error on READ now.\n", proto->error_inject_type);
             inject_comm_error = 0;
         }
-        while ((bytes_read = read_serial(proto->serial_context, &databyte, 1, inject_error)) == 0) {
+        for (;;) {
+            uint64_t now = mm_monotonic_ms();
+            uint64_t limit = deadline;
+
+            if ((proto->session_deadline != 0) && (proto->session_deadline < limit)) {
+                limit = proto->session_deadline;
+            }
+
+            if (now >= limit) {
+                if (limit != deadline) {
+                    printf("%s: Session time limit reached, hanging up.\n", __func__);
+                    proto_disconnect(proto);
+                    return PKT_ERROR_DISCONNECT;
+                }
+                printf("%s: Timeout waiting for packet error.\n", __func__);
+                proto->stats.rx_timeouts++;
+                return PKT_ERROR_TIMEOUT;
+            }
+
+            /* Wake at least once a second to check the connection, unless a carrier change wakes the read. */
+            bytes_read = read_serial_timeout(proto->serial_context, &databyte, 1,
+                                             ((limit - now > 1000) && !serial_read_wakes(proto->serial_context)) ?
+                                             1000 : (int)(limit - now), inject_error);
+            if (bytes_read != 0) break;
+
             if (!proto->connected) {
                 return PKT_ERROR_DISCONNECT;
             }
-            putchar('.');
             if (proto->monitor_carrier) {
                 if ((serial_get_modem_status(proto->serial_context) & (MS_RING_ON | MS_RLSD_ON)) == 0) {
                     fprintf(stderr, "%s: Carrier lost, bailing.\n", __func__);
@@ -259,13 +411,9 @@ static pkt_status_t receive_mm_packet(mm_proto_t *proto, mm_packet_t *pkt) {
                 }
             }
 
-            fflush(stdout);
-            timeout++;
-
-            if (timeout > PKT_TIMEOUT_MAX) {
-                printf("%s: Timeout waiting for packet error.\n", __func__);
-                status = PKT_ERROR_TIMEOUT;
-                return status;
+            if (proto->debuglevel > 1) {
+                putchar('.');
+                fflush(stdout);
             }
         }
 
@@ -275,8 +423,6 @@ static pkt_status_t receive_mm_packet(mm_proto_t *proto, mm_packet_t *pkt) {
             return PKT_ERROR_FAILURE;
         }
 
-        timeout = 0;
-
         switch (l2_state) {
             case L2_STATE_SEARCH_FOR_START:
                 if (databyte == START_BYTE) {
@@ -335,6 +481,18 @@ static pkt_status_t receive_mm_packet(mm_proto_t *proto, mm_packet_t *pkt) {
                 pkt_received     = 1;
                 break;
         }
+
+        /* Once a packet has started, the rest of it must follow promptly. */
+        if (l2_state != L2_STATE_SEARCH_FOR_START) {
+            deadline = mm_monotonic_ms() + proto->timeout_inter_byte;
+        }
+    }
+
+    proto->rx_complete = mm_monotonic_ms();
+
+    proto->stats.rx_packets++;
+    if (status & (PKT_ERROR_CRC | PKT_ERROR_FRAMING)) {
+        proto->stats.rx_errors++;
     }
 
     /* Copy the packet trailer (CRC-16, STOP) immediately following the data */
@@ -399,16 +557,14 @@ static pkt_status_t send_mm_packet(mm_proto_t* proto, uint8_t* payload, size_t l
             }
         }
 
-        /* Insert Tx packet delay when using a modem, in 10ms increments. */
+        /*
+         * Insert Tx packet delay when using a modem, in 10ms increments,
+         * after both the last packet received and the last packet sent.
+         */
         if (proto->use_modem) {
-#ifdef _WIN32
-            Sleep(proto->rx_packet_gap * 10);
-#else  /* ifdef _WIN32 */
-            struct timespec tim;
-            tim.tv_sec = 0;
-            tim.tv_nsec = proto->rx_packet_gap * 10000000L;
-            nanosleep(&tim, NULL);
-#endif /* _WIN32 */
+            uint64_t last = (proto->tx_complete > proto->rx_complete) ? proto->tx_complete : proto->rx_complete;
+
+            proto_sleep_until(last + (uint64_t)proto->rx_packet_gap * 10);
         }
 
         memset(&pkt, 0, sizeof(pkt));
@@ -472,8 +628,13 @@ static pkt_status_t send_mm_packet(mm_proto_t* proto, uint8_t* payload, size_t l
             dump_hex(&pkt.hdr.start, (size_t)pkt.hdr.pktlen + 1);
         }
 
+        /* Don't wait for the UART to drain, just note when the packet will be sent. */
         write_serial(proto->serial_context, &pkt, (size_t)pkt.hdr.pktlen + 1);
-        drain_serial(proto->serial_context);
+        proto_tx_queued(proto, (size_t)pkt.hdr.pktlen + 1);
+        proto->stats.tx_packets++;
+        if (retries > 0) {
+            proto->stats.tx_retries++;
+        }
 
         /* Don't wait for ACK if sending an ACK. */
         if (payload == NULL) {
@@ -0,0 +1,535 @@
+/*
+ * Protocol tests for mm_manager.
+ *
+ * Runs the manager side of the Millennium protocol (mm_proto) against a
+ * simulated terminal on the in-memory pipe transport: tables received
+ * from and sent to the terminal, retries after a NACK, CRC errors, and
+ * loss of carrier.  The TCP transport is run over loopback, with the
+ * terminal connecting over IPv6 and IPv4, and the manager connecting to
+ * an IPv6 address.  Returns the number of failed
+ * tests.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define close_socket    closesocket
+#else
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#define SOCKET          int
+#define INVALID_SOCKET  (-1)
+#define close_socket    close
+#endif  /* _WIN32 */
+
+#include "mm_manager.h"
+#include "mm_serial.h"
+
+#define TEST_TERMINAL_ID    "5551234567"
+
+volatile int inject_comm_error = 0;
+
+/* Simulated terminal, the peer on the terminal side of the pipe. */
+typedef struct term_sim {
+    uint8_t rx[1024];           /* Bytes from the manager, not yet framed. */
+    size_t  rx_len;
+    uint8_t table[2048];        /* Table data received from the manager. */
+    size_t  table_len;
+    int     packets;            /* Data packets received. */
+    int     acks;               /* ACKs received. */
+    int     nacks;              /* NACKs received. */
+    int     nack_packet;        /* NACK the data packet with this number (from 1) once, 0 for none. */
+    uint8_t last_flags;
+} term_sim_t;
+
+typedef struct proto_test {
+    mm_serial_context_t *serial;
+    mm_proto_t proto;
+    mm_modem_t modem;
+    term_sim_t term;
+} proto_test_t;
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/* Frame a packet as the terminal sends it, with the terminal ID before a payload. */
+static size_t term_frame(uint8_t *buf, uint8_t flags, const uint8_t *payload, size_t len, int corrupt) {
+    uint8_t  *p = buf;
+    uint16_t  crc;
+    size_t    payload_len = (payload != NULL) ? len + PKT_TABLE_ID_OFFSET : 0;
+
+    *p++ = START_BYTE;
+    *p++ = flags;
+    *p++ = (uint8_t)(payload_len + 5);
+
+    if (payload != NULL) {
+        string_to_bcd_a(TEST_TERMINAL_ID, p, PKT_TABLE_ID_OFFSET);
+        memcpy(p + PKT_TABLE_ID_OFFSET, payload, len);
+        p += payload_len;
+    }
+
+    crc = crc16(0, buf, (size_t)(p - buf));
+    if (corrupt) crc = ~crc;
+    *p++ = (uint8_t)(crc & 0xff);
+    *p++ = (uint8_t)(crc >> 8);
+    *p++ = STOP_BYTE;
+
+    return (size_t)(p - buf);
+}
+
+static void term_send(mm_serial_context_t *serial, uint8_t flags, const uint8_t *payload, size_t len, int corrupt) {
+    uint8_t buf[PKT_TABLE_DATA_LEN_MAX + 16];
+    size_t  buf_len = term_frame(buf, flags, payload, len, corrupt);
+
+    CHECK(pipe_serial_peer_write(serial, buf, buf_len) == (ssize_t)buf_len);
+}
+
+/* Answer each complete packet from the manager as the terminal does. */
+static void term_peer(mm_serial_context_t *serial, void *arg) {
+    term_sim_t *term = (term_sim_t *)arg;
+    ssize_t     bytes_read;
+
+    bytes_read = pipe_serial_peer_read(serial, &term->rx[term->rx_len], sizeof(term->rx) - term->rx_len);
+    if (bytes_read > 0) term->rx_len += (size_t)bytes_read;
+
+    while ((term->rx_len >= 3) && (term->rx_len >= (size_t)term->rx[2] + 1)) {
+        size_t   pkt_len = (size_t)term->rx[2] + 1;
+        size_t   payload_len = (size_t)term->rx[2] - 5;
+        uint8_t  flags = term->rx[1];
+        uint16_t crc = crc16(0, term->rx, pkt_len - 3);
+
+        CHECK(term->rx[0] == START_BYTE);
+        CHECK(term->rx[pkt_len - 1] == STOP_BYTE);
+        CHECK((term->rx[pkt_len - 3] | (term->rx[pkt_len - 2] << 8)) == crc);
+        term->last_flags = flags;
+
+        if (payload_len == 0) {
+            if (flags & FLAG_ACK) {
+                term->acks++;
+            } else {
+                term->nacks++;
+                /* The manager NACKed a packet from the terminal, which NACKs back. */
+                term_send(serial, FLAG_NACK | (flags & FLAG_SEQUENCE), NULL, 0, 0);
+            }
+        } else {
+            term->packets++;
+
+            if (term->packets == term->nack_packet) {
+                term->nack_packet = 0;
+                term->packets--;
+                term_send(serial, FLAG_NACK | (flags & FLAG_SEQUENCE), NULL, 0, 0);
+            } else {
+                CHECK(payload_len > PKT_TABLE_ID_OFFSET);
+                if (term->table_len + payload_len - PKT_TABLE_ID_OFFSET <= sizeof(term->table)) {
+                    memcpy(&term->table[term->table_len], &term->rx[3 + PKT_TABLE_ID_OFFSET], payload_len - PKT_TABLE_ID_OFFSET);
+                    term->table_len += payload_len - PKT_TABLE_ID_OFFSET;
+                }
+                term_send(serial, FLAG_ACK | (flags & FLAG_SEQUENCE), NULL, 0, 0);
+            }
+        }
+
+        memmove(term->rx, &term->rx[pkt_len], term->rx_len - pkt_len);
+        term->rx_len -= pkt_len;
+    }
+}
+
+/* Run the manager's protocol on test->serial, with a terminal connected. */
+static void proto_test_start(proto_test_t *test) {
+    modem_attach(&test->modem, test->serial);
+    test->proto.serial_context = test->serial;
+    test->proto.modem = &test->modem;
+    test->proto.monitor_carrier = 1;
+    test->proto.timeout_packet = 200;
+    test->proto.timeout_inter_byte = 200;
+    test->proto.timeout_ack = 200;
+    test->proto.timeout_table_ack = 200;
+    snprintf(test->proto.terminal_id, sizeof(test->proto.terminal_id), "%s", TEST_TERMINAL_ID);
+    proto_connect(&test->proto);
+}
+
+/* Open a pipe with a terminal connected, and the manager's protocol on it. */
+static int proto_test_open(proto_test_t *test) {
+    memset(test, 0, sizeof(proto_test_t));
+
+    if ((test->serial = open_serial("pipe:", NULL, NULL)) == NULL) return -ENODEV;
+
+    pipe_serial_set_peer(test->serial, term_peer, &test->term);
+    pipe_serial_set_carrier(test->serial, 1);
+    flush_serial(test->serial);     /* RING and CONNECT, normally consumed by mm_connection_wait(). */
+    proto_test_start(test);
+
+    return 0;
+}
+
+static void proto_test_close(proto_test_t *test) {
+    close_serial(test->serial);
+}
+
+/* A table from the terminal is received and acknowledged. */
+static void test_receive_table(void) {
+    proto_test_t test;
+    mm_table_t   table;
+    uint8_t      payload[] = { DLOG_MT_MAINT_REQ, 0x12, 0x34 };
+
+    if (proto_test_open(&test) != 0) {
+        CHECK(0);
+        return;
+    }
+    test.proto.terminal_id[0] = '\0';
+
+    term_send(test.serial, 1, payload, sizeof(payload), 0);
+    memset(&table, 0, sizeof(table));
+    CHECK(receive_mm_table(&test.proto, &table) == PKT_SUCCESS);
+    CHECK(strcmp(test.proto.terminal_id, TEST_TERMINAL_ID) == 0);
+    CHECK(table.pkt.payload_len == PKT_TABLE_ID_OFFSET + sizeof(payload));
+    CHECK(memcmp(&table.pkt.payload[PKT_TABLE_ID_OFFSET], payload, sizeof(payload)) == 0);
+    CHECK(test.term.acks == 1);
+    CHECK((test.term.last_flags & FLAG_SEQUENCE) == 1);
+    CHECK(test.proto.stats.rx_packets == 1);
+
+    proto_test_close(&test);
+}
+
+/*
+ * A table larger than a packet is sent in packets, one of them again
+ * after the terminal NACKs it, and the terminal's table ACK is answered.
+ */
+static void test_send_table(void) {
+    proto_test_t test;
+    uint8_t      image[600];
+    uint8_t      table_ack[] = { DLOG_MT_TABLE_UPD_ACK, DLOG_MT_CARD_TABLE_EXP };
+    int          acks;
+
+    if (proto_test_open(&test) != 0) {
+        CHECK(0);
+        return;
+    }
+
+    image[0] = DLOG_MT_CARD_TABLE_EXP;
+    for (size_t i = 1; i < sizeof(image); i++) {
+        image[i] = (uint8_t)(i * 7);
+    }
+
+    test.term.nack_packet = 2;
+    CHECK(send_mm_table(&test.proto, image, sizeof(image)) == PKT_SUCCESS);
+    CHECK(test.term.packets == 3);
+    CHECK(test.term.nacks == 0);
+    CHECK(test.term.table_len == sizeof(image));
+    CHECK(memcmp(test.term.table, image, sizeof(image)) == 0);
+    CHECK(test.proto.stats.tx_packets == 4);
+    CHECK(test.proto.stats.tx_retries == 1);
+
+    acks = test.term.acks;
+    term_send(test.serial, 0, table_ack, sizeof(table_ack), 0);
+    CHECK(wait_for_table_ack(&test.proto, DLOG_MT_CARD_TABLE_EXP) == 0);
+    CHECK(test.term.acks == acks + 1);
+
+    proto_test_close(&test);
+}
+
+/*
+ * A packet with a bad CRC is NACKed and counted as an error.  The status
+ * returned is that of the NACK exchange.
+ */
+static void test_crc_error(void) {
+    proto_test_t test;
+    mm_table_t   table;
+    uint8_t      payload[] = { DLOG_MT_MAINT_REQ, 0x00 };
+
+    if (proto_test_open(&test) != 0) {
+        CHECK(0);
+        return;
+    }
+
+    term_send(test.serial, 0, payload, sizeof(payload), 1);
+    memset(&table, 0, sizeof(table));
+    CHECK(receive_mm_table(&test.proto, &table) == PKT_ERROR_NACK);
+    CHECK(test.term.nacks == 1);
+    CHECK(test.term.acks == 0);
+    CHECK(test.proto.stats.rx_errors == 1);
+    CHECK(proto_connected(&test.proto));
+
+    proto_test_close(&test);
+}
+
+/* Loss of carrier ends the session. */
+static void test_carrier_lost(void) {
+    proto_test_t test;
+    mm_table_t   table;
+
+    if (proto_test_open(&test) != 0) {
+        CHECK(0);
+        return;
+    }
+
+    pipe_serial_set_carrier(test.serial, 0);
+    memset(&table, 0, sizeof(table));
+    CHECK(receive_mm_table(&test.proto, &table) == PKT_ERROR_NO_CARRIER);
+    CHECK(!proto_connected(&test.proto));
+
+    proto_test_close(&test);
+}
+
+/* Nothing from the terminal times out. */
+static void test_timeout(void) {
+    proto_test_t test;
+    mm_table_t   table;
+
+    if (proto_test_open(&test) != 0) {
+        CHECK(0);
+        return;
+    }
+
+    memset(&table, 0, sizeof(table));
+    CHECK(receive_mm_table(&test.proto, &table) != PKT_SUCCESS);
+    CHECK(test.proto.stats.rx_timeouts == 1);
+    CHECK(test.term.nacks == 1);
+
+    proto_test_close(&test);
+}
+
+/* A free TCP port on loopback, to listen on. */
+static uint16_t tcp_test_port(void) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    SOCKET    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    uint16_t  port = 0;
+
+    if (sock == INVALID_SOCKET) return 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) &&
+        (getsockname(sock, (struct sockaddr *)&addr, &addr_len) == 0)) {
+        port = ntohs(addr.sin_port);
+    }
+
+    close_socket(sock);
+
+    return port;
+}
+
+/* Connect a terminal to the manager on loopback, over IPv6 if ipv6. */
+static SOCKET tcp_test_connect(uint16_t port, int ipv6) {
+    struct sockaddr_in6 addr6;
+    struct sockaddr_in  addr;
+    struct sockaddr    *sa = (struct sockaddr *)&addr;
+    socklen_t           sa_len = sizeof(addr);
+    SOCKET              sock;
+
+    memset(&addr6, 0, sizeof(addr6));
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_port = htons(port);
+    addr6.sin6_addr = in6addr_loopback;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (ipv6) {
+        sa = (struct sockaddr *)&addr6;
+        sa_len = sizeof(addr6);
+    }
+
+    sock = socket(sa->sa_family, SOCK_STREAM, IPPROTO_TCP);
+
+    if ((sock != INVALID_SOCKET) && (connect(sock, sa, sa_len) != 0)) {
+        close_socket(sock);
+        sock = INVALID_SOCKET;
+    }
+
+    return sock;
+}
+
+/* Whether this host has IPv6 loopback, so that the manager can be reached on it. */
+static int tcp_test_have_ipv6(void) {
+    struct sockaddr_in6 addr6;
+    SOCKET sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+    int    have_ipv6;
+
+    if (sock == INVALID_SOCKET) return 0;
+
+    memset(&addr6, 0, sizeof(addr6));
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_addr = in6addr_loopback;
+    have_ipv6 = (bind(sock, (struct sockaddr *)&addr6, sizeof(addr6)) == 0);
+    close_socket(sock);
+
+    return have_ipv6;
+}
+
+/*
+ * A terminal connecting to a listening manager is reported as a call, a
+ * table from it is received and acknowledged, and dropping DTR hangs up.
+ * The listener takes connections over IPv6 and IPv4.
+ */
+static void test_tcp_listen(void) {
+    proto_test_t test;
+    mm_table_t   table;
+    char         dev[32];
+    uint8_t      payload[] = { DLOG_MT_MAINT_REQ, 0x56 };
+    uint8_t      buf[PKT_TABLE_DATA_LEN_MAX + 16];
+    uint16_t     port = tcp_test_port();
+
+    memset(&test, 0, sizeof(test));
+    snprintf(dev, sizeof(dev), "tcp::%u", port);
+
+    if ((port == 0) || ((test.serial = open_serial(dev, NULL, NULL)) == NULL)) {
+        CHECK(0);
+        return;
+    }
+
+    for (int ipv6 = tcp_test_have_ipv6() ? 1 : 0; ipv6 >= 0; ipv6--) {
+        SOCKET  sock = tcp_test_connect(port, ipv6);
+        char    rsp[64] = "";
+        size_t  rsp_len = 0;
+        size_t  buf_len;
+        ssize_t bytes_read;
+
+        CHECK(sock != INVALID_SOCKET);
+        if (sock == INVALID_SOCKET) break;
+
+        /* RING and CONNECT, as from a modem. */
+        for (int i = 0; (i < 10) && (strstr(rsp, "CONNECT") == NULL); i++) {
+            bytes_read = read_serial_timeout(test.serial, &rsp[rsp_len], sizeof(rsp) - rsp_len - 1, 100, 0);
+            if (bytes_read > 0) rsp_len += (size_t)bytes_read;
+            rsp[rsp_len] = '\0';
+        }
+        CHECK(strstr(rsp, "CONNECT") != NULL);
+        CHECK(serial_get_modem_status(test.serial) & MS_RLSD_ON);
+
+        proto_test_start(&test);
+        buf_len = term_frame(buf, 1, payload, sizeof(payload), 0);
+        CHECK(send(sock, (const char *)buf, (int)buf_len, 0) == (int)buf_len);
+        memset(&table, 0, sizeof(table));
+        CHECK(receive_mm_table(&test.proto, &table) == PKT_SUCCESS);
+        CHECK(memcmp(&table.pkt.payload[PKT_TABLE_ID_OFFSET], payload, sizeof(payload)) == 0);
+
+        /* The ACK reaches the terminal. */
+        CHECK(recv(sock, (char *)buf, sizeof(buf), 0) == 6);
+        CHECK((buf[0] == START_BYTE) && (buf[1] & FLAG_ACK));
+
+        /* Dropping DTR closes the connection. */
+        serial_set_dtr(test.serial, 0);
+        CHECK(!(serial_get_modem_status(test.serial) & MS_RLSD_ON));
+        CHECK(recv(sock, (char *)buf, sizeof(buf), 0) == 0);
+        serial_set_dtr(test.serial, 1);
+
+        close_socket(sock);
+    }
+
+    close_serial(test.serial);
+}
+
+/*
+ * The manager connects to a terminal listening on an IPv6 address given in
+ * brackets.  Without brackets, the address can't be told from the port.
+ */
+static void test_tcp_connect_ipv6(void) {
+    mm_serial_context_t *serial;
+    struct sockaddr_in6 addr6;
+    socklen_t addr_len = sizeof(addr6);
+    SOCKET   listen_sock;
+    SOCKET   sock;
+    char     dev[32];
+    char     rsp[64] = "";
+    size_t   rsp_len = 0;
+    ssize_t  bytes_read;
+
+    CHECK(open_serial("tcp:::1:2000", NULL, NULL) == NULL);
+
+    if (!tcp_test_have_ipv6()) return;
+
+    listen_sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+    memset(&addr6, 0, sizeof(addr6));
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_addr = in6addr_loopback;
+    if ((listen_sock == INVALID_SOCKET) ||
+        (bind(listen_sock, (struct sockaddr *)&addr6, sizeof(addr6)) != 0) ||
+        (getsockname(listen_sock, (struct sockaddr *)&addr6, &addr_len) != 0) ||
+        (listen(listen_sock, 1) != 0)) {
+        CHECK(0);
+        if (listen_sock != INVALID_SOCKET) close_socket(listen_sock);
+        return;
+    }
+
+    snprintf(dev, sizeof(dev), "tcp:[::1]:%u", ntohs(addr6.sin6_port));
+    if ((serial = open_serial(dev, NULL, NULL)) == NULL) {
+        CHECK(0);
+        close_socket(listen_sock);
+        return;
+    }
+
+    /* RING and CONNECT once connected. */
+    for (int i = 0; (i < 10) && (strstr(rsp, "CONNECT") == NULL); i++) {
+        bytes_read = read_serial_timeout(serial, &rsp[rsp_len], sizeof(rsp) - rsp_len - 1, 100, 0);
+        if (bytes_read > 0) rsp_len += (size_t)bytes_read;
+        rsp[rsp_len] = '\0';
+    }
+    CHECK(strstr(rsp, "CONNECT") != NULL);
+
+    sock = accept(listen_sock, NULL, NULL);
+    CHECK(sock != INVALID_SOCKET);
+    if (sock != INVALID_SOCKET) close_socket(sock);
+
+    close_serial(serial);
+    close_socket(listen_sock);
+}
+
+/* Shutdown ends a wait for a modem server to connect.  Run last. */
+static void test_tcp_stop(void) {
+    char     dev[32];
+    uint16_t port = tcp_test_port();
+
+    snprintf(dev, sizeof(dev), "rfc2217::%u", port);
+    serial_wake_all();
+    CHECK(serial_stopped());
+    CHECK((port == 0) || (open_serial(dev, NULL, NULL) == NULL));
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        fprintf(stderr, "%s: WSAStartup() Failed. Error Code : %d", __func__, WSAGetLastError());
+        return 1;
+    }
+#endif /* _WIN32 */
+
+    test_receive_table();
+    test_send_table();
+    test_crc_error();
+    test_carrier_lost();
+    test_timeout();
+    test_tcp_listen();
+    test_tcp_connect_ipv6();
+    test_tcp_stop();
+
+    printf("mm_proto_test: %d failures.\n", failures);
+
+    return failures;
+}
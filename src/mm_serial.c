@@ -7,25 +7,46 @@
  */
 
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>  /* Standard input/output definitions */
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h> /* String function definitions */
+#ifdef _WIN32
+# include <windows.h>
+#endif /* _WIN32 */
 
 #include "mm_serial.h"
 
+/* Transport selected by a device name prefix, anything else is a tty. */
+static const struct {
+    const char *prefix;
+    const mm_serial_transport_t *transport;
+} serial_transport_prefixes[] = {
+    { "pipe:", &serial_transport_pipe },
+    { "tcp:",  &serial_transport_tcp  },
+    { "rfc2217:", &serial_transport_rfc2217 },
+#ifndef _WIN32
+    { "pty:",  &serial_transport_pty  },
+#endif /* _WIN32 */
+};
+
 /*
  * Open serial port specified in modem_dev.
  *
- * Returns the file descriptor on success or -1 on error.
+ * modem_dev may name a tty, or select another transport with a prefix:
+ *   pipe:            In-memory pipe, driven by a peer in the same process.
+ *   pty:             Pseudo-terminal, for use with a terminal simulator.
+ *   tcp:<host>:<port> TCP connection to <host>, or listen on <port> if
+ *                    <host> is empty.
+ *   rfc2217:<host>:<port> Modem on an RFC 2217 (Telnet COM Port Control)
+ *                    modem server, or listen on <port> if <host> is empty.
+ *
+ * Returns the serial context on success or NULL on error.
  */
 mm_serial_context_t* open_serial(const char *modem_dev, FILE *logstream, FILE *bytestream) {
-    int fd = -1;
     mm_serial_context_t *pserial_context;
-
-    if (bytestream == NULL) {
-        fd = platform_open_serial(modem_dev);
-    }
+    const char *dev = modem_dev;
 
     pserial_context = (mm_serial_context_t *)calloc(1, sizeof(mm_serial_context_t));
 
@@ -34,9 +55,29 @@ mm_serial_context_t* open_serial(const char *modem_dev, FILE *logstream, FILE *b
         exit(-ENOMEM);
     }
 
-    pserial_context->fd = fd;
+    pserial_context->fd = -1;
     pserial_context->logstream  = logstream;
     pserial_context->bytestream = bytestream;
+    pserial_context->transport  = &serial_transport_tty;
+
+    if (bytestream != NULL) {
+        pserial_context->transport = &serial_transport_bytestream;
+    } else {
+        for (size_t i = 0; i < sizeof(serial_transport_prefixes) / sizeof(serial_transport_prefixes[0]); i++) {
+            size_t prefix_len = strlen(serial_transport_prefixes[i].prefix);
+
+            if (strncmp(modem_dev, serial_transport_prefixes[i].prefix, prefix_len) == 0) {
+                pserial_context->transport = serial_transport_prefixes[i].transport;
+                dev = modem_dev + prefix_len;
+                break;
+            }
+        }
+    }
+
+    if (pserial_context->transport->open(pserial_context, dev) != 0) {
+        free(pserial_context);
+        return NULL;
+    }
 
     return pserial_context;
 }
@@ -45,7 +86,7 @@ int close_serial(mm_serial_context_t *pserial_context) {
     int status = -1;
 
     if (pserial_context != NULL) {
-        status = platform_close_serial(pserial_context->fd);
+        status = pserial_context->transport->close(pserial_context);
         free(pserial_context);
     }
 
@@ -53,57 +94,32 @@ int close_serial(mm_serial_context_t *pserial_context) {
 }
 
 int init_serial(mm_serial_context_t *pserial_context, int baudrate) {
-    int status = 0;
-
-    if (pserial_context->bytestream == NULL) {
-        status = platform_init_serial(pserial_context->fd, baudrate);
-    }
-
-    return status;
+    return pserial_context->transport->init(pserial_context, baudrate);
 }
 
 ssize_t read_serial(mm_serial_context_t *pserial_context, void *buf, size_t count, int inject_error) {
-    ssize_t bytes_read = -1;
-
-    if (pserial_context->bytestream == NULL) {
-        bytes_read = platform_read_serial(pserial_context->fd, buf, count);
-        if (inject_error) {
-            printf("Invert RX data\n");
-            /* Force an error by inverting the recevied data */
-            ((uint8_t *)buf)[0] = ~((uint8_t*)buf)[0];
-        }
-    }
-    else {
-        for (size_t i = 0; i < count; i++) {
-            if (feof(pserial_context->bytestream)) {
-                printf("%s: Terminating due to EOF.\n", __func__);
-                fflush(stdout);
-                fclose(pserial_context->bytestream);
-                exit(0);
-            }
-            else {
-                char* bytep;
-                char testbuf[80];
+    return read_serial_timeout(pserial_context, buf, count, SERIAL_READ_TIMEOUT_MS, inject_error);
+}
 
-                if (fgets(testbuf, 80, pserial_context->bytestream) == NULL) {
-                    break;
-                }
+/*
+ * Read up to count bytes, waiting at most timeout_ms for the first byte,
+ * or, where serial_read_wakes(), without a timeout if negative.  Returns
+ * 0 on timeout.  The tty transport on Windows always waits for the
+ * COMMTIMEOUTS read timeout instead.
+ */
+ssize_t read_serial_timeout(mm_serial_context_t *pserial_context, void *buf, size_t count, int timeout_ms, int inject_error) {
+    ssize_t bytes_read;
 
-                /* Data that came from the Millennium Terminal. */
-                if ((bytep = strstr(testbuf, "RX: ")) != NULL) {
-                    uint32_t filebyte;
-                    if (sscanf(bytep, "RX: %x", &filebyte) != 1) {
-                        fprintf(stderr, "%s: Error parsing bytestream\n", __func__);
-                    }
-                    ((uint8_t*)buf)[i] = filebyte & 0xFF;;
-                }
-            }
-        }
-        bytes_read = count;
+    bytes_read = pserial_context->transport->read(pserial_context, buf, count, timeout_ms);
+
+    if (inject_error && (bytes_read > 0)) {
+        printf("Invert RX data\n");
+        /* Force an error by inverting the recevied data */
+        ((uint8_t *)buf)[0] = ~((uint8_t*)buf)[0];
     }
 
-    if (pserial_context->logstream != NULL) {
-        for (size_t i = 0; i < count; i++) {
+    if ((pserial_context->logstream != NULL) && (bytes_read > 0)) {
+        for (ssize_t i = 0; i < bytes_read; i++) {
             fprintf(pserial_context->logstream, "UART: RX: %02X\n", ((uint8_t*)buf)[i]);
         }
     }
@@ -111,50 +127,293 @@ ssize_t read_serial(mm_serial_context_t *pserial_context, void *buf, size_t coun
 }
 
 ssize_t write_serial(mm_serial_context_t *pserial_context, const void *buf, size_t count) {
-    ssize_t bytes_written = count;
-
     if (pserial_context->logstream != NULL) {
         for (size_t i = 0; i < count; i++) {
             fprintf(pserial_context->logstream, "UART: TX: %02X\n", ((uint8_t*)buf)[i]);
         }
     }
 
-    /* If we are using a serial port, send the data */
-    if (pserial_context->bytestream == NULL) {
-        bytes_written = platform_write_serial(pserial_context->fd, buf, count);
+    return pserial_context->transport->write(pserial_context, buf, count);
+}
+
+int drain_serial(mm_serial_context_t *pserial_context) {
+    return pserial_context->transport->drain(pserial_context);
+}
+
+int flush_serial(mm_serial_context_t *pserial_context) {
+    return pserial_context->transport->flush(pserial_context);
+}
+
+int serial_set_dtr(mm_serial_context_t *pserial_context, int set) {
+    return pserial_context->transport->set_dtr(pserial_context, set);
+}
+
+int serial_get_modem_status(mm_serial_context_t* pserial_context) {
+    return pserial_context->transport->get_modem_status(pserial_context);
+}
+
+/*
+ * Reads wait for data as long as asked, as a carrier change and
+ * serial_wake_all() end the wait.  Otherwise, a reader must wake up
+ * periodically to check the carrier and whether to stop.
+ */
+int serial_read_wakes(mm_serial_context_t *pserial_context) {
+    return (pserial_context->transport == &serial_transport_tty) &&
+           platform_serial_monitor_wakes(pserial_context->priv);
+}
+
+static volatile sig_atomic_t serial_stopping = 0;
+
+/*
+ * Wake every read waiting on a transport for which serial_read_wakes(), and
+ * stop waiting for connections, for shutdown.  Safe to call from a signal
+ * handler.
+ */
+void serial_wake_all(void) {
+    serial_stopping = 1;
+    platform_serial_wake_all();
+}
+
+/* Nonzero once serial_wake_all() was called. */
+int serial_stopped(void) {
+    return serial_stopping;
+}
+
+/*
+ * tty transport, a real serial port through the platform_* layer.  Where
+ * the platform supports it, a carrier monitor (kept in priv) tracks the
+ * modem status so that carrier changes wake up readers.
+ */
+static int tty_open(mm_serial_context_t *pserial_context, const char *modem_dev) {
+    pserial_context->fd = platform_open_serial(modem_dev);
+
+    if (pserial_context->fd == -1) {
+        fprintf(stderr, "%s: Unable to open %s.\n", __func__, modem_dev);
+        return -ENODEV;
     }
 
-    return bytes_written;
+    return 0;
 }
 
-int drain_serial(mm_serial_context_t *pserial_context) {
-    int status = -1;
-    if (pserial_context->bytestream == NULL) {
-        status = platform_drain_serial(pserial_context->fd);
+static int tty_init(mm_serial_context_t *pserial_context, int baudrate) {
+    int status = platform_init_serial(pserial_context->fd, baudrate);
+
+    if ((status == 0) && (pserial_context->priv == NULL)) {
+        pserial_context->priv = platform_serial_monitor_start(pserial_context->fd);
     }
+
     return status;
 }
 
-int flush_serial(mm_serial_context_t *pserial_context) {
-    int status = -1;
-    if (pserial_context->bytestream == NULL) {
-        status = platform_flush_serial(pserial_context->fd);
+static int tty_close(mm_serial_context_t *pserial_context) {
+    platform_serial_monitor_stop(pserial_context->priv);
+    pserial_context->priv = NULL;
+    return platform_close_serial(pserial_context->fd);
+}
+
+static ssize_t tty_read(mm_serial_context_t *pserial_context, void *buf, size_t count, int timeout_ms) {
+    if (!platform_serial_monitor_wait(pserial_context->priv, pserial_context->fd, timeout_ms)) {
+        return 0;
     }
-    return status;
+
+    return platform_read_serial(pserial_context->fd, buf, count);
 }
 
-int serial_set_dtr(mm_serial_context_t *pserial_context, int set) {
-    int status = -1;
-    if (pserial_context->bytestream == NULL) {
-        status = platform_serial_set_dtr(pserial_context->fd, set);
+static ssize_t tty_write(mm_serial_context_t *pserial_context, const void *buf, size_t count) {
+    return platform_write_serial(pserial_context->fd, buf, count);
+}
+
+static int tty_drain(mm_serial_context_t *pserial_context) {
+    return platform_drain_serial(pserial_context->fd);
+}
+
+static int tty_flush(mm_serial_context_t *pserial_context) {
+    return platform_flush_serial(pserial_context->fd);
+}
+
+static int tty_set_dtr(mm_serial_context_t *pserial_context, int set) {
+    return platform_serial_set_dtr(pserial_context->fd, set);
+}
+
+static int tty_get_modem_status(mm_serial_context_t *pserial_context) {
+    return platform_serial_monitor_status(pserial_context->priv, pserial_context->fd);
+}
+
+const mm_serial_transport_t serial_transport_tty = {
+    "tty",
+    tty_open,
+    tty_init,
+    tty_close,
+    tty_read,
+    tty_write,
+    tty_drain,
+    tty_flush,
+    tty_set_dtr,
+    tty_get_modem_status
+};
+
+/*
+ * Bytestream transport, plays back the RX side of a dialog transcript
+ * recorded with -l.  Transmitted data is discarded.
+ */
+static int bytestream_open(mm_serial_context_t *pserial_context, const char *modem_dev) {
+    (void)pserial_context;
+    (void)modem_dev;
+    return 0;
+}
+
+static int bytestream_init(mm_serial_context_t *pserial_context, int baudrate) {
+    (void)pserial_context;
+    (void)baudrate;
+    return 0;
+}
+
+static int bytestream_close(mm_serial_context_t *pserial_context) {
+    (void)pserial_context;
+    return -1;
+}
+
+static ssize_t bytestream_read(mm_serial_context_t *pserial_context, void *buf, size_t count, int timeout_ms) {
+    (void)timeout_ms;
+
+    for (size_t i = 0; i < count; i++) {
+        if (feof(pserial_context->bytestream)) {
+            printf("%s: Terminating due to EOF.\n", __func__);
+            fflush(stdout);
+            fclose(pserial_context->bytestream);
+            exit(0);
+        }
+        else {
+            char* bytep;
+            char testbuf[80];
+
+            if (fgets(testbuf, 80, pserial_context->bytestream) == NULL) {
+                break;
+            }
+
+            /* Data that came from the Millennium Terminal. */
+            if ((bytep = strstr(testbuf, "RX: ")) != NULL) {
+                uint32_t filebyte;
+                if (sscanf(bytep, "RX: %x", &filebyte) != 1) {
+                    fprintf(stderr, "%s: Error parsing bytestream\n", __func__);
+                }
+                ((uint8_t*)buf)[i] = filebyte & 0xFF;;
+            }
+        }
     }
-    return status;
+
+    return count;
 }
 
-int serial_get_modem_status(mm_serial_context_t* pserial_context) {
-    int status = -1;
-    if (pserial_context->bytestream == NULL) {
-        status = platform_serial_get_modem_status(pserial_context->fd);
+static ssize_t bytestream_write(mm_serial_context_t *pserial_context, const void *buf, size_t count) {
+    (void)pserial_context;
+    (void)buf;
+    return count;
+}
+
+static int bytestream_nop(mm_serial_context_t *pserial_context) {
+    (void)pserial_context;
+    return -1;
+}
+
+static int bytestream_set_dtr(mm_serial_context_t *pserial_context, int set) {
+    (void)pserial_context;
+    (void)set;
+    return -1;
+}
+
+const mm_serial_transport_t serial_transport_bytestream = {
+    "bytestream",
+    bytestream_open,
+    bytestream_init,
+    bytestream_close,
+    bytestream_read,
+    bytestream_write,
+    bytestream_nop,
+    bytestream_nop,
+    bytestream_set_dtr,
+    bytestream_nop
+};
+
+/* Modem emulation */
+static void modem_emu_respond(mm_modem_emu_t *emu, const char *response) {
+    int len = snprintf(&emu->rsp[emu->rsp_len], sizeof(emu->rsp) - emu->rsp_len, "\r\n%s\r\n", response);
+
+    if ((len > 0) && ((size_t)emu->rsp_len + len < sizeof(emu->rsp))) {
+        emu->rsp_len += (uint8_t)len;
     }
-    return status;
+}
+
+void modem_emu_init(mm_modem_emu_t *emu) {
+    memset(emu, 0, sizeof(mm_modem_emu_t));
+    emu->dtr = 1;
+}
+
+/*
+ * Process data written by the manager.  While on-hook, the data is an AT
+ * command, which is answered with OK.
+ *
+ * Returns 1 if the data should be passed through to the peer, 0 if it was
+ * consumed by the emulated modem.
+ */
+int modem_emu_write(mm_modem_emu_t *emu, const void *buf, size_t count) {
+    const char *p = (const char *)buf;
+
+    if (emu->carrier) return 1;
+
+    for (size_t i = 0; i < count; i++) {
+        if ((p[i] == '\r') || (p[i] == '\n')) {
+            if (emu->cmd_len >= 2) {
+                modem_emu_respond(emu, "OK");
+            }
+            emu->cmd_len = 0;
+        } else if (emu->cmd_len < sizeof(emu->cmd) - 1) {
+            emu->cmd[emu->cmd_len++] = p[i];
+        }
+    }
+
+    return 0;
+}
+
+/* Read pending result codes. */
+size_t modem_emu_read(mm_modem_emu_t *emu, void *buf, size_t count) {
+    if (count > emu->rsp_len) {
+        count = emu->rsp_len;
+    }
+
+    memcpy(buf, emu->rsp, count);
+    memmove(emu->rsp, &emu->rsp[count], emu->rsp_len - count);
+    emu->rsp_len -= (uint8_t)count;
+
+    return count;
+}
+
+/* Report the start or end of a call. */
+void modem_emu_set_carrier(mm_modem_emu_t *emu, int carrier) {
+    carrier = (carrier && emu->dtr) ? 1 : 0;
+
+    if (carrier == emu->carrier) return;
+
+    emu->carrier = (uint8_t)carrier;
+    if (carrier) {
+        modem_emu_respond(emu, "RING");
+        modem_emu_respond(emu, "CONNECT 1200");
+    } else {
+        modem_emu_respond(emu, "NO CARRIER");
+    }
+}
+
+/* Hang up at the manager's request (DTR dropped), no result code is reported. */
+void modem_emu_hangup(mm_modem_emu_t *emu) {
+    emu->carrier = 0;
+    emu->cmd_len = 0;
+}
+
+void modem_emu_flush(mm_modem_emu_t *emu) {
+    emu->rsp_len = 0;
+    emu->cmd_len = 0;
+}
+
+int modem_emu_get_modem_status(mm_modem_emu_t *emu) {
+    return emu->carrier ? MS_RLSD_ON : 0;
 }
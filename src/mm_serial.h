@@ -9,6 +9,9 @@
 #ifndef MM_SERIAL_H_
 #define MM_SERIAL_H_
 
+#include <stdio.h>
+#include <stdint.h>
+
 #if defined(_MSC_VER)
 # include <BaseTsd.h>
 typedef SSIZE_T ssize_t;
@@ -18,21 +21,92 @@ typedef SSIZE_T ssize_t;
 #define MS_RLSD_ON      0x0080
 #endif /* if defined(_MSC_VER) */
 
+#define SERIAL_READ_TIMEOUT_MS  (1000)  /* Default read timeout, as VTIME=10 */
+
+#define MODEM_EMU_BUF_LEN   (64)
+
+/*
+ * Hayes modem emulation for transports that have no modem of their own
+ * (pipe, pty, TCP.)  AT commands written while on-hook are answered with
+ * OK, and the transport's notion of a call is reported as RING / CONNECT /
+ * NO CARRIER result codes and through the DCD/RI modem status bits.
+ */
+typedef struct mm_modem_emu {
+    char    cmd[80];                    /* AT command being assembled */
+    uint8_t cmd_len;
+    char    rsp[MODEM_EMU_BUF_LEN];     /* Pending result codes */
+    uint8_t rsp_len;
+    uint8_t dtr;
+    uint8_t carrier;
+} mm_modem_emu_t;
+
+struct mm_serial_context;
+
+/* Transport backend operations. */
+typedef struct mm_serial_transport {
+    const char *name;
+    int     (*open)(struct mm_serial_context *pserial_context, const char *modem_dev);
+    int     (*init)(struct mm_serial_context *pserial_context, int baudrate);
+    int     (*close)(struct mm_serial_context *pserial_context);
+    ssize_t (*read)(struct mm_serial_context *pserial_context, void *buf, size_t count, int timeout_ms);
+    ssize_t (*write)(struct mm_serial_context *pserial_context, const void *buf, size_t count);
+    int     (*drain)(struct mm_serial_context *pserial_context);
+    int     (*flush)(struct mm_serial_context *pserial_context);
+    int     (*set_dtr)(struct mm_serial_context *pserial_context, int set);
+    int     (*get_modem_status)(struct mm_serial_context *pserial_context);
+} mm_serial_transport_t;
+
 typedef struct mm_serial_context {
     int fd;
     FILE *logstream;
     FILE *bytestream;
+    const mm_serial_transport_t *transport;
+    void *priv;                         /* Transport-specific state */
 } mm_serial_context_t;
 
 mm_serial_context_t* open_serial(const char *modem_dev, FILE *logstream, FILE *bytestream);
 extern int init_serial(mm_serial_context_t *pserial_context, int baudrate);
 extern int close_serial(mm_serial_context_t *pserial_context);
 ssize_t    read_serial(mm_serial_context_t *pserial_context, void *buf, size_t count, int inject_error);
+ssize_t    read_serial_timeout(mm_serial_context_t *pserial_context, void *buf, size_t count, int timeout_ms, int inject_error);
 ssize_t    write_serial(mm_serial_context_t *pserial_context, const void *buf, size_t count);
 int        drain_serial(mm_serial_context_t *pserial_context);
 int        flush_serial(mm_serial_context_t *pserial_context);
 int        serial_set_dtr(mm_serial_context_t* pserial_context, int set);
 int        serial_get_modem_status(mm_serial_context_t* pserial_context);
+int        serial_read_wakes(mm_serial_context_t* pserial_context);
+void       serial_wake_all(void);
+int        serial_stopped(void);
+
+/* Transports */
+extern const mm_serial_transport_t serial_transport_tty;
+extern const mm_serial_transport_t serial_transport_bytestream;
+extern const mm_serial_transport_t serial_transport_pipe;
+extern const mm_serial_transport_t serial_transport_tcp;
+extern const mm_serial_transport_t serial_transport_rfc2217;
+#ifndef _WIN32
+extern const mm_serial_transport_t serial_transport_pty;
+#endif /* _WIN32 */
+
+/* Modem emulation, shared by the pipe, pty and TCP transports. */
+void    modem_emu_init(mm_modem_emu_t *emu);
+int     modem_emu_write(mm_modem_emu_t *emu, const void *buf, size_t count);
+size_t  modem_emu_read(mm_modem_emu_t *emu, void *buf, size_t count);
+void    modem_emu_set_carrier(mm_modem_emu_t *emu, int carrier);
+void    modem_emu_hangup(mm_modem_emu_t *emu);
+void    modem_emu_flush(mm_modem_emu_t *emu);
+int     modem_emu_get_modem_status(mm_modem_emu_t *emu);
+
+/*
+ * In-memory pipe transport ("pipe:"), the terminal side is driven from the
+ * same process.  The peer callback is invoked whenever the manager writes
+ * to, or finds nothing to read from, the pipe.
+ */
+typedef void (*pipe_serial_peer_fn)(mm_serial_context_t *pserial_context, void *arg);
+void    pipe_serial_set_peer(mm_serial_context_t *pserial_context, pipe_serial_peer_fn peer, void *arg);
+ssize_t pipe_serial_peer_write(mm_serial_context_t *pserial_context, const void *buf, size_t count);
+ssize_t pipe_serial_peer_read(mm_serial_context_t *pserial_context, void *buf, size_t count);
+void    pipe_serial_set_carrier(mm_serial_context_t *pserial_context, int carrier);
 
 extern int platform_open_serial(const char *modem_dev);
 extern int platform_init_serial(int fd, int baudrate);
@@ -43,5 +117,11 @@ int        platform_drain_serial(int fd);
 int        platform_flush_serial(int fd);
 int        platform_serial_set_dtr(int fd, int set);
 int        platform_serial_get_modem_status(int fd);
+void      *platform_serial_monitor_start(int fd);
+void       platform_serial_monitor_stop(void *monitor);
+int        platform_serial_monitor_status(void *monitor, int fd);
+int        platform_serial_monitor_wait(void *monitor, int fd, int timeout_ms);
+int        platform_serial_monitor_wakes(void *monitor);
+void       platform_serial_wake_all(void);
 
 #endif  /* MM_SERIAL_H_ */
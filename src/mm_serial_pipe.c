@@ -0,0 +1,215 @@
+/*
+ * In-memory pipe serial transport, part of mm_manager.
+ *
+ * The terminal side of the pipe is driven by a peer callback running in the
+ * same process, which allows a complete session to be run without a modem.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mm_serial.h"
+
+#define PIPE_RING_LEN   (4096)
+
+typedef struct pipe_ring {
+    uint8_t buf[PIPE_RING_LEN];
+    size_t  head;
+    size_t  len;
+} pipe_ring_t;
+
+typedef struct pipe_priv {
+    pipe_ring_t         to_manager;
+    pipe_ring_t         to_peer;
+    mm_modem_emu_t      emu;
+    pipe_serial_peer_fn peer;
+    void               *peer_arg;
+    uint8_t             in_peer;    /* Peer callback is running */
+} pipe_priv_t;
+
+static size_t pipe_ring_put(pipe_ring_t *ring, const uint8_t *buf, size_t count) {
+    size_t i;
+
+    for (i = 0; (i < count) && (ring->len < PIPE_RING_LEN); i++) {
+        ring->buf[(ring->head + ring->len) % PIPE_RING_LEN] = buf[i];
+        ring->len++;
+    }
+
+    return i;
+}
+
+static size_t pipe_ring_get(pipe_ring_t *ring, uint8_t *buf, size_t count) {
+    size_t i;
+
+    for (i = 0; (i < count) && (ring->len > 0); i++) {
+        buf[i] = ring->buf[ring->head];
+        ring->head = (ring->head + 1) % PIPE_RING_LEN;
+        ring->len--;
+    }
+
+    return i;
+}
+
+static void pipe_run_peer(mm_serial_context_t *pserial_context) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+
+    if ((priv->peer == NULL) || priv->in_peer) return;
+
+    priv->in_peer = 1;
+    priv->peer(pserial_context, priv->peer_arg);
+    priv->in_peer = 0;
+}
+
+static int pipe_open(mm_serial_context_t *pserial_context, const char *modem_dev) {
+    pipe_priv_t *priv;
+
+    (void)modem_dev;
+
+    priv = (pipe_priv_t *)calloc(1, sizeof(pipe_priv_t));
+
+    if (priv == NULL) {
+        fprintf(stderr, "%s: Error allocating memory.\n", __func__);
+        return -ENOMEM;
+    }
+
+    modem_emu_init(&priv->emu);
+    pserial_context->priv = priv;
+
+    return 0;
+}
+
+static int pipe_init(mm_serial_context_t *pserial_context, int baudrate) {
+    (void)pserial_context;
+    (void)baudrate;
+    return 0;
+}
+
+static int pipe_close(mm_serial_context_t *pserial_context) {
+    free(pserial_context->priv);
+    pserial_context->priv = NULL;
+    return 0;
+}
+
+/* Never blocks: if the peer has nothing to send, 0 is returned as on a timeout. */
+static ssize_t pipe_read(mm_serial_context_t *pserial_context, void *buf, size_t count, int timeout_ms) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+    size_t bytes_read;
+
+    (void)timeout_ms;
+
+    if ((bytes_read = modem_emu_read(&priv->emu, buf, count)) > 0) {
+        return bytes_read;
+    }
+
+    if (priv->to_manager.len == 0) {
+        pipe_run_peer(pserial_context);
+
+        if ((bytes_read = modem_emu_read(&priv->emu, buf, count)) > 0) {
+            return bytes_read;
+        }
+    }
+
+    return pipe_ring_get(&priv->to_manager, (uint8_t *)buf, count);
+}
+
+static ssize_t pipe_write(mm_serial_context_t *pserial_context, const void *buf, size_t count) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+    size_t bytes_written;
+
+    if (modem_emu_write(&priv->emu, buf, count) == 0) {
+        return count;
+    }
+
+    bytes_written = pipe_ring_put(&priv->to_peer, (const uint8_t *)buf, count);
+    pipe_run_peer(pserial_context);
+
+    return bytes_written;
+}
+
+static int pipe_drain(mm_serial_context_t *pserial_context) {
+    (void)pserial_context;
+    return 0;
+}
+
+static int pipe_flush(mm_serial_context_t *pserial_context) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+
+    priv->to_manager.len = 0;
+    modem_emu_flush(&priv->emu);
+    return 0;
+}
+
+/* Dropping DTR hangs up the call, the peer sees DCD drop. */
+static int pipe_set_dtr(mm_serial_context_t *pserial_context, int set) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+
+    priv->emu.dtr = set ? 1 : 0;
+
+    if (!set) {
+        modem_emu_hangup(&priv->emu);
+        priv->to_manager.len = 0;
+        priv->to_peer.len = 0;
+    }
+
+    return 0;
+}
+
+static int pipe_get_modem_status(mm_serial_context_t *pserial_context) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+
+    return modem_emu_get_modem_status(&priv->emu);
+}
+
+const mm_serial_transport_t serial_transport_pipe = {
+    "pipe",
+    pipe_open,
+    pipe_init,
+    pipe_close,
+    pipe_read,
+    pipe_write,
+    pipe_drain,
+    pipe_flush,
+    pipe_set_dtr,
+    pipe_get_modem_status
+};
+
+/* Peer (terminal) side of the pipe. */
+void pipe_serial_set_peer(mm_serial_context_t *pserial_context, pipe_serial_peer_fn peer, void *arg) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+
+    priv->peer = peer;
+    priv->peer_arg = arg;
+}
+
+ssize_t pipe_serial_peer_write(mm_serial_context_t *pserial_context, const void *buf, size_t count) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+
+    if (!priv->emu.carrier) return -ENOTCONN;
+
+    return pipe_ring_put(&priv->to_manager, (const uint8_t *)buf, count);
+}
+
+ssize_t pipe_serial_peer_read(mm_serial_context_t *pserial_context, void *buf, size_t count) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+
+    return pipe_ring_get(&priv->to_peer, (uint8_t *)buf, count);
+}
+
+/* Place (carrier = 1) or end (carrier = 0) a call from the terminal side. */
+void pipe_serial_set_carrier(mm_serial_context_t *pserial_context, int carrier) {
+    pipe_priv_t *priv = (pipe_priv_t *)pserial_context->priv;
+
+    modem_emu_set_carrier(&priv->emu, carrier);
+
+    if (!priv->emu.carrier) {
+        priv->to_manager.len = 0;
+        priv->to_peer.len = 0;
+    }
+}
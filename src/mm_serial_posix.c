@@ -6,6 +6,10 @@
  * Copyright (c) 2020-2023, Howard M. Harte
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* posix_openpt(), ptsname() */
+#endif /* _GNU_SOURCE */
+
 #include <stdio.h>  /* Standard input/output definitions */
 #include <stdlib.h>
 #include <stdint.h>
@@ -14,7 +18,15 @@
 #include <errno.h>  /* Error number definitions */
 #include <termios.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/ioctl.h>
+#ifdef __linux__
+# include <linux/serial.h>  /* struct serial_icounter_struct */
+#endif /* __linux__ */
+
+#include "mm_serial.h"
 
 /*
  * Open serial port specified in modem_dev.
@@ -157,3 +169,418 @@ int platform_serial_get_modem_status(int fd) {
 
     return retstatus;
 }
+
+#ifdef TIOCMIWAIT
+/*
+ * Carrier monitor: a thread sleeps in TIOCMIWAIT until DCD or RI changes,
+ * caches the modem status, and signals readers through a pipe.  Reads wait
+ * in poll() on the port, that pipe and the shared wake pipe, so a carrier
+ * change or platform_serial_wake_all() wakes them immediately, an idle
+ * read needs no timeout, and checking carrier costs no system calls.
+ * Where the driver counts modem status transitions (TIOCGICOUNT), any
+ * transition is signalled, even one back to the same status, and so is a
+ * transition made while the thread was not waiting.
+ *
+ * The thread is stopped by setting stopping and interrupting TIOCMIWAIT
+ * with SERIAL_MONITOR_SIGNAL, which has a handler that does nothing and
+ * is installed without SA_RESTART.
+ */
+#define SERIAL_MONITOR_SIGNAL   SIGUSR2
+
+typedef struct serial_monitor {
+    pthread_t    thread;
+    int          fd;
+    int          event_pipe[2];
+    volatile int status;
+    volatile int failed;    /* TIOCMIWAIT not supported by the driver. */
+    volatile int stopping;
+    volatile int stopped;
+} serial_monitor_t;
+
+static pthread_once_t serial_monitor_once = PTHREAD_ONCE_INIT;
+static int serial_wake_pipe[2] = { -1, -1 };
+
+static void serial_monitor_signal(int sig) {
+    (void)sig;
+}
+
+static void serial_monitor_init(void) {
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = serial_monitor_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SERIAL_MONITOR_SIGNAL, &action, NULL);
+
+    if (pipe(serial_wake_pipe) == 0) {
+        fcntl(serial_wake_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(serial_wake_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+}
+
+static void serial_monitor_notify(serial_monitor_t *mon, int status) {
+    mon->status = status;
+    if (write(mon->event_pipe[1], "C", 1) < 0) {
+        /* The pipe is full of unread events already. */
+    }
+}
+
+static void *serial_monitor_thread(void *arg) {
+    serial_monitor_t *mon = (serial_monitor_t *)arg;
+#ifdef TIOCGICOUNT
+    struct serial_icounter_struct seen;
+    struct serial_icounter_struct icount;
+    int counted = (ioctl(mon->fd, TIOCGICOUNT, &seen) == 0);
+#endif /* TIOCGICOUNT */
+
+    while (!mon->stopping) {
+        int status;
+
+#ifdef TIOCGICOUNT
+        /* Transitions since the count was last seen, including while not waiting. */
+        if (counted && (ioctl(mon->fd, TIOCGICOUNT, &icount) == 0) &&
+            ((icount.dcd != seen.dcd) || (icount.rng != seen.rng))) {
+            seen = icount;
+            serial_monitor_notify(mon, platform_serial_get_modem_status(mon->fd));
+            continue;
+        }
+#endif /* TIOCGICOUNT */
+
+        if (ioctl(mon->fd, TIOCMIWAIT, TIOCM_CD | TIOCM_RNG) < 0) {
+            if (errno == EINTR) continue;
+            mon->failed = 1;
+            break;
+        }
+
+        status = platform_serial_get_modem_status(mon->fd);
+
+        if (status != mon->status) {
+            serial_monitor_notify(mon, status);
+        }
+    }
+
+    mon->stopped = 1;
+    return NULL;
+}
+
+void *platform_serial_monitor_start(int fd) {
+    serial_monitor_t *mon;
+
+    pthread_once(&serial_monitor_once, serial_monitor_init);
+
+    if ((mon = (serial_monitor_t *)calloc(1, sizeof(serial_monitor_t))) == NULL) return NULL;
+
+    mon->fd = fd;
+    mon->status = platform_serial_get_modem_status(fd);
+
+    if (pipe(mon->event_pipe) != 0) {
+        free(mon);
+        return NULL;
+    }
+
+    fcntl(mon->event_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(mon->event_pipe[1], F_SETFL, O_NONBLOCK);
+
+    if (pthread_create(&mon->thread, NULL, serial_monitor_thread, mon) != 0) {
+        close(mon->event_pipe[0]);
+        close(mon->event_pipe[1]);
+        free(mon);
+        return NULL;
+    }
+
+    return mon;
+}
+
+void platform_serial_monitor_stop(void *monitor) {
+    serial_monitor_t *mon = (serial_monitor_t *)monitor;
+
+    if (mon == NULL) return;
+
+    /* The signal is lost if it arrives just before TIOCMIWAIT, so repeat it. */
+    mon->stopping = 1;
+    while (!mon->stopped) {
+        pthread_kill(mon->thread, SERIAL_MONITOR_SIGNAL);
+        usleep(10000);
+    }
+
+    pthread_join(mon->thread, NULL);
+    close(mon->event_pipe[0]);
+    close(mon->event_pipe[1]);
+    free(mon);
+}
+
+int platform_serial_monitor_status(void *monitor, int fd) {
+    serial_monitor_t *mon = (serial_monitor_t *)monitor;
+
+    if ((mon == NULL) || mon->failed) {
+        return platform_serial_get_modem_status(fd);
+    }
+
+    return mon->status;
+}
+
+int platform_serial_monitor_wakes(void *monitor) {
+    serial_monitor_t *mon = (serial_monitor_t *)monitor;
+
+    return (mon != NULL) && !mon->failed && (serial_wake_pipe[0] != -1);
+}
+
+/*
+ * Wait up to timeout_ms, or forever if negative, for data to read.
+ * Returns 1 if data is available, 0 on timeout, if the modem status
+ * changed, or once platform_serial_wake_all() was called.  monitor may be
+ * NULL.
+ */
+int platform_serial_monitor_wait(void *monitor, int fd, int timeout_ms) {
+    serial_monitor_t *mon = (serial_monitor_t *)monitor;
+    struct pollfd pfd[3] = {
+        { fd, POLLIN, 0 },
+        { (mon != NULL) ? mon->event_pipe[0] : -1, POLLIN, 0 },
+        { serial_wake_pipe[0], POLLIN, 0 }
+    };
+    int result = poll(pfd, 3, timeout_ms);
+
+    if (result <= 0) return 0;
+
+    if (pfd[1].revents & POLLIN) {
+        char event[16];
+
+        while (read(pfd[1].fd, event, sizeof(event)) > 0) { }
+        return 0;
+    }
+
+    /* The wake pipe is left readable, to wake every line. */
+    if (pfd[2].revents & POLLIN) return 0;
+
+    return 1;
+}
+
+void platform_serial_wake_all(void) {
+    if (serial_wake_pipe[1] != -1) {
+        if (write(serial_wake_pipe[1], "W", 1) < 0) {
+            /* Already woken. */
+        }
+    }
+}
+#else  /* TIOCMIWAIT */
+/* No carrier change notification on this platform, poll for status. */
+void *platform_serial_monitor_start(int fd) {
+    (void)fd;
+    return NULL;
+}
+
+void platform_serial_monitor_stop(void *monitor) {
+    (void)monitor;
+}
+
+int platform_serial_monitor_status(void *monitor, int fd) {
+    (void)monitor;
+    return platform_serial_get_modem_status(fd);
+}
+
+int platform_serial_monitor_wakes(void *monitor) {
+    (void)monitor;
+    return 0;
+}
+
+int platform_serial_monitor_wait(void *monitor, int fd, int timeout_ms) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+
+    (void)monitor;
+    return (poll(&pfd, 1, timeout_ms) > 0) ? 1 : 0;
+}
+
+void platform_serial_wake_all(void) {
+}
+#endif /* TIOCMIWAIT */
+
+/*
+ * Pseudo-terminal transport ("pty:"), for use with a terminal simulator.
+ * The slave device name is printed when it is opened.  Carrier is present
+ * while the simulator holds the slave open, and dropping DTR hangs up until
+ * the simulator closes and reopens it.
+ */
+#define PTY_CARRIER_POLL_MS     (100)   /* Carrier check interval while the slave is closed */
+
+typedef struct pty_priv {
+    mm_modem_emu_t emu;
+    int            hungup;  /* Hung up by DTR, wait for the slave to close. */
+} pty_priv_t;
+
+/* Track whether the slave side is open, reported as carrier. */
+static void pty_update_carrier(mm_serial_context_t *pserial_context) {
+    pty_priv_t   *priv = (pty_priv_t *)pserial_context->priv;
+    struct pollfd pfd = { pserial_context->fd, POLLIN, 0 };
+    int           slave_open;
+
+    if (poll(&pfd, 1, 0) < 0) return;
+
+    slave_open = !(pfd.revents & POLLHUP);
+
+    if (!slave_open) {
+        priv->hungup = 0;
+    }
+
+    if (!priv->hungup) {
+        modem_emu_set_carrier(&priv->emu, slave_open);
+    }
+}
+
+static int pty_open(mm_serial_context_t *pserial_context, const char *modem_dev) {
+    pty_priv_t    *priv;
+    const char    *slave_name;
+    struct termios options;
+    int            slave_fd;
+
+    (void)modem_dev;
+
+    pserial_context->fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if ((pserial_context->fd == -1) || (grantpt(pserial_context->fd) != 0) ||
+        (unlockpt(pserial_context->fd) != 0) || ((slave_name = ptsname(pserial_context->fd)) == NULL)) {
+        fprintf(stderr, "%s: Unable to create pseudo-terminal: %s\n", __func__, strerror(errno));
+        if (pserial_context->fd != -1) close(pserial_context->fd);
+        pserial_context->fd = -1;
+        return -ENODEV;
+    }
+
+    /* Put the slave in raw mode, the setting persists while the master is open. */
+    if ((slave_fd = open(slave_name, O_RDWR | O_NOCTTY)) != -1) {
+        if (tcgetattr(slave_fd, &options) == 0) {
+            cfmakeraw(&options);
+            tcsetattr(slave_fd, TCSANOW, &options);
+        }
+        close(slave_fd);
+    }
+
+    priv = (pty_priv_t *)calloc(1, sizeof(pty_priv_t));
+
+    if (priv == NULL) {
+        fprintf(stderr, "%s: Error allocating memory.\n", __func__);
+        close(pserial_context->fd);
+        pserial_context->fd = -1;
+        return -ENOMEM;
+    }
+
+    modem_emu_init(&priv->emu);
+    pserial_context->priv = priv;
+
+    printf("Terminal pseudo-terminal: %s\n", slave_name);
+
+    return 0;
+}
+
+static int pty_init(mm_serial_context_t *pserial_context, int baudrate) {
+    (void)pserial_context;
+    (void)baudrate;
+    return 0;
+}
+
+static int pty_close(mm_serial_context_t *pserial_context) {
+    free(pserial_context->priv);
+    pserial_context->priv = NULL;
+    return close(pserial_context->fd);
+}
+
+static ssize_t pty_read(mm_serial_context_t *pserial_context, void *buf, size_t count, int timeout_ms) {
+    pty_priv_t   *priv = (pty_priv_t *)pserial_context->priv;
+    struct pollfd pfd = { pserial_context->fd, POLLIN, 0 };
+    ssize_t       bytes_read;
+
+    pty_update_carrier(pserial_context);
+
+    if ((bytes_read = modem_emu_read(&priv->emu, buf, count)) > 0) {
+        return bytes_read;
+    }
+
+    if (!priv->emu.carrier) {
+        /*
+         * poll() returns immediately while the slave is closed, so check for
+         * carrier periodically until the timeout, or forever if negative.
+         */
+        for (int waited = 0; (timeout_ms < 0) || (waited < timeout_ms); waited += PTY_CARRIER_POLL_MS) {
+            int wait_ms = ((timeout_ms < 0) || (timeout_ms - waited > PTY_CARRIER_POLL_MS)) ?
+                          PTY_CARRIER_POLL_MS : timeout_ms - waited;
+
+            usleep((useconds_t)wait_ms * 1000);
+            pty_update_carrier(pserial_context);
+            if (priv->emu.carrier || serial_stopped()) break;
+        }
+        return modem_emu_read(&priv->emu, buf, count);
+    }
+
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return 0;
+    }
+
+    if (!(pfd.revents & POLLIN)) {
+        pty_update_carrier(pserial_context);
+        return modem_emu_read(&priv->emu, buf, count);
+    }
+
+    bytes_read = read(pserial_context->fd, buf, count);
+
+    if ((bytes_read < 0) && (errno == EIO)) {
+        /* Slave closed. */
+        pty_update_carrier(pserial_context);
+        return modem_emu_read(&priv->emu, buf, count);
+    }
+
+    return bytes_read;
+}
+
+static ssize_t pty_write(mm_serial_context_t *pserial_context, const void *buf, size_t count) {
+    pty_priv_t *priv = (pty_priv_t *)pserial_context->priv;
+
+    if (modem_emu_write(&priv->emu, buf, count) == 0) {
+        return count;
+    }
+
+    return write(pserial_context->fd, buf, count);
+}
+
+static int pty_drain(mm_serial_context_t *pserial_context) {
+    (void)pserial_context;
+    return 0;
+}
+
+static int pty_flush(mm_serial_context_t *pserial_context) {
+    pty_priv_t *priv = (pty_priv_t *)pserial_context->priv;
+
+    modem_emu_flush(&priv->emu);
+    return tcflush(pserial_context->fd, TCIOFLUSH);
+}
+
+static int pty_set_dtr(mm_serial_context_t *pserial_context, int set) {
+    pty_priv_t *priv = (pty_priv_t *)pserial_context->priv;
+
+    priv->emu.dtr = set ? 1 : 0;
+
+    if (!set && priv->emu.carrier) {
+        modem_emu_hangup(&priv->emu);
+        priv->hungup = 1;
+        tcflush(pserial_context->fd, TCIOFLUSH);
+    }
+
+    return 0;
+}
+
+static int pty_get_modem_status(mm_serial_context_t *pserial_context) {
+    pty_priv_t *priv = (pty_priv_t *)pserial_context->priv;
+
+    pty_update_carrier(pserial_context);
+    return modem_emu_get_modem_status(&priv->emu);
+}
+
+const mm_serial_transport_t serial_transport_pty = {
+    "pty",
+    pty_open,
+    pty_init,
+    pty_close,
+    pty_read,
+    pty_write,
+    pty_drain,
+    pty_flush,
+    pty_set_dtr,
+    pty_get_modem_status
+};
@@ -0,0 +1,719 @@
+/*
+ * TCP serial transport, part of mm_manager.
+ *
+ * tcp:<host>:<port> connects to a terminal simulator or serial server at
+ * <host>, which is an IPv6 address in brackets as in tcp:[::1]:<port>, and
+ * tcp::<port> listens for one on <port>.  An established connection
+ * is treated as a call: it is reported as RING / CONNECT, and dropping DTR
+ * closes it.
+ *
+ * rfc2217:<host>:<port> (or rfc2217::<port>) uses Telnet COM Port Control
+ * (RFC 2217) to drive a modem attached to a modem server.  The connection
+ * is a serial link to that modem: AT commands and result codes pass through,
+ * DTR is controlled with SET-CONTROL and DCD/RI come from NOTIFY-MODEMSTATE.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#define close_socket    closesocket
+#else
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#define SOCKET          int
+#define INVALID_SOCKET  (-1)
+#define SOCKET_ERROR    (-1)
+#define close_socket    close
+#endif  /* _WIN32 */
+
+#include "mm_serial.h"
+
+#define TCP_CONNECT_INTERVAL    (5)     /* Seconds between outbound connection attempts. */
+
+/* Telnet commands and options */
+#define TN_SE                   (240)
+#define TN_SB                   (250)
+#define TN_WILL                 (251)
+#define TN_WONT                 (252)
+#define TN_DO                   (253)
+#define TN_DONT                 (254)
+#define TN_IAC                  (255)
+
+#define TN_OPT_BINARY           (0)
+#define TN_OPT_SGA              (3)
+#define TN_OPT_COM_PORT         (44)
+
+/* RFC 2217 COM-PORT-OPTION commands (client to server, server adds 100.) */
+#define CPO_SET_BAUDRATE        (1)
+#define CPO_SET_DATASIZE        (2)
+#define CPO_SET_PARITY          (3)
+#define CPO_SET_STOPSIZE        (4)
+#define CPO_SET_CONTROL         (5)
+#define CPO_NOTIFY_MODEMSTATE   (7)
+#define CPO_SET_MODEMSTATE_MASK (11)
+#define CPO_PURGE_DATA          (12)
+#define CPO_SERVER_OFFSET       (100)
+
+#define CPO_PARITY_NONE         (1)
+#define CPO_CONTROL_HW_FLOW     (3)
+#define CPO_CONTROL_DTR_ON      (8)
+#define CPO_CONTROL_DTR_OFF     (9)
+#define CPO_PURGE_BOTH          (3)
+
+/* NOTIFY-MODEMSTATE bits, these match MS_RLSD_ON / MS_RING_ON. */
+#define CPO_MODEMSTATE_DCD      (0x80)
+#define CPO_MODEMSTATE_RI       (0x40)
+
+enum tn_state {
+    TN_STATE_DATA = 0,
+    TN_STATE_IAC,
+    TN_STATE_OPT,
+    TN_STATE_SB,
+    TN_STATE_SB_IAC
+};
+
+typedef struct tcp_priv {
+    char            host[64];
+    char            port[8];
+    SOCKET          listen_sock;
+    SOCKET          sock;
+    time_t          last_connect;
+    mm_modem_emu_t  emu;
+    int             rfc2217;        /* Telnet COM Port Control */
+    int             baudrate;
+    enum tn_state   tn_state;
+    uint8_t         tn_verb;        /* WILL/WONT/DO/DONT being received */
+    uint8_t         tn_sb[16];      /* Subnegotiation being received */
+    uint8_t         tn_sb_len;
+    uint8_t         tn_us[256];     /* Options enabled on our side */
+    uint8_t         tn_him[256];    /* Options enabled on the server's side */
+    uint8_t         modemstate;     /* Last NOTIFY-MODEMSTATE */
+} tcp_priv_t;
+
+static void tcp_disconnect(tcp_priv_t *priv) {
+    if (priv->sock != INVALID_SOCKET) {
+        close_socket(priv->sock);
+        priv->sock = INVALID_SOCKET;
+    }
+
+    priv->tn_state = TN_STATE_DATA;
+    priv->modemstate = 0;
+    memset(priv->tn_us, 0, sizeof(priv->tn_us));
+    memset(priv->tn_him, 0, sizeof(priv->tn_him));
+}
+
+/* Connection lost or closed by the remote end. */
+static void tcp_lost(tcp_priv_t *priv) {
+    tcp_disconnect(priv);
+    modem_emu_set_carrier(&priv->emu, 0);
+}
+
+static int tcp_send(tcp_priv_t *priv, const uint8_t *buf, size_t count) {
+    if (priv->sock == INVALID_SOCKET) return -1;
+
+    if (send(priv->sock, (const char *)buf, (int)count, 0) == SOCKET_ERROR) {
+        tcp_lost(priv);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void tn_send_option(tcp_priv_t *priv, uint8_t verb, uint8_t option) {
+    uint8_t cmd[3] = { TN_IAC, verb, option };
+
+    tcp_send(priv, cmd, sizeof(cmd));
+}
+
+/* Send a COM-PORT-OPTION subnegotiation, escaping IAC in the value. */
+static void cpo_send(tcp_priv_t *priv, uint8_t command, const uint8_t *value, size_t len) {
+    uint8_t cmd[32];
+    size_t  cmd_len = 0;
+
+    cmd[cmd_len++] = TN_IAC;
+    cmd[cmd_len++] = TN_SB;
+    cmd[cmd_len++] = TN_OPT_COM_PORT;
+    cmd[cmd_len++] = command;
+
+    for (size_t i = 0; i < len; i++) {
+        cmd[cmd_len++] = value[i];
+        if (value[i] == TN_IAC) cmd[cmd_len++] = TN_IAC;
+    }
+
+    cmd[cmd_len++] = TN_IAC;
+    cmd[cmd_len++] = TN_SE;
+
+    tcp_send(priv, cmd, cmd_len);
+}
+
+static void cpo_send_byte(tcp_priv_t *priv, uint8_t command, uint8_t value) {
+    cpo_send(priv, command, &value, 1);
+}
+
+static void rfc2217_set_baudrate(tcp_priv_t *priv) {
+    uint8_t baud[4] = {
+        (uint8_t)(priv->baudrate >> 24), (uint8_t)(priv->baudrate >> 16),
+        (uint8_t)(priv->baudrate >> 8),  (uint8_t)(priv->baudrate)
+    };
+
+    cpo_send(priv, CPO_SET_BAUDRATE, baud, sizeof(baud));
+}
+
+/* Negotiate binary mode and COM Port Control, and set up the serial port. */
+static void rfc2217_start(tcp_priv_t *priv) {
+    priv->tn_us[TN_OPT_COM_PORT] = 1;
+    priv->tn_us[TN_OPT_BINARY] = 1;
+    priv->tn_him[TN_OPT_BINARY] = 1;
+    priv->tn_us[TN_OPT_SGA] = 1;
+    priv->tn_him[TN_OPT_SGA] = 1;
+
+    tn_send_option(priv, TN_WILL, TN_OPT_COM_PORT);
+    tn_send_option(priv, TN_WILL, TN_OPT_BINARY);
+    tn_send_option(priv, TN_DO, TN_OPT_BINARY);
+    tn_send_option(priv, TN_WILL, TN_OPT_SGA);
+    tn_send_option(priv, TN_DO, TN_OPT_SGA);
+
+    rfc2217_set_baudrate(priv);
+    cpo_send_byte(priv, CPO_SET_DATASIZE, 8);
+    cpo_send_byte(priv, CPO_SET_PARITY, CPO_PARITY_NONE);
+    cpo_send_byte(priv, CPO_SET_STOPSIZE, 1);
+    cpo_send_byte(priv, CPO_SET_CONTROL, CPO_CONTROL_HW_FLOW);
+    cpo_send_byte(priv, CPO_SET_MODEMSTATE_MASK, CPO_MODEMSTATE_DCD | CPO_MODEMSTATE_RI);
+    cpo_send_byte(priv, CPO_SET_CONTROL, priv->emu.dtr ? CPO_CONTROL_DTR_ON : CPO_CONTROL_DTR_OFF);
+}
+
+static void tn_option(tcp_priv_t *priv, uint8_t verb, uint8_t option) {
+    int supported = (option == TN_OPT_BINARY) || (option == TN_OPT_SGA) || (option == TN_OPT_COM_PORT);
+
+    switch (verb) {
+        case TN_WILL:
+            if (!supported) {
+                tn_send_option(priv, TN_DONT, option);
+            } else if (!priv->tn_him[option]) {
+                priv->tn_him[option] = 1;
+                tn_send_option(priv, TN_DO, option);
+            }
+            break;
+        case TN_DO:
+            if (!supported) {
+                tn_send_option(priv, TN_WONT, option);
+            } else if (!priv->tn_us[option]) {
+                priv->tn_us[option] = 1;
+                tn_send_option(priv, TN_WILL, option);
+            }
+            break;
+        case TN_WONT:
+            if (priv->tn_him[option]) {
+                priv->tn_him[option] = 0;
+                tn_send_option(priv, TN_DONT, option);
+            }
+            break;
+        case TN_DONT:
+            if (priv->tn_us[option]) {
+                priv->tn_us[option] = 0;
+                tn_send_option(priv, TN_WONT, option);
+            }
+            if (option == TN_OPT_COM_PORT) {
+                fprintf(stderr, "%s: Server refused COM Port Control.\n", __func__);
+            }
+            break;
+    }
+}
+
+static void tn_subnegotiation(tcp_priv_t *priv) {
+    if ((priv->tn_sb_len < 3) || (priv->tn_sb[0] != TN_OPT_COM_PORT)) return;
+
+    if (priv->tn_sb[1] == CPO_SERVER_OFFSET + CPO_NOTIFY_MODEMSTATE) {
+        priv->modemstate = priv->tn_sb[2];
+
+        /* Track DCD so that a dropped connection reports NO CARRIER. */
+        priv->emu.carrier = (priv->modemstate & CPO_MODEMSTATE_DCD) ? 1 : 0;
+    }
+}
+
+/* Strip Telnet commands from received data, in place. */
+static size_t tn_receive(tcp_priv_t *priv, uint8_t *buf, size_t len) {
+    size_t out = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = buf[i];
+
+        switch (priv->tn_state) {
+            case TN_STATE_DATA:
+                if (c == TN_IAC) {
+                    priv->tn_state = TN_STATE_IAC;
+                } else {
+                    buf[out++] = c;
+                }
+                break;
+            case TN_STATE_IAC:
+                priv->tn_state = TN_STATE_DATA;
+
+                if (c == TN_IAC) {
+                    buf[out++] = c;
+                } else if ((c >= TN_WILL) && (c <= TN_DONT)) {
+                    priv->tn_verb = c;
+                    priv->tn_state = TN_STATE_OPT;
+                } else if (c == TN_SB) {
+                    priv->tn_sb_len = 0;
+                    priv->tn_state = TN_STATE_SB;
+                }
+                break;
+            case TN_STATE_OPT:
+                priv->tn_state = TN_STATE_DATA;
+                tn_option(priv, priv->tn_verb, c);
+                break;
+            case TN_STATE_SB:
+                if (c == TN_IAC) {
+                    priv->tn_state = TN_STATE_SB_IAC;
+                } else if (priv->tn_sb_len < sizeof(priv->tn_sb)) {
+                    priv->tn_sb[priv->tn_sb_len++] = c;
+                }
+                break;
+            case TN_STATE_SB_IAC:
+                if (c == TN_SE) {
+                    tn_subnegotiation(priv);
+                    priv->tn_state = TN_STATE_DATA;
+                } else {
+                    if (priv->tn_sb_len < sizeof(priv->tn_sb)) {
+                        priv->tn_sb[priv->tn_sb_len++] = c;
+                    }
+                    priv->tn_state = TN_STATE_SB;
+                }
+                break;
+        }
+    }
+
+    return out;
+}
+
+/* Wait up to timeout_ms for sock to become readable. */
+static int tcp_wait_readable(SOCKET sock, int timeout_ms) {
+    fd_set readfds;
+    struct timeval tv;
+
+    FD_ZERO(&readfds);
+    FD_SET(sock, &readfds);
+    tv.tv_sec  = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    return select((int)sock + 1, &readfds, NULL, NULL, &tv);
+}
+
+static void tcp_sleep_ms(int timeout_ms) {
+#ifdef _WIN32
+    Sleep(timeout_ms);
+#else
+    usleep(timeout_ms * 1000);
+#endif /* _WIN32 */
+}
+
+static void tcp_set_nodelay(SOCKET sock) {
+    int one = 1;
+
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+}
+
+/* Accept an incoming connection, or place an outgoing one. */
+static void tcp_try_connect(tcp_priv_t *priv, int timeout_ms) {
+    if (priv->listen_sock != INVALID_SOCKET) {
+        if (tcp_wait_readable(priv->listen_sock, timeout_ms) > 0) {
+            priv->sock = accept(priv->listen_sock, NULL, NULL);
+        }
+    } else {
+        struct addrinfo hints, *res, *ai;
+        time_t now = time(NULL);
+
+        if (now - priv->last_connect < TCP_CONNECT_INTERVAL) {
+            tcp_sleep_ms(timeout_ms);
+            return;
+        }
+
+        priv->last_connect = now;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        if (getaddrinfo(priv->host, priv->port, &hints, &res) != 0) return;
+
+        for (ai = res; ai != NULL; ai = ai->ai_next) {
+            priv->sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+            if (priv->sock == INVALID_SOCKET) continue;
+
+            if (connect(priv->sock, ai->ai_addr, (int)ai->ai_addrlen) != SOCKET_ERROR) break;
+
+            tcp_disconnect(priv);
+        }
+
+        freeaddrinfo(res);
+    }
+
+    if (priv->sock != INVALID_SOCKET) {
+        tcp_set_nodelay(priv->sock);
+
+        if (priv->rfc2217) {
+            rfc2217_start(priv);
+        } else {
+            modem_emu_set_carrier(&priv->emu, 1);
+        }
+    }
+}
+
+/*
+ * Listen on priv->port, on IPv6 and IPv4 where the stack allows both on one
+ * socket, otherwise on IPv4 only.
+ */
+static int tcp_listen(tcp_priv_t *priv) {
+    struct sockaddr_in6 addr6;
+    struct sockaddr_in  addr;
+    uint16_t port = htons((uint16_t)atoi(priv->port));
+    int one = 1;
+    int zero = 0;
+
+    memset(&addr6, 0, sizeof(addr6));
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_port = port;
+    addr6.sin6_addr = in6addr_any;
+
+    priv->listen_sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+
+    if (priv->listen_sock != INVALID_SOCKET) {
+        setsockopt(priv->listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one));
+
+        if ((setsockopt(priv->listen_sock, IPPROTO_IPV6, IPV6_V6ONLY, (const char *)&zero, sizeof(zero)) == SOCKET_ERROR) ||
+            (bind(priv->listen_sock, (struct sockaddr *)&addr6, sizeof(addr6)) == SOCKET_ERROR)) {
+            close_socket(priv->listen_sock);
+            priv->listen_sock = INVALID_SOCKET;
+        }
+    }
+
+    if (priv->listen_sock == INVALID_SOCKET) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = port;
+        addr.sin_addr.s_addr = INADDR_ANY;
+
+        priv->listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+        if (priv->listen_sock == INVALID_SOCKET) return -1;
+
+        setsockopt(priv->listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one));
+
+        if (bind(priv->listen_sock, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) {
+            close_socket(priv->listen_sock);
+            priv->listen_sock = INVALID_SOCKET;
+            return -1;
+        }
+    }
+
+    if (listen(priv->listen_sock, 1) == SOCKET_ERROR) {
+        close_socket(priv->listen_sock);
+        priv->listen_sock = INVALID_SOCKET;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Shared by tcp: and rfc2217:, which is named by the transport in messages. */
+static int tcp_open(mm_serial_context_t *pserial_context, const char *modem_dev) {
+    tcp_priv_t *priv;
+    const char *host = modem_dev;
+    const char *port = NULL;
+    size_t      host_len = 0;
+    const char *name = pserial_context->transport->name;
+
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        fprintf(stderr, "%s: WSAStartup() Failed. Error Code : %d", __func__, WSAGetLastError());
+        return -1;
+    }
+#endif /* _WIN32 */
+
+    /* An IPv6 address is given in brackets, as its colons can't be told from the port's. */
+    if (modem_dev[0] == '[') {
+        const char *end = strchr(modem_dev, ']');
+
+        host = modem_dev + 1;
+        if ((end != NULL) && (end[1] == ':')) {
+            host_len = (size_t)(end - host);
+            port = end + 2;
+        }
+    } else if ((port = strchr(modem_dev, ':')) != NULL) {
+        host_len = (size_t)(port - modem_dev);
+        port++;
+    }
+
+    if ((port == NULL) || (strchr(port, ':') != NULL) || (host_len >= sizeof(priv->host)) ||
+        (strlen(port) >= sizeof(priv->port))) {
+        fprintf(stderr, "%s: Expected %s:<host>:<port>, %s:[<IPv6 address>]:<port> or %s::<port>, got %s:%s.\n",
+                __func__, name, name, name, name, modem_dev);
+        return -EINVAL;
+    }
+
+    priv = (tcp_priv_t *)calloc(1, sizeof(tcp_priv_t));
+
+    if (priv == NULL) {
+        fprintf(stderr, "%s: Error allocating memory.\n", __func__);
+        return -ENOMEM;
+    }
+
+    memcpy(priv->host, host, host_len);
+    snprintf(priv->port, sizeof(priv->port), "%s", port);
+    priv->listen_sock = INVALID_SOCKET;
+    priv->sock = INVALID_SOCKET;
+    priv->baudrate = 1200;
+    priv->rfc2217 = (pserial_context->transport == &serial_transport_rfc2217);
+    modem_emu_init(&priv->emu);
+
+    if (priv->host[0] == '\0') {
+        if (tcp_listen(priv) != 0) {
+            fprintf(stderr, "%s: Unable to listen on %s port %s.\n", __func__, name, priv->port);
+            free(priv);
+            return -ENODEV;
+        }
+
+        printf("Listening for %s connections on TCP port %s.\n",
+               priv->rfc2217 ? "modem server" : "terminal", priv->port);
+    }
+
+    pserial_context->priv = priv;
+
+    return 0;
+}
+
+static int tcp_init(mm_serial_context_t *pserial_context, int baudrate) {
+    tcp_priv_t *priv = (tcp_priv_t *)pserial_context->priv;
+
+    priv->baudrate = baudrate;
+
+    if (priv->rfc2217 && (priv->sock != INVALID_SOCKET)) {
+        rfc2217_set_baudrate(priv);
+    }
+
+    return 0;
+}
+
+static int tcp_close(mm_serial_context_t *pserial_context) {
+    tcp_priv_t *priv = (tcp_priv_t *)pserial_context->priv;
+
+    tcp_disconnect(priv);
+
+    if (priv->listen_sock != INVALID_SOCKET) {
+        close_socket(priv->listen_sock);
+    }
+
+    free(priv);
+    pserial_context->priv = NULL;
+
+#ifdef _WIN32
+    WSACleanup();
+#endif /* _WIN32 */
+
+    return 0;
+}
+
+static ssize_t tcp_read(mm_serial_context_t *pserial_context, void *buf, size_t count, int timeout_ms) {
+    tcp_priv_t *priv = (tcp_priv_t *)pserial_context->priv;
+    size_t bytes_read;
+    int    len;
+
+    if ((bytes_read = modem_emu_read(&priv->emu, buf, count)) > 0) {
+        return bytes_read;
+    }
+
+    if (priv->sock == INVALID_SOCKET) {
+        /* The modem server link is kept up regardless of DTR. */
+        if (priv->emu.dtr || priv->rfc2217) {
+            tcp_try_connect(priv, timeout_ms);
+        }
+        return modem_emu_read(&priv->emu, buf, count);
+    }
+
+    do {
+        if (tcp_wait_readable(priv->sock, timeout_ms) <= 0) {
+            return 0;
+        }
+
+        len = recv(priv->sock, (char *)buf, (int)count, 0);
+
+        if (len <= 0) {
+            /* Remote end closed the connection. */
+            tcp_lost(priv);
+            return modem_emu_read(&priv->emu, buf, count);
+        }
+
+        if (priv->rfc2217) {
+            len = (int)tn_receive(priv, (uint8_t *)buf, len);
+        }
+    } while ((len == 0) && (priv->sock != INVALID_SOCKET));
+
+    return len;
+}
+
+static ssize_t tcp_write(mm_serial_context_t *pserial_context, const void *buf, size_t count) {
+    tcp_priv_t *priv = (tcp_priv_t *)pserial_context->priv;
+    int len;
+
+    if (priv->rfc2217) {
+        const uint8_t *p = (const uint8_t *)buf;
+        uint8_t escaped[256];
+        size_t  escaped_len = 0;
+
+        if (priv->sock == INVALID_SOCKET) return -1;
+
+        for (size_t i = 0; i < count; i++) {
+            escaped[escaped_len++] = p[i];
+            if (p[i] == TN_IAC) escaped[escaped_len++] = TN_IAC;
+
+            if ((escaped_len >= sizeof(escaped) - 1) || (i == count - 1)) {
+                if (tcp_send(priv, escaped, escaped_len) != 0) return -1;
+                escaped_len = 0;
+            }
+        }
+
+        return count;
+    }
+
+    if ((modem_emu_write(&priv->emu, buf, count) == 0) || (priv->sock == INVALID_SOCKET)) {
+        return count;
+    }
+
+    len = send(priv->sock, (const char *)buf, (int)count, 0);
+
+    if (len == SOCKET_ERROR) {
+        tcp_lost(priv);
+        return -1;
+    }
+
+    return len;
+}
+
+static int tcp_drain(mm_serial_context_t *pserial_context) {
+    (void)pserial_context;
+    return 0;
+}
+
+static int tcp_flush(mm_serial_context_t *pserial_context) {
+    tcp_priv_t *priv = (tcp_priv_t *)pserial_context->priv;
+
+    modem_emu_flush(&priv->emu);
+
+    if (priv->rfc2217 && (priv->sock != INVALID_SOCKET)) {
+        cpo_send_byte(priv, CPO_PURGE_DATA, CPO_PURGE_BOTH);
+    }
+    return 0;
+}
+
+/*
+ * Dropping DTR closes the connection, or for RFC 2217 is passed on to the
+ * modem server.
+ */
+static int tcp_set_dtr(mm_serial_context_t *pserial_context, int set) {
+    tcp_priv_t *priv = (tcp_priv_t *)pserial_context->priv;
+
+    priv->emu.dtr = set ? 1 : 0;
+
+    if (priv->rfc2217) {
+        if (priv->sock != INVALID_SOCKET) {
+            cpo_send_byte(priv, CPO_SET_CONTROL, set ? CPO_CONTROL_DTR_ON : CPO_CONTROL_DTR_OFF);
+        }
+        if (!set) {
+            modem_emu_hangup(&priv->emu);
+        }
+    } else if (!set) {
+        tcp_disconnect(priv);
+        modem_emu_hangup(&priv->emu);
+    }
+
+    return 0;
+}
+
+static int tcp_get_modem_status(mm_serial_context_t *pserial_context) {
+    tcp_priv_t *priv = (tcp_priv_t *)pserial_context->priv;
+
+    if (priv->rfc2217) {
+        return priv->modemstate & (CPO_MODEMSTATE_DCD | CPO_MODEMSTATE_RI);
+    }
+
+    return modem_emu_get_modem_status(&priv->emu);
+}
+
+const mm_serial_transport_t serial_transport_tcp = {
+    "tcp",
+    tcp_open,
+    tcp_init,
+    tcp_close,
+    tcp_read,
+    tcp_write,
+    tcp_drain,
+    tcp_flush,
+    tcp_set_dtr,
+    tcp_get_modem_status
+};
+
+/* The modem must be reachable before it can be initialized, so connect now. */
+static int rfc2217_open(mm_serial_context_t *pserial_context, const char *modem_dev) {
+    tcp_priv_t *priv;
+    int status = tcp_open(pserial_context, modem_dev);
+
+    if (status != 0) return status;
+
+    priv = (tcp_priv_t *)pserial_context->priv;
+
+    if (priv->listen_sock != INVALID_SOCKET) {
+        printf("Waiting for modem server to connect.\n");
+        while ((priv->sock == INVALID_SOCKET) && !serial_stopped()) {
+            tcp_try_connect(priv, SERIAL_READ_TIMEOUT_MS);
+        }
+
+        if (priv->sock == INVALID_SOCKET) {
+            tcp_close(pserial_context);
+            return -ENODEV;
+        }
+    } else {
+        tcp_try_connect(priv, SERIAL_READ_TIMEOUT_MS);
+
+        if (priv->sock == INVALID_SOCKET) {
+            fprintf(stderr, "%s: Unable to connect to modem server %s:%s.\n", __func__, priv->host, priv->port);
+            tcp_close(pserial_context);
+            return -ENODEV;
+        }
+    }
+
+    return 0;
+}
+
+const mm_serial_transport_t serial_transport_rfc2217 = {
+    "rfc2217",
+    rfc2217_open,
+    tcp_init,
+    tcp_close,
+    tcp_read,
+    tcp_write,
+    tcp_drain,
+    tcp_flush,
+    tcp_set_dtr,
+    tcp_get_modem_status
+};
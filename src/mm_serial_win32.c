@@ -151,3 +151,33 @@ int platform_serial_get_modem_status(int fd) {
 
     return (dwModemStat & 0xFFFF);
 }
+
+/* Carrier change notification is not implemented, poll for status. */
+void *platform_serial_monitor_start(int fd) {
+    (void)fd;
+    return NULL;
+}
+
+void platform_serial_monitor_stop(void *monitor) {
+    (void)monitor;
+}
+
+int platform_serial_monitor_status(void *monitor, int fd) {
+    (void)monitor;
+    return platform_serial_get_modem_status(fd);
+}
+
+int platform_serial_monitor_wakes(void *monitor) {
+    (void)monitor;
+    return 0;
+}
+
+int platform_serial_monitor_wait(void *monitor, int fd, int timeout_ms) {
+    (void)monitor;
+    (void)fd;
+    (void)timeout_ms;
+    return 1;
+}
+
+void platform_serial_wake_all(void) {
+}
@@ -195,6 +195,303 @@ int mm_sql_load_TCASHST(void* db, const char* terminal_id, cashbox_status_univ_t
     return 0;
 }
 
+#define TERMSTATE_COLUMNS "TERMINAL_ID, TERMINAL_TYPE, CONTROL_ROM_EDITION, STATUS_WORD, CASH_BOX_STATUS, CALL_IN_OFFSET, SESSION_SECS, DL_STARTED, DL_ACKED"
+
+/* Decode a row of TERMSTATE_COLUMNS. */
+static void mm_sql_termstate_row(sqlite3_stmt* res, mm_termstate_t* state) {
+    const unsigned char* terminal_id;
+    const unsigned char* control_rom_edition;
+    const void* cashbox_status;
+    const void* dl_acked;
+
+    memset(state, 0, sizeof(mm_termstate_t));
+    terminal_id = sqlite3_column_text(res, 0);
+    if (terminal_id != NULL) {
+        snprintf(state->terminal_id, sizeof(state->terminal_id), "%s", (const char*)terminal_id);
+    }
+    state->terminal_type = (uint8_t)sqlite3_column_int(res, 1);
+    control_rom_edition = sqlite3_column_text(res, 2);
+    if (control_rom_edition != NULL) {
+        snprintf(state->control_rom_edition, sizeof(state->control_rom_edition), "%s", (const char*)control_rom_edition);
+    }
+    state->status_word = (uint64_t)sqlite3_column_int64(res, 3);
+    cashbox_status = sqlite3_column_blob(res, 4);
+    if ((cashbox_status != NULL) && (sqlite3_column_bytes(res, 4) == sizeof(cashbox_status_univ_t))) {
+        memcpy(&state->cashbox_status, cashbox_status, sizeof(cashbox_status_univ_t));
+    }
+    state->call_in_offset = (int16_t)sqlite3_column_int(res, 5);
+    state->session_secs = (uint16_t)sqlite3_column_int(res, 6);
+    state->dl_started = (time_t)sqlite3_column_int64(res, 7);
+    dl_acked = sqlite3_column_blob(res, 8);
+    if ((dl_acked != NULL) && (sqlite3_column_bytes(res, 8) == sizeof(state->dl_acked))) {
+        memcpy(state->dl_acked, dl_acked, sizeof(state->dl_acked));
+    }
+}
+
+int mm_sql_load_TERMSTATE(void* db, const char* terminal_id, mm_termstate_t* state) {
+    int rc;
+    sqlite3_stmt* res;
+
+    rc = sqlite3_prepare_v2((sqlite3 *)db, "SELECT " TERMSTATE_COLUMNS " from TERMSTATE where (TERMINAL_ID = ?)", -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    sqlite3_bind_text(res, 1, terminal_id, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(res) != SQLITE_ROW) {
+        sqlite3_finalize(res);
+        return -ENOENT;
+    }
+
+    mm_sql_termstate_row(res, state);
+    sqlite3_finalize(res);
+
+    return 0;
+}
+
+/* Call fn with the state of every terminal in TERMSTATE. */
+int mm_sql_foreach_TERMSTATE(void* db, void (*fn)(void* arg, const mm_termstate_t* state), void* arg) {
+    int rc;
+    sqlite3_stmt* res;
+    mm_termstate_t state;
+
+    rc = sqlite3_prepare_v2((sqlite3 *)db, "SELECT " TERMSTATE_COLUMNS " from TERMSTATE", -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        mm_sql_termstate_row(res, &state);
+        fn(arg, &state);
+    }
+
+    sqlite3_finalize(res);
+
+    return 0;
+}
+
+int mm_sql_save_TERMSTATE(void* db, const mm_termstate_t* state) {
+    int rc;
+    sqlite3_stmt* res;
+
+    rc = sqlite3_prepare_v2((sqlite3 *)db, "INSERT OR REPLACE INTO TERMSTATE ( "
+        TERMSTATE_COLUMNS ", UPDATED_DATE, UPDATED_TIME "
+        ") VALUES ( ?, ?, ?, ?, ?, ?, ?, ?, ?, strftime('%Y%m%d', 'now', 'localtime'), strftime('%H%M%S', 'now', 'localtime'))",
+        -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    sqlite3_bind_text(res, 1, state->terminal_id, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, state->terminal_type);
+    sqlite3_bind_text(res, 3, state->control_rom_edition, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(res, 4, (sqlite3_int64)state->status_word);
+    sqlite3_bind_blob(res, 5, &state->cashbox_status, sizeof(cashbox_status_univ_t), SQLITE_STATIC);
+    sqlite3_bind_int(res, 6, state->call_in_offset);
+    sqlite3_bind_int(res, 7, state->session_secs);
+    sqlite3_bind_int64(res, 8, (sqlite3_int64)state->dl_started);
+    sqlite3_bind_blob(res, 9, state->dl_acked, sizeof(state->dl_acked), SQLITE_STATIC);
+
+    rc = sqlite3_step(res);
+    sqlite3_finalize(res);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "%s: Failed to save terminal %s: %s\n", __func__, state->terminal_id, sqlite3_errmsg((sqlite3 *)db));
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/* Hash of the table assigned to terminal_id in the table store, and when it was assigned. */
+int mm_sql_load_TABLEASSIGN(void* db, const char* terminal_id, uint8_t table_id, char* hash, time_t* assigned_time) {
+    int rc;
+    sqlite3_stmt* res;
+    const unsigned char* db_hash;
+
+    rc = sqlite3_prepare_v2((sqlite3 *)db, "SELECT HASH, ASSIGNED_TIME from TABLEASSIGN where (TERMINAL_ID = ? and TABLE_ID = ?)", -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    sqlite3_bind_text(res, 1, terminal_id, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, table_id);
+
+    if ((sqlite3_step(res) != SQLITE_ROW) || ((db_hash = sqlite3_column_text(res, 0)) == NULL)) {
+        sqlite3_finalize(res);
+        return -ENOENT;
+    }
+
+    snprintf(hash, TABLE_HASH_LEN, "%s", (const char*)db_hash);
+    *assigned_time = (time_t)sqlite3_column_int64(res, 1);
+    sqlite3_finalize(res);
+
+    return 0;
+}
+
+/* Load a table from the table store by hash, into a buffer the caller frees. */
+int mm_sql_load_TABLESTORE(void* db, const char* hash, uint8_t** image, size_t* len) {
+    int rc;
+    sqlite3_stmt* res;
+    const void* blob;
+
+    rc = sqlite3_prepare_v2((sqlite3 *)db, "SELECT TABLE_DATA from TABLESTORE where (HASH = ?)", -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    sqlite3_bind_text(res, 1, hash, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(res) != SQLITE_ROW) {
+        sqlite3_finalize(res);
+        return -ENOENT;
+    }
+
+    *len = (size_t)sqlite3_column_bytes(res, 0);
+    blob = sqlite3_column_blob(res, 0);
+    *image = (uint8_t *)malloc(*len + 1);
+
+    if (*image == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, *len + 1);
+        sqlite3_finalize(res);
+        return -ENOMEM;
+    }
+
+    if (*len != 0) memcpy(*image, blob, *len);
+    sqlite3_finalize(res);
+
+    return 0;
+}
+
+/*
+ * Store a table an overlay was made on in the table store by hash, unless
+ * it is stored already, and keep it there while unassigned.
+ */
+int mm_sql_save_TABLEBASE(void* db, const char* hash, uint8_t table_id, const uint8_t* image, size_t len) {
+    int rc;
+    sqlite3_stmt* res;
+
+    rc = sqlite3_prepare_v2((sqlite3 *)db, "INSERT OR IGNORE INTO TABLESTORE (HASH, TABLE_ID, DATA_LENGTH, TABLE_DATA) VALUES ( ?, ?, ?, ? )",
+                            -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    sqlite3_bind_text(res, 1, hash, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, table_id);
+    sqlite3_bind_int64(res, 3, (sqlite3_int64)len);
+    sqlite3_bind_blob(res, 4, image, (int)len, SQLITE_STATIC);
+
+    rc = sqlite3_step(res);
+    sqlite3_finalize(res);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "%s: Failed to store table %s: %s\n", __func__, hash, sqlite3_errmsg((sqlite3 *)db));
+        return -EIO;
+    }
+
+    rc = sqlite3_prepare_v2((sqlite3 *)db, "INSERT OR IGNORE INTO TABLEBASE (HASH) VALUES ( ? )", -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    sqlite3_bind_text(res, 1, hash, -1, SQLITE_STATIC);
+
+    rc = sqlite3_step(res);
+    sqlite3_finalize(res);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "%s: Failed to keep table %s: %s\n", __func__, hash, sqlite3_errmsg((sqlite3 *)db));
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/* Calls answered in each of the 24 hours of the day, and when they were last decayed. */
+int mm_sql_load_LINECALLS(void* db, double* calls, time_t* decayed_time) {
+    int rc;
+    sqlite3_stmt* res;
+
+    rc = sqlite3_prepare_v2((sqlite3 *)db, "SELECT HOUR, CALLS, DECAYED_TIME from LINECALLS", -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        int hour = sqlite3_column_int(res, 0);
+
+        if ((hour < 0) || (hour >= 24)) continue;
+        calls[hour] = sqlite3_column_double(res, 1);
+        *decayed_time = (time_t)sqlite3_column_int64(res, 2);
+    }
+
+    sqlite3_finalize(res);
+
+    return 0;
+}
+
+int mm_sql_save_LINECALLS(void* db, const double* calls, time_t decayed_time) {
+    char sql[1024];
+    size_t len;
+    int rc;
+    sqlite3_stmt* res;
+
+    /* One statement, so the hours are saved together. */
+    len = (size_t)snprintf(sql, sizeof(sql), "INSERT OR REPLACE INTO LINECALLS ( HOUR, CALLS, DECAYED_TIME ) VALUES ");
+    for (int hour = 0; hour < 24; hour++) {
+        len += (size_t)snprintf(&sql[len], sizeof(sql) - len, "%s( %d, ?, ? )", (hour > 0) ? ", " : "", hour);
+    }
+
+    rc = sqlite3_prepare_v2((sqlite3 *)db, sql, -1, &res, 0);
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    for (int hour = 0; hour < 24; hour++) {
+        sqlite3_bind_double(res, hour * 2 + 1, calls[hour]);
+        sqlite3_bind_int64(res, hour * 2 + 2, (sqlite3_int64)decayed_time);
+    }
+
+    rc = sqlite3_step(res);
+    sqlite3_finalize(res);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "%s: Failed to save: %s\n", __func__, sqlite3_errmsg((sqlite3 *)db));
+        return -EIO;
+    }
+
+    return 0;
+}
+
 void *mm_open_database(const char *database_filename) {
     sqlite3 *db = { 0 };
 
@@ -224,6 +521,18 @@ void *mm_open_database(const char *database_filename) {
         return NULL;
     }
 
+    if (mm_termstate_create_tables(db) != 0) {
+        fprintf(stderr, "Failure creating terminal state table: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    if (mm_connection_create_tables(db) != 0) {
+        fprintf(stderr, "Failure creating line calls table: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+
     return (void *)db;
 }
 
@@ -5,7 +5,23 @@
  *
  * Copyright (c) 2022-2023, Howard M. Harte
  *
- * Example:
+ * The tables built into a ROM are listed in a table directory of 10-byte
+ * entries, one for each table starting with table 1, each with the table's
+ * length and, for tables that are in the ROM, its address.  Given ROM images
+ * or directories of ROM images, the table directory of each is found by
+ * scanning the ROM for the longest run of valid entries: table IDs counting
+ * up from 1, and lengths and addresses within the ROM.  ROMs are scanned by
+ * a thread per core, their tables extracted to a directory per control ROM
+ * edition (-o), and a catalog of each edition's table directory offset and
+ * table hashes written as CSV (-c):
+ *
+ * mm_table_cutter -o rom_tables -c rom_catalog.csv roms/
+ *
+ * The edition is the name of the ROM image, without its extension, as ROM
+ * dumps are named after the edition on their label.
+ *
+ * The table directory offset and the last table can still be given, to list
+ * and extract the tables of a single ROM to the current directory:
  *
  * MTR 1.7 ROMs:
  * mm_table_cutter NT_NAA1S05.bin 12502 91
@@ -30,50 +46,32 @@
  * International
  * mm_table_cutter PBAXS05.BIN 13121 93
  * mm_table_cutter 06CNB02.bin 13248 84 (Bosnia)
- *
- * Determining table data structure offset:
- *
- * 1. Use a hex dump program like WinHex or hexdump to find the starting
- *    address of an easily-recognizable table, such as the visual prompts
- *    table.  Search for this address in the ROM.  Use that as an offset
- *    to remove the beginning of the ROM up until this point, for example:
- *
- *    dd if=NAA1S05.bin of=table_list.bin bs=1 count=1030 skip=12502
- *
- * 2. Use hexdump to list the tables, and then remove less of the
- *    ROM with 'dd' until the output with table
- *    1.  Each table entry is 10 bytes.
- *
- *    hexdump -v -e '/10 "%010_ad  |"'  -e '10/1 "%02x "' -e '"\n"' table_list.bin
- *
- * 3. Determine how many valid table entries are contained within the ROM.
- *    For example:
- *
- * 0000000630  |54 00 06 00 64 a0 01 00 05 2e
- * 0000000640  |5a 47 33 03 c6 bc 03 00 9f 16
- * 0000000650  |5b 47 33 03 fc bf 03 00 a2 16
- * 0000000660  |42 6a 33 60 ff 00 00 00 00 ef
- *
- * This ROM has 5b entries, converted to decimal is 91.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include "mm_manager.h"
 
-#if defined(_MSC_VER)
-# include <BaseTsd.h>
-typedef SSIZE_T ssize_t;
-#else  /* if defined(_MSC_VER) */
+#ifndef _WIN32
+# include <getopt.h>
 # include <unistd.h>
-#endif /* if defined(_MSC_VER) */
+# include <libgen.h>
+#else  /* ifndef _WIN32 */
+# include <windows.h>
+# include "third-party/getopt.h"
+#endif /* ifndef _WIN32 */
 
 #define TABLE_MAX       152
 #define TABLE_LEN_MASK  0x1FFF      /* Maximum table length 8K */
+#define TABLE_DIR_MIN   16          /* Shortest run of entries taken for a table directory. */
+#define ROM_MAX_LEN     (4 * 1024 * 1024)
+#define EDITION_LEN     (64)
 
 #pragma pack(push, 1)   /* Pack data structures for communication with terminal. */
 
@@ -87,149 +85,491 @@ typedef struct mt_table_entry {
 
 #pragma pack(pop)
 
-int main(int argc, char *argv[]) {
+typedef struct rom_image {
+    char path[TABLE_PATH_MAX_LEN];
+    char edition[EDITION_LEN];
+    uint8_t *rom;
+    size_t rom_len;
+    uint64_t hash;
+    long offset;                            /* Of the table directory, -1 if not found. */
+    int entries;
+    mt_table_entry_t dir[TABLE_MAX];
+    uint64_t table_hash[TABLE_MAX];
+    int status;
+} rom_image_t;
+
+static int load_rom(rom_image_t *image) {
+    struct stat attr;
     FILE *instream;
-    FILE *ostream = NULL;
-    int   index;
-    char  outfile[21];
-    int   ret = 0;
-    ssize_t rom_pos;
-    uint8_t *ptable_buf;
-    uint8_t last_table = TABLE_MAX;
-
-    mt_table_entry_t *ptable_entry;
-
-    if (argc <= 1) {
-        printf("Usage:\n" \
-               "\tmm_table_cutter firmware.bin <offset> [last_table]\n");
+
+    if (stat(image->path, &attr) != 0) {
+        fprintf(stderr, "Error opening %s\n", image->path);
+        return -ENOENT;
+    }
+
+    if ((attr.st_size == 0) || (attr.st_size > ROM_MAX_LEN)) {
+        fprintf(stderr, "%s is not a ROM image.\n", image->path);
         return -EINVAL;
     }
 
-    printf("Nortel Millennium Table Cutter\n\n");
+    if ((instream = fopen(image->path, "rb")) == NULL) {
+        fprintf(stderr, "Error opening %s\n", image->path);
+        return -ENOENT;
+    }
 
-    ptable_entry = (mt_table_entry_t *)calloc(1, sizeof(mt_table_entry_t));
+    image->rom_len = (size_t)attr.st_size;
+    image->rom = (uint8_t *)malloc(image->rom_len);
 
-    if (ptable_entry == NULL) {
-        printf("Failed to allocate %zu bytes.\n", sizeof(mt_table_entry_t));
+    if (image->rom == NULL) {
+        fprintf(stderr, "Failed to allocate %zu bytes.\n", image->rom_len);
+        fclose(instream);
         return -ENOMEM;
     }
 
-    if ((instream = fopen(argv[1], "rb")) == NULL) {
-        printf("Error opening %s\n", argv[1]);
-        free(ptable_entry);
-        return -ENOENT;
+    if (fread(image->rom, image->rom_len, 1, instream) != 1) {
+        fprintf(stderr, "Error reading %s.\n", image->path);
+        free(image->rom);
+        image->rom = NULL;
+        fclose(instream);
+        return -EIO;
     }
 
-    printf("Offset: 0x%05x (%d)\n", atoi(argv[2]), atoi(argv[2]));
+    fclose(instream);
+    image->hash = mm_fnv1a(image->rom, image->rom_len);
+
+    return 0;
+}
+
+/* Number of valid table entries at offset in the ROM, numbered from table 1. */
+static int table_dir_entries(const uint8_t *rom, size_t rom_len, size_t offset) {
+    mt_table_entry_t entry;
+    int entries;
+
+    for (entries = 0; entries < TABLE_MAX; entries++) {
+        size_t entry_offset = offset + entries * sizeof(mt_table_entry_t);
 
-    if (argc > 3) {
-        last_table = atoi(argv[3]);
+        if (entry_offset + sizeof(mt_table_entry_t) > rom_len) break;
+
+        memcpy(&entry, &rom[entry_offset], sizeof(mt_table_entry_t));
+
+        if (entry.id != entries + 1) break;
+        if ((entry.rom_addr != 0) &&
+            (((entry.len & TABLE_LEN_MASK) == 0) ||
+             ((size_t)entry.rom_addr + (entry.len & TABLE_LEN_MASK) > rom_len))) {
+            break;
+        }
     }
 
-    printf("Last table: %d\n", last_table);
-    if (fseek(instream, atoi(argv[2]), SEEK_SET) != 0) {
-        fprintf(stderr, "Error: fseek() to ROM table entry point failed.\n");
-        goto done;
+    return entries;
+}
+
+/* Find the table directory: the longest run of valid table entries in the ROM. */
+static void find_table_dir(rom_image_t *image) {
+    image->offset = -1;
+    image->entries = 0;
+
+    for (size_t offset = 0; offset + sizeof(mt_table_entry_t) <= image->rom_len; offset++) {
+        int entries;
+
+        if (image->rom[offset] != 1) continue;
+
+        entries = table_dir_entries(image->rom, image->rom_len, offset);
+        if ((entries >= TABLE_DIR_MIN) && (entries > image->entries)) {
+            image->offset = (long)offset;
+            image->entries = entries;
+        }
     }
+}
+
+/*
+ * Read the table directory of entries at offset in the ROM, up to
+ * last_table, hashing the tables that are in the ROM.
+ */
+static int read_table_dir(rom_image_t *image, size_t offset, int last_table) {
+    image->offset = (long)offset;
 
-    rom_pos = ftell(instream);
+    for (image->entries = 0; image->entries < TABLE_MAX; image->entries++) {
+        mt_table_entry_t *entry = &image->dir[image->entries];
+        size_t entry_offset = offset + image->entries * sizeof(mt_table_entry_t);
+
+        if (entry_offset + sizeof(mt_table_entry_t) > image->rom_len) {
+            fprintf(stderr, "Error reading table entry %d.\n", image->entries + 1);
+            return -EIO;
+        }
+
+        memcpy(entry, &image->rom[entry_offset], sizeof(mt_table_entry_t));
+
+        if ((entry->rom_addr != 0) && ((size_t)entry->rom_addr + (entry->len & TABLE_LEN_MASK) <= image->rom_len)) {
+            image->table_hash[image->entries] = mm_fnv1a(&image->rom[entry->rom_addr], entry->len & TABLE_LEN_MASK);
+        }
 
-    if (rom_pos < 0) {
-        fprintf(stderr, "Error: ftell() failed.\n");
-        goto done;
+        if (entry->id == last_table) {
+            image->entries++;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* Write the tables in the ROM to cut_table_xx.bin files in out_dir. */
+static int extract_tables(const rom_image_t *image, const char *out_dir) {
+    char outfile[TABLE_PATH_MAX_LEN];
+    FILE *ostream;
+
+    for (int i = 0; i < image->entries; i++) {
+        const mt_table_entry_t *entry = &image->dir[i];
+
+        if (entry->rom_addr == 0) continue;
+
+        if ((size_t)entry->rom_addr + (entry->len & TABLE_LEN_MASK) > image->rom_len) {
+            fprintf(stderr, "Error reading table %d from ROM.\n", entry->id);
+            return -EIO;
+        }
+
+        snprintf(outfile, sizeof(outfile), "%s/cut_table_%02x.bin", out_dir, entry->id);
+        if ((ostream = fopen(outfile, "wb")) == NULL) {
+            fprintf(stderr, "Error opening output file %s for write.\n", outfile);
+            return -ENOENT;
+        }
+
+        if (fwrite(&image->rom[entry->rom_addr], entry->len & TABLE_LEN_MASK, 1, ostream) != 1) {
+            fprintf(stderr, "Error writing ROM table %d.\n", entry->id);
+            fclose(ostream);
+            return -EIO;
+        }
+        fclose(ostream);
     }
 
+    return 0;
+}
+
+static void print_table_dir(const rom_image_t *image, int dump) {
     printf("+---------------------------------------------------------------------------+\n" \
            "| Idx        | Table                       | Pad1 | Length | Address | Dir  |\n" \
            "+------------+-----------------------------+------+--------+---------+------+\n");
 
-    for (index = 1; index <= TABLE_MAX; index++) {
-        if (fseek(instream, (long)rom_pos, SEEK_SET) != 0) {
-            fprintf(stderr, "Error: fseek() failed.\n");
-            goto done;
-        }
-
-        if (fread(ptable_entry, sizeof(mt_table_entry_t), 1, instream) != 1) {
-            fprintf(stderr, "Error reading table entry %d.\n", index);
-            ret = -EIO;
-            goto done;
-        }
-
-        rom_pos = ftell(instream);
-        if (rom_pos < 0) {
-            fprintf(stderr, "Error: ftell() failed.\n");
-            goto done;
-        }
-
-        if (argv[3] != NULL && argv[4] == NULL) {
-            printf("| 0x%02x (%3d) | %27s | 0x%02x |  %4d  |  0x%04x | %s | ",
-                ptable_entry->id, ptable_entry->id,
-                table_to_string(ptable_entry->id),
-                ptable_entry->pad1,
-                ptable_entry->len,
-                ptable_entry->rom_addr,
-                ptable_entry->rom_addr != 0 ? "M->T" : "    ");
-
-            if (ptable_entry->rom_addr != 0) {
-                if (fseek(instream, ptable_entry->rom_addr, SEEK_SET) != 0) {
-                    fprintf(stderr, "Error: fseek() failed.\n");
-                    goto done;
-                }
-
-                snprintf(outfile, sizeof(outfile), "cut_table_%02x.bin", ptable_entry->id);
-                printf("Dumping %d bytes at %04x\n", ptable_entry->len, ptable_entry->rom_addr);
-                if ((ostream = fopen(outfile, "wb")) == NULL) {
-                    printf("Error opening output file %s for write.\n", outfile);
-                    ret = -ENOENT;
-                    goto done;
-                }
-
-                ptable_entry->len &= TABLE_LEN_MASK;
-                ptable_buf = (uint8_t *)calloc(1, ptable_entry->len);
-
-                if (ptable_buf == NULL) {
-                    printf("Failed to allocate %d bytes.\n", ptable_entry->len);
-                    ret = -ENOMEM;
-                    goto done;
-                }
-                if (fread(ptable_buf, ptable_entry->len, 1, instream) != 1) {
-                    printf("Error reading table %d from ROM.\n", index);
-                    free(ptable_buf);
-                    ret =  -EIO;
-                    goto done;
-                }
-
-                if (fwrite(ptable_buf, ptable_entry->len, 1, ostream) != 1) {
-                    printf("Error writing ROM table %d.\n", index);
-                    free(ptable_buf);
-                    ret = -EIO;
-                    goto done;
-                }
-                free(ptable_buf);
-            } else {
-                printf("\n");
-            }
+    for (int i = 0; i < image->entries; i++) {
+        const mt_table_entry_t *entry = &image->dir[i];
+
+        printf("| 0x%02x (%3d) | %27s | 0x%02x |  %4d  |  0x%04x | %s | ",
+               entry->id, entry->id,
+               table_to_string(entry->id),
+               entry->pad1,
+               entry->len,
+               entry->rom_addr,
+               entry->rom_addr != 0 ? "M->T" : "    ");
+
+        if ((entry->rom_addr != 0) && dump) {
+            printf("Dumping %d bytes at %04x\n", entry->len & TABLE_LEN_MASK, entry->rom_addr);
         } else {
-            printf("0x%02x,%s,0x%02x,%d\n",
-                ptable_entry->id,
-                table_to_string(ptable_entry->id),
-                ptable_entry->pad1,
-                ptable_entry->len);
+            printf("\n");
         }
-        if (ptable_entry-> id == last_table) break;
     }
 
     printf("+---------------------------------------------------------------------------+\n");
+}
 
-done:
-    fclose(instream);
-    if (ostream != NULL) {
-        fclose(ostream);
+/* Edition of the ROM: the name of its image, without the extension. */
+static void rom_edition(rom_image_t *image) {
+    const char *name = image->path;
+    char *ext;
+
+    for (const char *p = image->path; *p != '\0'; p++) {
+        if ((*p == '/') || (*p == '\\')) name = p + 1;
     }
 
-    if (ptable_entry != NULL) {
-        free(ptable_entry);
+    snprintf(image->edition, sizeof(image->edition), "%.*s", EDITION_LEN - 1, name);
+    if ((ext = strrchr(image->edition, '.')) != NULL) *ext = '\0';
+}
+
+typedef struct rom_list {
+    rom_image_t *images;
+    int count;
+    int allocated;
+    const char *out_dir;
+} rom_list_t;
+
+static int add_rom(rom_list_t *list, const char *path) {
+    if (list->count == list->allocated) {
+        int allocated = list->allocated ? list->allocated * 2 : 16;
+        rom_image_t *grown = (rom_image_t *)realloc(list->images, allocated * sizeof(rom_image_t));
+
+        if (grown == NULL) {
+            fprintf(stderr, "Failed to allocate %zu bytes.\n", allocated * sizeof(rom_image_t));
+            return -ENOMEM;
+        }
+        list->images = grown;
+        list->allocated = allocated;
     }
 
+    memset(&list->images[list->count], 0, sizeof(rom_image_t));
+    snprintf(list->images[list->count].path, sizeof(list->images[list->count].path), "%s", path);
+    rom_edition(&list->images[list->count]);
+    list->count++;
+
+    return 0;
+}
+
+static int add_rom_in_dir(void *arg, const char *dir, const char *name) {
+    struct stat attr;
+    char rom_path[TABLE_PATH_MAX_LEN];
+
+    if (snprintf(rom_path, sizeof(rom_path), "%s/%s", dir, name) >= (int)sizeof(rom_path)) {
+        fprintf(stderr, "Path %s/%s is too long.\n", dir, name);
+        return -ENAMETOOLONG;
+    }
+
+    if ((stat(rom_path, &attr) != 0) || !S_ISREG(attr.st_mode)) return 0;
+
+    return add_rom((rom_list_t *)arg, rom_path);
+}
+
+/* Add a ROM image, or every file in a directory of ROM images. */
+static int find_roms(rom_list_t *list, const char *path) {
+    struct stat attr;
+
+    if (stat(path, &attr) != 0) {
+        fprintf(stderr, "Error opening %s\n", path);
+        return -ENOENT;
+    }
+
+    if (!S_ISDIR(attr.st_mode)) {
+        return add_rom(list, path);
+    }
+
+    return mm_list_dir(path, add_rom_in_dir, list);
+}
+
+/* Scan a ROM for its table directory, and extract its tables to out_dir/<edition>. */
+static void cut_rom(rom_image_t *image, const char *out_dir) {
+    char edition_dir[TABLE_PATH_MAX_LEN];
+
+    if ((image->status = load_rom(image)) != 0) return;
+
+    find_table_dir(image);
+    if (image->offset < 0) {
+        image->status = -ENOENT;
+        return;
+    }
+
+    /* Tables in the directory are numbered from 1, so the last is the number of entries. */
+    if ((image->status = read_table_dir(image, image->offset, image->entries)) != 0) return;
+
+    if (out_dir != NULL) {
+        snprintf(edition_dir, sizeof(edition_dir), "%s/%s", out_dir, image->edition);
+        if ((image->status = mm_make_directory(edition_dir)) != 0) return;
+
+        image->status = extract_tables(image, edition_dir);
+    }
+}
+
+static void cut_one_rom(void *arg, int index) {
+    rom_list_t *list = (rom_list_t *)arg;
+
+    cut_rom(&list->images[index], list->out_dir);
+}
+
+static int compare_editions(const void *a, const void *b) {
+    int result = strcmp(((const rom_image_t *)a)->edition, ((const rom_image_t *)b)->edition);
+
+    return result ? result : strcmp(((const rom_image_t *)a)->path, ((const rom_image_t *)b)->path);
+}
+
+/* Catalog of each ROM's edition, table directory offset and tables, as CSV. */
+static int write_catalog(const rom_list_t *list, const char *catalog) {
+    FILE *ostream;
+
+    if ((ostream = fopen(catalog, "w")) == NULL) {
+        fprintf(stderr, "Error opening catalog %s for write.\n", catalog);
+        return -ENOENT;
+    }
+
+    fprintf(ostream, "edition,rom,rom_hash,offset,tables,table_id,table,length,address,hash\n");
+
+    for (int i = 0; i < list->count; i++) {
+        const rom_image_t *image = &list->images[i];
+
+        if (image->status != 0) continue;
+
+        for (int j = 0; j < image->entries; j++) {
+            const mt_table_entry_t *entry = &image->dir[j];
+
+            if (entry->rom_addr == 0) continue;
+
+            fprintf(ostream, "\"%s\",\"%s\",%016" PRIx64 ",%ld,%d,%d,%s,%d,%d,%016" PRIx64 "\n",
+                    image->edition, image->path, image->hash, image->offset, image->entries,
+                    entry->id, table_to_string(entry->id), entry->len & TABLE_LEN_MASK, entry->rom_addr,
+                    image->table_hash[j]);
+        }
+    }
+
+    fclose(ostream);
+
+    return 0;
+}
+
+static void mm_table_cutter_help(const char *name, FILE *stream) {
+    fprintf(stream, "usage: %s [-h] [-v] [-c <catalog.csv>] [-j <threads>] [-o <out_dir>] <rom>|<rom_dir>...\n", name);
+    fprintf(stream, "       %s <rom> <offset> [last_table]\n", name);
+    fprintf(stream,
+        "\t<rom_dir> - directory of ROM images, each scanned for its table directory\n" \
+        "\t-c <catalog.csv> - write a catalog of the ROMs' table directory offsets and table hashes\n" \
+        "\t-j <threads> - number of threads scanning ROMs (default: one per core)\n" \
+        "\t-o <out_dir> - extract each ROM's tables to <out_dir>/<edition>\n" \
+        "\t-v - print each ROM's table directory\n" \
+        "\t<offset> - offset of the table directory in the ROM; lists its tables, and extracts them\n" \
+        "\t           to the current directory if last_table is given\n" \
+        "\t-h this help.\n");
+}
+
+/* Tables of a ROM with its table directory at the given offset, as before scanning was added. */
+static int cut_rom_at(const char *path, long offset, int last_table, int dump) {
+    rom_image_t *image;
+    int ret;
+
+    printf("Offset: 0x%05lx (%ld)\n", offset, offset);
+    printf("Last table: %d\n", last_table);
+
+    image = (rom_image_t *)calloc(1, sizeof(rom_image_t));
+    if (image == NULL) {
+        printf("Failed to allocate %zu bytes.\n", sizeof(rom_image_t));
+        return -ENOMEM;
+    }
+
+    snprintf(image->path, sizeof(image->path), "%s", path);
+
+    if (((ret = load_rom(image)) != 0) || ((ret = read_table_dir(image, (size_t)offset, last_table)) != 0)) {
+        free(image->rom);
+        free(image);
+        return ret;
+    }
+
+    if (dump) {
+        print_table_dir(image, 1);
+        ret = extract_tables(image, ".");
+    } else {
+        for (int i = 0; i < image->entries; i++) {
+            printf("0x%02x,%s,0x%02x,%d\n",
+                image->dir[i].id,
+                table_to_string(image->dir[i].id),
+                image->dir[i].pad1,
+                image->dir[i].len);
+        }
+    }
+
+    free(image->rom);
+    free(image);
+
     return ret;
 }
+
+int main(int argc, char *argv[]) {
+    rom_list_t list = { 0 };
+    const char *catalog = NULL;
+    int threads = mm_default_threads();
+    int verbose = 0;
+    int failed = 0;
+    int ret = 0;
+    int c;
+    char *end;
+
+    while ((c = getopt(argc, argv, "c:hj:o:v")) != -1) {
+        switch (c) {
+            case 'c':
+                catalog = optarg;
+                break;
+            case 'h':
+                mm_table_cutter_help(basename(argv[0]), stdout);
+                return 0;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'o':
+                list.out_dir = optarg;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                mm_table_cutter_help(basename(argv[0]), stderr);
+                return -EINVAL;
+        }
+    }
+
+    if (optind == argc) {
+        mm_table_cutter_help(basename(argv[0]), stderr);
+        return -EINVAL;
+    }
+
+    printf("Nortel Millennium Table Cutter\n\n");
+
+    /* A ROM followed by an offset: its table directory is not scanned for. */
+    if ((argc - optind >= 2) && (argc - optind <= 3)) {
+        long offset = strtol(argv[optind + 1], &end, 0);
+
+        if ((*end == '\0') && (offset >= 0)) {
+            int last_table = (argc - optind == 3) ? atoi(argv[optind + 2]) : TABLE_MAX;
+
+            return cut_rom_at(argv[optind], offset, last_table, argc - optind == 3);
+        }
+    }
+
+    for (int i = optind; (i < argc) && (ret == 0); i++) {
+        ret = find_roms(&list, argv[i]);
+    }
+
+    if ((ret == 0) && (list.out_dir != NULL)) {
+        ret = mm_make_directory(list.out_dir);
+    }
+
+    if (ret != 0) {
+        free(list.images);
+        return ret;
+    }
+
+    if (threads < 1) threads = 1;
+    if (threads > MM_THREADS_MAX) threads = MM_THREADS_MAX;
+
+    mm_parallel_for(list.count, threads, cut_one_rom, &list);
+    qsort(list.images, list.count, sizeof(rom_image_t), compare_editions);
+
+    for (int i = 0; i < list.count; i++) {
+        rom_image_t *image = &list.images[i];
+        int in_rom = 0;
+
+        if (image->status == -ENOENT) {
+            printf("%s: no table directory found.\n", image->path);
+        }
+        if (image->status != 0) {
+            failed++;
+            continue;
+        }
+
+        for (int j = 0; j < image->entries; j++) {
+            if (image->dir[j].rom_addr != 0) in_rom++;
+        }
+
+        printf("%s: %s, table directory at 0x%05lx (%ld), %d tables, %d in ROM.\n",
+               image->path, image->edition, image->offset, image->offset, image->entries, in_rom);
+
+        if (verbose) {
+            print_table_dir(image, 0);
+        }
+    }
+
+    if (catalog != NULL) {
+        ret = write_catalog(&list, catalog);
+    }
+
+    printf("%d ROMs, %d failed.\n", list.count, failed);
+
+    for (int i = 0; i < list.count; i++) {
+        free(list.images[i].rom);
+    }
+    free(list.images);
+
+    if (ret != 0) return ret;
+
+    return failed ? -EIO : 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Binary table patches for mm_manager.
+ *
+ * A patch holds the byte ranges in which a table differs from a base
+ * table, so a table that differs from another in a few fields is stored
+ * in a few bytes.  Tables are passed with their table ID prepended, as
+ * they are loaded.  The patch format is, little-endian:
+ *
+ * 'M' 'P' <version> <table_id> <base length:16> <length:16> <base hash:64>
+ * followed by records of <offset:16> <count:8> <count bytes>
+ *
+ * The base hash, the FNV-1a hash of the base table, ensures a patch is
+ * only applied to the table it was made from.  Bytes past the end of the
+ * base are taken to be zero.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_manager.h"
+
+#define TABLE_PATCH_VERSION     (1)
+#define TABLE_PATCH_RECORD_LEN  (3)     /* Offset and count of a record. */
+#define TABLE_PATCH_RECORD_MAX  (255)   /* Bytes in a record. */
+
+static uint8_t base_byte(const uint8_t *base, size_t base_len, size_t offset) {
+    return (offset < base_len) ? base[offset] : 0;
+}
+
+/*
+ * Make a patch from base (base_len bytes with its table ID) to image (len
+ * bytes with its table ID.)  Unchanged runs shorter than a record header
+ * are included in the surrounding record.  The patch is allocated, and
+ * returned in patch and patch_len.  Returns 0, -EINVAL if a table is too
+ * large to patch, or -ENOMEM.
+ */
+int mm_table_patch_create(const uint8_t *base, size_t base_len, const uint8_t *image, size_t len, uint8_t **patch, size_t *patch_len) {
+    uint8_t *p;
+    uint64_t hash;
+    size_t   offset = 0;
+
+    if ((base_len < 1) || (len < 1) || (base_len - 1 > UINT16_MAX) || (len - 1 > UINT16_MAX)) return -EINVAL;
+
+    /* Skip the table IDs. */
+    base++;
+    base_len--;
+    image++;
+    len--;
+
+    /* At worst, a record per TABLE_PATCH_RECORD_MAX bytes. */
+    *patch = (uint8_t *)malloc(TABLE_PATCH_HEADER_LEN + len + ((len / TABLE_PATCH_RECORD_MAX) + 1) * TABLE_PATCH_RECORD_LEN);
+    if (*patch == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate patch for %zu bytes.\n", __func__, len);
+        return -ENOMEM;
+    }
+
+    p = *patch;
+    hash = mm_fnv1a(base, base_len);
+
+    *p++ = 'M';
+    *p++ = 'P';
+    *p++ = TABLE_PATCH_VERSION;
+    *p++ = image[-1];
+    *p++ = (uint8_t)(base_len & 0xff);
+    *p++ = (uint8_t)(base_len >> 8);
+    *p++ = (uint8_t)(len & 0xff);
+    *p++ = (uint8_t)(len >> 8);
+    for (int i = 0; i < 8; i++) {
+        *p++ = (uint8_t)(hash >> (i * 8));
+    }
+
+    while (offset < len) {
+        size_t start, end, gap;
+
+        if (image[offset] == base_byte(base, base_len, offset)) {
+            offset++;
+            continue;
+        }
+
+        /* Extend the record over changed bytes and short unchanged runs. */
+        start = offset;
+        end = offset + 1;
+        gap = 0;
+        for (offset = end; (offset < len) && (offset - start < TABLE_PATCH_RECORD_MAX); offset++) {
+            if (image[offset] != base_byte(base, base_len, offset)) {
+                end = offset + 1;
+                gap = 0;
+            } else if (++gap > TABLE_PATCH_RECORD_LEN) {
+                break;
+            }
+        }
+
+        *p++ = (uint8_t)(start & 0xff);
+        *p++ = (uint8_t)(start >> 8);
+        *p++ = (uint8_t)(end - start);
+        memcpy(p, &image[start], end - start);
+        p += end - start;
+        offset = end;
+    }
+
+    *patch_len = (size_t)(p - *patch);
+
+    return 0;
+}
+
+/*
+ * Hash of the base table a patch was made from, as stored in the patch.
+ * Returns 0, or -EINVAL if the patch is invalid.
+ */
+int mm_table_patch_base_hash(const uint8_t *patch, size_t patch_len, uint64_t *hash) {
+    if ((patch_len < TABLE_PATCH_HEADER_LEN) ||
+        (patch[0] != 'M') || (patch[1] != 'P') || (patch[2] != TABLE_PATCH_VERSION)) {
+        return -EINVAL;
+    }
+
+    *hash = 0;
+    for (int i = 0; i < 8; i++) {
+        *hash |= (uint64_t)patch[8 + i] << (i * 8);
+    }
+
+    return 0;
+}
+
+/*
+ * Apply a patch to base (base_len bytes with its table ID.)  The patched
+ * table is allocated with its table ID, and returned in image and len.
+ * Returns 0, -EINVAL if the patch is invalid or was not made from base,
+ * or -ENOMEM.
+ */
+int mm_table_patch_apply(const uint8_t *base, size_t base_len, const uint8_t *patch, size_t patch_len, uint8_t **image, size_t *len) {
+    const uint8_t *p = patch + TABLE_PATCH_HEADER_LEN;
+    size_t   patch_base_len, patch_image_len;
+    uint64_t hash;
+
+    *image = NULL;
+
+    if ((base_len < 1) || (mm_table_patch_base_hash(patch, patch_len, &hash) != 0)) {
+        return -EINVAL;
+    }
+
+    patch_base_len = patch[4] | (patch[5] << 8);
+    patch_image_len = patch[6] | (patch[7] << 8);
+
+    if ((patch_base_len != base_len - 1) || (hash != mm_fnv1a(base + 1, base_len - 1))) {
+        return -EINVAL;
+    }
+
+    *image = (uint8_t *)calloc(1, patch_image_len + 1);
+    if (*image == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, patch_image_len + 1);
+        return -ENOMEM;
+    }
+
+    (*image)[0] = patch[3];
+    memcpy(*image + 1, base + 1, (patch_base_len < patch_image_len) ? patch_base_len : patch_image_len);
+
+    while (p < patch + patch_len) {
+        size_t offset, count;
+
+        if (p + TABLE_PATCH_RECORD_LEN > patch + patch_len) break;
+
+        offset = p[0] | (p[1] << 8);
+        count = p[2];
+
+        /* A record cut short leaves p before the end, so the patch is rejected. */
+        if ((p + TABLE_PATCH_RECORD_LEN + count > patch + patch_len) || (offset + count > patch_image_len)) break;
+
+        p += TABLE_PATCH_RECORD_LEN;
+        memcpy(*image + 1 + offset, p, count);
+        p += count;
+    }
+
+    if (p != patch + patch_len) {
+        free(*image);
+        *image = NULL;
+        return -EINVAL;
+    }
+
+    *len = patch_image_len + 1;
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Table patch tests for mm_manager.
+ *
+ * Makes patches between tables with mm_table_patch_create() and applies
+ * them with mm_table_patch_apply(): the patched table must equal the one
+ * the patch was made to, whether it grew, shrank or had a few fields
+ * changed, and a patch must only apply to its own base.  Returns the
+ * number of failed tests.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mm_manager.h"
+
+#define TEST_TABLE_ID   DLOG_MT_CARRIER_TABLE_EXP
+#define TEST_TABLE_LEN  (1108)
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/* A table of len bytes after its table ID, with contents depending on seed. */
+static void test_table(uint8_t *table, size_t len, uint32_t seed) {
+    table[0] = TEST_TABLE_ID;
+    for (size_t i = 1; i <= len; i++) {
+        seed = seed * 1103515245 + 12345;
+        table[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+/*
+ * Patch base to image and back.  Returns the length of the patch, 0 if
+ * it could not be made or applied.
+ */
+static size_t test_round_trip(const uint8_t *base, size_t base_len, const uint8_t *image, size_t len) {
+    uint8_t *patch = NULL;
+    uint8_t *patched = NULL;
+    size_t   patch_len = 0;
+    size_t   patched_len = 0;
+    uint64_t hash;
+
+    CHECK(mm_table_patch_create(base, base_len, image, len, &patch, &patch_len) == 0);
+    if (patch == NULL) return 0;
+
+    CHECK(mm_table_patch_base_hash(patch, patch_len, &hash) == 0);
+    CHECK(hash == mm_fnv1a(base + 1, base_len - 1));
+
+    CHECK(mm_table_patch_apply(base, base_len, patch, patch_len, &patched, &patched_len) == 0);
+    CHECK(patched != NULL);
+    if (patched != NULL) {
+        CHECK(patched_len == len);
+        CHECK((patched_len == len) && (memcmp(patched, image, len) == 0));
+    }
+
+    free(patched);
+    free(patch);
+
+    return (patched_len == len) ? patch_len : 0;
+}
+
+/* A few fields changed: the patch is small, and restores them. */
+static void test_fields_changed(void) {
+    uint8_t base[TEST_TABLE_LEN + 1];
+    uint8_t image[TEST_TABLE_LEN + 1];
+    size_t  patch_len;
+
+    test_table(base, TEST_TABLE_LEN, 1);
+    memcpy(image, base, sizeof(image));
+    image[1] ^= 0xff;
+    image[500] ^= 0x55;
+    image[501] ^= 0x55;
+    memset(&image[700], 0x20, 300);     /* Longer than a record. */
+    image[TEST_TABLE_LEN] ^= 0x01;
+
+    patch_len = test_round_trip(base, sizeof(base), image, sizeof(image));
+    CHECK((patch_len > TABLE_PATCH_HEADER_LEN) && (patch_len < 400));
+}
+
+/* The same table patches to a header only. */
+static void test_unchanged(void) {
+    uint8_t base[TEST_TABLE_LEN + 1];
+
+    test_table(base, TEST_TABLE_LEN, 2);
+    CHECK(test_round_trip(base, sizeof(base), base, sizeof(base)) == TABLE_PATCH_HEADER_LEN);
+}
+
+/* Tables that grew or shrank, including a table ID of its own. */
+static void test_length_changed(void) {
+    uint8_t base[TEST_TABLE_LEN + 1];
+    uint8_t image[TEST_TABLE_LEN + 101];
+
+    test_table(base, TEST_TABLE_LEN, 3);
+    memcpy(image, base, sizeof(base));
+    memset(&image[sizeof(base)], 0, 50);          /* As the base is taken past its end. */
+    memset(&image[sizeof(base) + 50], 0xa5, 50);
+    CHECK(test_round_trip(base, sizeof(base), image, sizeof(image)) != 0);
+
+    CHECK(test_round_trip(base, sizeof(base), base, 100) != 0);
+
+    test_table(image, 200, 4);
+    image[0] = DLOG_MT_CARRIER_TABLE;
+    CHECK(test_round_trip(base, sizeof(base), image, 201) != 0);
+}
+
+/* A patch applies only to the base it was made from, and a damaged patch not at all. */
+static void test_wrong_base(void) {
+    uint8_t  base[TEST_TABLE_LEN + 1];
+    uint8_t  other[TEST_TABLE_LEN + 1];
+    uint8_t  image[TEST_TABLE_LEN + 1];
+    uint8_t *patch = NULL;
+    uint8_t *patched = NULL;
+    size_t   patch_len = 0;
+    size_t   patched_len = 0;
+
+    test_table(base, TEST_TABLE_LEN, 5);
+    memcpy(other, base, sizeof(other));
+    other[10] ^= 1;
+    memcpy(image, base, sizeof(image));
+    image[20] ^= 1;
+
+    CHECK(mm_table_patch_create(base, sizeof(base), image, sizeof(image), &patch, &patch_len) == 0);
+    if (patch == NULL) return;
+
+    CHECK(mm_table_patch_apply(other, sizeof(other), patch, patch_len, &patched, &patched_len) == -EINVAL);
+    CHECK(patched == NULL);
+    CHECK(mm_table_patch_apply(base, sizeof(base) - 1, patch, patch_len, &patched, &patched_len) == -EINVAL);
+
+    /* Truncated in a record. */
+    CHECK(mm_table_patch_apply(base, sizeof(base), patch, patch_len - 1, &patched, &patched_len) == -EINVAL);
+    CHECK(patched == NULL);
+
+    patch[0] = 'X';
+    CHECK(mm_table_patch_apply(base, sizeof(base), patch, patch_len, &patched, &patched_len) == -EINVAL);
+
+    free(patch);
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+
+    test_fields_changed();
+    test_unchanged();
+    test_length_changed();
+    test_wrong_base();
+
+    printf("mm_table_patch_test: %d failures.\n", failures);
+
+    return failures;
+}
@@ -0,0 +1,540 @@
+/*
+ * Table diff and patch for mm_manager.
+ *
+ * Compares two versions of a table field by field: the entries of Rate,
+ * Carrier, Call Screening and Card tables, and the NXX flags of LCD
+ * tables, printing only the fields that changed.  Other tables, and the
+ * parts of these tables outside their entries, are compared byte by byte.
+ *
+ * Also makes a binary patch from one version to the other, and applies a
+ * patch to a table.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+
+#ifndef _WIN32
+# include <getopt.h>
+# include <unistd.h>
+# include <libgen.h>
+#else  /* ifndef _WIN32 */
+# include "third-party/getopt.h"
+#endif /* ifndef _WIN32 */
+
+#include "mm_manager.h"
+#include "mm_card.h"
+
+#define RANGE_GAP_MAX   (3)     /* Unchanged bytes within a range of changed bytes. */
+#define RANGE_SHOW_MAX  (16)    /* Bytes of a range printed. */
+
+typedef enum field_format {
+    FIELD_UINT = 0,             /* Little-endian unsigned integer. */
+    FIELD_HEX,
+    FIELD_STRING,
+    FIELD_CALLSCRN_NUM          /* Call screening number, a digit per nibble. */
+} field_format_t;
+
+typedef struct table_field {
+    const char *name;
+    size_t offset;
+    size_t size;
+    field_format_t format;
+} table_field_t;
+
+#define FIELD(type, member, format) { #member, offsetof(type, member), sizeof(((type *)0)->member), format }
+
+static const table_field_t rate_fields[] = {
+    FIELD(rate_table_entry_t, type, FIELD_UINT),
+    FIELD(rate_table_entry_t, initial_period, FIELD_UINT),
+    FIELD(rate_table_entry_t, initial_charge, FIELD_UINT),
+    FIELD(rate_table_entry_t, additional_period, FIELD_UINT),
+    FIELD(rate_table_entry_t, additional_charge, FIELD_UINT),
+    { NULL, 0, 0, FIELD_UINT }
+};
+
+static const table_field_t carrier_fields[] = {
+    FIELD(carrier_table_entry_t, carrier_ref, FIELD_UINT),
+    FIELD(carrier_table_entry_t, carrier_num, FIELD_UINT),
+    FIELD(carrier_table_entry_t, valid_cards, FIELD_HEX),
+    FIELD(carrier_table_entry_t, display_prompt, FIELD_STRING),
+    FIELD(carrier_table_entry_t, control_byte2, FIELD_HEX),
+    FIELD(carrier_table_entry_t, control_byte, FIELD_HEX),
+    FIELD(carrier_table_entry_t, fgb_timer, FIELD_UINT),
+    FIELD(carrier_table_entry_t, international_accept_flags, FIELD_HEX),
+    FIELD(carrier_table_entry_t, call_entry, FIELD_UINT),
+    { NULL, 0, 0, FIELD_UINT }
+};
+
+static const table_field_t carrier_mtr1_fields[] = {
+    FIELD(carrier_table_entry_mtr1_t, carrier_ref, FIELD_UINT),
+    FIELD(carrier_table_entry_mtr1_t, carrier_num, FIELD_UINT),
+    FIELD(carrier_table_entry_mtr1_t, valid_cards, FIELD_HEX),
+    FIELD(carrier_table_entry_mtr1_t, display_prompt, FIELD_STRING),
+    FIELD(carrier_table_entry_mtr1_t, control_byte2, FIELD_HEX),
+    FIELD(carrier_table_entry_mtr1_t, control_byte, FIELD_HEX),
+    FIELD(carrier_table_entry_mtr1_t, fgb_timer, FIELD_UINT),
+    FIELD(carrier_table_entry_mtr1_t, spare, FIELD_HEX),
+    FIELD(carrier_table_entry_mtr1_t, call_entry, FIELD_UINT),
+    { NULL, 0, 0, FIELD_UINT }
+};
+
+static const table_field_t callscrn_fields[] = {
+    FIELD(call_screen_list_entry_t, free_call_flags, FIELD_HEX),
+    FIELD(call_screen_list_entry_t, call_type, FIELD_UINT),
+    FIELD(call_screen_list_entry_t, carrier_ref, FIELD_UINT),
+    FIELD(call_screen_list_entry_t, ident2, FIELD_HEX),
+    FIELD(call_screen_list_entry_t, phone_number, FIELD_CALLSCRN_NUM),
+    FIELD(call_screen_list_entry_t, cs_class, FIELD_HEX),
+    FIELD(call_screen_list_entry_t, spare, FIELD_HEX),
+    { NULL, 0, 0, FIELD_UINT }
+};
+
+static const table_field_t callscrnu_fields[] = {
+    FIELD(call_screen_universal_entry_t, free_call_flags, FIELD_HEX),
+    FIELD(call_screen_universal_entry_t, call_type, FIELD_UINT),
+    FIELD(call_screen_universal_entry_t, carrier_ref, FIELD_UINT),
+    FIELD(call_screen_universal_entry_t, ident2, FIELD_HEX),
+    FIELD(call_screen_universal_entry_t, phone_number, FIELD_CALLSCRN_NUM),
+    { NULL, 0, 0, FIELD_UINT }
+};
+
+static const table_field_t card_fields[] = {
+    FIELD(card_entry_t, pan_start, FIELD_HEX),
+    FIELD(card_entry_t, pan_end, FIELD_HEX),
+    FIELD(card_entry_t, standard_cd, FIELD_UINT),
+    FIELD(card_entry_t, vfy_flags, FIELD_HEX),
+    FIELD(card_entry_t, p_exp_date, FIELD_UINT),
+    FIELD(card_entry_t, p_init_date, FIELD_UINT),
+    FIELD(card_entry_t, p_disc_data, FIELD_UINT),
+    FIELD(card_entry_t, svc_code, FIELD_HEX),
+    FIELD(card_entry_t, ref_num, FIELD_UINT),
+    FIELD(card_entry_t, carrier_ref, FIELD_UINT),
+    FIELD(card_entry_t, control_info, FIELD_HEX),
+    FIELD(card_entry_t, bank_info, FIELD_HEX),
+    FIELD(card_entry_t, lang_code, FIELD_UINT),
+    { NULL, 0, 0, FIELD_UINT }
+};
+
+static const table_field_t card_mtr1_fields[] = {
+    FIELD(card_entry_mtr1_t, pan_start, FIELD_HEX),
+    FIELD(card_entry_mtr1_t, pan_end, FIELD_HEX),
+    FIELD(card_entry_mtr1_t, standard_cd, FIELD_UINT),
+    FIELD(card_entry_mtr1_t, vfy_flags, FIELD_HEX),
+    FIELD(card_entry_mtr1_t, p_exp_date, FIELD_UINT),
+    FIELD(card_entry_mtr1_t, p_init_date, FIELD_UINT),
+    FIELD(card_entry_mtr1_t, p_disc_data, FIELD_UINT),
+    FIELD(card_entry_mtr1_t, svc_code, FIELD_HEX),
+    FIELD(card_entry_mtr1_t, ref_num, FIELD_UINT),
+    FIELD(card_entry_mtr1_t, carrier_ref, FIELD_UINT),
+    { NULL, 0, 0, FIELD_UINT }
+};
+
+/* Layout of a table: an array of entries, or the NXX flags of an LCD table. */
+typedef struct table_layout {
+    uint8_t table_id;
+    uint8_t last_table_id;      /* Of a range of table IDs of the same layout. */
+    const char *entry_name;
+    size_t entries_offset;      /* From the table ID. */
+    size_t entry_size;
+    int entry_count;
+    const table_field_t *fields;
+    int lcd_bits;               /* Bits per NXX of an LCD table, 0 if not one. */
+} table_layout_t;
+
+static const table_layout_t table_layouts[] = {
+    { DLOG_MT_RATE_TABLE, DLOG_MT_RATE_TABLE, "r", offsetof(dlog_mt_rate_table_t, r),
+      sizeof(rate_table_entry_t), RATE_TABLE_MAX_ENTRIES, rate_fields, 0 },
+    { DLOG_MT_CARRIER_TABLE_EXP, DLOG_MT_CARRIER_TABLE_EXP, "carrier", offsetof(dlog_mt_carrier_table_t, carrier),
+      sizeof(carrier_table_entry_t), CARRIER_TABLE_MAX_CARRIERS, carrier_fields, 0 },
+    { DLOG_MT_CARRIER_TABLE, DLOG_MT_CARRIER_TABLE, "carrier", offsetof(dlog_mt_carrier_table_mtr1_t, carrier),
+      sizeof(carrier_table_entry_mtr1_t), CARRIER_TABLE_MTR1_MAX_CARRIERS, carrier_mtr1_fields, 0 },
+    { DLOG_MT_CALL_SCREEN_LIST, DLOG_MT_CALL_SCREEN_LIST, "entry", offsetof(dlog_mt_call_screen_list_t, entry),
+      sizeof(call_screen_list_entry_t), CALLSCRN_TABLE_MAX, callscrn_fields, 0 },
+    { DLOG_MT_CALLSCRN_UNIVERSAL, DLOG_MT_CALLSCRN_UNIVERSAL, "entry", offsetof(dlog_mt_call_screen_universal_t, entry),
+      sizeof(call_screen_universal_entry_t), CALLSCRNU_TABLE_MAX, callscrnu_fields, 0 },
+    { DLOG_MT_CALLSCRN_EXP, DLOG_MT_CALLSCRN_EXP, "entry", offsetof(dlog_mt_call_screen_enhanced_t, entry),
+      sizeof(call_screen_universal_entry_t), CALLSCRNE_TABLE_MAX, callscrnu_fields, 0 },
+    { DLOG_MT_CARD_TABLE_EXP, DLOG_MT_CARD_TABLE_EXP, "c", 1, sizeof(card_entry_t), CCARD_MAX, card_fields, 0 },
+    { DLOG_MT_CARD_TABLE, DLOG_MT_CARD_TABLE, "c", 1, sizeof(card_entry_mtr1_t), CCARD_MAX_MTR1, card_mtr1_fields, 0 },
+    { DLOG_MT_LCD_TABLE_1, DLOG_MT_LCD_TABLE_8, NULL, offsetof(dlog_mt_lcd_table_t, lcd), 0, 0, NULL, 8 },
+    { DLOG_MT_LCD_TABLE_9, DLOG_MT_LCD_TABLE_10, NULL, offsetof(dlog_mt_lcd_table_t, lcd), 0, 0, NULL, 8 },
+    { DLOG_MT_COMP_LCD_TABLE_1, DLOG_MT_COMP_LCD_TABLE_15, NULL, offsetof(dlog_mt_compressed_lcd_table_t, lcd), 0, 0, NULL, 4 },
+    { DLOG_MT_NPA_NXX_TABLE_1, DLOG_MT_NPA_NXX_TABLE_14, NULL, offsetof(dlog_mt_npa_nxx_table_t, lcd), 0, 0, NULL, 2 },
+    { DLOG_MT_NPA_NXX_TABLE_15, DLOG_MT_NPA_NXX_TABLE_16, NULL, offsetof(dlog_mt_npa_nxx_table_t, lcd), 0, 0, NULL, 2 },
+};
+
+static const char *lcd_flag_str[] = { "local", "LMS", "intra-LATA toll", "invalid", "inter-LATA toll" };
+
+static const table_layout_t *find_table_layout(uint8_t table_id) {
+    for (size_t i = 0; i < sizeof(table_layouts) / sizeof(table_layouts[0]); i++) {
+        if ((table_id >= table_layouts[i].table_id) && (table_id <= table_layouts[i].last_table_id)) {
+            return &table_layouts[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Table ID of a table file named mm_table_<xx>.bin or cut_table_<xx>.bin, -1 if it is not one. */
+static int table_file_id(const char *path) {
+    const char *name = strstr(path, "table_");
+    unsigned int table_id;
+
+    while ((name != NULL) && (strstr(name + 1, "table_") != NULL)) {
+        name = strstr(name + 1, "table_");
+    }
+
+    if ((name == NULL) || (sscanf(name, "table_%2x", &table_id) != 1)) return -1;
+
+    return (int)table_id;
+}
+
+/* Load a table file, with the table ID prepended. */
+static int load_table(const char *fname, uint8_t table_id, uint8_t **buffer, size_t *len) {
+    FILE *stream;
+    long  size;
+
+    if ((stream = fopen(fname, "rb")) == NULL) {
+        fprintf(stderr, "Error opening %s\n", fname);
+        return -ENOENT;
+    }
+
+    if ((fseek(stream, 0, SEEK_END) != 0) || ((size = ftell(stream)) < 0) || (fseek(stream, 0, SEEK_SET) != 0)) {
+        fprintf(stderr, "Can't tell the size of %s.\n", fname);
+        fclose(stream);
+        return -EIO;
+    }
+
+    *buffer = (uint8_t *)malloc(size + 1);
+    if (*buffer == NULL) {
+        fprintf(stderr, "Failed to allocate %ld bytes.\n", size + 1);
+        fclose(stream);
+        return -ENOMEM;
+    }
+
+    (*buffer)[0] = table_id;
+    if ((size > 0) && (fread(*buffer + 1, size, 1, stream) != 1)) {
+        fprintf(stderr, "Error reading %s.\n", fname);
+        free(*buffer);
+        fclose(stream);
+        return -EIO;
+    }
+
+    fclose(stream);
+    *len = (size_t)size + 1;
+
+    return 0;
+}
+
+static int save_file(const char *fname, const uint8_t *buffer, size_t len) {
+    FILE *stream;
+
+    if ((stream = fopen(fname, "wb")) == NULL) {
+        fprintf(stderr, "Error opening %s for write.\n", fname);
+        return -ENOENT;
+    }
+
+    if ((len > 0) && (fwrite(buffer, len, 1, stream) != 1)) {
+        fprintf(stderr, "Error writing %s.\n", fname);
+        fclose(stream);
+        return -EIO;
+    }
+
+    fclose(stream);
+
+    return 0;
+}
+
+static void print_field(const uint8_t *value, const table_field_t *field) {
+    char     number[32];
+    uint32_t uint_value = 0;
+
+    switch (field->format) {
+    case FIELD_UINT:
+        for (size_t i = 0; i < field->size; i++) {
+            uint_value |= (uint32_t)value[i] << (i * 8);
+        }
+        printf("%u", uint_value);
+        break;
+    case FIELD_STRING:
+        printf("\"");
+        for (size_t i = 0; (i < field->size) && (value[i] != '\0'); i++) {
+            printf(((value[i] >= 0x20) && (value[i] < 0x7f)) ? "%c" : "\\x%02x", value[i]);
+        }
+        printf("\"");
+        break;
+    case FIELD_CALLSCRN_NUM:
+        callscrn_num_to_string(number, sizeof(number), (uint8_t *)value, field->size);
+        printf("\"%s\"", number);
+        break;
+    case FIELD_HEX:
+    default:
+        for (size_t i = 0; i < field->size; i++) {
+            printf("%02x", value[i]);
+        }
+        break;
+    }
+}
+
+/* Whether a change to a string field is past its terminator, so it does not show when decoded. */
+static int field_change_hidden(const uint8_t *old_value, const uint8_t *new_value, const table_field_t *field) {
+    char old_number[32];
+    char new_number[32];
+
+    switch (field->format) {
+    case FIELD_STRING:
+        return strncmp((const char *)old_value, (const char *)new_value, field->size) == 0;
+    case FIELD_CALLSCRN_NUM:
+        callscrn_num_to_string(old_number, sizeof(old_number), (uint8_t *)old_value, field->size);
+        callscrn_num_to_string(new_number, sizeof(new_number), (uint8_t *)new_value, field->size);
+        return strcmp(old_number, new_number) == 0;
+    default:
+        return 0;
+    }
+}
+
+/* Print the ranges of bytes that differ between offsets start and end.  Returns the number of ranges. */
+static int diff_bytes(const uint8_t *old_table, const uint8_t *new_table, size_t start, size_t end) {
+    int ranges = 0;
+
+    for (size_t offset = start; offset < end; offset++) {
+        size_t range_end = offset + 1;
+
+        if (old_table[offset] == new_table[offset]) continue;
+
+        for (size_t i = range_end; (i < end) && (i - range_end < RANGE_GAP_MAX + 1); i++) {
+            if (old_table[i] != new_table[i]) range_end = i + 1;
+        }
+
+        /* Offsets in the table file, without the table ID. */
+        printf("bytes 0x%04zx-0x%04zx:", offset - 1, range_end - 2);
+        for (size_t i = offset; (i < range_end) && (i < offset + RANGE_SHOW_MAX); i++) printf(" %02x", old_table[i]);
+        printf("%s ->", (range_end - offset > RANGE_SHOW_MAX) ? " ..." : "");
+        for (size_t i = offset; (i < range_end) && (i < offset + RANGE_SHOW_MAX); i++) printf(" %02x", new_table[i]);
+        printf("%s\n", (range_end - offset > RANGE_SHOW_MAX) ? " ..." : "");
+
+        ranges++;
+        offset = range_end;
+    }
+
+    return ranges;
+}
+
+static int diff_entries(const table_layout_t *layout, const uint8_t *old_table, const uint8_t *new_table, size_t len) {
+    int changes = 0;
+    int count = (int)((len - layout->entries_offset) / layout->entry_size);
+
+    if (count > layout->entry_count) count = layout->entry_count;
+
+    changes += diff_bytes(old_table, new_table, 0, layout->entries_offset);
+
+    for (int i = 0; i < count; i++) {
+        const uint8_t *old_entry = &old_table[layout->entries_offset + i * layout->entry_size];
+        const uint8_t *new_entry = &new_table[layout->entries_offset + i * layout->entry_size];
+
+        if (memcmp(old_entry, new_entry, layout->entry_size) == 0) continue;
+
+        for (const table_field_t *field = layout->fields; field->name != NULL; field++) {
+            if (memcmp(&old_entry[field->offset], &new_entry[field->offset], field->size) == 0) continue;
+
+            printf("%s[%d].%s: ", layout->entry_name, i, field->name);
+            if (field_change_hidden(&old_entry[field->offset], &new_entry[field->offset], field)) {
+                table_field_t hex_field = *field;
+
+                hex_field.format = FIELD_HEX;
+                print_field(&old_entry[field->offset], &hex_field);
+                printf(" -> ");
+                print_field(&new_entry[field->offset], &hex_field);
+            } else {
+                print_field(&old_entry[field->offset], field);
+                printf(" -> ");
+                print_field(&new_entry[field->offset], field);
+            }
+            printf("\n");
+            changes++;
+        }
+    }
+
+    changes += diff_bytes(old_table, new_table, layout->entries_offset + count * layout->entry_size, len);
+
+    return changes;
+}
+
+static void print_lcd_flag(uint8_t flag) {
+    if (flag < sizeof(lcd_flag_str) / sizeof(lcd_flag_str[0])) {
+        printf("%s", lcd_flag_str[flag]);
+    } else {
+        printf("%d", flag);
+    }
+}
+
+static int diff_lcd(const table_layout_t *layout, const uint8_t *old_table, const uint8_t *new_table, size_t len) {
+    uint8_t old_flags[MAX_NPA];
+    uint8_t new_flags[MAX_NPA];
+    int     npa = ((new_table[1] >> 4) * 100) + ((new_table[1] & 0x0f) * 10) + (new_table[2] >> 4);
+    int     changes = 0;
+
+    if (len < layout->entries_offset + (MAX_NPA * layout->lcd_bits) / 8) {
+        return diff_bytes(old_table, new_table, 0, len);
+    }
+
+    changes += diff_bytes(old_table, new_table, 0, layout->entries_offset);
+
+    mm_lcd_unpack(&old_table[layout->entries_offset], layout->lcd_bits, old_flags);
+    mm_lcd_unpack(&new_table[layout->entries_offset], layout->lcd_bits, new_flags);
+
+    for (int nxx = 0; nxx < MAX_NPA; nxx++) {
+        if (old_flags[nxx] == new_flags[nxx]) continue;
+
+        printf("%03d-%03d: ", npa, nxx + 200);
+        print_lcd_flag(old_flags[nxx]);
+        printf(" -> ");
+        print_lcd_flag(new_flags[nxx]);
+        printf("\n");
+        changes++;
+    }
+
+    changes += diff_bytes(old_table, new_table, layout->entries_offset + (MAX_NPA * layout->lcd_bits) / 8, len);
+
+    return changes;
+}
+
+/* Print the fields that differ between two versions of a table.  Returns the number of changes. */
+static int diff_tables(uint8_t table_id, const uint8_t *old_table, size_t old_len, const uint8_t *new_table, size_t new_len) {
+    const table_layout_t *layout = find_table_layout(table_id);
+    size_t len = (old_len < new_len) ? old_len : new_len;
+    int changes = 0;
+
+    if (old_len != new_len) {
+        printf("length: %zu -> %zu\n", old_len - 1, new_len - 1);
+        changes++;
+    }
+
+    if ((layout != NULL) && (layout->lcd_bits != 0)) {
+        changes += diff_lcd(layout, old_table, new_table, len);
+    } else if ((layout != NULL) && (len >= layout->entries_offset)) {
+        changes += diff_entries(layout, old_table, new_table, len);
+    } else {
+        changes += diff_bytes(old_table, new_table, 1, len);
+    }
+
+    return changes;
+}
+
+static void mm_tablediff_help(const char *name, FILE *stream) {
+    fprintf(stream, "usage: %s [-h] [-t <table_id>] [-p <patch>] <old_table> <new_table>\n", name);
+    fprintf(stream, "       %s [-h] [-t <table_id>] -a <patch> <table> <patched_table>\n", name);
+    fprintf(stream,
+        "\t-p <patch> - also write a patch from old_table to new_table\n" \
+        "\t-a <patch> - apply a patch to table, writing patched_table\n" \
+        "\t-t <table_id> - table ID, if the file names are not mm_table_<xx>.bin\n" \
+        "\t-h this help.\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *patch_fname = NULL;
+    const char *apply_fname = NULL;
+    uint8_t *old_table = NULL;
+    uint8_t *new_table = NULL;
+    uint8_t *patch = NULL;
+    size_t   old_len, new_len, patch_len;
+    int      table_id = -1;
+    int      status;
+    int      c;
+
+    while ((c = getopt(argc, argv, "a:hp:t:")) != -1) {
+        switch (c) {
+            case 'a':
+                apply_fname = optarg;
+                break;
+            case 'h':
+                mm_tablediff_help(basename(argv[0]), stdout);
+                return 0;
+            case 'p':
+                patch_fname = optarg;
+                break;
+            case 't':
+                table_id = (int)strtol(optarg, NULL, 0);
+                break;
+            default:
+                mm_tablediff_help(basename(argv[0]), stderr);
+                return -EINVAL;
+        }
+    }
+
+    if (argc - optind != 2) {
+        mm_tablediff_help(basename(argv[0]), stderr);
+        return -EINVAL;
+    }
+
+    if (table_id < 0) table_id = table_file_id(argv[optind + 1]);
+    if (table_id < 0) table_id = table_file_id(argv[optind]);
+    if (table_id < 0) table_id = 0;
+
+    if ((status = load_table(argv[optind], (uint8_t)table_id, &old_table, &old_len)) != 0) {
+        return status;
+    }
+
+    if (apply_fname != NULL) {
+        uint8_t *patched;
+        size_t   patched_len;
+
+        if ((status = load_table(apply_fname, 0, &patch, &patch_len)) == 0) {
+            status = mm_table_patch_apply(old_table, old_len, patch + 1, patch_len - 1, &patched, &patched_len);
+
+            if (status == -EINVAL) {
+                fprintf(stderr, "%s is not a patch for %s.\n", apply_fname, argv[optind]);
+            } else if (status == 0) {
+                status = save_file(argv[optind + 1], patched + 1, patched_len - 1);
+                free(patched);
+            }
+        }
+
+        free(patch);
+        free(old_table);
+        return status;
+    }
+
+    if ((status = load_table(argv[optind + 1], (uint8_t)table_id, &new_table, &new_len)) != 0) {
+        free(old_table);
+        return status;
+    }
+
+    printf("Table %d (0x%02x) %s: %s -> %s\n", table_id, table_id, table_to_string((uint8_t)table_id),
+           argv[optind], argv[optind + 1]);
+
+    status = diff_tables((uint8_t)table_id, old_table, old_len, new_table, new_len);
+    printf("%d change%s.\n", status, (status == 1) ? "" : "s");
+
+    if (patch_fname != NULL) {
+        int patch_status = mm_table_patch_create(old_table, old_len, new_table, new_len, &patch, &patch_len);
+
+        if (patch_status == 0) {
+            patch_status = save_file(patch_fname, patch, patch_len);
+        }
+
+        if (patch_status != 0) {
+            free(patch);
+            free(old_table);
+            free(new_table);
+            return patch_status;
+        }
+
+        printf("Patch %s: %zu bytes, for a %zu-byte table.\n", patch_fname, patch_len, new_len - 1);
+    }
+
+    free(patch);
+    free(old_table);
+    free(new_table);
+
+    /* As diff(1), 1 if the tables differ. */
+    return (status != 0) ? 1 : 0;
+}
@@ -1,17 +1,25 @@
 /*
  * Table Management module for mm_manager.
  *
- * Database for table management.
+ * Database for table management, and the content-addressed table store:
+ * table files are stored once each, by the hash of their contents, and
+ * assigned to terminals by hash.  Tables loaded from the store are cached,
+ * shared by all lines, so a table assigned to many terminals is loaded
+ * once for the whole fleet while it is in use.  Also table overlays,
+ * terminal tables kept as a patch on another table, which are cached once
+ * composed.
  *
  * www.github.com/hharte/mm_manager
  *
  * Copyright (c) 2022-2023, Howard M. Harte
  */
 
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "mm_manager.h"
 
@@ -25,6 +33,24 @@
 #define SQL_IGNORE      ""
 #endif /* MYSQL */
 
+#define TABLE_STORE_CACHE_BYTES (4 * 1024 * 1024)
+
+/* Table file contents by hash, after a byte for the table ID. */
+static mm_cache_t *table_store_cache;
+
+#define TABLE_OVERLAY_CACHE_BYTES   (4 * 1024 * 1024)
+
+/* Composed overlays by file name: this header, then the table with its ID. */
+typedef struct mm_table_overlay_header {
+    char     base_fname[TABLE_PATH_MAX_LEN];
+    int64_t  mtime;             /* Of the overlay and base files it was composed from. */
+    int64_t  size;
+    int64_t  base_mtime;
+    int64_t  base_size;
+} mm_table_overlay_header_t;
+
+static mm_cache_t *table_overlay_cache;
+
 
 size_t mm_table_load(mm_context_t *context, uint8_t table_id, uint64_t version_timestamp, uint8_t *buffer, size_t buflen) {
     char sql[512] = { 0 };
@@ -75,5 +101,258 @@ int mm_table_create_tables(void *db) {
         return -1;
     }
 
+    rc = mm_sql_exec(db, TABLESTORE_SCHEMA);
+
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to create table TABLESTORE.\n", __func__);
+        return -1;
+    }
+
+    rc = mm_sql_exec(db, TABLEASSIGN_SCHEMA);
+
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to create table TABLEASSIGN.\n", __func__);
+        return -1;
+    }
+
+    rc = mm_sql_exec(db, TABLEBASE_SCHEMA);
+
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to create table TABLEBASE.\n", __func__);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Hash of the table assigned to terminal_id in the table store, and the
+ * time it was assigned.  Returns 0, or -ENOENT if none is assigned.
+ */
+int mm_table_store_assigned(void *db, const char *terminal_id, uint8_t table_id, char *hash, time_t *assigned_time) {
+    return mm_sql_load_TABLEASSIGN(db, terminal_id, table_id, hash, assigned_time);
+}
+
+int mm_table_store_init(void) {
+    table_store_cache = mm_cache_create(TABLE_STORE_CACHE_BYTES);
+
+    return (table_store_cache != NULL) ? 0 : -ENOMEM;
+}
+
+/*
+ * Load the table with hash from the table store as table_id, with the
+ * table ID prepended like load_mm_table(), into a buffer the caller frees.
+ */
+int mm_table_store_load(void *db, const char *hash, uint8_t table_id, uint8_t **buffer, size_t *len) {
+    char     image_hash[TABLE_HASH_LEN];
+    uint8_t *image;
+    size_t   image_len;
+    int      rc;
+
+    rc = mm_cache_get(table_store_cache, hash, strlen(hash), buffer, len);
+    if (rc == -ENOENT) {
+        rc = mm_sql_load_TABLESTORE(db, hash, &image, &image_len);
+        if (rc != 0) {
+            fprintf(stderr, "%s: Table %s is not in the table store.\n", __func__, hash);
+            *buffer = NULL;
+            return rc;
+        }
+
+        snprintf(image_hash, sizeof(image_hash), "%016" PRIx64, mm_fnv1a(image, image_len));
+        if (strcmp(image_hash, hash) != 0) {
+            fprintf(stderr, "%s: Table %s in the table store is corrupt, its hash is %s.\n", __func__, hash, image_hash);
+            free(image);
+            *buffer = NULL;
+            return -EIO;
+        }
+
+        *buffer = (uint8_t *)malloc(image_len + 1);
+        if (*buffer == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes for table %d\n", __func__, image_len + 1, table_id);
+            free(image);
+            return -ENOMEM;
+        }
+        memcpy(*buffer + 1, image, image_len);
+        free(image);
+        *len = image_len + 1;
+
+        /* Another line may have loaded it meanwhile. */
+        mm_cache_put(table_store_cache, hash, strlen(hash), *buffer, *len, 0);
+    } else if (rc != 0) {
+        return rc;
+    }
+
+    (*buffer)[0] = table_id;
+
+    return 0;
+}
+
+void mm_table_store_free(void) {
+    mm_cache_free(table_store_cache);
+    table_store_cache = NULL;
+}
+
+/* Read a file, with a byte for the table ID before its contents. */
+static int mm_table_read_file(const char *fname, uint8_t **buffer, size_t *len) {
+    FILE *stream;
+    long  size;
+
+    *buffer = NULL;
+
+    if ((stream = fopen(fname, "rb")) == NULL) {
+        return -ENOENT;
+    }
+
+    if ((fseek(stream, 0, SEEK_END) != 0) || ((size = ftell(stream)) < 0) || (fseek(stream, 0, SEEK_SET) != 0)) {
+        fprintf(stderr, "%s: Error: can't tell the size of %s\n", __func__, fname);
+        fclose(stream);
+        return -EIO;
+    }
+
+    *buffer = (uint8_t *)malloc(size + 1);
+    if (*buffer == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %ld bytes for %s\n", __func__, size + 1, fname);
+        fclose(stream);
+        return -ENOMEM;
+    }
+
+    if ((size > 0) && (fread(*buffer + 1, size, 1, stream) != 1)) {
+        fprintf(stderr, "%s: Error reading %s\n", __func__, fname);
+        free(*buffer);
+        *buffer = NULL;
+        fclose(stream);
+        return -EIO;
+    }
+
+    fclose(stream);
+    *len = (size_t)size + 1;
+
+    return 0;
+}
+
+int mm_table_overlay_init(void) {
+    table_overlay_cache = mm_cache_create(TABLE_OVERLAY_CACHE_BYTES);
+
+    return (table_overlay_cache != NULL) ? 0 : -ENOMEM;
+}
+
+/*
+ * Load the table overlay in fname, composed on the table in base_fname,
+ * as table_id, with the table ID prepended like load_mm_table(), into a
+ * buffer the caller frees.  The base is kept in the table store, so once
+ * base_fname is changed, the overlay is composed on the table it was made
+ * from instead.  Composed tables are cached by the overlay's file name
+ * until the overlay or its base changes.  Returns 0, -ENOENT, -EINVAL if
+ * neither base_fname nor the table store holds the table the overlay was
+ * made from, or -ENOMEM.
+ */
+int mm_table_overlay_load(void *db, const char *fname, const char *base_fname, uint8_t table_id, uint8_t **buffer, size_t *len) {
+    mm_table_overlay_header_t header;
+    struct stat attr;
+    struct stat base_attr;
+    char     hash[TABLE_HASH_LEN];
+    uint64_t base_hash;
+    uint8_t *base;
+    uint8_t *patch;
+    uint8_t *image = NULL;
+    uint8_t *cached;
+    size_t   base_len, patch_len, image_len = 0, cached_len;
+    int      rc;
+
+    *buffer = NULL;
+
+    if ((stat(fname, &attr) != 0) || (stat(base_fname, &base_attr) != 0)) {
+        return -ENOENT;
+    }
+
+    memset(&header, 0, sizeof(header));
+    snprintf(header.base_fname, sizeof(header.base_fname), "%s", base_fname);
+    header.mtime = (int64_t)attr.st_mtime;
+    header.size = (int64_t)attr.st_size;
+    header.base_mtime = (int64_t)base_attr.st_mtime;
+    header.base_size = (int64_t)base_attr.st_size;
+
+    if (mm_cache_get(table_overlay_cache, fname, strlen(fname), &cached, &cached_len) == 0) {
+        if ((cached_len > sizeof(header)) && (memcmp(cached, &header, sizeof(header)) == 0)) {
+            image_len = cached_len - sizeof(header);
+            memmove(cached, cached + sizeof(header), image_len);
+            image = cached;
+        } else {
+            free(cached);
+        }
+    }
+
+    if (image == NULL) {
+        if ((rc = mm_table_read_file(fname, &patch, &patch_len)) != 0) {
+            return rc;
+        }
+
+        if (mm_table_patch_base_hash(patch + 1, patch_len - 1, &base_hash) != 0) {
+            fprintf(stderr, "%s: %s is not a table overlay.\n", __func__, fname);
+            free(patch);
+            return -EINVAL;
+        }
+        snprintf(hash, sizeof(hash), "%016" PRIx64, base_hash);
+
+        if ((rc = mm_table_read_file(base_fname, &base, &base_len)) != 0) {
+            free(patch);
+            return rc;
+        }
+
+        if (mm_fnv1a(base + 1, base_len - 1) == base_hash) {
+            /* Keep the base, for when base_fname changes. */
+            mm_sql_save_TABLEBASE(db, hash, table_id, base + 1, base_len - 1);
+        } else {
+            free(base);
+
+            if (mm_table_store_load(db, hash, table_id, &base, &base_len) != 0) {
+                fprintf(stderr, "%s: Error: %s was made on table %s, which is no longer %s and is not in the table store.  "
+                        "Make the overlay again on %s.\n", __func__, fname, hash, base_fname, base_fname);
+                free(patch);
+                return -EINVAL;
+            }
+
+            fprintf(stderr, "%s: Warning: %s was made on table %s, not on %s as it is now.  "
+                    "It is composed on %s from the table store, without the changes to %s.\n",
+                    __func__, fname, hash, base_fname, hash, base_fname);
+        }
+
+        base[0] = table_id;
+        rc = mm_table_patch_apply(base, base_len, patch + 1, patch_len - 1, &image, &image_len);
+        free(base);
+        free(patch);
+
+        if (rc == -EINVAL) {
+            fprintf(stderr, "%s: %s is not a valid overlay on %s.\n", __func__, fname, hash);
+            return rc;
+        } else if (rc != 0) {
+            return rc;
+        }
+
+        if (image[0] != table_id) {
+            fprintf(stderr, "%s: %s is an overlay of table %d, not table %d.\n", __func__, fname, image[0], table_id);
+            free(image);
+            return -EINVAL;
+        }
+
+        cached_len = sizeof(header) + image_len;
+        cached = (uint8_t *)malloc(cached_len);
+        if (cached != NULL) {
+            memcpy(cached, &header, sizeof(header));
+            memcpy(cached + sizeof(header), image, image_len);
+            /* Replaces the overlay composed from older files. */
+            mm_cache_put(table_overlay_cache, fname, strlen(fname), cached, cached_len, 1);
+            free(cached);
+        }
+    }
+
+    *buffer = image;
+    *len = image_len;
+
     return 0;
 }
+
+void mm_table_overlay_free(void) {
+    mm_cache_free(table_overlay_cache);
+    table_overlay_cache = NULL;
+}
@@ -0,0 +1,492 @@
+/*
+ * Table audit for mm_manager.
+ *
+ * Walks one or more table directories, such as a whole tables tree with
+ * terminal-specific, model and default directories, and checks every
+ * table file found in it: the table ID in its name, its size and, for the
+ * tables with a structure that can be checked, its contents.  Tables are
+ * checked by a thread per core, and reported as text, CSV or JSON, so a
+ * fleet's tables can be audited with a single command.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+# include <getopt.h>
+# include <unistd.h>
+# include <libgen.h>
+#else  /* ifndef _WIN32 */
+# include <windows.h>
+# include "third-party/getopt.h"
+#endif /* ifndef _WIN32 */
+
+#include "mm_manager.h"
+#include "mm_card.h"
+
+#define DETAIL_LEN      (96)
+
+typedef enum table_status {
+    TABLE_OK = 0,
+    TABLE_UNCHECKED,        /* Size and structure not known. */
+    TABLE_BAD_SIZE,
+    TABLE_INVALID,          /* Contents fail the table's checks. */
+    TABLE_ERROR             /* Could not be read. */
+} table_status_t;
+
+static const char *table_status_str[] = { "ok", "unchecked", "size", "invalid", "error" };
+
+typedef struct table_result {
+    char path[TABLE_PATH_MAX_LEN];
+    uint8_t table_id;
+    size_t size;
+    size_t expected_size;   /* 0 if not known. */
+    table_status_t status;
+    uint64_t hash;
+    char detail[DETAIL_LEN];
+} table_result_t;
+
+/* Checks the contents of a table, with its table ID prepended.  Returns TABLE_OK or TABLE_INVALID. */
+typedef table_status_t (*table_check_fn)(const uint8_t *table, char *detail, size_t detail_len);
+
+typedef struct table_type {
+    uint8_t table_id;
+    uint8_t last_table_id;  /* Of a range of table IDs of the same type. */
+    size_t size;            /* Size of the table file, without the table ID. */
+    table_check_fn check;
+} table_type_t;
+
+static table_status_t check_card(const uint8_t *table, char *detail, size_t detail_len);
+static table_status_t check_card_mtr1(const uint8_t *table, char *detail, size_t detail_len);
+static table_status_t check_carrier(const uint8_t *table, char *detail, size_t detail_len);
+static table_status_t check_carrier_mtr1(const uint8_t *table, char *detail, size_t detail_len);
+static table_status_t check_fconfig(const uint8_t *table, char *detail, size_t detail_len);
+static table_status_t check_lcd(const uint8_t *table, char *detail, size_t detail_len);
+
+static const table_type_t table_types[] = {
+    { DLOG_MT_CARD_TABLE,         DLOG_MT_CARD_TABLE,         sizeof(dlog_mt_card_table_mtr1_t),           check_card_mtr1 },
+    { DLOG_MT_CARRIER_TABLE,      DLOG_MT_CARRIER_TABLE,      sizeof(dlog_mt_carrier_table_mtr1_t) - 1,    check_carrier_mtr1 },
+    { DLOG_MT_CALLSCRN_UNIVERSAL, DLOG_MT_CALLSCRN_UNIVERSAL, sizeof(dlog_mt_call_screen_universal_t) - 1, NULL },
+    { DLOG_MT_FCONFIG_OPTS,       DLOG_MT_FCONFIG_OPTS,       sizeof(dlog_mt_fconfig_opts_t) - 1,          check_fconfig },
+    { DLOG_MT_ADVERT_PROMPTS,     DLOG_MT_ADVERT_PROMPTS,     sizeof(dlog_mt_advert_prompts_t) - 1,        NULL },
+    { DLOG_MT_USER_IF_PARMS,      DLOG_MT_USER_IF_PARMS,      sizeof(dlog_mt_user_if_params_t) - 1,        NULL },
+    { DLOG_MT_INSTALL_PARAMS,     DLOG_MT_INSTALL_PARAMS,     sizeof(dlog_mt_install_params_t) - 1,        NULL },
+    { DLOG_MT_COMM_STAT_PARMS,    DLOG_MT_COMM_STAT_PARMS,    sizeof(dlog_mt_comm_stat_params_t) - 1,      NULL },
+    { DLOG_MT_CALL_STAT_PARMS,    DLOG_MT_CALL_STAT_PARMS,    sizeof(dlog_mt_call_stat_params_t) - 1,      NULL },
+    { DLOG_MT_CALL_IN_PARMS,      DLOG_MT_CALL_IN_PARMS,      sizeof(dlog_mt_call_in_params_t) - 1,        NULL },
+    { DLOG_MT_COIN_VAL_TABLE,     DLOG_MT_COIN_VAL_TABLE,     sizeof(dlog_mt_coin_val_table_t),            NULL },
+    { DLOG_MT_REP_DIAL_LIST,      DLOG_MT_REP_DIAL_LIST,      sizeof(dlog_mt_rdlist_table_t) - 1,          NULL },
+    { DLOG_MT_CALLSCRN_EXP,       DLOG_MT_CALLSCRN_EXP,       sizeof(dlog_mt_call_screen_enhanced_t) - 1,  NULL },
+    { DLOG_MT_RATE_TABLE,         DLOG_MT_RATE_TABLE,         sizeof(dlog_mt_rate_table_t) - 1,            NULL },
+    { DLOG_MT_LCD_TABLE_1,        DLOG_MT_LCD_TABLE_8,        sizeof(dlog_mt_lcd_table_t) - 1,             check_lcd },
+    { DLOG_MT_LCD_TABLE_9,        DLOG_MT_LCD_TABLE_10,       sizeof(dlog_mt_lcd_table_t) - 1,             check_lcd },
+    { DLOG_MT_CALL_SCREEN_LIST,   DLOG_MT_CALL_SCREEN_LIST,   sizeof(dlog_mt_call_screen_list_t) - 1,      NULL },
+    { DLOG_MT_SCARD_PARM_TABLE,   DLOG_MT_SCARD_PARM_TABLE,   sizeof(dlog_mt_scard_parm_table_t) - 1,      NULL },
+    { DLOG_MT_COMP_LCD_TABLE_1,   DLOG_MT_COMP_LCD_TABLE_15,  sizeof(dlog_mt_compressed_lcd_table_t) - 1,  check_lcd },
+    { DLOG_MT_CARD_TABLE_EXP,     DLOG_MT_CARD_TABLE_EXP,     sizeof(dlog_mt_card_table_t),                check_card },
+    { DLOG_MT_CARRIER_TABLE_EXP,  DLOG_MT_CARRIER_TABLE_EXP,  sizeof(dlog_mt_carrier_table_t) - 1,         check_carrier },
+    { DLOG_MT_NPA_NXX_TABLE_1,    DLOG_MT_NPA_NXX_TABLE_14,   sizeof(dlog_mt_npa_nxx_table_t) - 1,         check_lcd },
+    { DLOG_MT_NPA_NXX_TABLE_15,   DLOG_MT_NPA_NXX_TABLE_16,   sizeof(dlog_mt_npa_nxx_table_t) - 1,         check_lcd },
+    { DLOG_MT_NPA_SBR_TABLE,      DLOG_MT_NPA_SBR_TABLE,      sizeof(dlog_mt_npa_sbr_table_t) - 1,         NULL },
+    { DLOG_MT_INTL_SBR_TABLE,     DLOG_MT_INTL_SBR_TABLE,     sizeof(dlog_mt_intl_sbr_table_t) - 1,        NULL },
+};
+
+static const table_type_t *find_table_type(uint8_t table_id) {
+    for (size_t i = 0; i < sizeof(table_types) / sizeof(table_types[0]); i++) {
+        if ((table_id >= table_types[i].table_id) && (table_id <= table_types[i].last_table_id)) {
+            return &table_types[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* PAN ranges must not be inverted, and the card standard must be known. */
+static table_status_t check_card_entry(int index, const uint8_t *pan_start, const uint8_t *pan_end, uint8_t standard_cd,
+                                       char *detail, size_t detail_len) {
+    if (standard_cd > proton) {
+        snprintf(detail, detail_len, "card %d: unknown card standard %d", index, standard_cd);
+        return TABLE_INVALID;
+    }
+
+    if (memcmp(pan_start, pan_end, 3) > 0) {
+        snprintf(detail, detail_len, "card %d: PAN range %02x%02x%02x-%02x%02x%02x is inverted", index,
+                 pan_start[0], pan_start[1], pan_start[2], pan_end[0], pan_end[1], pan_end[2]);
+        return TABLE_INVALID;
+    }
+
+    return TABLE_OK;
+}
+
+static table_status_t check_card(const uint8_t *table, char *detail, size_t detail_len) {
+    const dlog_mt_card_table_t *card_table = (const dlog_mt_card_table_t *)(table + 1);
+    int cards = 0;
+
+    for (int i = 0; i < CCARD_MAX; i++) {
+        const card_entry_t *card = &card_table->c[i];
+
+        if (card->standard_cd == 0) continue;
+        if (check_card_entry(i, card->pan_start, card->pan_end, card->standard_cd, detail, detail_len) != TABLE_OK) {
+            return TABLE_INVALID;
+        }
+        cards++;
+    }
+
+    snprintf(detail, detail_len, "%d cards", cards);
+    return TABLE_OK;
+}
+
+static table_status_t check_card_mtr1(const uint8_t *table, char *detail, size_t detail_len) {
+    const dlog_mt_card_table_mtr1_t *card_table = (const dlog_mt_card_table_mtr1_t *)(table + 1);
+    int cards = 0;
+
+    for (int i = 0; i < CCARD_MAX_MTR1; i++) {
+        const card_entry_mtr1_t *card = &card_table->c[i];
+
+        if (card->standard_cd == 0) continue;
+        if (check_card_entry(i, card->pan_start, card->pan_end, card->standard_cd, detail, detail_len) != TABLE_OK) {
+            return TABLE_INVALID;
+        }
+        cards++;
+    }
+
+    snprintf(detail, detail_len, "%d cards", cards);
+    return TABLE_OK;
+}
+
+static table_status_t check_carrier(const uint8_t *table, char *detail, size_t detail_len) {
+    const dlog_mt_carrier_table_t *carrier_table = (const dlog_mt_carrier_table_t *)table;
+    int carriers = 0;
+
+    for (int i = 0; i < CARRIER_TABLE_MAX_CARRIERS; i++) {
+        if (carrier_table->carrier[i].carrier_ref != 0) carriers++;
+    }
+
+    snprintf(detail, detail_len, "%d carriers", carriers);
+    return TABLE_OK;
+}
+
+static table_status_t check_carrier_mtr1(const uint8_t *table, char *detail, size_t detail_len) {
+    const dlog_mt_carrier_table_mtr1_t *carrier_table = (const dlog_mt_carrier_table_mtr1_t *)table;
+    int carriers = 0;
+
+    for (int i = 0; i < CARRIER_TABLE_MTR1_MAX_CARRIERS; i++) {
+        if (carrier_table->carrier[i].carrier_ref != 0) carriers++;
+    }
+
+    snprintf(detail, detail_len, "%d carriers", carriers);
+    return TABLE_OK;
+}
+
+static table_status_t check_fconfig(const uint8_t *table, char *detail, size_t detail_len) {
+    const dlog_mt_fconfig_opts_t *fconfig_table = (const dlog_mt_fconfig_opts_t *)table;
+
+    if ((fconfig_table->term_type == 0) || (fconfig_table->term_type > TERM_TYPE_MAX)) {
+        snprintf(detail, detail_len, "invalid terminal type %d", fconfig_table->term_type);
+        return TABLE_INVALID;
+    }
+
+    snprintf(detail, detail_len, "terminal type %d", fconfig_table->term_type);
+    return TABLE_OK;
+}
+
+/* LCD tables of every compression start with the NPA, as BCD digits, and a check digit. */
+static table_status_t check_lcd(const uint8_t *table, char *detail, size_t detail_len) {
+    const dlog_mt_lcd_table_t *lcd_table = (const dlog_mt_lcd_table_t *)table;
+    uint8_t digits[3] = { lcd_table->npa[0] >> 4, lcd_table->npa[0] & 0x0f, lcd_table->npa[1] >> 4 };
+
+    if ((digits[0] < 2) || (digits[0] > 9) || (digits[1] > 9) || (digits[2] > 9)) {
+        snprintf(detail, detail_len, "invalid NPA %02x%x", lcd_table->npa[0], lcd_table->npa[1] >> 4);
+        return TABLE_INVALID;
+    }
+
+    snprintf(detail, detail_len, "NPA %d%d%d", digits[0], digits[1], digits[2]);
+    return TABLE_OK;
+}
+
+/* Table ID of a table file named mm_table_<xx>.bin, -1 if it is not one. */
+static int table_file_id(const char *name) {
+    unsigned int table_id;
+    char ext[5] = { 0 };
+
+    if ((strlen(name) != strlen("mm_table_xx.bin")) ||
+        (sscanf(name, "mm_table_%2x%4s", &table_id, ext) != 2) || (strcmp(ext, ".bin") != 0)) {
+        return -1;
+    }
+
+    return (int)table_id;
+}
+
+static void check_table(table_result_t *result) {
+    const table_type_t *table_type = find_table_type(result->table_id);
+    struct stat attr;
+    FILE *stream;
+    uint8_t *table;
+
+    if ((stat(result->path, &attr) != 0) || ((stream = fopen(result->path, "rb")) == NULL)) {
+        result->status = TABLE_ERROR;
+        snprintf(result->detail, sizeof(result->detail), "cannot open");
+        return;
+    }
+
+    result->size = (size_t)attr.st_size;
+    table = (uint8_t *)malloc(result->size + 1);
+
+    if ((table == NULL) || (fread(table + 1, 1, result->size, stream) != result->size)) {
+        result->status = TABLE_ERROR;
+        snprintf(result->detail, sizeof(result->detail), "cannot read");
+        free(table);
+        fclose(stream);
+        return;
+    }
+    fclose(stream);
+
+    table[0] = result->table_id;
+    result->hash = mm_fnv1a(table + 1, result->size);
+
+    if (table_type == NULL) {
+        result->status = TABLE_UNCHECKED;
+    } else if (result->size != table_type->size) {
+        result->status = TABLE_BAD_SIZE;
+        result->expected_size = table_type->size;
+        snprintf(result->detail, sizeof(result->detail), "expected %zu bytes", table_type->size);
+    } else {
+        result->expected_size = table_type->size;
+        result->status = (table_type->check != NULL) ? table_type->check(table, result->detail, sizeof(result->detail)) : TABLE_OK;
+    }
+
+    free(table);
+}
+
+typedef struct table_list {
+    table_result_t *results;
+    int count;
+    int allocated;
+} table_list_t;
+
+static int add_table(table_list_t *list, const char *path, int table_id) {
+    if (list->count == list->allocated) {
+        int allocated = list->allocated ? list->allocated * 2 : 256;
+        table_result_t *grown = (table_result_t *)realloc(list->results, allocated * sizeof(table_result_t));
+
+        if (grown == NULL) {
+            fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, allocated * sizeof(table_result_t));
+            return -ENOMEM;
+        }
+        list->results = grown;
+        list->allocated = allocated;
+    }
+
+    memset(&list->results[list->count], 0, sizeof(table_result_t));
+    snprintf(list->results[list->count].path, sizeof(list->results[list->count].path), "%s", path);
+    list->results[list->count].table_id = (uint8_t)table_id;
+    list->count++;
+
+    return 0;
+}
+
+static int find_tables(table_list_t *list, const char *path);
+
+static int find_tables_in_dir(void *arg, const char *dir, const char *name) {
+    char entry_path[TABLE_PATH_MAX_LEN];
+
+    if (snprintf(entry_path, sizeof(entry_path), "%s/%s", dir, name) >= (int)sizeof(entry_path)) {
+        fprintf(stderr, "Path %s/%s is too long.\n", dir, name);
+        return -ENAMETOOLONG;
+    }
+
+    return find_tables((table_list_t *)arg, entry_path);
+}
+
+/* Find the table files in path, a table file or a directory searched recursively. */
+static int find_tables(table_list_t *list, const char *path) {
+    struct stat attr;
+    const char *name;
+
+    if (stat(path, &attr) != 0) {
+        fprintf(stderr, "Cannot open %s.\n", path);
+        return -ENOENT;
+    }
+
+    if (!S_ISDIR(attr.st_mode)) {
+        name = strrchr(path, '/');
+        name = (name != NULL) ? name + 1 : path;
+
+        if (table_file_id(name) < 0) return 0;
+        return add_table(list, path, table_file_id(name));
+    }
+
+    return mm_list_dir(path, find_tables_in_dir, list);
+}
+
+static void check_one_table(void *arg, int index) {
+    check_table(&((table_list_t *)arg)->results[index]);
+}
+
+static int compare_results(const void *a, const void *b) {
+    return strcmp(((const table_result_t *)a)->path, ((const table_result_t *)b)->path);
+}
+
+/* Print a string as a JSON string. */
+static void print_json_string(FILE *stream, const char *str) {
+    fputc('"', stream);
+    for (; *str != '\0'; str++) {
+        if ((*str == '"') || (*str == '\\')) {
+            fprintf(stream, "\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            fprintf(stream, "\\u%04x", (unsigned char)*str);
+        } else {
+            fputc(*str, stream);
+        }
+    }
+    fputc('"', stream);
+}
+
+/* Print a string as a CSV field. */
+static void print_csv_string(FILE *stream, const char *str) {
+    fputc('"', stream);
+    for (; *str != '\0'; str++) {
+        if (*str == '"') fputc('"', stream);
+        fputc(*str, stream);
+    }
+    fputc('"', stream);
+}
+
+typedef enum report_format {
+    REPORT_TEXT = 0,
+    REPORT_CSV,
+    REPORT_JSON
+} report_format_t;
+
+static void print_result(FILE *stream, report_format_t format, const table_result_t *result, int first) {
+    switch (format) {
+    case REPORT_CSV:
+        print_csv_string(stream, result->path);
+        fprintf(stream, ",%d,%s,%zu,%zu,%s,%016" PRIx64 ",", result->table_id, table_to_string(result->table_id),
+                result->size, result->expected_size, table_status_str[result->status], result->hash);
+        print_csv_string(stream, result->detail);
+        fprintf(stream, "\n");
+        break;
+    case REPORT_JSON:
+        fprintf(stream, "%s\n  { \"path\": ", first ? "" : ",");
+        print_json_string(stream, result->path);
+        fprintf(stream, ", \"table_id\": %d, \"table\": \"%s\", \"size\": %zu, \"expected_size\": %zu, "
+                "\"status\": \"%s\", \"hash\": \"%016" PRIx64 "\", \"detail\": ",
+                result->table_id, table_to_string(result->table_id), result->size, result->expected_size,
+                table_status_str[result->status], result->hash);
+        print_json_string(stream, result->detail);
+        fprintf(stream, " }");
+        break;
+    case REPORT_TEXT:
+    default:
+        fprintf(stream, "%-40s %3d (0x%02x) %-28s %6zu  %-9s %s\n", result->path, result->table_id, result->table_id,
+                table_to_string(result->table_id), result->size, table_status_str[result->status], result->detail);
+        break;
+    }
+}
+
+static void mm_tables_help(const char *name, FILE *stream) {
+    fprintf(stream, "usage: %s [-h] [-e] [-j <threads>] [-o text|csv|json] [<table_dir>|<mm_table_xx.bin>...]\n", name);
+    fprintf(stream,
+        "\t<table_dir> - directory searched recursively for table files (default: tables)\n" \
+        "\t-e - report only tables that failed their checks\n" \
+        "\t-j <threads> - number of threads checking tables (default: one per core)\n" \
+        "\t-o text|csv|json - report format (default: text)\n" \
+        "\t-h this help.\n");
+}
+
+int main(int argc, char *argv[]) {
+    table_list_t list = { 0 };
+    report_format_t format = REPORT_TEXT;
+    int threads = mm_default_threads();
+    int errors_only = 0;
+    int counts[TABLE_ERROR + 1] = { 0 };
+    int printed = 0;
+    int status = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "ehj:o:")) != -1) {
+        switch (c) {
+            case 'e':
+                errors_only = 1;
+                break;
+            case 'h':
+                mm_tables_help(basename(argv[0]), stdout);
+                return 0;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'o':
+                if (strcmp(optarg, "text") == 0) {
+                    format = REPORT_TEXT;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    format = REPORT_CSV;
+                } else if (strcmp(optarg, "json") == 0) {
+                    format = REPORT_JSON;
+                } else {
+                    fprintf(stderr, "Unknown report format '%s'.\n", optarg);
+                    return -EINVAL;
+                }
+                break;
+            default:
+                mm_tables_help(basename(argv[0]), stderr);
+                return -EINVAL;
+        }
+    }
+
+    if (threads < 1) threads = 1;
+    if (threads > MM_THREADS_MAX) threads = MM_THREADS_MAX;
+
+    if (optind == argc) {
+        status = find_tables(&list, "tables");
+    }
+    for (int i = optind; (i < argc) && (status == 0); i++) {
+        status = find_tables(&list, argv[i]);
+    }
+
+    if (status != 0) {
+        free(list.results);
+        return status;
+    }
+
+    mm_parallel_for(list.count, threads, check_one_table, &list);
+    qsort(list.results, list.count, sizeof(table_result_t), compare_results);
+
+    if (format == REPORT_CSV) {
+        printf("path,table_id,table,size,expected_size,status,hash,detail\n");
+    } else if (format == REPORT_JSON) {
+        printf("[");
+    }
+
+    for (int i = 0; i < list.count; i++) {
+        const table_result_t *result = &list.results[i];
+
+        counts[result->status]++;
+        if (errors_only && ((result->status == TABLE_OK) || (result->status == TABLE_UNCHECKED))) continue;
+
+        print_result(stdout, format, result, printed++ == 0);
+    }
+
+    if (format == REPORT_JSON) {
+        printf("\n]\n");
+    }
+
+    /* The summary goes to stderr, to keep the report machine-readable. */
+    fprintf((format == REPORT_TEXT) ? stdout : stderr,
+            "%d tables: %d ok, %d unchecked, %d of the wrong size, %d invalid, %d unreadable.\n",
+            list.count, counts[TABLE_OK], counts[TABLE_UNCHECKED], counts[TABLE_BAD_SIZE],
+            counts[TABLE_INVALID], counts[TABLE_ERROR]);
+
+    free(list.results);
+
+    return (counts[TABLE_BAD_SIZE] + counts[TABLE_INVALID] + counts[TABLE_ERROR]) ? -EIO : 0;
+}
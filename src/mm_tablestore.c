@@ -0,0 +1,538 @@
+/*
+ * Content-addressed table store maintenance for mm_manager.
+ *
+ * Imports terminal-specific table files into the mm_manager database,
+ * where each table is stored once, by the hash of its contents, and each
+ * terminal is assigned its tables by hash.  A table shared by many
+ * terminals is then stored, and cached by mm_manager, only once.  Also
+ * lists the store and the tables assigned to a terminal, removes a
+ * terminal's assignments, and garbage collects tables no longer assigned
+ * to any terminal.  Tables that table overlays were made on are kept.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+# include <getopt.h>
+# include <unistd.h>
+# include <libgen.h>
+#else  /* ifndef _WIN32 */
+# include <windows.h>
+# include "third-party/getopt.h"
+#endif /* ifndef _WIN32 */
+
+#include <sqlite3.h>
+
+#include "mm_manager.h"
+
+typedef struct import_stats {
+    int tables;
+    int stored;                 /* Tables not already in the store. */
+    size_t bytes;
+    size_t stored_bytes;
+} import_stats_t;
+
+/* Terminal IDs are the terminal's 10-digit phone number. */
+static int is_terminal_id(const char* name) {
+    if (strlen(name) != 10) return 0;
+
+    for (int i = 0; i < 10; i++) {
+        if ((name[i] < '0') || (name[i] > '9')) return 0;
+    }
+
+    return 1;
+}
+
+/* Table ID of a table file named mm_table_<xx>.bin, -1 if it is not one. */
+static int table_file_id(const char* path) {
+    const char* name = path;
+    unsigned int table_id;
+    char ext[5] = { 0 };
+
+    for (const char* p = path; *p != '\0'; p++) {
+        if ((*p == '/') || (*p == '\\')) name = p + 1;
+    }
+
+    if ((strlen(name) != strlen("mm_table_xx.bin")) ||
+        (sscanf(name, "mm_table_%2x%4s", &table_id, ext) != 2) || (strcmp(ext, ".bin") != 0)) {
+        return -1;
+    }
+
+    return (int)table_id;
+}
+
+/* Store a table, unless it is stored already. */
+static int store_table(sqlite3* db, const char* hash, uint8_t table_id, const uint8_t* image, size_t len, import_stats_t* stats) {
+    sqlite3_stmt* res;
+    int rc;
+
+    if (sqlite3_prepare_v2(db, "SELECT TABLE_DATA from TABLESTORE where (HASH = ?)", -1, &res, 0) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+    sqlite3_bind_text(res, 1, hash, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(res) == SQLITE_ROW) {
+        /* A different table with the same hash would be loaded in its place. */
+        rc = ((size_t)sqlite3_column_bytes(res, 0) == len) &&
+             ((len == 0) || (memcmp(sqlite3_column_blob(res, 0), image, len) == 0));
+        sqlite3_finalize(res);
+
+        if (!rc) {
+            fprintf(stderr, "%s: Table %d (0x%02x) has the hash %s of a different table in the store.\n",
+                    __func__, table_id, table_id, hash);
+            return -EEXIST;
+        }
+        return 0;
+    }
+    sqlite3_finalize(res);
+
+    if (sqlite3_prepare_v2(db, "INSERT INTO TABLESTORE (HASH, TABLE_ID, DATA_LENGTH, TABLE_DATA) VALUES ( ?, ?, ?, ? )",
+                           -1, &res, 0) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+    sqlite3_bind_text(res, 1, hash, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, table_id);
+    sqlite3_bind_int64(res, 3, (sqlite3_int64)len);
+    sqlite3_bind_blob(res, 4, image, (int)len, SQLITE_STATIC);
+
+    rc = sqlite3_step(res);
+    sqlite3_finalize(res);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "%s: Failed to store table %s: %s\n", __func__, hash, sqlite3_errmsg(db));
+        return -EIO;
+    }
+
+    stats->stored++;
+    stats->stored_bytes += len;
+
+    return 0;
+}
+
+/*
+ * Assign a table to a terminal.  A terminal keeps the time it was assigned
+ * a table while the table stays the same, so reimporting an unchanged
+ * table does not make it newer.
+ */
+static int assign_table(sqlite3* db, const char* terminal_id, uint8_t table_id, const char* hash, time_t assigned_time) {
+    sqlite3_stmt* res;
+    int rc;
+
+    if (sqlite3_prepare_v2(db, "INSERT INTO TABLEASSIGN (TERMINAL_ID, TABLE_ID, HASH, ASSIGNED_TIME) VALUES ( ?, ?, ?, ? ) "
+                           "ON CONFLICT(TERMINAL_ID, TABLE_ID) DO UPDATE SET HASH = excluded.HASH, ASSIGNED_TIME = excluded.ASSIGNED_TIME "
+                           "WHERE HASH != excluded.HASH", -1, &res, 0) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+    sqlite3_bind_text(res, 1, terminal_id, -1, SQLITE_STATIC);
+    sqlite3_bind_int(res, 2, table_id);
+    sqlite3_bind_text(res, 3, hash, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(res, 4, (sqlite3_int64)assigned_time);
+
+    rc = sqlite3_step(res);
+    sqlite3_finalize(res);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "%s: Failed to assign table %d to terminal %s: %s\n", __func__, table_id, terminal_id, sqlite3_errmsg(db));
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/* Import a table file, and assign it to terminal_id. */
+static int import_file(sqlite3* db, const char* terminal_id, const char* path, import_stats_t* stats) {
+    FILE* stream;
+    struct stat attr;
+    uint8_t* image;
+    char hash[TABLE_HASH_LEN];
+    int table_id = table_file_id(path);
+    int status;
+
+    if (table_id < 0) {
+        fprintf(stderr, "%s: %s is not a table file, expected mm_table_<xx>.bin.\n", __func__, path);
+        return -EINVAL;
+    }
+
+    if ((stat(path, &attr) != 0) || ((stream = fopen(path, "rb")) == NULL)) {
+        fprintf(stderr, "%s: Cannot open %s.\n", __func__, path);
+        return -ENOENT;
+    }
+
+    image = (uint8_t*)malloc((size_t)attr.st_size + 1);
+    if (image == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, (size_t)attr.st_size + 1);
+        fclose(stream);
+        return -ENOMEM;
+    }
+
+    if (fread(image, 1, (size_t)attr.st_size, stream) != (size_t)attr.st_size) {
+        fprintf(stderr, "%s: Error reading %s.\n", __func__, path);
+        free(image);
+        fclose(stream);
+        return -EIO;
+    }
+    fclose(stream);
+
+    snprintf(hash, sizeof(hash), "%016" PRIx64, mm_fnv1a(image, (size_t)attr.st_size));
+
+    status = store_table(db, hash, (uint8_t)table_id, image, (size_t)attr.st_size, stats);
+    free(image);
+
+    if (status == 0) {
+        status = assign_table(db, terminal_id, (uint8_t)table_id, hash, attr.st_mtime);
+    }
+
+    if (status != 0) return status;
+
+    stats->tables++;
+    stats->bytes += (size_t)attr.st_size;
+    printf("%s: table %3d (0x%02x) %-28s %s\n", terminal_id, table_id, table_id, table_to_string((uint8_t)table_id), hash);
+
+    return 0;
+}
+
+static int remove_file(const char* path) {
+    if (remove(path) != 0) {
+        fprintf(stderr, "%s: Cannot remove %s.\n", __func__, path);
+    }
+
+    return 0;
+}
+
+typedef struct import_dir_arg {
+    sqlite3* db;
+    const char* terminal_id;
+    int removing;               /* Remove the table files, once imported. */
+    import_stats_t* stats;
+} import_dir_arg_t;
+
+static int import_terminal_file(void* arg, const char* dir, const char* name) {
+    import_dir_arg_t* import = (import_dir_arg_t*)arg;
+    char path[TABLE_PATH_MAX_LEN];
+
+    if (table_file_id(name) < 0) return 0;
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path)) {
+        fprintf(stderr, "Path %s/%s is too long.\n", dir, name);
+        return -ENAMETOOLONG;
+    }
+    if (import->removing) return remove_file(path);
+
+    return import_file(import->db, import->terminal_id, path, import->stats);
+}
+
+/* Import the tables of a terminal-specific directory, named by its terminal ID. */
+static int import_terminal_dir(void* arg, const char* dir, const char* name) {
+    import_dir_arg_t* import = (import_dir_arg_t*)arg;
+    char path[TABLE_PATH_MAX_LEN];
+
+    if (!is_terminal_id(name)) return 0;
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path)) {
+        fprintf(stderr, "Path %s/%s is too long.\n", dir, name);
+        return -ENAMETOOLONG;
+    }
+    import->terminal_id = name;
+    return mm_list_dir(path, import_terminal_file, import);
+}
+
+/*
+ * Import the table files given, or every terminal-specific directory of
+ * term_table_dir, in one transaction: either all are imported, or none.
+ * The files are only removed once all are imported.
+ */
+static int import_tables(sqlite3* db, const char* term_table_dir, const char* terminal_id, char* files[], int count, int remove_files) {
+    import_stats_t stats = { 0 };
+    import_dir_arg_t import = { db, terminal_id, 0, &stats };
+    int status = 0;
+
+    if (sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, 0, NULL) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to begin transaction: %s\n", __func__, sqlite3_errmsg(db));
+        return -EIO;
+    }
+
+    if (term_table_dir != NULL) {
+        status = mm_list_dir(term_table_dir, import_terminal_dir, &import);
+    } else {
+        for (int i = 0; (i < count) && (status == 0); i++) {
+            status = import_file(db, terminal_id, files[i], &stats);
+        }
+    }
+
+    if (status != 0) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, 0, NULL);
+        fprintf(stderr, "Import failed, nothing was imported.\n");
+        return status;
+    }
+
+    if (sqlite3_exec(db, "COMMIT;", NULL, 0, NULL) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to commit: %s\n", __func__, sqlite3_errmsg(db));
+        return -EIO;
+    }
+
+    printf("Imported %d tables (%zu bytes), %d new to the store (%zu bytes).\n",
+           stats.tables, stats.bytes, stats.stored, stats.stored_bytes);
+
+    if (remove_files) {
+        import.removing = 1;
+
+        if (term_table_dir != NULL) {
+            mm_list_dir(term_table_dir, import_terminal_dir, &import);
+        } else {
+            for (int i = 0; i < count; i++) {
+                remove_file(files[i]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* List the tables in the store, with the number of terminals each is assigned to. */
+static int list_store(sqlite3* db) {
+    sqlite3_stmt* res;
+    int tables = 0;
+    int assigned = 0;
+    size_t bytes = 0;
+    size_t assigned_bytes = 0;
+
+    if (sqlite3_prepare_v2(db, "SELECT S.HASH, S.TABLE_ID, S.DATA_LENGTH, COUNT(A.HASH) from TABLESTORE S "
+                           "LEFT JOIN TABLEASSIGN A ON (A.HASH = S.HASH) GROUP BY S.HASH ORDER BY S.TABLE_ID, S.HASH",
+                           -1, &res, 0) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+
+    printf("Hash              Table                                    Bytes  Terminals\n");
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        const char* hash = (const char*)sqlite3_column_text(res, 0);
+        uint8_t table_id = (uint8_t)sqlite3_column_int(res, 1);
+        size_t len = (size_t)sqlite3_column_int64(res, 2);
+        int refs = sqlite3_column_int(res, 3);
+
+        printf("%-16s  %3d (0x%02x) %-28s %6zu  %9d\n", hash ? hash : "", table_id, table_id, table_to_string(table_id), len, refs);
+
+        tables++;
+        bytes += len;
+        assigned += refs;
+        assigned_bytes += len * refs;
+    }
+
+    sqlite3_finalize(res);
+
+    printf("%d tables, %zu bytes, assigned %d times for %zu bytes", tables, bytes, assigned, assigned_bytes);
+    if (bytes != 0) {
+        printf(", %.1f:1 deduplication", (double)assigned_bytes / bytes);
+    }
+    printf(".\n");
+
+    return 0;
+}
+
+/* List the tables assigned to terminal_id. */
+static int list_terminal(sqlite3* db, const char* terminal_id) {
+    sqlite3_stmt* res;
+    int tables = 0;
+    size_t bytes = 0;
+
+    if (sqlite3_prepare_v2(db, "SELECT A.TABLE_ID, A.HASH, S.DATA_LENGTH, A.ASSIGNED_TIME from TABLEASSIGN A "
+                           "LEFT JOIN TABLESTORE S ON (S.HASH = A.HASH) WHERE (A.TERMINAL_ID = ?) ORDER BY A.TABLE_ID",
+                           -1, &res, 0) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+    sqlite3_bind_text(res, 1, terminal_id, -1, SQLITE_STATIC);
+
+    printf("Tables assigned to terminal %s:\n", terminal_id);
+    printf("Table                                    Bytes  Hash              Assigned\n");
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        uint8_t table_id = (uint8_t)sqlite3_column_int(res, 0);
+        const char* hash = (const char*)sqlite3_column_text(res, 1);
+        time_t assigned_time = (time_t)sqlite3_column_int64(res, 3);
+        char assigned[32];
+        struct tm ptm = { 0 };
+
+        localtime_r(&assigned_time, &ptm);
+        strftime(assigned, sizeof(assigned), "%Y-%m-%d %H:%M:%S", &ptm);
+
+        if (sqlite3_column_type(res, 2) == SQLITE_NULL) {
+            printf("%3d (0x%02x) %-28s      -  %-16s  %s (missing from the store)\n",
+                   table_id, table_id, table_to_string(table_id), hash ? hash : "", assigned);
+        } else {
+            printf("%3d (0x%02x) %-28s %6d  %-16s  %s\n",
+                   table_id, table_id, table_to_string(table_id), sqlite3_column_int(res, 2), hash ? hash : "", assigned);
+            bytes += (size_t)sqlite3_column_int(res, 2);
+        }
+        tables++;
+    }
+
+    sqlite3_finalize(res);
+
+    printf("%d tables, %zu bytes.\n", tables, bytes);
+
+    return 0;
+}
+
+/* Run a statement with terminal_id bound, returning the number of rows changed. */
+static int exec_changes(sqlite3* db, const char* sql, const char* terminal_id) {
+    sqlite3_stmt* res;
+    int rc;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &res, 0) != SQLITE_OK) {
+        fprintf(stderr, "%s: Failed to prepare: %s\n", __func__, sqlite3_errmsg(db));
+        sqlite3_finalize(res);
+        return -EIO;
+    }
+    if (terminal_id != NULL) sqlite3_bind_text(res, 1, terminal_id, -1, SQLITE_STATIC);
+
+    rc = sqlite3_step(res);
+    sqlite3_finalize(res);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "%s: Failed: %s\n", __func__, sqlite3_errmsg(db));
+        return -EIO;
+    }
+
+    return sqlite3_changes(db);
+}
+
+static void mm_tablestore_help(const char* name, FILE* stream) {
+    fprintf(stream,
+        "usage: %s [-h] [-d <database>] [-i <term_table_dir>] [-t <terminal_id> <mm_table_xx.bin>...] [-r] "
+        "[-l] [-a <terminal_id>] [-u <terminal_id>] [-g]\n", name);
+    fprintf(stream,
+        "\t-d <database> - mm_manager database (default: mm_manager.db)\n" \
+        "\t-i <term_table_dir> - import the tables of every terminal-specific directory in term_table_dir\n" \
+        "\t-t <terminal_id> - import the table files given for terminal_id\n" \
+        "\t-r - remove table files once imported\n" \
+        "\t-l - list the tables in the store\n" \
+        "\t-a <terminal_id> - list the tables assigned to terminal_id\n" \
+        "\t-u <terminal_id> - remove the tables assigned to terminal_id\n" \
+        "\t-g - remove tables no longer assigned to any terminal, nor made an overlay on, from the store\n" \
+        "\t-h this help.\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* database = "mm_manager.db";
+    const char* import_dir = NULL;
+    const char* import_terminal_id = NULL;
+    const char* list_terminal_id = NULL;
+    const char* unassign_terminal_id = NULL;
+    int remove_files = 0;
+    int list = 0;
+    int gc = 0;
+    int status = 0;
+    int c;
+    sqlite3* db;
+
+    while ((c = getopt(argc, argv, "a:d:ghi:lrt:u:")) != -1) {
+        switch (c) {
+            case 'a':
+                list_terminal_id = optarg;
+                break;
+            case 'd':
+                database = optarg;
+                break;
+            case 'g':
+                gc = 1;
+                break;
+            case 'h':
+                mm_tablestore_help(basename(argv[0]), stdout);
+                return 0;
+            case 'i':
+                import_dir = optarg;
+                break;
+            case 'l':
+                list = 1;
+                break;
+            case 'r':
+                remove_files = 1;
+                break;
+            case 't':
+                import_terminal_id = optarg;
+                break;
+            case 'u':
+                unassign_terminal_id = optarg;
+                break;
+            default:
+                mm_tablestore_help(basename(argv[0]), stderr);
+                return -EINVAL;
+        }
+    }
+
+    if (((import_terminal_id != NULL) && (!is_terminal_id(import_terminal_id) || (optind >= argc) || (import_dir != NULL))) ||
+        ((import_terminal_id == NULL) && (optind < argc)) ||
+        ((import_dir == NULL) && (import_terminal_id == NULL) && !list && !gc &&
+         (list_terminal_id == NULL) && (unassign_terminal_id == NULL))) {
+        mm_tablestore_help(basename(argv[0]), stderr);
+        return -EINVAL;
+    }
+
+    if (sqlite3_open(database, &db) != SQLITE_OK) {
+        fprintf(stderr, "Cannot open database %s: %s\n", database, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return -ENOENT;
+    }
+
+    if ((sqlite3_exec(db, TABLESTORE_SCHEMA, NULL, 0, NULL) != SQLITE_OK) ||
+        (sqlite3_exec(db, TABLEASSIGN_SCHEMA, NULL, 0, NULL) != SQLITE_OK) ||
+        (sqlite3_exec(db, TABLEBASE_SCHEMA, NULL, 0, NULL) != SQLITE_OK)) {
+        fprintf(stderr, "Failed to create the table store in %s: %s\n", database, sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return -EIO;
+    }
+
+    if ((import_dir != NULL) || (import_terminal_id != NULL)) {
+        status = import_tables(db, import_dir, import_terminal_id, &argv[optind], argc - optind, remove_files);
+    }
+
+    if ((status == 0) && (unassign_terminal_id != NULL)) {
+        status = exec_changes(db, "DELETE FROM TABLEASSIGN WHERE (TERMINAL_ID = ?)", unassign_terminal_id);
+        if (status >= 0) {
+            printf("Removed %d tables assigned to terminal %s.\n", status, unassign_terminal_id);
+            status = 0;
+        }
+    }
+
+    if ((status == 0) && gc) {
+        status = exec_changes(db, "DELETE FROM TABLESTORE WHERE HASH NOT IN (SELECT HASH FROM TABLEASSIGN) "
+                             "AND HASH NOT IN (SELECT HASH FROM TABLEBASE)", NULL);
+        if (status >= 0) {
+            printf("Removed %d unassigned tables from the store.\n", status);
+            status = 0;
+        }
+    }
+
+    if ((status == 0) && list) {
+        status = list_store(db);
+    }
+
+    if ((status == 0) && (list_terminal_id != NULL)) {
+        status = list_terminal(db, list_terminal_id);
+    }
+
+    sqlite3_close(db);
+
+    return status;
+}
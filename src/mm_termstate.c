@@ -0,0 +1,332 @@
+/*
+ * Terminal state cache for mm_manager.
+ *
+ * Keeps the last known state of each terminal: terminal type, control
+ * ROM edition, cash box status and status word.  The state is cached in
+ * memory, shared by all lines, and written through to the TERMSTATE
+ * table when it changes, so it survives restarts without having to be
+ * reconstructed from the accounting tables on every call.  Terminals that
+ * have not called in for a while are evicted from the cache.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_manager.h"
+
+#define TERMSTATE_CACHE_BYTES   (8 * 1024 * 1024)
+
+/* Terminal state by terminal ID. */
+static mm_cache_t *termstate_cache;
+
+/*
+ * Number of terminals in TERMSTATE expected to keep a line busy in each
+ * minute of the call-in interval.  Kept up to date under the terminal
+ * state lock as states are written, see mm_termstate_put_locked().
+ */
+static uint16_t call_in_busy[CALL_IN_INTERVAL_MINS];
+
+/* Columns added to TERMSTATE since it was created. */
+static const char *termstate_new_columns[][2] = {
+    { "CALL_IN_OFFSET", "SMALLINT DEFAULT -1" },
+    { "SESSION_SECS",   "INTEGER DEFAULT 0" },
+    { "DL_STARTED",     "BIGINT DEFAULT 0" },
+    { "DL_ACKED",       "BLOB" },
+};
+
+/* Compared field by field, the structure has padding. */
+static int mm_termstate_equal(const mm_termstate_t *a, const mm_termstate_t *b) {
+    return (a->terminal_type == b->terminal_type) &&
+           (a->status_word == b->status_word) &&
+           (strcmp(a->control_rom_edition, b->control_rom_edition) == 0) &&
+           (memcmp(&a->cashbox_status, &b->cashbox_status, sizeof(cashbox_status_univ_t)) == 0) &&
+           (a->call_in_offset == b->call_in_offset) &&
+           (a->session_secs == b->session_secs) &&
+           (a->dl_started == b->dl_started) &&
+           (memcmp(a->dl_acked, b->dl_acked, sizeof(a->dl_acked)) == 0);
+}
+
+int mm_termstate_create_tables(void *db) {
+    int rc;
+
+    rc = mm_sql_exec(db, "CREATE TABLE IF NOT EXISTS TERMSTATE ( "
+        "TERMINAL_ID VARCHAR(10) NOT NULL PRIMARY KEY,"
+        "TERMINAL_TYPE TINYINT DEFAULT 0,"
+        "CONTROL_ROM_EDITION VARCHAR(7),"
+        "STATUS_WORD BIGINT DEFAULT 0,"
+        "CASH_BOX_STATUS BLOB,"
+        "CALL_IN_OFFSET SMALLINT DEFAULT -1,"
+        "SESSION_SECS INTEGER DEFAULT 0,"
+        "DL_STARTED BIGINT DEFAULT 0,"
+        "DL_ACKED BLOB,"
+        "UPDATED_DATE VARCHAR(8),"
+        "UPDATED_TIME VARCHAR(6));");
+
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to create table TERMSTATE.\n", __func__);
+        return -1;
+    }
+
+    /* Add the columns a TERMSTATE table from an older mm_manager lacks. */
+    for (size_t i = 0; i < sizeof(termstate_new_columns) / sizeof(termstate_new_columns[0]); i++) {
+        char sql[160];
+
+        snprintf(sql, sizeof(sql), "SELECT COUNT(*) from pragma_table_info('TERMSTATE') where (name = '%s');",
+                 termstate_new_columns[i][0]);
+        if (mm_sql_read_uint8(db, sql) != 0) continue;
+
+        snprintf(sql, sizeof(sql), "ALTER TABLE TERMSTATE ADD COLUMN %s %s;",
+                 termstate_new_columns[i][0], termstate_new_columns[i][1]);
+        if (mm_sql_exec(db, sql) != 0) {
+            fprintf(stderr, "%s: Failed to add column %s to table TERMSTATE.\n", __func__, termstate_new_columns[i][0]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Minutes a terminal's call-in is expected to keep a line busy. */
+static int mm_termstate_call_in_mins(const mm_termstate_t *state) {
+    uint32_t secs = (state->session_secs != 0) ? state->session_secs : CALL_IN_SESSION_SECS;
+
+    return (int)((secs + 59) / 60);
+}
+
+/* Add (delta 1) or remove (delta -1) the terminal's call-in to call_in_busy[]. */
+static void mm_termstate_occupy(const mm_termstate_t *state, int delta) {
+    if ((state->call_in_offset < 0) || (state->call_in_offset >= CALL_IN_INTERVAL_MINS)) return;
+
+    for (int i = 0; i < mm_termstate_call_in_mins(state); i++) {
+        uint16_t *busy = &call_in_busy[(state->call_in_offset + i) % CALL_IN_INTERVAL_MINS];
+
+        if ((delta > 0) || (*busy > 0)) *busy = (uint16_t)(*busy + delta);
+    }
+}
+
+static void mm_termstate_add_call_in(void *arg, const mm_termstate_t *state) {
+    (void)arg;
+    mm_termstate_occupy(state, 1);
+}
+
+/* Create the cache, and count the call-ins of the fleet from TERMSTATE. */
+int mm_termstate_init(void *db) {
+    termstate_cache = mm_cache_create(TERMSTATE_CACHE_BYTES);
+    if (termstate_cache == NULL) return -ENOMEM;
+
+    mm_termstate_lock();
+    memset(call_in_busy, 0, sizeof(call_in_busy));
+    mm_sql_foreach_TERMSTATE(db, mm_termstate_add_call_in, NULL);
+    mm_termstate_unlock();
+
+    return 0;
+}
+
+/*
+ * Retrieve the state of terminal_id.  A terminal that is not cached is
+ * loaded from the TERMSTATE table, or for a terminal that predates it,
+ * from the accounting tables.
+ */
+int mm_termstate_get(void *db, const char *terminal_id, mm_termstate_t *state) {
+    if (mm_cache_read(termstate_cache, terminal_id, strlen(terminal_id), state, sizeof(mm_termstate_t)) == 0) {
+        return 0;
+    }
+
+    mm_termstate_lock();
+    /* Another line may have loaded it meanwhile. */
+    if (mm_cache_read(termstate_cache, terminal_id, strlen(terminal_id), state, sizeof(mm_termstate_t)) != 0) {
+        if (mm_sql_load_TERMSTATE(db, terminal_id, state) != 0) {
+            memset(state, 0, sizeof(mm_termstate_t));
+            snprintf(state->terminal_id, sizeof(state->terminal_id), "%s", terminal_id);
+            state->call_in_offset = -1;
+            state->terminal_type = mm_acct_load_terminal_type(db, state->terminal_id);
+            state->status_word = mm_acct_load_TSTATUS(db, state->terminal_id);
+            mm_sql_load_TCASHST(db, state->terminal_id, &state->cashbox_status);
+
+            if (mm_sql_save_TERMSTATE(db, state) != 0) {
+                fprintf(stderr, "%s: Failed to save state of terminal %s.\n", __func__, terminal_id);
+            }
+        }
+
+        mm_cache_put(termstate_cache, terminal_id, strlen(terminal_id), state, sizeof(mm_termstate_t), 0);
+    }
+    mm_termstate_unlock();
+
+    return 0;
+}
+
+/*
+ * State of the terminal as last written, from the cache, or the database
+ * once evicted.  Called with the terminal state locked.  Returns 0, or
+ * -ENOENT if the terminal is not in TERMSTATE.
+ */
+static int mm_termstate_stored(void *db, const char *terminal_id, mm_termstate_t *state) {
+    if (mm_cache_read(termstate_cache, terminal_id, strlen(terminal_id), state, sizeof(mm_termstate_t)) == 0) {
+        return 0;
+    }
+
+    return (mm_sql_load_TERMSTATE(db, terminal_id, state) == 0) ? 0 : -ENOENT;
+}
+
+/* Called with the terminal state locked. */
+static int mm_termstate_put_locked(void *db, const mm_termstate_t *state) {
+    mm_termstate_t stored;
+
+    if (mm_termstate_stored(db, state->terminal_id, &stored) != 0) {
+        memset(&stored, 0, sizeof(mm_termstate_t));
+        stored.call_in_offset = -1;
+    } else if (mm_termstate_equal(&stored, state)) {
+        mm_cache_put(termstate_cache, state->terminal_id, strlen(state->terminal_id), state, sizeof(mm_termstate_t), 0);
+        return 0;
+    }
+
+    mm_termstate_occupy(&stored, -1);
+    mm_termstate_occupy(state, 1);
+    mm_cache_put(termstate_cache, state->terminal_id, strlen(state->terminal_id), state, sizeof(mm_termstate_t), 1);
+
+    return mm_sql_save_TERMSTATE(db, state);
+}
+
+/*
+ * Update the state of a terminal, writing it to the database if it
+ * changed.  The write is made under the terminal state lock, so the
+ * database is left with the last state put.
+ */
+int mm_termstate_put(void *db, const mm_termstate_t *state) {
+    int rc;
+
+    mm_termstate_lock();
+    rc = mm_termstate_put_locked(db, state);
+    mm_termstate_unlock();
+
+    return rc;
+}
+
+void mm_termstate_free(void) {
+    mm_cache_free(termstate_cache);
+    termstate_cache = NULL;
+}
+
+/* Fold the length of a session into the terminal's average. */
+void mm_termstate_session_ended(mm_termstate_t *state, uint32_t session_secs) {
+    if (session_secs > UINT16_MAX) session_secs = UINT16_MAX;
+
+    if (state->session_secs == 0) {
+        state->session_secs = (uint16_t)session_secs;
+    } else {
+        state->session_secs = (uint16_t)(((uint32_t)state->session_secs * 3 + session_secs) / 4);
+    }
+}
+
+typedef struct mm_call_in_load {
+    uint16_t lines_busy[CALL_IN_INTERVAL_MINS];
+    uint16_t idle_mins[CALL_IN_INTERVAL_MINS];  /* Distance to the nearest busy minute */
+} mm_call_in_load_t;
+
+/*
+ * Assign the terminal its call-in time, in minutes into the call-in
+ * interval, so the fleet's call-ins are spread over the interval rather
+ * than all arriving at once.  Each terminal is expected to keep a line
+ * busy for its average session length.  A terminal keeps its call-in time
+ * while the calls expected then fit on the lines; otherwise it is moved
+ * to the time with the fewest calls expected, and of those, the one
+ * furthest from other call-ins.  The state is put with its call-in time
+ * before the terminal state lock is released, so two lines can't assign
+ * the same time to two terminals.
+ *
+ * Returns the call-in offset.
+ */
+int mm_termstate_call_in_offset(void *db, mm_termstate_t *state, int lines) {
+    mm_call_in_load_t *load;
+    mm_termstate_t stored;
+    int mins = mm_termstate_call_in_mins(state);
+    int best_offset = 0;
+    int best_peak = INT32_MAX;
+    int best_total = INT32_MAX;
+    int best_idle = -1;
+    int start;
+    int idle;
+
+    load = (mm_call_in_load_t *)calloc(1, sizeof(mm_call_in_load_t));
+    if (load == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, sizeof(mm_call_in_load_t));
+        return (state->call_in_offset >= 0) ? state->call_in_offset : 0;
+    }
+
+    mm_termstate_lock();
+
+    /* The other terminals' call-ins, without the terminal's own. */
+    memcpy(load->lines_busy, call_in_busy, sizeof(load->lines_busy));
+    if ((mm_termstate_stored(db, state->terminal_id, &stored) == 0) &&
+        (stored.call_in_offset >= 0) && (stored.call_in_offset < CALL_IN_INTERVAL_MINS)) {
+        for (int i = 0; i < mm_termstate_call_in_mins(&stored); i++) {
+            uint16_t *busy = &load->lines_busy[(stored.call_in_offset + i) % CALL_IN_INTERVAL_MINS];
+
+            if (*busy > 0) (*busy)--;
+        }
+    }
+
+    /* Two passes each way around the interval, as it wraps. */
+    idle = CALL_IN_INTERVAL_MINS;
+    for (int i = 0; i < 2 * CALL_IN_INTERVAL_MINS; i++) {
+        idle = load->lines_busy[i % CALL_IN_INTERVAL_MINS] ? 0 : idle + 1;
+        load->idle_mins[i % CALL_IN_INTERVAL_MINS] = (uint16_t)((idle < CALL_IN_INTERVAL_MINS) ? idle : CALL_IN_INTERVAL_MINS);
+    }
+    idle = CALL_IN_INTERVAL_MINS;
+    for (int i = 2 * CALL_IN_INTERVAL_MINS - 1; i >= 0; i--) {
+        idle = load->lines_busy[i % CALL_IN_INTERVAL_MINS] ? 0 : idle + 1;
+        if (idle < load->idle_mins[i % CALL_IN_INTERVAL_MINS]) {
+            load->idle_mins[i % CALL_IN_INTERVAL_MINS] = (uint16_t)idle;
+        }
+    }
+
+    /* Start the search at a time that depends on the terminal, to spread out ties. */
+    start = (int)(strtoull(state->terminal_id, NULL, 10) % CALL_IN_INTERVAL_MINS);
+
+    for (int i = 0; i < CALL_IN_INTERVAL_MINS; i++) {
+        int offset = (start + i) % CALL_IN_INTERVAL_MINS;
+        int peak = 0;
+        int total = 0;
+        int gap;
+
+        for (int j = 0; j < mins; j++) {
+            int busy = load->lines_busy[(offset + j) % CALL_IN_INTERVAL_MINS];
+
+            if (busy > peak) peak = busy;
+            total += busy;
+        }
+
+        if ((offset == state->call_in_offset) && (peak < lines)) {
+            best_offset = offset;
+            break;
+        }
+
+        gap = load->idle_mins[offset];
+        if (load->idle_mins[(offset + mins - 1) % CALL_IN_INTERVAL_MINS] < gap) {
+            gap = load->idle_mins[(offset + mins - 1) % CALL_IN_INTERVAL_MINS];
+        }
+
+        if ((peak < best_peak) ||
+            ((peak == best_peak) && (total < best_total)) ||
+            ((peak == best_peak) && (total == best_total) && (gap > best_idle))) {
+            best_offset = offset;
+            best_peak = peak;
+            best_total = total;
+            best_idle = gap;
+        }
+    }
+
+    state->call_in_offset = (int16_t)best_offset;
+    mm_termstate_put_locked(db, state);
+    mm_termstate_unlock();
+
+    free(load);
+
+    return best_offset;
+}
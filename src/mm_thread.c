@@ -0,0 +1,116 @@
+/*
+ * Worker threads for the mm_manager tools.
+ *
+ * Runs a loop body on a thread per core, for the tools that process a
+ * whole tables tree, ROM collection or fleet at once.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#ifdef _WIN32
+# include <windows.h>
+# include <process.h>
+#else  /* ifdef _WIN32 */
+# include <unistd.h>
+# include <pthread.h>
+#endif /* _WIN32 */
+
+#include "mm_manager.h"
+
+typedef struct mm_worker {
+    void (*fn)(void *arg, int index);
+    void *arg;
+    int count;
+    int first;
+    int step;
+#ifdef _WIN32
+    HANDLE handle;
+#else  /* ifdef _WIN32 */
+    pthread_t handle;
+#endif /* _WIN32 */
+} mm_worker_t;
+
+/* Each worker takes every step'th index. */
+#ifdef _WIN32
+static unsigned __stdcall mm_worker_main(void *arg) {
+#else  /* ifdef _WIN32 */
+static void *mm_worker_main(void *arg) {
+#endif /* _WIN32 */
+    mm_worker_t *worker = (mm_worker_t *)arg;
+
+    for (int i = worker->first; i < worker->count; i += worker->step) {
+        worker->fn(worker->arg, i);
+    }
+
+#ifdef _WIN32
+    return 0;
+#else  /* ifdef _WIN32 */
+    return NULL;
+#endif /* _WIN32 */
+}
+
+/* Number of threads to use by default, one per core. */
+int mm_default_threads(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else  /* ifdef _WIN32 */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (cpus > 0) ? (int)cpus : 1;
+#endif /* _WIN32 */
+}
+
+/*
+ * Call fn(arg, index) for each index from 0 to count - 1, on up to
+ * threads threads (at most MM_THREADS_MAX); the calling thread is the
+ * first.  Returns once every index is done.
+ */
+void mm_parallel_for(int count, int threads, void (*fn)(void *arg, int index), void *arg) {
+    mm_worker_t worker[MM_THREADS_MAX];
+    int started;
+
+    if (threads > count) threads = count;
+    if (threads > MM_THREADS_MAX) threads = MM_THREADS_MAX;
+    if (threads < 1) threads = 1;
+
+    for (started = 1; started < threads; started++) {
+        worker[started].fn = fn;
+        worker[started].arg = arg;
+        worker[started].count = count;
+        worker[started].first = started;
+        worker[started].step = threads;
+#ifdef _WIN32
+        worker[started].handle = (HANDLE)_beginthreadex(NULL, 0, mm_worker_main, &worker[started], 0, NULL);
+        if (worker[started].handle == 0) break;
+#else  /* ifdef _WIN32 */
+        if (pthread_create(&worker[started].handle, NULL, mm_worker_main, &worker[started]) != 0) break;
+#endif /* _WIN32 */
+    }
+
+    /* Indexes of workers that could not be started are done here. */
+    for (int first = 0; first < threads; first = (first == 0) ? started : first + 1) {
+        worker[0].fn = fn;
+        worker[0].arg = arg;
+        worker[0].count = count;
+        worker[0].first = first;
+        worker[0].step = threads;
+        mm_worker_main(&worker[0]);
+    }
+
+    for (int i = 1; i < started; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(worker[i].handle, INFINITE);
+        CloseHandle(worker[i].handle);
+#else  /* ifdef _WIN32 */
+        pthread_join(worker[i].handle, NULL);
+#endif /* _WIN32 */
+    }
+}
@@ -0,0 +1,212 @@
+/*
+ * Table transcoding for mm_manager.
+ *
+ * Tables are kept in their canonical MTR 2.x format, and transcoded when
+ * loaded for a terminal: Card, Carrier and Call Screening List tables are
+ * converted to their MTR 1.x equivalents, the Call Screening List is padded
+ * for MTR 1.9 to 1.13, and the Feature Configuration table is given the
+ * terminal's model.  Transcoded tables are cached, shared by all lines, by
+ * the hash of the source table, the MTR and the model, so each is only
+ * transcoded once for the whole fleet while it is in use.
+ *
+ * www.github.com/hharte/mm_manager
+ *
+ * Copyright (c) 2020-2023, Howard M. Harte
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_manager.h"
+#include "mm_card.h"
+
+#define TRANSCODE_CACHE_BYTES   (1024 * 1024)
+
+typedef struct mm_transcode_key {
+    uint64_t hash;              /* Hash of the source table. */
+    uint64_t source_len;
+    uint16_t mtr;
+    uint8_t  table_id;
+    uint8_t  model;
+    uint8_t  pad[4];
+} mm_transcode_key_t;
+
+static mm_cache_t *transcode_cache;
+
+/*
+ * Table that table_id is transcoded from for a terminal of terminal_type,
+ * when there is no table_id in its own format.  Returns table_id if it is
+ * not transcoded from another table.
+ */
+uint8_t mm_transcode_source(uint8_t table_id, uint8_t terminal_type) {
+    if (term_type_to_mtr(terminal_type) >= MTR_1_20) return table_id;
+
+    switch (table_id) {
+    case DLOG_MT_CARD_TABLE:
+        return DLOG_MT_CARD_TABLE_EXP;
+    case DLOG_MT_CARRIER_TABLE:
+        return DLOG_MT_CARRIER_TABLE_EXP;
+    case DLOG_MT_CALLSCRN_UNIVERSAL:
+        return DLOG_MT_CALL_SCREEN_LIST;
+    default:
+        return table_id;
+    }
+}
+
+/* Expanded Card table (32 entries) to the MTR 1.x Card table (20 entries.) */
+static int mm_transcode_card(const uint8_t *source, size_t source_len, uint8_t *image) {
+    const dlog_mt_card_table_t *card_table = (const dlog_mt_card_table_t *)(source + 1);
+    dlog_mt_card_table_mtr1_t  *card_table_mtr1 = (dlog_mt_card_table_mtr1_t *)(image + 1);
+
+    if (source_len != sizeof(dlog_mt_card_table_t) + 1) return -EINVAL;
+
+    for (int i = 0; i < CCARD_MAX_MTR1; i++) {
+        memcpy(&card_table_mtr1->c[i], &card_table->c[i], sizeof(card_entry_mtr1_t));
+    }
+
+    return 0;
+}
+
+/* Expanded Carrier table (33 carriers) to the MTR 1.x Carrier table (21 carriers.) */
+static int mm_transcode_carrier(const uint8_t *source, size_t source_len, uint8_t *image) {
+    const dlog_mt_carrier_table_t *carrier_table = (const dlog_mt_carrier_table_t *)source;
+    dlog_mt_carrier_table_mtr1_t  *carrier_table_mtr1 = (dlog_mt_carrier_table_mtr1_t *)image;
+
+    if (source_len != sizeof(dlog_mt_carrier_table_t)) return -EINVAL;
+
+    memcpy(carrier_table_mtr1->defaults, carrier_table->defaults, sizeof(carrier_table_mtr1->defaults));
+
+    for (int i = 0; i < CARRIER_TABLE_MTR1_MAX_CARRIERS; i++) {
+        const carrier_table_entry_t *carrier = &carrier_table->carrier[i];
+        carrier_table_entry_mtr1_t  *carrier_mtr1 = &carrier_table_mtr1->carrier[i];
+
+        carrier_mtr1->carrier_ref = carrier->carrier_ref;
+        carrier_mtr1->carrier_num = carrier->carrier_num;
+        /* Valid cards is 24 bits on MTR 1.x, little-endian on the terminal. */
+        memcpy(carrier_mtr1->valid_cards, &carrier->valid_cards, sizeof(carrier_mtr1->valid_cards));
+        memcpy(carrier_mtr1->display_prompt, carrier->display_prompt, sizeof(carrier_mtr1->display_prompt));
+        carrier_mtr1->control_byte2 = carrier->control_byte2;
+        carrier_mtr1->control_byte = carrier->control_byte;
+        carrier_mtr1->fgb_timer = carrier->fgb_timer;
+        carrier_mtr1->call_entry = carrier->call_entry;
+    }
+
+    return 0;
+}
+
+/* 180-entry Call Screening List to the 60-entry Call Screening List Universal. */
+static int mm_transcode_callscrn(const uint8_t *source, size_t source_len, uint8_t *image) {
+    const dlog_mt_call_screen_list_t *callscrn_table = (const dlog_mt_call_screen_list_t *)source;
+    dlog_mt_call_screen_universal_t  *callscrnu_table = (dlog_mt_call_screen_universal_t *)image;
+
+    if (source_len != sizeof(dlog_mt_call_screen_list_t)) return -EINVAL;
+
+    for (int i = 0; i < CALLSCRNU_TABLE_MAX; i++) {
+        memcpy(&callscrnu_table->entry[i], &callscrn_table->entry[i], sizeof(call_screen_universal_entry_t));
+    }
+
+    return 0;
+}
+
+/*
+ * Transcode the table image, which was loaded from a table in the
+ * canonical format, for a terminal of terminal_type as table_id.  The
+ * image is replaced by the transcoded table, taken from the cache when it
+ * was transcoded before.  An image that needs no transcoding is left as it
+ * is.
+ *
+ * Returns 0, or -EINVAL if the table is not of the expected size.
+ */
+int mm_transcode_table(uint8_t table_id, uint8_t terminal_type, uint8_t **image, size_t *len) {
+    mm_transcode_key_t key;
+    uint8_t  source_id = (*image)[0];
+    uint16_t mtr = term_type_to_mtr(terminal_type);
+    uint8_t  model = term_type_to_model(terminal_type);
+    uint8_t *transcoded;
+    size_t   transcoded_len;
+    int      status = 0;
+
+    if ((table_id == DLOG_MT_CARD_TABLE) && (source_id == DLOG_MT_CARD_TABLE_EXP)) {
+        transcoded_len = sizeof(dlog_mt_card_table_mtr1_t) + 1;
+    } else if ((table_id == DLOG_MT_CARRIER_TABLE) && (source_id == DLOG_MT_CARRIER_TABLE_EXP)) {
+        transcoded_len = sizeof(dlog_mt_carrier_table_mtr1_t);
+    } else if ((table_id == DLOG_MT_CALLSCRN_UNIVERSAL) && (source_id == DLOG_MT_CALL_SCREEN_LIST)) {
+        transcoded_len = sizeof(dlog_mt_call_screen_universal_t);
+    } else if ((table_id == DLOG_MT_CALL_SCREEN_LIST) && (mtr >= MTR_1_9) && (mtr < MTR_1_20) &&
+               (*len == sizeof(dlog_mt_call_screen_list_t))) {
+        transcoded_len = *len + 340;    /* Pad 180-entry Call Screen List to 200-entries. */
+    } else if ((table_id == DLOG_MT_FCONFIG_OPTS) && (*len >= offsetof(dlog_mt_fconfig_opts_t, term_type) + 1)) {
+        transcoded_len = *len;
+    } else {
+        return 0;
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.hash = mm_fnv1a(*image, *len);
+    key.source_len = *len;
+    key.mtr = mtr;
+    key.table_id = table_id;
+    key.model = model;
+
+    if (mm_cache_get(transcode_cache, &key, sizeof(key), &transcoded, &transcoded_len) == 0) {
+        free(*image);
+        *image = transcoded;
+        *len = transcoded_len;
+        return 0;
+    }
+
+    transcoded = (uint8_t *)calloc(1, transcoded_len);
+    if (transcoded == NULL) {
+        fprintf(stderr, "%s: Error: failed to allocate %zu bytes.\n", __func__, transcoded_len);
+        return -ENOMEM;
+    }
+
+    switch (table_id) {
+    case DLOG_MT_CARD_TABLE:
+        status = mm_transcode_card(*image, *len, transcoded);
+        break;
+    case DLOG_MT_CARRIER_TABLE:
+        status = mm_transcode_carrier(*image, *len, transcoded);
+        break;
+    case DLOG_MT_CALLSCRN_UNIVERSAL:
+        status = mm_transcode_callscrn(*image, *len, transcoded);
+        break;
+    case DLOG_MT_FCONFIG_OPTS:
+        memcpy(transcoded, *image, *len);
+        ((dlog_mt_fconfig_opts_t *)transcoded)->term_type = model & 0x0F;
+        break;
+    default:
+        memcpy(transcoded, *image, *len);
+        break;
+    }
+    transcoded[0] = table_id;
+
+    if (status != 0) {
+        fprintf(stderr, "%s: Table %d (0x%02x) is %zu bytes, can't transcode it to table %d (0x%02x).\n",
+                __func__, source_id, source_id, *len, table_id, table_id);
+        free(transcoded);
+        return status;
+    }
+
+    mm_cache_put(transcode_cache, &key, sizeof(key), transcoded, transcoded_len, 1);
+
+    free(*image);
+    *image = transcoded;
+    *len = transcoded_len;
+
+    return 0;
+}
+
+int mm_transcode_init(void) {
+    transcode_cache = mm_cache_create(TRANSCODE_CACHE_BYTES);
+
+    return (transcode_cache != NULL) ? 0 : -ENOMEM;
+}
+
+void mm_transcode_free(void) {
+    mm_cache_free(transcode_cache);
+    transcode_cache = NULL;
+}
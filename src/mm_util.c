@@ -15,6 +15,14 @@
 #include <stdint.h>
 #include <string.h> /* String function definitions */
 #include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+# include <windows.h>
+# include <direct.h>
+#else  /* ifdef _WIN32 */
+# include <dirent.h>
+#endif /* _WIN32 */
 
 #include "mm_manager.h"
 
@@ -36,6 +44,109 @@ uint16_t crc16(uint16_t crc, uint8_t *buf, size_t len) {
     return crc;
 }
 
+/* 64-bit FNV-1a hash. */
+uint64_t mm_fnv1a(const uint8_t *buf, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while (len--) {
+        hash ^= *buf++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* Milliseconds from an arbitrary starting point, unaffected by changes to the time of day. */
+uint64_t mm_monotonic_ms(void) {
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#endif /* _WIN32 */
+}
+
+/* Sleep for ms milliseconds. */
+void mm_sleep_ms(uint32_t ms) {
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else  /* ifdef _WIN32 */
+    struct timespec tim;
+
+    tim.tv_sec = (time_t)(ms / 1000);
+    tim.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&tim, NULL);
+#endif /* _WIN32 */
+}
+
+/*
+ * Call fn with the name of each entry in directory dir, except those
+ * starting with '.', until fn returns nonzero.  Returns what fn returned
+ * last, or -ENOENT if dir can't be opened.
+ */
+int mm_list_dir(const char *dir, int (*fn)(void *arg, const char *dir, const char *name), void *arg) {
+    int status = 0;
+#ifndef _WIN32
+    DIR *dirp = opendir(dir);
+    struct dirent *entry;
+
+    if (dirp == NULL) {
+        fprintf(stderr, "Cannot open directory %s.\n", dir);
+        return -ENOENT;
+    }
+
+    while ((status == 0) && ((entry = readdir(dirp)) != NULL)) {
+        if (entry->d_name[0] == '.') continue;
+
+        status = fn(arg, dir, entry->d_name);
+    }
+
+    closedir(dirp);
+#else  /* ifndef _WIN32 */
+    char pattern[TABLE_PATH_MAX_LEN];
+    WIN32_FIND_DATAA find_data;
+    HANDLE find;
+
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    find = FindFirstFileA(pattern, &find_data);
+
+    if (find == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Cannot open directory %s.\n", dir);
+        return -ENOENT;
+    }
+
+    do {
+        if (find_data.cFileName[0] == '.') continue;
+
+        status = fn(arg, dir, find_data.cFileName);
+    } while ((status == 0) && FindNextFileA(find, &find_data));
+
+    FindClose(find);
+#endif /* ifndef _WIN32 */
+
+    return status;
+}
+
+/* Create directory dirname, if it does not exist yet. */
+int mm_make_directory(const char *dirname) {
+    int status;
+
+    errno = 0;
+#ifdef _WIN32
+    status = _mkdir(dirname);
+#else  /* ifdef _WIN32 */
+    status = mkdir(dirname, 0755);
+#endif /* ifdef _WIN32 */
+
+    if ((status != 0) && (errno != EEXIST)) {
+        fprintf(stderr, "%s: Failed to create directory: %s\n", __func__, dirname);
+        return -ENOENT;
+    }
+
+    return 0;
+}
+
 void dump_hex(const uint8_t *data, size_t len) {
     uint8_t  ascii[32] = { 0 };
     uint8_t *pascii    = ascii;
@@ -869,6 +980,101 @@ uint8_t term_type_to_model(uint8_t term_type) {
     return term_type_model[term_type];
 }
 
+/* Tables the terminal needs to be operational, the table set of -s. */
+int mm_table_is_mandatory(uint8_t table_id) {
+    switch (table_id) {
+    case DLOG_MT_NCC_TERM_PARAMS:
+    case DLOG_MT_CARD_TABLE:
+    case DLOG_MT_CARRIER_TABLE:
+    case DLOG_MT_CALLSCRN_UNIVERSAL:
+    case DLOG_MT_FCONFIG_OPTS:
+    case DLOG_MT_INSTALL_PARAMS:
+    case DLOG_MT_COIN_VAL_TABLE:
+    case DLOG_MT_NUM_PLAN_TABLE:
+    case DLOG_MT_SPARE_TABLE:
+    case DLOG_MT_RATE_TABLE:
+    case DLOG_MT_CALL_SCREEN_LIST:
+    case DLOG_MT_SCARD_PARM_TABLE:
+    case DLOG_MT_CARD_TABLE_EXP:
+    case DLOG_MT_CARRIER_TABLE_EXP:
+    case DLOG_MT_NPA_NXX_TABLE_1:
+    case DLOG_MT_COMP_LCD_TABLE_1:
+    case DLOG_MT_LCD_TABLE_1:
+    case DLOG_MT_END_DATA:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Order of a download from table_list, the tables of the terminal type:
+ * the mandatory tables first, so the terminal is operational as soon as
+ * possible, then the optional tables unless minimal_table_set, then
+ * DLOG_MT_END_DATA.  Tables that don't apply to the terminal's model are
+ * left out.
+ *
+ * Returns the number of tables in order, which is terminated by 0.
+ */
+int mm_table_download_order(const uint8_t *table_list, uint8_t terminal_type, int minimal_table_set, uint8_t *order) {
+    uint8_t table_id;
+    uint8_t term_model = term_type_to_model(terminal_type);
+    int     end_data = 0;
+    int     count = 0;
+
+    for (int mandatory = 1; mandatory >= 0; mandatory--) {
+        if (!mandatory && minimal_table_set) break;
+
+        for (int i = 0; (table_id = table_list[i]) > 0; i++) {
+            if (table_id == DLOG_MT_END_DATA) {
+                end_data = 1;
+                continue;
+            }
+
+            if (mm_table_is_mandatory(table_id) != mandatory) continue;
+
+            /* Skip DLOG_MT_CARD_TABLE, DLOG_MT_CARD_TABLE_EXP if the terminal is coin-only. */
+            if ((term_model == TERM_COIN_BASIC) &&
+                ((table_id == DLOG_MT_CARD_TABLE) || (table_id == DLOG_MT_CARD_TABLE_EXP))) {
+                continue;
+            }
+
+            /* Skip DLOG_MT_COIN_VAL_TABLE for card-only terminals */
+            if (((term_model == TERM_CARD) || (term_model == TERM_DESK)) && (table_id == DLOG_MT_COIN_VAL_TABLE)) {
+                continue;
+            }
+
+            order[count++] = table_id;
+        }
+    }
+
+    if (end_data) {
+        order[count++] = DLOG_MT_END_DATA;
+    }
+    order[count] = 0;
+
+    return count;
+}
+
+/*
+ * What to do with a table of a download: skip it if the download is
+ * resumed and the table was ACKed (dl_acked, one bit per table ID) and
+ * not changed since, and leave it to the next call if it is optional and
+ * the download budget is used.  Mandatory tables and DLOG_MT_END_DATA
+ * are always sent.
+ */
+int mm_table_download_action(uint8_t table_id, int resume, const uint8_t *dl_acked, int changed, int budget_used) {
+    if (resume && !changed && (dl_acked[table_id / 8] & (1 << (table_id % 8)))) {
+        return DL_TABLE_ACKED;
+    }
+
+    if (budget_used && !mm_table_is_mandatory(table_id)) {
+        return DL_TABLE_DEFERRED;
+    }
+
+    return DL_TABLE_SEND;
+}
+
 const char* feature_term_type_str_lut[5] = {
     "Invalid  ",
     "Card     ",